@@ -84,6 +84,12 @@ typedef enum {
     H2_PUSH_FAST_LOAD,
 } h2_push_policy;
 
+typedef enum {
+    H2_LIMITER_STEPS,               /* cut to 16/8/4/2, double on success */
+    H2_LIMITER_AIMD,                /* add one on success, cut by a quarter */
+    H2_LIMITER_DRAIN,               /* follow the drain rate of output */
+} h2_worker_limiter;
+
 typedef enum {
     H2_SESSION_ST_INIT,             /* send initial SETTINGS, etc. */
     H2_SESSION_ST_DONE,             /* finished, connection close */
@@ -154,7 +160,8 @@ struct h2_headers {
 
 typedef apr_status_t h2_io_data_cb(void *ctx, const char *data, apr_off_t len);
 
-typedef int h2_stream_pri_cmp(int stream_id1, int stream_id2, void *ctx);
+/* The scheduling rank of a stream, lower ranks are started first */
+typedef apr_uint64_t h2_stream_pri_rank(int stream_id, void *ctx);
 
 /* Note key to attach connection task id to conn_rec/request_rec instances */
 
@@ -163,5 +170,6 @@ typedef int h2_stream_pri_cmp(int stream_id1, int stream_id2, void *ctx);
 #define H2_HDR_CONFORMANCE      "http2-hdr-conformance"
 #define H2_HDR_CONFORMANCE_UNSAFE      "unsafe"
 #define H2_PUSH_MODE_NOTE       "http2-push-mode"
+#define H2_TLS_VERDICT_NOTE     "http2-tls-acceptable"
 
 #endif /* defined(__mod_h2__h2__) */
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
  
+#include <stdlib.h>
+
 #include <apr_lib.h>
 #include <apr_atomic.h>
 #include <apr_strings.h>
@@ -29,6 +31,9 @@
 #include "h2_private.h"
 #include "h2_util.h"
 #include "h2_bucket_beam.h"
+#include "h2_fcache.h"
+#include "h2_metrics.h"
+#include "h2_probes.h"
 
 static void h2_beam_emitted(h2_bucket_beam *beam, h2_beam_proxy *proxy);
 
@@ -57,6 +62,270 @@ static void h2_beam_emitted(h2_bucket_beam *beam, h2_beam_proxy *proxy);
     } while (0)
 
 
+/*******************************************************************************
+ * transfer chunks, shared by all beams of a child process
+ ******************************************************************************/
+
+/* Data copied into a beam goes into chunks of a few size classes that
+ * are kept for reuse, instead of allocating from the sender's bucket 
+ * allocator every time. A bucket gets the smallest class it fits, so
+ * at most half of a chunk goes unused. Chunks are returned when the last
+ * bucket referring to them is destroyed, which may happen in any thread.
+ * Idle chunks are kept up to a quarter of the chunk memory, the others
+ * go back to malloc. */
+#define H2_CHUNK_CLASSES    5
+#define H2_CHUNK_LARGE      (64 * 1024)
+#define H2_CHUNK_MIN_COPY   1024
+
+static const apr_size_t ChunkSizes[H2_CHUNK_CLASSES] = {
+    2 * 1024, 4 * 1024, 8 * 1024, 16 * 1024, H2_CHUNK_LARGE
+};
+
+typedef struct h2_beam_chunk h2_beam_chunk;
+struct h2_beam_chunk {
+    h2_beam_chunk *next;
+    apr_size_t size;
+    int cls;
+};
+
+#define H2_CHUNK_HDR_LEN    APR_ALIGN_DEFAULT(sizeof(h2_beam_chunk))
+#define H2_CHUNK_DATA(c)    (((char*)(c)) + H2_CHUNK_HDR_LEN)
+#define H2_CHUNK_OF(d)      ((h2_beam_chunk*)(((char*)(d)) - H2_CHUNK_HDR_LEN))
+
+typedef struct {
+    apr_thread_mutex_t *lock;
+    h2_beam_chunk *free[H2_CHUNK_CLASSES];
+    apr_size_t max_mem;          /* max bytes of allocated chunks */
+    apr_size_t max_idle;         /* max bytes of chunks in free lists */
+    apr_size_t mem;              /* bytes in all allocated chunks */
+    apr_size_t idle_mem;         /* bytes in free lists */
+    apr_uint32_t in_use;         /* number of chunks handed out */
+    apr_uint32_t idle;           /* number of chunks in free lists */
+} h2_beam_chunks;
+
+static h2_beam_chunks *chunks;
+
+static apr_status_t chunks_cleanup(void *data)
+{
+    h2_beam_chunks *cs = data;
+    h2_beam_chunk *c;
+    int i;
+    
+    chunks = NULL;
+    for (i = 0; i < H2_CHUNK_CLASSES; ++i) {
+        while ((c = cs->free[i])) {
+            cs->free[i] = c->next;
+            free(c);
+        }
+    }
+    return APR_SUCCESS;
+}
+
+apr_status_t h2_beam_chunks_init(apr_pool_t *pchild, apr_size_t max_mem)
+{
+    h2_beam_chunks *cs;
+    apr_status_t status;
+    
+    if (max_mem < H2_CHUNK_LARGE) {
+        return APR_SUCCESS;
+    }
+    cs = apr_pcalloc(pchild, sizeof(*cs));
+    status = apr_thread_mutex_create(&cs->lock, APR_THREAD_MUTEX_DEFAULT, 
+                                     pchild);
+    if (status == APR_SUCCESS) {
+        cs->max_mem = max_mem;
+        cs->max_idle = max_mem / 4;
+        apr_pool_cleanup_register(pchild, cs, chunks_cleanup, 
+                                  apr_pool_cleanup_null);
+        chunks = cs;
+    }
+    return status;
+}
+
+static char *chunk_get(apr_size_t len)
+{
+    h2_beam_chunks *cs = chunks;
+    h2_beam_chunk *c = NULL;
+    int cls;
+    
+    if (!cs || len < H2_CHUNK_MIN_COPY || len > H2_CHUNK_LARGE) {
+        return NULL;
+    }
+    for (cls = 0; ChunkSizes[cls] < len; ++cls);
+    
+    apr_thread_mutex_lock(cs->lock);
+    if (cs->free[cls]) {
+        c = cs->free[cls];
+        cs->free[cls] = c->next;
+        cs->idle_mem -= c->size;
+        --cs->idle;
+    }
+    else if (cs->mem + ChunkSizes[cls] <= cs->max_mem
+             && (c = malloc(H2_CHUNK_HDR_LEN + ChunkSizes[cls]))) {
+        c->size = ChunkSizes[cls];
+        c->cls = cls;
+        cs->mem += c->size;
+    }
+    if (c) {
+        ++cs->in_use;
+    }
+    apr_thread_mutex_unlock(cs->lock);
+    if (c) {
+        H2_METRIC_ADD(beam_chunk_bytes, c->size);
+    }
+    return c? H2_CHUNK_DATA(c) : NULL;
+}
+
+static void chunk_free(void *data)
+{
+    h2_beam_chunks *cs = chunks;
+    h2_beam_chunk *c = H2_CHUNK_OF(data);
+    
+    if (!cs) {
+        /* child is shutting down */
+        free(c);
+        return;
+    }
+    H2_METRIC_SUB(beam_chunk_bytes, c->size);
+    apr_thread_mutex_lock(cs->lock);
+    --cs->in_use;
+    if (cs->idle_mem + c->size <= cs->max_idle) {
+        c->next = cs->free[c->cls];
+        cs->free[c->cls] = c;
+        cs->idle_mem += c->size;
+        ++cs->idle;
+        c = NULL;
+    }
+    else {
+        cs->mem -= c->size;
+    }
+    apr_thread_mutex_unlock(cs->lock);
+    if (c) {
+        free(c);
+    }
+}
+
+/* Copy the data of the bucket into a chunk, if one is available, and
+ * turn it into a heap bucket that gives the chunk back on destruction. */
+static apr_status_t chunk_setaside(apr_bucket *b)
+{
+    const char *data;
+    apr_size_t len;
+    apr_status_t status;
+    char *buf;
+    
+    if (!(buf = chunk_get(b->length))) {
+        return APR_ENOMEM;
+    }
+    status = apr_bucket_read(b, &data, &len, APR_BLOCK_READ);
+    if (status != APR_SUCCESS || len != b->length) {
+        chunk_free(buf);
+        return (status != APR_SUCCESS)? status : APR_EGENERAL;
+    }
+    memcpy(buf, data, len);
+    apr_bucket_heap_make(b, buf, len, chunk_free);
+    return APR_SUCCESS;
+}
+
+void h2_beam_chunks_stats(apr_uint32_t *pin_use, apr_uint32_t *pidle, 
+                          apr_size_t *pmem)
+{
+    h2_beam_chunks *cs = chunks;
+    
+    *pin_use = *pidle = 0;
+    *pmem = 0;
+    if (cs) {
+        apr_thread_mutex_lock(cs->lock);
+        *pin_use = cs->in_use;
+        *pidle = cs->idle;
+        *pmem = cs->mem;
+        apr_thread_mutex_unlock(cs->lock);
+    }
+}
+
+/*******************************************************************************
+ * memory budget, shared by all beams of a child process
+ ******************************************************************************/
+
+/* With a budget, every beam accounts the memory buffered in its send list
+ * in a child wide sum. A beam with a buffer size is always allowed its
+ * fair share of the budget, or its buffer size when that is smaller, plus
+ * its share of half the memory that is still free. While memory is plenty,
+ * single streams may buffer far more than their buffer size. As the sum
+ * nears the budget, all beams are throttled down towards their share. */
+#define H2_BUDGET_MIN_SPACE     (16 * 1024)
+#define H2_BUDGET_POLL          apr_time_from_msec(10)
+
+typedef struct {
+    apr_size_t max_mem;          /* the budget */
+    volatile apr_uint64_t mem;   /* bytes buffered in all beams */
+    volatile apr_uint32_t beams; /* beams with buffered bytes */
+} h2_beam_budget;
+
+static h2_beam_budget *budget;
+
+static apr_status_t budget_cleanup(void *data)
+{
+    budget = NULL;
+    return APR_SUCCESS;
+}
+
+apr_status_t h2_beam_budget_init(apr_pool_t *pchild, apr_size_t max_mem)
+{
+    h2_beam_budget *bg;
+    
+    if (max_mem == 0) {
+        return APR_SUCCESS;
+    }
+    bg = apr_pcalloc(pchild, sizeof(*bg));
+    bg->max_mem = max_mem;
+    apr_pool_cleanup_register(pchild, bg, budget_cleanup, 
+                              apr_pool_cleanup_null);
+    budget = bg;
+    return APR_SUCCESS;
+}
+
+/* Set the bytes the beam has buffered, needs to be called with the
+ * beam lock held. */
+static void budget_update(h2_bucket_beam *beam, apr_size_t len)
+{
+    h2_beam_budget *bg = budget;
+    apr_uint64_t delta;
+    
+    if (!bg || len == beam->budget_used) {
+        return;
+    }
+    if (!beam->budget_used) {
+        apr_atomic_inc32(&bg->beams);
+    }
+    else if (!len) {
+        apr_atomic_dec32(&bg->beams);
+    }
+    delta = (apr_uint64_t)len - (apr_uint64_t)beam->budget_used;
+    H2_ATOMIC_ADD64(&bg->mem, delta);
+    H2_METRIC_ADD(beam_mem_bytes, delta);
+    beam->budget_used = len;
+}
+
+/* The bytes the beam may buffer under the budget right now. */
+static apr_size_t budget_limit(h2_beam_budget *bg, h2_bucket_beam *beam)
+{
+    apr_uint64_t used = H2_ATOMIC_GET64(&bg->mem);
+    apr_uint32_t n = apr_atomic_read32(&bg->beams);
+    apr_size_t share, free_mem, limit;
+    
+    if (!beam->budget_used) {
+        ++n; /* not counted yet, but about to be */
+    }
+    share = bg->max_mem / n;
+    if (share > beam->max_buf_size) {
+        share = beam->max_buf_size;
+    }
+    free_mem = (used < bg->max_mem)? (apr_size_t)(bg->max_mem - used) : 0;
+    limit = share + free_mem / (2 * n);
+    return (limit < H2_BUDGET_MIN_SPACE)? H2_BUDGET_MIN_SPACE : limit;
+}
+
 /*******************************************************************************
  * beam bucket with reference to beam and bucket it represents
  ******************************************************************************/
@@ -223,9 +492,18 @@ static void leave_yellow(h2_bucket_beam *beam, h2_beam_lock *pbl)
     }
 }
 
+/* Announce a change to the other side. The generation lets the receiver
+ * see without taking the lock that nothing happened since its last look.
+ * Needs to be called with the lock held. */
+static void beam_changed(h2_bucket_beam *beam)
+{
+    apr_atomic_inc32(&beam->change_gen);
+    apr_thread_cond_broadcast(beam->change);
+}
+
 static apr_off_t bucket_mem_used(apr_bucket *b)
 {
-    if (APR_BUCKET_IS_FILE(b)) {
+    if (APR_BUCKET_IS_FILE(b) || H2_BUCKET_IS_FCACHE(b)) {
         return 0;
     }
     else {
@@ -237,9 +515,11 @@ static apr_off_t bucket_mem_used(apr_bucket *b)
 static int report_consumption(h2_bucket_beam *beam, h2_beam_lock *pbl)
 {
     int rv = 0;
-    apr_off_t len = beam->received_bytes - beam->cons_bytes_reported;
+    apr_off_t len;
     h2_beam_io_callback *cb = beam->cons_io_cb;
      
+    apr_atomic_set32(&beam->cons_gen, apr_atomic_read32(&beam->recv_gen));
+    len = beam->received_bytes - beam->cons_bytes_reported;
     if (len > 0) {
         if (cb) {
             void *ctx = beam->cons_ctx;
@@ -280,7 +560,7 @@ static apr_size_t calc_buffered(h2_bucket_beam *beam)
         if (b->length == ((apr_size_t)-1)) {
             /* do not count */
         }
-        else if (APR_BUCKET_IS_FILE(b)) {
+        else if (APR_BUCKET_IS_FILE(b) || H2_BUCKET_IS_FCACHE(b)) {
             /* if unread, has no real mem footprint. */
         }
         else {
@@ -301,11 +581,26 @@ static void r_purge_sent(h2_bucket_beam *beam)
     }
 }
 
+/* Bring the beam's part of the child budget up to date */
+static void budget_account(h2_bucket_beam *beam)
+{
+    if (budget) {
+        budget_update(beam, calc_buffered(beam));
+    }
+}
+
 static apr_size_t calc_space_left(h2_bucket_beam *beam)
 {
     if (beam->max_buf_size > 0) {
+        h2_beam_budget *bg = budget;
         apr_size_t len = calc_buffered(beam);
-        return (beam->max_buf_size > len? (beam->max_buf_size - len) : 0);
+        apr_size_t max = beam->max_buf_size;
+        
+        if (bg) {
+            budget_update(beam, len);
+            max = budget_limit(bg, beam);
+        }
+        return (max > len? (max - len) : 0);
     }
     return APR_SIZE_MAX;
 }
@@ -364,6 +659,7 @@ static apr_status_t wait_not_full(h2_bucket_beam *beam, apr_read_type_e block,
                                   apr_size_t *pspace_left, h2_beam_lock *bl)
 {
     apr_status_t rv = APR_SUCCESS;
+    apr_interval_time_t waited = 0;
     apr_size_t left;
     
     while (0 == (left = calc_space_left(beam)) && APR_SUCCESS == rv) {
@@ -373,6 +669,21 @@ static apr_status_t wait_not_full(h2_bucket_beam *beam, apr_read_type_e block,
         else if (block != APR_BLOCK_READ || !bl->mutex) {
             rv = APR_EAGAIN;
         }
+        else if (budget && calc_buffered(beam) < beam->max_buf_size) {
+            /* throttled by the budget. Memory freed in other beams does
+             * not signal us, look again every now and then. */
+            if (!waited) {
+                H2_METRIC_INC(beam_budget_waits);
+            }
+            rv = apr_thread_cond_timedwait(beam->change, bl->mutex, 
+                                           H2_BUDGET_POLL);
+            if (APR_STATUS_IS_TIMEUP(rv)) {
+                waited += H2_BUDGET_POLL;
+                if (beam->timeout <= 0 || waited < beam->timeout) {
+                    rv = APR_SUCCESS;
+                }
+            }
+        }
         else {
             if (beam->timeout > 0) {
                 rv = apr_thread_cond_timedwait(beam->change, bl->mutex, beam->timeout);
@@ -447,7 +758,7 @@ static void h2_beam_emitted(h2_bucket_beam *beam, h2_beam_proxy *proxy)
             r_purge_sent(beam);
         }
         else {
-            apr_thread_cond_broadcast(beam->change);
+            beam_changed(beam);
         }
         leave_yellow(beam, &bl);
     }
@@ -463,11 +774,21 @@ static void h2_blist_cleanup(h2_blist *bl)
     }
 }
 
+/* Receivers skipping the lock on an unchanged generation need to see
+ * every abort, also of a beam that is already closed. */
+static void beam_set_aborted(h2_bucket_beam *beam)
+{
+    if (!beam->aborted) {
+        beam->aborted = 1;
+        beam_changed(beam);
+    }
+}
+
 static apr_status_t beam_close(h2_bucket_beam *beam)
 {
     if (!beam->closed) {
         beam->closed = 1;
-        apr_thread_cond_broadcast(beam->change);
+        beam_changed(beam);
     }
     return APR_SUCCESS;
 }
@@ -511,6 +832,7 @@ static apr_status_t beam_send_cleanup(void *data)
     /* sender is going away, clear up all references to its memory */
     r_purge_sent(beam);
     h2_blist_cleanup(&beam->send_list);
+    budget_update(beam, 0);
     report_consumption(beam, NULL);
     while (!H2_BPROXY_LIST_EMPTY(&beam->proxies)) {
         h2_beam_proxy *proxy = H2_BPROXY_LIST_FIRST(&beam->proxies);
@@ -545,6 +867,7 @@ static void recv_buffer_cleanup(h2_bucket_beam *beam, h2_beam_lock *bl)
         beam->recv_buffer = NULL;
         apr_brigade_length(bb, 0, &bblen);
         beam->received_bytes += bblen;
+        apr_atomic_inc32(&beam->recv_gen);
         
         /* need to do this unlocked since bucket destroy might 
          * call this beam again. */
@@ -552,7 +875,7 @@ static void recv_buffer_cleanup(h2_bucket_beam *beam, h2_beam_lock *bl)
         apr_brigade_destroy(bb);
         if (bl) enter_yellow(beam, bl);
         
-        apr_thread_cond_broadcast(beam->change);
+        beam_changed(beam);
         if (beam->cons_ev_cb) { 
             beam->cons_ev_cb(beam->cons_ctx, beam);
         }
@@ -610,6 +933,7 @@ static apr_status_t beam_cleanup(h2_bucket_beam *beam, int from_pool)
         ap_assert(H2_BLIST_EMPTY(&beam->hold_list));
         ap_assert(H2_BLIST_EMPTY(&beam->purge_list));
     }
+    budget_update(beam, 0);
     return status;
 }
 
@@ -649,6 +973,7 @@ apr_status_t h2_beam_create(h2_bucket_beam **pbeam, apr_pool_t *pool,
     beam->tx_mem_limits = 1;
     beam->max_buf_size = max_buf_size;
     beam->timeout = timeout;
+    beam->recv_idle_gen = beam->change_gen - 1;
 
     rv = apr_thread_mutex_create(&beam->lock, APR_THREAD_MUTEX_DEFAULT, pool);
     if (APR_SUCCESS == rv) {
@@ -710,11 +1035,12 @@ void h2_beam_abort(h2_bucket_beam *beam)
     h2_beam_lock bl;
     
     if (beam && enter_yellow(beam, &bl) == APR_SUCCESS) {
-        beam->aborted = 1;
+        beam_set_aborted(beam);
         r_purge_sent(beam);
         h2_blist_cleanup(&beam->send_list);
+        budget_update(beam, 0);
         report_consumption(beam, &bl);
-        apr_thread_cond_broadcast(beam->change);
+        beam_changed(beam);
         leave_yellow(beam, &bl);
     }
 }
@@ -738,7 +1064,7 @@ apr_status_t h2_beam_leave(h2_bucket_beam *beam)
     
     if (beam && enter_yellow(beam, &bl) == APR_SUCCESS) {
         recv_buffer_cleanup(beam, &bl);
-        beam->aborted = 1;
+        beam_set_aborted(beam);
         beam_close(beam);
         leave_yellow(beam, &bl);
     }
@@ -817,6 +1143,11 @@ static apr_status_t append_bucket(h2_bucket_beam *beam,
         }
         check_len = !can_beam;
     }
+    else if (H2_BUCKET_IS_FCACHE(b)) {
+        /* A descriptor shared via H2FileCacheSize, read with pread() from
+         * any thread. Like a beamed file, it has no memory to count. */
+        check_len = 0;
+    }
     else {
         if (b->length == ((apr_size_t)-1)) {
             const char *data2;
@@ -844,7 +1175,10 @@ static apr_status_t append_bucket(h2_bucket_beam *beam,
         /* this takes care of transient buckets and converts them
          * into heap ones. Other bucket types might or might not be
          * affected by this. */
-        status = apr_bucket_setaside(b, beam->send_pool);
+        status = chunk_setaside(b);
+        if (status != APR_SUCCESS) {
+            status = apr_bucket_setaside(b, beam->send_pool);
+        }
     }
     else if (APR_BUCKET_IS_HEAP(b)) {
         /* For heap buckets read from a receiver thread is fine. The
@@ -858,14 +1192,20 @@ static apr_status_t append_bucket(h2_bucket_beam *beam,
          * even after the bucket data pointer has been read. So at
          * any time inside the receiver thread, the pool bucket memory
          * may disappear. yikes. */
-        status = apr_bucket_read(b, &data, &len, APR_BLOCK_READ);
-        if (status == APR_SUCCESS) {
-            apr_bucket_heap_make(b, data, len, NULL);
+        status = chunk_setaside(b);
+        if (status != APR_SUCCESS) {
+            status = apr_bucket_read(b, &data, &len, APR_BLOCK_READ);
+            if (status == APR_SUCCESS) {
+                apr_bucket_heap_make(b, data, len, NULL);
+            }
         }
     }
     else if (APR_BUCKET_IS_FILE(b) && can_beam) {
         status = apr_bucket_setaside(b, beam->send_pool);
     }
+    else if (H2_BUCKET_IS_FCACHE(b)) {
+        status = APR_SUCCESS;
+    }
     
     if (status == APR_ENOTIMPL) {
         /* we have no knowledge about the internals of this bucket,
@@ -909,11 +1249,13 @@ apr_status_t h2_beam_send(h2_bucket_beam *beam,
     apr_bucket *b;
     apr_status_t rv = APR_SUCCESS;
     apr_size_t space_left = 0;
+    apr_off_t sent_before;
     h2_beam_lock bl;
 
     /* Called from the sender thread to add buckets to the beam */
     if (enter_yellow(beam, &bl) == APR_SUCCESS) {
         ap_assert(beam->send_pool);
+        sent_before = beam->sent_bytes;
         r_purge_sent(beam);
         
         if (beam->aborted) {
@@ -928,6 +1270,9 @@ apr_status_t h2_beam_send(h2_bucket_beam *beam,
                 if (space_left <= 0) {
                     report_prod_io(beam, force_report, &bl);
                     r_purge_sent(beam);
+                    /* the receiver needs to see what we appended so far,
+                     * or it will not make room for the rest */
+                    beam_changed(beam);
                     rv = wait_not_full(beam, block, &space_left, &bl);
                     if (APR_SUCCESS != rv) {
                         break;
@@ -938,7 +1283,10 @@ apr_status_t h2_beam_send(h2_bucket_beam *beam,
             }
             
             report_prod_io(beam, force_report, &bl);
-            apr_thread_cond_broadcast(beam->change);
+            budget_account(beam);
+            beam_changed(beam);
+            H2_PROBE3(beam_send, beam->id, beam->tag, 
+                      beam->sent_bytes - sent_before);
         }
         report_consumption(beam, &bl);
         leave_yellow(beam, &bl);
@@ -957,9 +1305,18 @@ apr_status_t h2_beam_receive(h2_bucket_beam *beam,
     apr_status_t status = APR_SUCCESS;
     apr_off_t remain;
     int transferred_buckets = 0;
+    apr_uint32_t gen;
+    
+    /* There is only one receiver. If the sender did not change anything 
+     * since we last came back empty handed, we will again. */
+    if (block == APR_NONBLOCK_READ 
+        && apr_atomic_read32(&beam->change_gen) == beam->recv_idle_gen) {
+        return APR_EAGAIN;
+    }
     
     /* Called from the receiver thread to take buckets from the beam */
     if (enter_yellow(beam, &bl) == APR_SUCCESS) {
+        gen = apr_atomic_read32(&beam->change_gen);
         if (readbytes <= 0) {
             readbytes = (apr_off_t)APR_SIZE_MAX;
         }
@@ -1047,6 +1404,12 @@ transfer:
                 ++transferred_buckets;
                 continue;
             }
+            else if (H2_BUCKET_IS_FCACHE(bsender)) {
+                /* The receiver gets its own bucket on the cached descriptor,
+                 * reading the sender one from here would split and morph it
+                 * with the sender's allocator. */
+                brecv = h2_fcache_bucket_dup(bsender, bb->bucket_alloc);
+            }
             else {
                 /* create a "receiver" standin bucket. we took care about the
                  * underlying sender bucket and its data when we placed it into
@@ -1063,6 +1426,7 @@ transfer:
             H2_BLIST_INSERT_TAIL(&beam->hold_list, bsender);
             
             beam->received_bytes += bsender->length;
+            apr_atomic_inc32(&beam->recv_gen);
             ++transferred_buckets;
             
             if (brecv) {
@@ -1120,14 +1484,20 @@ transfer:
         }
         
         if (transferred) {
-            apr_thread_cond_broadcast(beam->change);
+            budget_account(beam);
+            beam_changed(beam);
+            H2_PROBE3(beam_receive, beam->id, beam->tag, readbytes - remain);
             status = APR_SUCCESS;
         }
         else {
             status = wait_not_empty(beam, block, bl.mutex);
             if (status != APR_SUCCESS) {
+                if (APR_STATUS_IS_EAGAIN(status)) {
+                    beam->recv_idle_gen = gen;
+                }
                 goto leave;
             }
+            gen = apr_atomic_read32(&beam->change_gen);
             goto transfer;
         }
 leave:        
@@ -1267,6 +1637,11 @@ int h2_beam_report_consumption(h2_bucket_beam *beam)
 {
     h2_beam_lock bl;
     int rv = 0;
+    
+    if (apr_atomic_read32(&beam->cons_gen) == apr_atomic_read32(&beam->recv_gen)) {
+        /* nothing received since the last report */
+        return 0;
+    }
     if (enter_yellow(beam, &bl) == APR_SUCCESS) {
         rv = report_consumption(beam, &bl);
         leave_yellow(beam, &bl);
@@ -175,6 +175,7 @@ struct h2_bucket_beam {
     apr_pool_t *recv_pool;
     
     apr_size_t max_buf_size;
+    apr_size_t budget_used;   /* bytes accounted in the child budget */
     apr_interval_time_t timeout;
 
     apr_off_t sent_bytes;     /* amount of bytes send */
@@ -190,6 +191,10 @@ struct h2_bucket_beam {
 
     struct apr_thread_mutex_t *lock;
     struct apr_thread_cond_t *change;
+    volatile apr_uint32_t change_gen; /* incremented on every change */
+    apr_uint32_t recv_idle_gen;       /* change_gen of last empty receive */
+    volatile apr_uint32_t recv_gen;   /* incremented when bytes received */
+    volatile apr_uint32_t cons_gen;   /* recv_gen at last consumed report */
     
     apr_off_t cons_bytes_reported;    /* amount of bytes reported as consumed */
     h2_beam_ev_callback *cons_ev_cb;
@@ -403,4 +408,30 @@ void h2_register_bucket_beamer(h2_bucket_beamer *beamer);
 
 void h2_beam_log(h2_bucket_beam *beam, conn_rec *c, int level, const char *msg);
 
+/**
+ * Set up the transfer chunks shared by all beams in this child. Data 
+ * that needs to be copied into a beam is kept in chunks of 2K to 64K
+ * that are reused, up to max_mem bytes in total. Idle chunks beyond a
+ * quarter of max_mem are freed.
+ * @param pchild the child pool
+ * @param max_mem the max bytes to allocate in chunks, 0 to disable
+ */
+apr_status_t h2_beam_chunks_init(apr_pool_t *pchild, apr_size_t max_mem);
+
+/**
+ * Get the number of chunks in use by beams, the number of idle chunks
+ * and the bytes allocated in all chunks.
+ */
+void h2_beam_chunks_stats(apr_uint32_t *pin_use, apr_uint32_t *pidle, 
+                          apr_size_t *pmem);
+
+/**
+ * Set up the memory budget shared by all beams in this child. Beams with
+ * a buffer size may then buffer more while the budget has room and are
+ * throttled together when it runs out.
+ * @param pchild the child pool
+ * @param max_mem the bytes all beams may buffer, 0 to disable
+ */
+apr_status_t h2_beam_budget_init(apr_pool_t *pchild, apr_size_t max_mem);
+
 #endif /* h2_bucket_beam_h */
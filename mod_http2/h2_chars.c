@@ -0,0 +1,178 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <apr.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define H2_CHARS_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define H2_CHARS_NEON
+#endif
+
+#include "h2_chars.h"
+
+/* bits from H2_CHAR_*, generated from the RFC grammars */
+const unsigned char h2_char_class[256] = {
+/*   0     1     2     3     4     5     6     7     8     9     a     b     c     d     e     f        */
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, /* 0 */
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, /* 1 */
+    0x02, 0x0f, 0x02, 0x0f, 0x0f, 0x03, 0x0f, 0x0b, 0x0a, 0x0a, 0x0b, 0x0f, 0x02, 0x0f, 0x0f, 0x0a, /* 2 */
+    0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0a, 0x02, 0x0a, 0x0a, 0x0a, 0x0a, /* 3 */
+    0x0a, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, /* 4 */
+    0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0a, 0x02, 0x0a, 0x0f, 0x0f, /* 5 */
+    0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, /* 6 */
+    0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0a, 0x0f, 0x0a, 0x0f, 0x00, /* 7 */
+    0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, /* 8 */
+    0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, /* 9 */
+    0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, /* a */
+    0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, /* b */
+    0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, /* c */
+    0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, /* d */
+    0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, /* e */
+    0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, /* f */
+};
+
+static apr_size_t span_scalar(const unsigned char *s, apr_size_t i, 
+                              apr_size_t len, unsigned int cls)
+{
+    for (; i + 4 <= len; i += 4) {
+        if (!(h2_char_class[s[i]] & cls)) return i;
+        if (!(h2_char_class[s[i+1]] & cls)) return i + 1;
+        if (!(h2_char_class[s[i+2]] & cls)) return i + 2;
+        if (!(h2_char_class[s[i+3]] & cls)) return i + 3;
+    }
+    for (; i < len && (h2_char_class[s[i]] & cls); ++i);
+    return i;
+}
+
+apr_size_t h2_chars_span(const char *s, apr_size_t len, unsigned int cls)
+{
+    const unsigned char *u = (const unsigned char *)s;
+    apr_size_t i = 0;
+    
+    if (cls == H2_CHAR_FIELD) {
+        /* Cookies and other long values, the blocks with a control char 
+         * are looked at bytewise */
+#if defined(H2_CHARS_SSE2)
+        const __m128i sp = _mm_set1_epi8(0x20), ht = _mm_set1_epi8(0x09);
+        const __m128i del = _mm_set1_epi8(0x7f), zero = _mm_setzero_si128();
+        
+        for (; i + 16 <= len; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(u + i));
+            /* signed compare, obs-text is negative and allowed */
+            __m128i ctl = _mm_andnot_si128(_mm_cmplt_epi8(v, zero), 
+                                           _mm_cmplt_epi8(v, sp));
+            __m128i bad = _mm_or_si128(_mm_andnot_si128(_mm_cmpeq_epi8(v, ht), ctl),
+                                       _mm_cmpeq_epi8(v, del));
+            if (_mm_movemask_epi8(bad)) {
+                break;
+            }
+        }
+#elif defined(H2_CHARS_NEON)
+        const uint8x16_t sp = vdupq_n_u8(0x20), ht = vdupq_n_u8(0x09);
+        const uint8x16_t del = vdupq_n_u8(0x7f);
+        
+        for (; i + 16 <= len; i += 16) {
+            uint8x16_t v = vld1q_u8(u + i);
+            uint8x16_t bad = vorrq_u8(vbicq_u8(vcltq_u8(v, sp), vceqq_u8(v, ht)),
+                                      vceqq_u8(v, del));
+            if (vmaxvq_u8(bad)) {
+                break;
+            }
+        }
+#endif
+    }
+    return span_scalar(u, i, len, cls);
+}
+
+void h2_chars_lower(char *dst, const char *src, apr_size_t len)
+{
+    apr_size_t i = 0;
+    
+#if defined(H2_CHARS_SSE2)
+    const __m128i a1 = _mm_set1_epi8('A' - 1), z1 = _mm_set1_epi8('Z' + 1);
+    const __m128i bit = _mm_set1_epi8(0x20);
+    
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i up = _mm_and_si128(_mm_cmpgt_epi8(v, a1), _mm_cmplt_epi8(v, z1));
+        _mm_storeu_si128((__m128i *)(dst + i), 
+                         _mm_or_si128(v, _mm_and_si128(up, bit)));
+    }
+#elif defined(H2_CHARS_NEON)
+    const uint8x16_t a = vdupq_n_u8('A'), z = vdupq_n_u8('Z');
+    const uint8x16_t bit = vdupq_n_u8(0x20);
+    
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)src + i);
+        uint8x16_t up = vandq_u8(vcgeq_u8(v, a), vcleq_u8(v, z));
+        vst1q_u8((uint8_t *)dst + i, vorrq_u8(v, vandq_u8(up, bit)));
+    }
+#endif
+    for (; i < len; ++i) {
+        char c = src[i];
+        dst[i] = (c >= 'A' && c <= 'Z')? (char)(c | 0x20) : c;
+    }
+}
+
+void h2_chars_camel_case(char *s, apr_size_t len)
+{
+    apr_size_t i = 1;
+    
+    if (len == 0) {
+        return;
+    }
+    if (s[0] >= 'a' && s[0] <= 'z') {
+        s[0] -= 'a' - 'A';
+    }
+    /* a letter is uppercased when the byte before it is a '-'. That byte 
+     * is never changed, so the block can be read again from one before. */
+#if defined(H2_CHARS_SSE2)
+    {
+        const __m128i a1 = _mm_set1_epi8('a' - 1), z1 = _mm_set1_epi8('z' + 1);
+        const __m128i dash = _mm_set1_epi8('-'), bit = _mm_set1_epi8(0x20);
+        
+        for (; i + 16 <= len; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+            __m128i prev = _mm_loadu_si128((const __m128i *)(s + i - 1));
+            __m128i lc = _mm_and_si128(_mm_cmpgt_epi8(v, a1), _mm_cmplt_epi8(v, z1));
+            __m128i m = _mm_and_si128(lc, _mm_cmpeq_epi8(prev, dash));
+            _mm_storeu_si128((__m128i *)(s + i), 
+                             _mm_xor_si128(v, _mm_and_si128(m, bit)));
+        }
+    }
+#elif defined(H2_CHARS_NEON)
+    {
+        const uint8x16_t a = vdupq_n_u8('a'), z = vdupq_n_u8('z');
+        const uint8x16_t dash = vdupq_n_u8('-'), bit = vdupq_n_u8(0x20);
+        
+        for (; i + 16 <= len; i += 16) {
+            uint8x16_t v = vld1q_u8((const uint8_t *)s + i);
+            uint8x16_t prev = vld1q_u8((const uint8_t *)s + i - 1);
+            uint8x16_t m = vandq_u8(vandq_u8(vcgeq_u8(v, a), vcleq_u8(v, z)),
+                                    vceqq_u8(prev, dash));
+            vst1q_u8((uint8_t *)s + i, veorq_u8(v, vandq_u8(m, bit)));
+        }
+    }
+#endif
+    for (; i < len; ++i) {
+        if (s[i-1] == '-' && s[i] >= 'a' && s[i] <= 'z') {
+            s[i] -= 'a' - 'A';
+        }
+    }
+}
@@ -0,0 +1,54 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __mod_h2__h2_chars__
+#define __mod_h2__h2_chars__
+
+/**
+ * Character classes and case mapping for header names and values, as
+ * used by mod_http2 and mod_proxy_http2. Classes are bits in a lookup
+ * table; field values, lowercasing and camel casing take 16 bytes at a
+ * time with SSE2 or NEON where the compiler has them, bytewise otherwise.
+ */
+
+#define H2_CHAR_TOKEN       0x01    /* tchar, RFC 7230 ch. 3.2.6 */
+#define H2_CHAR_FIELD       0x02    /* field-vchar, SP and HTAB, RFC 7230 ch. 3.2 */
+#define H2_CHAR_ATTR        0x04    /* attr-char, RFC 5987 ch. 3.2.1 */
+#define H2_CHAR_PTOKEN      0x08    /* ptoken char, RFC 8288 */
+
+extern const unsigned char h2_char_class[256];
+
+#define H2_CHAR_IS(c, cls)  (h2_char_class[(unsigned char)(c)] & (cls))
+
+/**
+ * @return the number of bytes at the start of s that are in any of the
+ *         given classes, len if all are
+ */
+apr_size_t h2_chars_span(const char *s, apr_size_t len, unsigned int cls);
+
+/**
+ * Copy len bytes from src to dst with ASCII letters lowercased. dst may
+ * be src.
+ */
+void h2_chars_lower(char *dst, const char *src, apr_size_t len);
+
+/**
+ * Uppercase the first letter and every letter after a '-', in place, for 
+ * HTTP/1 style header names.
+ */
+void h2_chars_camel_case(char *s, apr_size_t len);
+
+#endif /* defined(__mod_h2__h2_chars__) */
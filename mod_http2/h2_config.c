@@ -24,6 +24,7 @@
 #include <http_config.h>
 #include <http_log.h>
 #include <http_vhost.h>
+#include <util_cfgtree.h>
 
 #include <ap_mpm.h>
 
@@ -35,6 +36,9 @@
 #include "h2_conn.h"
 #include "h2_config.h"
 #include "h2_h2.h"
+#include "h2_push_cache.h"
+#include "h2_fcache.h"
+#include "h2_rcache.h"
 #include "h2_private.h"
 
 #define DEF_VAL     (-1)
@@ -78,8 +82,37 @@ typedef struct h2_config {
     int early_hints;              /* support status code 103 */
     int padding_bits;
     int padding_always;
+    int worker_stealing;          /* per worker queues with work stealing */
+    int slave_pool_size;          /* # of slave pools kept per child */
+    int tls_adaptive_size;        /* size TLS writes from the TCP window */
+    int async_suspend;            /* give thread back to mpm while waiting */
+    int worker_limiter;           /* how the per connection worker limit adapts */
+    int worker_weight;            /* share of worker time per connection */
+    int early_dispatch;           /* start requests during a read */
+    int win_autotune;             /* grow stream windows as input drains */
+    int win_budget;               /* max sum of autotuned stream windows */
+    const char *push_diary_key;   /* client key for the shared push diary */
+    const h2_config_values *values; /* resolved at post config */
+    int response_cache;           /* serve small responses from memory */
+    apr_array_header_t *inline_locs; /* h2_inline_loc of H2Inline in <Location>s */
+    int direct_send;              /* h2c output via sendv, not the filters */
+    int flush_delay;              /* usecs control frames may wait */
+    int flush_batch;              /* bytes of control frames to batch */
+    int worker_affinity;          /* pin workers to NUMA nodes */
+    int worker_scaling;           /* resize workers by load */
+    apr_int64_t upload_spool;     /* body bytes held in memory when spooling */
+    apr_int64_t upload_spool_max; /* max bytes spooled per connection */
+    apr_hash_t *hpack_policy;     /* lowercase header name to h2_hpack_policy */
+    int hpack_table_size;         /* max HPACK encoder table */
+    apr_int64_t beam_mem_budget;  /* bytes buffered in all beams of a child */
+    int ext_priorities;           /* use RFC 9218 priorities */
 } h2_config;
 
+typedef struct h2_inline_loc {
+    const char *path;             /* <Location> prefix */
+    int on;
+} h2_inline_loc;
+
 typedef struct h2_dir_config {
     const char *name;
     apr_array_header_t *alt_svcs; /* h2_alt_svc specs for this server */
@@ -88,6 +121,7 @@ typedef struct h2_dir_config {
     int h2_push;                  /* if HTTP/2 server push is enabled */
     apr_array_header_t *push_list;/* list of h2_push_res configurations */
     int early_hints;              /* support status code 103 */
+    int response_cache;           /* serve small responses from memory */
 } h2_dir_config;
 
 
@@ -115,6 +149,30 @@ static h2_config defconf = {
     0,                      /* early hints, http status 103 */
     0,                      /* padding bits */
     1,                      /* padding always */
+    0,                      /* worker queues with stealing */
+    -1,                     /* slave pool size, auto */
+    0,                      /* tls adaptive size */
+    0,                      /* async suspend */
+    H2_LIMITER_STEPS,       /* worker limiter */
+    1,                      /* worker weight */
+    0,                      /* early dispatch */
+    0,                      /* window autotune */
+    8 * 1024 * 1024,        /* window budget */
+    NULL,                   /* push diary key */
+    NULL,                   /* resolved values */
+    0,                      /* response cache */
+    NULL,                   /* inline locations */
+    0,                      /* direct send */
+    0,                      /* flush delay */
+    1300,                   /* flush batch */
+    0,                      /* worker affinity */
+    0,                      /* worker scaling */
+    0,                      /* upload spool */
+    1024*1024*1024,         /* upload spool max */
+    NULL,                   /* hpack policies */
+    4096,                   /* hpack table size */
+    0,                      /* beam memory budget */
+    0,                      /* extensible priorities */
 };
 
 static h2_dir_config defdconf = {
@@ -125,6 +183,7 @@ static h2_dir_config defdconf = {
     -1,                     /* HTTP/2 server push enabled */
     NULL,                   /* push list */
     -1,                     /* early hints, http status 103 */
+    -1,                     /* response cache */
 };
 
 void h2_config_init(apr_pool_t *pool)
@@ -159,6 +218,30 @@ void *h2_config_create_svr(apr_pool_t *pool, server_rec *s)
     conf->early_hints          = DEF_VAL;
     conf->padding_bits         = DEF_VAL;
     conf->padding_always       = DEF_VAL;
+    conf->worker_stealing      = DEF_VAL;
+    conf->slave_pool_size      = DEF_VAL;
+    conf->tls_adaptive_size    = DEF_VAL;
+    conf->async_suspend        = DEF_VAL;
+    conf->worker_limiter       = DEF_VAL;
+    conf->worker_weight        = DEF_VAL;
+    conf->early_dispatch       = DEF_VAL;
+    conf->win_autotune         = DEF_VAL;
+    conf->win_budget           = DEF_VAL;
+    conf->push_diary_key       = NULL;
+    conf->values               = NULL;
+    conf->response_cache       = DEF_VAL;
+    conf->inline_locs          = NULL;
+    conf->direct_send          = DEF_VAL;
+    conf->flush_delay          = DEF_VAL;
+    conf->flush_batch          = DEF_VAL;
+    conf->worker_affinity      = DEF_VAL;
+    conf->worker_scaling       = DEF_VAL;
+    conf->upload_spool         = DEF_VAL;
+    conf->upload_spool_max     = DEF_VAL;
+    conf->hpack_policy         = NULL;
+    conf->hpack_table_size     = DEF_VAL;
+    conf->beam_mem_budget      = DEF_VAL;
+    conf->ext_priorities       = DEF_VAL;
     return conf;
 }
 
@@ -202,6 +285,39 @@ static void *h2_config_merge(apr_pool_t *pool, void *basev, void *addv)
     n->early_hints          = H2_CONFIG_GET(add, base, early_hints);
     n->padding_bits         = H2_CONFIG_GET(add, base, padding_bits);
     n->padding_always       = H2_CONFIG_GET(add, base, padding_always);
+    n->worker_stealing      = H2_CONFIG_GET(add, base, worker_stealing);
+    n->slave_pool_size      = H2_CONFIG_GET(add, base, slave_pool_size);
+    n->tls_adaptive_size    = H2_CONFIG_GET(add, base, tls_adaptive_size);
+    n->async_suspend        = H2_CONFIG_GET(add, base, async_suspend);
+    n->worker_limiter       = H2_CONFIG_GET(add, base, worker_limiter);
+    n->worker_weight        = H2_CONFIG_GET(add, base, worker_weight);
+    n->early_dispatch       = H2_CONFIG_GET(add, base, early_dispatch);
+    n->win_autotune         = H2_CONFIG_GET(add, base, win_autotune);
+    n->win_budget           = H2_CONFIG_GET(add, base, win_budget);
+    n->push_diary_key       = add->push_diary_key? add->push_diary_key : base->push_diary_key;
+    n->response_cache       = H2_CONFIG_GET(add, base, response_cache);
+    if (add->inline_locs && base->inline_locs) {
+        n->inline_locs      = apr_array_append(pool, base->inline_locs, add->inline_locs);
+    }
+    else {
+        n->inline_locs      = add->inline_locs? add->inline_locs : base->inline_locs;
+    }
+    n->direct_send          = H2_CONFIG_GET(add, base, direct_send);
+    n->flush_delay          = H2_CONFIG_GET(add, base, flush_delay);
+    n->flush_batch          = H2_CONFIG_GET(add, base, flush_batch);
+    n->worker_affinity      = H2_CONFIG_GET(add, base, worker_affinity);
+    n->worker_scaling       = H2_CONFIG_GET(add, base, worker_scaling);
+    n->upload_spool         = H2_CONFIG_GET(add, base, upload_spool);
+    n->upload_spool_max     = H2_CONFIG_GET(add, base, upload_spool_max);
+    if (add->hpack_policy && base->hpack_policy) {
+        n->hpack_policy     = apr_hash_overlay(pool, add->hpack_policy, base->hpack_policy);
+    }
+    else {
+        n->hpack_policy     = add->hpack_policy? add->hpack_policy : base->hpack_policy;
+    }
+    n->hpack_table_size     = H2_CONFIG_GET(add, base, hpack_table_size);
+    n->beam_mem_budget      = H2_CONFIG_GET(add, base, beam_mem_budget);
+    n->ext_priorities       = H2_CONFIG_GET(add, base, ext_priorities);
     return n;
 }
 
@@ -221,6 +337,7 @@ void *h2_config_create_dir(apr_pool_t *pool, char *x)
     conf->h2_upgrade           = DEF_VAL;
     conf->h2_push              = DEF_VAL;
     conf->early_hints          = DEF_VAL;
+    conf->response_cache       = DEF_VAL;
     return conf;
 }
 
@@ -242,11 +359,15 @@ void *h2_config_merge_dir(apr_pool_t *pool, void *basev, void *addv)
         n->push_list        = add->push_list? add->push_list : base->push_list;
     }
     n->early_hints          = H2_CONFIG_GET(add, base, early_hints);
+    n->response_cache       = H2_CONFIG_GET(add, base, response_cache);
     return n;
 }
 
 static apr_int64_t h2_srv_config_geti64(const h2_config *conf, h2_config_var_t var)
 {
+    if (conf->values && var < H2_CONF_COUNT) {
+        return conf->values->val[var];
+    }
     switch(var) {
         case H2_CONF_MAX_STREAMS:
             return H2_CONFIG_GET(conf, &defconf, h2_max_streams);
@@ -287,6 +408,46 @@ static apr_int64_t h2_srv_config_geti64(const h2_config *conf, h2_config_var_t v
             return H2_CONFIG_GET(conf, &defconf, padding_bits);
         case H2_CONF_PADDING_ALWAYS:
             return H2_CONFIG_GET(conf, &defconf, padding_always);
+        case H2_CONF_WORKER_STEALING:
+            return H2_CONFIG_GET(conf, &defconf, worker_stealing);
+        case H2_CONF_SLAVE_POOL_SIZE:
+            return H2_CONFIG_GET(conf, &defconf, slave_pool_size);
+        case H2_CONF_TLS_ADAPTIVE_SIZE:
+            return H2_CONFIG_GET(conf, &defconf, tls_adaptive_size);
+        case H2_CONF_ASYNC_SUSPEND:
+            return H2_CONFIG_GET(conf, &defconf, async_suspend);
+        case H2_CONF_WORKER_LIMITER:
+            return H2_CONFIG_GET(conf, &defconf, worker_limiter);
+        case H2_CONF_WORKER_WEIGHT:
+            return H2_CONFIG_GET(conf, &defconf, worker_weight);
+        case H2_CONF_EARLY_DISPATCH:
+            return H2_CONFIG_GET(conf, &defconf, early_dispatch);
+        case H2_CONF_WIN_AUTOTUNE:
+            return H2_CONFIG_GET(conf, &defconf, win_autotune);
+        case H2_CONF_WIN_BUDGET:
+            return H2_CONFIG_GET(conf, &defconf, win_budget);
+        case H2_CONF_RESPONSE_CACHE:
+            return H2_CONFIG_GET(conf, &defconf, response_cache);
+        case H2_CONF_DIRECT_SEND:
+            return H2_CONFIG_GET(conf, &defconf, direct_send);
+        case H2_CONF_FLUSH_DELAY:
+            return H2_CONFIG_GET(conf, &defconf, flush_delay);
+        case H2_CONF_FLUSH_BATCH:
+            return H2_CONFIG_GET(conf, &defconf, flush_batch);
+        case H2_CONF_WORKER_AFFINITY:
+            return H2_CONFIG_GET(conf, &defconf, worker_affinity);
+        case H2_CONF_WORKER_SCALING:
+            return H2_CONFIG_GET(conf, &defconf, worker_scaling);
+        case H2_CONF_UPLOAD_SPOOL:
+            return H2_CONFIG_GET(conf, &defconf, upload_spool);
+        case H2_CONF_UPLOAD_SPOOL_MAX:
+            return H2_CONFIG_GET(conf, &defconf, upload_spool_max);
+        case H2_CONF_HPACK_TABLE_SIZE:
+            return H2_CONFIG_GET(conf, &defconf, hpack_table_size);
+        case H2_CONF_BEAM_MEM_BUDGET:
+            return H2_CONFIG_GET(conf, &defconf, beam_mem_budget);
+        case H2_CONF_EXT_PRIORITIES:
+            return H2_CONFIG_GET(conf, &defconf, ext_priorities);
         default:
             return DEF_VAL;
     }
@@ -352,6 +513,66 @@ static void h2_srv_config_seti(h2_config *conf, h2_config_var_t var, int val)
         case H2_CONF_PADDING_ALWAYS:
             H2_CONFIG_SET(conf, padding_always, val);
             break;
+        case H2_CONF_WORKER_STEALING:
+            H2_CONFIG_SET(conf, worker_stealing, val);
+            break;
+        case H2_CONF_SLAVE_POOL_SIZE:
+            H2_CONFIG_SET(conf, slave_pool_size, val);
+            break;
+        case H2_CONF_TLS_ADAPTIVE_SIZE:
+            H2_CONFIG_SET(conf, tls_adaptive_size, val);
+            break;
+        case H2_CONF_ASYNC_SUSPEND:
+            H2_CONFIG_SET(conf, async_suspend, val);
+            break;
+        case H2_CONF_WORKER_LIMITER:
+            H2_CONFIG_SET(conf, worker_limiter, val);
+            break;
+        case H2_CONF_WORKER_WEIGHT:
+            H2_CONFIG_SET(conf, worker_weight, val);
+            break;
+        case H2_CONF_EARLY_DISPATCH:
+            H2_CONFIG_SET(conf, early_dispatch, val);
+            break;
+        case H2_CONF_WIN_AUTOTUNE:
+            H2_CONFIG_SET(conf, win_autotune, val);
+            break;
+        case H2_CONF_WIN_BUDGET:
+            H2_CONFIG_SET(conf, win_budget, val);
+            break;
+        case H2_CONF_RESPONSE_CACHE:
+            H2_CONFIG_SET(conf, response_cache, val);
+            break;
+        case H2_CONF_DIRECT_SEND:
+            H2_CONFIG_SET(conf, direct_send, val);
+            break;
+        case H2_CONF_FLUSH_DELAY:
+            H2_CONFIG_SET(conf, flush_delay, val);
+            break;
+        case H2_CONF_FLUSH_BATCH:
+            H2_CONFIG_SET(conf, flush_batch, val);
+            break;
+        case H2_CONF_WORKER_AFFINITY:
+            H2_CONFIG_SET(conf, worker_affinity, val);
+            break;
+        case H2_CONF_WORKER_SCALING:
+            H2_CONFIG_SET(conf, worker_scaling, val);
+            break;
+        case H2_CONF_UPLOAD_SPOOL:
+            H2_CONFIG_SET(conf, upload_spool, val);
+            break;
+        case H2_CONF_UPLOAD_SPOOL_MAX:
+            H2_CONFIG_SET(conf, upload_spool_max, val);
+            break;
+        case H2_CONF_HPACK_TABLE_SIZE:
+            H2_CONFIG_SET(conf, hpack_table_size, val);
+            break;
+        case H2_CONF_BEAM_MEM_BUDGET:
+            H2_CONFIG_SET(conf, beam_mem_budget, val);
+            break;
+        case H2_CONF_EXT_PRIORITIES:
+            H2_CONFIG_SET(conf, ext_priorities, val);
+            break;
         default:
             break;
     }
@@ -363,6 +584,15 @@ static void h2_srv_config_seti64(h2_config *conf, h2_config_var_t var, apr_int64
         case H2_CONF_TLS_WARMUP_SIZE:
             H2_CONFIG_SET(conf, tls_warmup_size, val);
             break;
+        case H2_CONF_UPLOAD_SPOOL:
+            H2_CONFIG_SET(conf, upload_spool, val);
+            break;
+        case H2_CONF_UPLOAD_SPOOL_MAX:
+            H2_CONFIG_SET(conf, upload_spool_max, val);
+            break;
+        case H2_CONF_BEAM_MEM_BUDGET:
+            H2_CONFIG_SET(conf, beam_mem_budget, val);
+            break;
         default:
             h2_srv_config_seti(conf, var, (int)val);
             break;
@@ -396,6 +626,8 @@ static apr_int64_t h2_dir_config_geti64(const h2_dir_config *conf, h2_config_var
             return H2_CONFIG_GET(conf, &defdconf, h2_push);
         case H2_CONF_EARLY_HINTS:
             return H2_CONFIG_GET(conf, &defdconf, early_hints);
+        case H2_CONF_RESPONSE_CACHE:
+            return H2_CONFIG_GET(conf, &defdconf, response_cache);
 
         default:
             return DEF_VAL;
@@ -419,6 +651,9 @@ static void h2_config_seti(h2_dir_config *dconf, h2_config *conf, h2_config_var_
             case H2_CONF_EARLY_HINTS:
                 H2_CONFIG_SET(dconf, early_hints, val);
                 break;
+            case H2_CONF_RESPONSE_CACHE:
+                H2_CONFIG_SET(dconf, response_cache, val);
+                break;
             default:
                 /* not handled in dir_conf */
                 set_srv = 1;
@@ -490,9 +725,19 @@ int h2_config_geti(request_rec *r, server_rec *s, h2_config_var_t var)
     return (int)h2_config_geti64(r, s, var);
 }
 
+static int h2_dir_config_has(h2_config_var_t var)
+{
+    /* All values of this one are set (0 is not DEF_VAL), so it gives 
+     * DEF_VAL only for variables a directory cannot override. */
+    static const h2_dir_config all_set;
+    return h2_dir_config_geti64(&all_set, var) != DEF_VAL;
+}
+
 apr_int64_t h2_config_geti64(request_rec *r, server_rec *s, h2_config_var_t var)
 {
-    apr_int64_t mode = r? (int)h2_dir_config_geti64(h2_config_rget(r), var) : DEF_VAL;
+    /* only look at the directory config for variables it can override */
+    apr_int64_t mode = (r && h2_dir_config_has(var))? 
+        (int)h2_dir_config_geti64(h2_config_rget(r), var) : DEF_VAL;
     return (mode != DEF_VAL)? mode : h2_config_sgeti64(s, var);
 }
 
@@ -518,6 +763,70 @@ apr_array_header_t *h2_config_push_list(request_rec *r)
     return sconf? sconf->push_list : NULL;
 }
 
+apr_hash_t *h2_config_shpack_policy(server_rec *s)
+{
+    const h2_config *conf = h2_config_sget(s);
+    return conf? conf->hpack_policy : NULL;
+}
+
+int h2_config_sinline(server_rec *s, const char *path)
+{
+    const h2_config *conf = h2_config_sget(s);
+    const h2_inline_loc *loc;
+    apr_size_t len, best = 0;
+    int i, on = 0;
+    
+    if (!conf || !conf->inline_locs) {
+        return 0;
+    }
+    /* the longest matching location decides, as with <Location> merging */
+    for (i = 0; i < conf->inline_locs->nelts; ++i) {
+        loc = &APR_ARRAY_IDX(conf->inline_locs, i, h2_inline_loc);
+        len = strlen(loc->path);
+        if (len >= best && !strncmp(loc->path, path, len)) {
+            best = len;
+            on = loc->on;
+        }
+    }
+    return on;
+}
+
+apr_status_t h2_config_post_config(apr_pool_t *pool, server_rec *s)
+{
+    h2_config *conf;
+    h2_config_values *values;
+    int i;
+    
+    for (; s; s = s->next) {
+        conf = h2_config_sget(s);
+        if (conf->values) {
+            /* server shares the config of another one */
+            continue;
+        }
+        values = apr_pcalloc(pool, sizeof(*values));
+        for (i = 0; i < H2_CONF_COUNT; ++i) {
+            values->val[i] = h2_srv_config_geti64(conf, (h2_config_var_t)i);
+        }
+        conf->values = values;
+    }
+    return APR_SUCCESS;
+}
+
+const h2_config_values *h2_config_svalues(server_rec *s)
+{
+    const h2_config *conf = h2_config_sget(s);
+    ap_assert(conf->values);
+    return conf->values;
+}
+
+const char *h2_config_push_diary_key(server_rec *s)
+{
+    const h2_config *conf = h2_config_sget(s);
+    const char *key = conf->push_diary_key? conf->push_diary_key : defconf.push_diary_key;
+    /* "" when explicitly set to none */
+    return (key && *key)? key : NULL;
+}
+
 apr_array_header_t *h2_config_alt_svcs(request_rec *r)
 {
     const h2_config *sconf;
@@ -837,6 +1146,28 @@ static void add_push(apr_array_header_t **plist, apr_pool_t *pool, h2_push_res *
     new->critical = push->critical;
 }
 
+static const char *h2_conf_set_inline(cmd_parms *cmd, void *dirconf, int flag)
+{
+    h2_config *conf = h2_config_sget(cmd->server);
+    const ap_directive_t *section = cmd->directive->parent;
+    h2_inline_loc *loc;
+    
+    (void)dirconf;
+    /* the decision is made before there is a request_rec, so only plain
+     * <Location> prefixes are known in time */
+    if (!cmd->path || !section || strcasecmp("<Location", section->directive)
+        || (section->args && section->args[0] == '~')) {
+        return "H2Inline is only allowed in a <Location path> section";
+    }
+    if (!conf->inline_locs) {
+        conf->inline_locs = apr_array_make(cmd->pool, 5, sizeof(h2_inline_loc));
+    }
+    loc = apr_array_push(conf->inline_locs);
+    loc->path = cmd->path;
+    loc->on = flag;
+    return NULL;
+}
+
 static const char *h2_conf_add_push_res(cmd_parms *cmd, void *dirconf,
                                         const char *arg1, const char *arg2,
                                         const char *arg3)
@@ -865,6 +1196,9 @@ static const char *h2_conf_add_push_res(cmd_parms *cmd, void *dirconf,
         }
     }
 
+    /* identical for each response, so h2_push_collect() finds it parsed */
+    push.link = apr_psprintf(cmd->pool, "<%s>; rel=preload%s", 
+                             push.uri_ref, push.critical? "; critical" : "");
     if (cmd->path) {
         add_push(&(((h2_dir_config*)dirconf)->push_list), cmd->pool, &push);
     }
@@ -874,6 +1208,70 @@ static const char *h2_conf_add_push_res(cmd_parms *cmd, void *dirconf,
     return NULL;
 }
 
+static const char *h2_conf_set_push_diary_cache(cmd_parms *cmd,
+                                                void *dirconf, const char *value)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    
+    (void)dirconf;
+    if (err) {
+        return err;
+    }
+    return h2_push_cache_configure(cmd, value);
+}
+
+static const char *h2_conf_set_response_cache_size(cmd_parms *cmd, void *dirconf, 
+                                                   const char *total, 
+                                                   const char *max_entry)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    
+    (void)dirconf;
+    if (err) {
+        return err;
+    }
+    return h2_rcache_configure(cmd, total, max_entry);
+}
+
+static const char *h2_conf_set_file_cache_size(cmd_parms *cmd, void *dirconf, 
+                                               const char *value)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    
+    (void)dirconf;
+    if (err) {
+        return err;
+    }
+    return h2_fcache_configure(cmd, value);
+}
+
+static const char *h2_conf_set_push_diary_key(cmd_parms *cmd, void *dirconf, 
+                                              const char *type, const char *name)
+{
+    h2_config *cfg = (h2_config *)h2_config_sget(cmd->server);
+    
+    (void)dirconf;
+    if (!strcasecmp(type, "none")) {
+        cfg->push_diary_key = "";
+    }
+    else if (!strcasecmp(type, "tls-session")) {
+        cfg->push_diary_key = "tls-session";
+    }
+    else if (!strcasecmp(type, "cookie") || !strcasecmp(type, "header")) {
+        if (!name || !*name) {
+            return "H2PushDiaryKey cookie and header need a name";
+        }
+        cfg->push_diary_key = apr_pstrcat(cmd->pool, strcasecmp(type, "cookie")? 
+                                          "header:" : "cookie:", name, NULL);
+        return NULL;
+    }
+    else {
+        return "H2PushDiaryKey needs one of 'tls-session', 'cookie <name>', "
+               "'header <name>' or 'none'";
+    }
+    return name? "H2PushDiaryKey: unexpected name argument" : NULL;
+}
+
 static const char *h2_conf_set_early_hints(cmd_parms *cmd,
                                            void *dirconf, const char *value)
 {
@@ -906,6 +1304,290 @@ static const char *h2_conf_set_padding(cmd_parms *cmd, void *dirconf, const char
     return NULL;
 }
 
+static const char *h2_conf_set_worker_stealing(cmd_parms *cmd,
+                                               void *dirconf, const char *value)
+{
+    if (!strcasecmp(value, "On")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_WORKER_STEALING, 1);
+        return NULL;
+    }
+    else if (!strcasecmp(value, "Off")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_WORKER_STEALING, 0);
+        return NULL;
+    }
+    return "value must be On or Off";
+}
+
+static const char *h2_conf_set_slave_pool_size(cmd_parms *cmd,
+                                               void *dirconf, const char *value)
+{
+    int val = (int)apr_atoi64(value);
+    if (val < 0) {
+        return "value must be >= 0";
+    }
+    CONFIG_CMD_SET(cmd, dirconf, H2_CONF_SLAVE_POOL_SIZE, val);
+    return NULL;
+}
+
+static const char *h2_conf_set_tls_adaptive_size(cmd_parms *cmd,
+                                                 void *dirconf, const char *value)
+{
+    if (!strcasecmp(value, "On")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_TLS_ADAPTIVE_SIZE, 1);
+        return NULL;
+    }
+    else if (!strcasecmp(value, "Off")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_TLS_ADAPTIVE_SIZE, 0);
+        return NULL;
+    }
+    return "value must be On or Off";
+}
+
+static const char *h2_conf_set_async_suspend(cmd_parms *cmd,
+                                             void *dirconf, const char *value)
+{
+    if (!strcasecmp(value, "On")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_ASYNC_SUSPEND, 1);
+        return NULL;
+    }
+    else if (!strcasecmp(value, "Off")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_ASYNC_SUSPEND, 0);
+        return NULL;
+    }
+    return "value must be On or Off";
+}
+
+static const char *h2_conf_set_worker_limiter(cmd_parms *cmd,
+                                              void *dirconf, const char *value)
+{
+    if (!strcasecmp(value, "steps")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_WORKER_LIMITER, H2_LIMITER_STEPS);
+        return NULL;
+    }
+    else if (!strcasecmp(value, "aimd")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_WORKER_LIMITER, H2_LIMITER_AIMD);
+        return NULL;
+    }
+    else if (!strcasecmp(value, "drain")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_WORKER_LIMITER, H2_LIMITER_DRAIN);
+        return NULL;
+    }
+    return "value must be one of steps, aimd or drain";
+}
+
+static const char *h2_conf_set_worker_weight(cmd_parms *cmd,
+                                             void *dirconf, const char *value)
+{
+    int val = (int)apr_atoi64(value);
+    if (val < 1 || val > 100) {
+        return "value must be between 1 and 100";
+    }
+    CONFIG_CMD_SET(cmd, dirconf, H2_CONF_WORKER_WEIGHT, val);
+    return NULL;
+}
+
+static const char *h2_conf_set_early_dispatch(cmd_parms *cmd,
+                                              void *dirconf, const char *value)
+{
+    if (!strcasecmp(value, "On")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_EARLY_DISPATCH, 1);
+        return NULL;
+    }
+    else if (!strcasecmp(value, "Off")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_EARLY_DISPATCH, 0);
+        return NULL;
+    }
+    return "value must be On or Off";
+}
+
+static const char *h2_conf_set_win_autotune(cmd_parms *cmd,
+                                            void *dirconf, const char *value)
+{
+    if (!strcasecmp(value, "On")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_WIN_AUTOTUNE, 1);
+        return NULL;
+    }
+    else if (!strcasecmp(value, "Off")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_WIN_AUTOTUNE, 0);
+        return NULL;
+    }
+    return "value must be On or Off";
+}
+
+static const char *h2_conf_set_win_budget(cmd_parms *cmd,
+                                          void *dirconf, const char *value)
+{
+    apr_int64_t val = apr_atoi64(value);
+    if (val < 65535 || val > APR_INT32_MAX) {
+        return "value must be between 65535 and 2147483647";
+    }
+    CONFIG_CMD_SET(cmd, dirconf, H2_CONF_WIN_BUDGET, (int)val);
+    return NULL;
+}
+
+static const char *h2_conf_set_response_cache(cmd_parms *cmd,
+                                              void *dirconf, const char *value)
+{
+    if (!strcasecmp(value, "On")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_RESPONSE_CACHE, 1);
+        return NULL;
+    }
+    else if (!strcasecmp(value, "Off")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_RESPONSE_CACHE, 0);
+        return NULL;
+    }
+    return "value must be On or Off";
+}
+
+static const char *h2_conf_set_direct_send(cmd_parms *cmd,
+                                           void *dirconf, const char *value)
+{
+    if (!strcasecmp(value, "On")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_DIRECT_SEND, 1);
+        return NULL;
+    }
+    else if (!strcasecmp(value, "Off")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_DIRECT_SEND, 0);
+        return NULL;
+    }
+    return "value must be On or Off";
+}
+
+static const char *h2_conf_set_flush_delay(cmd_parms *cmd, void *dirconf, 
+                                           const char *usecs, const char *bytes)
+{
+    int val = (int)apr_atoi64(usecs);
+    if (val < 0) {
+        return "microseconds must be >= 0";
+    }
+    CONFIG_CMD_SET(cmd, dirconf, H2_CONF_FLUSH_DELAY, val);
+    if (bytes) {
+        val = (int)apr_atoi64(bytes);
+        if (val <= 0) {
+            return "bytes must be > 0";
+        }
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_FLUSH_BATCH, val);
+    }
+    return NULL;
+}
+
+static const char *h2_conf_set_worker_affinity(cmd_parms *cmd,
+                                               void *dirconf, const char *value)
+{
+    if (!strcasecmp(value, "On")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_WORKER_AFFINITY, 1);
+        return NULL;
+    }
+    else if (!strcasecmp(value, "Off")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_WORKER_AFFINITY, 0);
+        return NULL;
+    }
+    return "value must be On or Off";
+}
+
+static const char *h2_conf_set_worker_scaling(cmd_parms *cmd,
+                                              void *dirconf, const char *value)
+{
+    if (!strcasecmp(value, "On")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_WORKER_SCALING, 1);
+        return NULL;
+    }
+    else if (!strcasecmp(value, "Off")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_WORKER_SCALING, 0);
+        return NULL;
+    }
+    return "value must be On or Off";
+}
+
+static const char *h2_conf_set_upload_spool(cmd_parms *cmd, void *dirconf, 
+                                            const char *mem, const char *max)
+{
+    apr_off_t val;
+    
+    if (apr_strtoff(&val, mem, NULL, 10) != APR_SUCCESS || val < 0) {
+        return "size must be a number >= 0";
+    }
+    CONFIG_CMD_SET64(cmd, dirconf, H2_CONF_UPLOAD_SPOOL, val);
+    if (max) {
+        if (apr_strtoff(&val, max, NULL, 10) != APR_SUCCESS || val <= 0) {
+            return "spool limit must be a number > 0";
+        }
+        CONFIG_CMD_SET64(cmd, dirconf, H2_CONF_UPLOAD_SPOOL_MAX, val);
+    }
+    return NULL;
+}
+
+static const h2_hpack_policy hpack_policies[] = {
+    H2_HPACK_INDEX, H2_HPACK_NEVER
+};
+
+static const char *h2_conf_add_hpack_policy(cmd_parms *cmd, void *dirconf,
+                                            const char *policy, 
+                                            const char *name)
+{
+    h2_config *cfg = h2_config_sget(cmd->server);
+    const h2_hpack_policy *ppolicy;
+    char *lname;
+    
+    (void)dirconf;
+    if (!strcasecmp(policy, "index")) {
+        ppolicy = &hpack_policies[H2_HPACK_INDEX];
+    }
+    else if (!strcasecmp(policy, "never") || !strcasecmp(policy, "literal")) {
+        ppolicy = &hpack_policies[H2_HPACK_NEVER];
+    }
+    else {
+        return "policy must be one of 'index', 'literal' or 'never'";
+    }
+    if (!cfg->hpack_policy) {
+        cfg->hpack_policy = apr_hash_make(cmd->pool);
+    }
+    lname = apr_pstrdup(cmd->pool, name);
+    ap_str_tolower(lname);
+    apr_hash_set(cfg->hpack_policy, lname, APR_HASH_KEY_STRING, ppolicy);
+    return NULL;
+}
+
+static const char *h2_conf_set_hpack_table_size(cmd_parms *cmd,
+                                                void *dirconf, const char *value)
+{
+    int val = (int)apr_atoi64(value);
+    if (val < 0) {
+        return "value must be >= 0";
+    }
+    CONFIG_CMD_SET(cmd, dirconf, H2_CONF_HPACK_TABLE_SIZE, val);
+    return NULL;
+}
+
+static const char *h2_conf_set_beam_mem_budget(cmd_parms *cmd,
+                                               void *dirconf, const char *value)
+{
+    apr_off_t val;
+    
+    if (apr_strtoff(&val, value, NULL, 10) != APR_SUCCESS || val < 0) {
+        return "value must be a number >= 0";
+    }
+    if (val > 0 && val < 1024 * 1024) {
+        return "value must be 0 or >= 1048576";
+    }
+    CONFIG_CMD_SET64(cmd, dirconf, H2_CONF_BEAM_MEM_BUDGET, val);
+    return NULL;
+}
+
+static const char *h2_conf_set_ext_priorities(cmd_parms *cmd,
+                                              void *dirconf, const char *value)
+{
+    if (!strcasecmp(value, "On")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_EXT_PRIORITIES, 1);
+        return NULL;
+    }
+    else if (!strcasecmp(value, "Off")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_EXT_PRIORITIES, 0);
+        return NULL;
+    }
+    return "value must be On or Off";
+}
+
 
 void h2_get_num_workers(server_rec *s, int *minw, int *maxw)
 {
@@ -973,10 +1655,58 @@ const command_rec h2_cmds[] = {
                   OR_FILEINFO, "on to perform copy of file data"),
     AP_INIT_TAKE123("H2PushResource", h2_conf_add_push_res, NULL,
                    OR_FILEINFO|OR_AUTHCFG, "add a resource to be pushed in this location/on this server."),
+    AP_INIT_TAKE1("H2PushDiaryCache", h2_conf_set_push_diary_cache, NULL,
+                  RSRC_CONF, "socache provider[:args] sharing push diaries between connections, or 'none'"),
+    AP_INIT_TAKE12("H2PushDiaryKey", h2_conf_set_push_diary_key, NULL,
+                  RSRC_CONF, "how to identify clients in the shared push diary cache"),
     AP_INIT_TAKE1("H2EarlyHints", h2_conf_set_early_hints, NULL,
                   RSRC_CONF, "on to enable interim status 103 responses"),
     AP_INIT_TAKE1("H2Padding", h2_conf_set_padding, NULL,
                   RSRC_CONF, "set payload padding"),
+    AP_INIT_TAKE1("H2WorkerStealing", h2_conf_set_worker_stealing, NULL,
+                  RSRC_CONF, "on to give each worker its own queue and steal work from siblings"),
+    AP_INIT_TAKE1("H2SlavePoolSize", h2_conf_set_slave_pool_size, NULL,
+                  RSRC_CONF, "number of slave connection pools kept for reuse per child process"),
+    AP_INIT_TAKE1("H2TLSAdaptiveSize", h2_conf_set_tls_adaptive_size, NULL,
+                  RSRC_CONF, "on to size TLS writes after the TCP congestion window and RTT"),
+    AP_INIT_TAKE1("H2AsyncSuspend", h2_conf_set_async_suspend, NULL,
+                  RSRC_CONF, "on to suspend connections waiting on responses in async MPMs"),
+    AP_INIT_TAKE1("H2WorkerLimiter", h2_conf_set_worker_limiter, NULL,
+                  RSRC_CONF, "how the number of workers per connection adapts: steps, aimd or drain"),
+    AP_INIT_TAKE1("H2WorkerWeight", h2_conf_set_worker_weight, NULL,
+                  RSRC_CONF, "share of worker time a connection gets relative to others, 1-100"),
+    AP_INIT_TAKE1("H2EarlyDispatch", h2_conf_set_early_dispatch, NULL,
+                  RSRC_CONF, "on to start requests as soon as their headers have been read"),
+    AP_INIT_TAKE1("H2WindowAutotune", h2_conf_set_win_autotune, NULL,
+                  RSRC_CONF, "on to grow stream receive windows for fast consumers"),
+    AP_INIT_TAKE1("H2WindowBudget", h2_conf_set_win_budget, NULL,
+                  RSRC_CONF, "maximum bytes of all stream receive windows of a connection, when autotuned"),
+    AP_INIT_TAKE1("H2ResponseCache", h2_conf_set_response_cache, NULL,
+                  RSRC_CONF|OR_AUTHCFG, "on to answer requests from the per child response cache"),
+    AP_INIT_FLAG("H2Inline", h2_conf_set_inline, NULL,
+                  ACCESS_CONF, "on to process requests for this location on the main connection, without a worker"),
+    AP_INIT_TAKE12("H2ResponseCacheSize", h2_conf_set_response_cache_size, NULL,
+                  RSRC_CONF, "total bytes of the per child response cache [and maximum body size of a cached response]"),
+    AP_INIT_TAKE1("H2FileCacheSize", h2_conf_set_file_cache_size, NULL,
+                  RSRC_CONF, "number of static files per child whose open descriptor is shared by all responses, h2c and kTLS connections no longer use sendfile for them"),
+    AP_INIT_TAKE1("H2DirectSend", h2_conf_set_direct_send, NULL,
+                  RSRC_CONF, "on to write cleartext h2 output directly to the socket when no other output filters are installed"),
+    AP_INIT_TAKE12("H2FlushDelay", h2_conf_set_flush_delay, NULL,
+                  RSRC_CONF, "microseconds [and bytes] that control frames may wait for more output before being flushed"),
+    AP_INIT_TAKE1("H2WorkerAffinity", h2_conf_set_worker_affinity, NULL,
+                  RSRC_CONF, "on to run h2 workers on the NUMA node of the connection they work for"),
+    AP_INIT_TAKE1("H2WorkerScaling", h2_conf_set_worker_scaling, NULL,
+                  RSRC_CONF, "on to start H2MinWorkers and grow or shrink with the load"),
+    AP_INIT_TAKE12("H2UploadSpool", h2_conf_set_upload_spool, NULL,
+                  RSRC_CONF, "request body bytes [and limit of bytes per connection] to buffer before a request is started"),
+    AP_INIT_ITERATE2("H2HpackIndex", h2_conf_add_hpack_policy, NULL,
+                  RSRC_CONF, "'index', 'literal' or 'never' and the response header names to encode so"),
+    AP_INIT_TAKE1("H2HpackTableSize", h2_conf_set_hpack_table_size, NULL,
+                  RSRC_CONF, "maximum size of the HPACK table for response headers"),
+    AP_INIT_TAKE1("H2BeamMemBudget", h2_conf_set_beam_mem_budget, NULL,
+                  RSRC_CONF, "maximum number of bytes buffered in memory for all streams of a child process"),
+    AP_INIT_TAKE1("H2ExtensiblePriorities", h2_conf_set_ext_priorities, NULL,
+                  RSRC_CONF, "on to schedule streams by RFC 9218 priorities"),
     AP_END_CMD
 };
 
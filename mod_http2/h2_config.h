@@ -44,8 +44,41 @@ typedef enum {
     H2_CONF_EARLY_HINTS,
     H2_CONF_PADDING_BITS,
     H2_CONF_PADDING_ALWAYS,
+    H2_CONF_WORKER_STEALING,
+    H2_CONF_SLAVE_POOL_SIZE,
+    H2_CONF_TLS_ADAPTIVE_SIZE,
+    H2_CONF_ASYNC_SUSPEND,
+    H2_CONF_WORKER_LIMITER,
+    H2_CONF_WORKER_WEIGHT,
+    H2_CONF_EARLY_DISPATCH,
+    H2_CONF_WIN_AUTOTUNE,
+    H2_CONF_WIN_BUDGET,
+    H2_CONF_RESPONSE_CACHE,
+    H2_CONF_DIRECT_SEND,
+    H2_CONF_FLUSH_DELAY,
+    H2_CONF_FLUSH_BATCH,
+    H2_CONF_WORKER_AFFINITY,
+    H2_CONF_WORKER_SCALING,
+    H2_CONF_UPLOAD_SPOOL,
+    H2_CONF_UPLOAD_SPOOL_MAX,
+    H2_CONF_HPACK_TABLE_SIZE,
+    H2_CONF_BEAM_MEM_BUDGET,
+    H2_CONF_EXT_PRIORITIES,
+    H2_CONF_COUNT           /* number of variables, keep last */
 } h2_config_var_t;
 
+/**
+ * All server variables of a host, resolved against the defaults once at
+ * post config. Immutable afterwards, so sessions and multiplexers keep
+ * a pointer and read values without further lookups.
+ */
+typedef struct h2_config_values {
+    apr_int64_t val[H2_CONF_COUNT];
+} h2_config_values;
+
+#define H2_CONF_VAL(vals, var)      ((int)(vals)->val[var])
+#define H2_CONF_VAL64(vals, var)    ((vals)->val[var])
+
 struct apr_hash_t;
 struct h2_priority;
 struct h2_push_res;
@@ -53,6 +86,7 @@ struct h2_push_res;
 typedef struct h2_push_res {
     const char *uri_ref;
     int critical;
+    const char *link;   /* Link header value announcing the resource */
 } h2_push_res;
 
 
@@ -86,9 +120,41 @@ apr_int64_t h2_config_sgeti64(server_rec *s, h2_config_var_t var);
 int h2_config_rgeti(request_rec *r, h2_config_var_t var);
 apr_int64_t h2_config_rgeti64(request_rec *r, h2_config_var_t var);
 
+/**
+ * Resolve the variables of all servers, see h2_config_svalues().
+ */
+apr_status_t h2_config_post_config(apr_pool_t *pool, server_rec *s);
+
+/**
+ * The resolved variables of a server. Directory settings are not part 
+ * of these, request based lookups still need h2_config_rgeti().
+ */
+const h2_config_values *h2_config_svalues(server_rec *s);
+
 apr_array_header_t *h2_config_push_list(request_rec *r);
 apr_array_header_t *h2_config_alt_svcs(request_rec *r);
 
+/* How H2HpackIndex wants a response header encoded. nghttp2 has one flag
+ * for literals, 'literal' and 'never' both end up never indexed. */
+typedef enum {
+    H2_HPACK_INDEX,             /* the encoder decides, as by default */
+    H2_HPACK_NEVER,             /* never put into the dynamic table */
+} h2_hpack_policy;
+
+/**
+ * @return the map of lowercase header names to const h2_hpack_policy* 
+ *         from H2HpackIndex, or NULL if there are none
+ */
+struct apr_hash_t *h2_config_shpack_policy(server_rec *s);
+
+/**
+ * @return != 0 iff H2Inline is on for the <Location> the path falls into
+ */
+int h2_config_sinline(server_rec *s, const char *path);
+
+/* H2PushDiaryKey as "tls-session", "cookie:<name>", "header:<name>" or NULL */
+const char *h2_config_push_diary_key(server_rec *s);
+
 
 void h2_get_num_workers(server_rec *s, int *minw, int *maxw);
 void h2_config_init(apr_pool_t *pool);
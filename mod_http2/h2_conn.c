@@ -15,7 +15,10 @@
  */
  
 #include <assert.h>
+#include <apr_atomic.h>
+#include <apr_poll.h>
 #include <apr_strings.h>
+#include <apr_thread_mutex.h>
 
 #include <ap_mpm.h>
 #include <ap_mmn.h>
@@ -32,6 +35,7 @@
 
 #include "h2_private.h"
 #include "h2.h"
+#include "h2_bucket_beam.h"
 #include "h2_config.h"
 #include "h2_ctx.h"
 #include "h2_filter.h"
@@ -50,8 +54,24 @@ static h2_mpm_type_t mpm_type = H2_MPM_UNKNOWN;
 static module *mpm_module;
 static int async_mpm;
 static int mpm_supported = 1;
+static int mpm_can_poll;
 static apr_socket_t *dummy_socket;
 
+/* Process wide cache of cleared slave connection pools, each with its own
+ * allocator. All h2 connections of the child borrow from it when they
+ * need a new slave and give the pool back when the slave is destroyed.
+ */
+typedef struct {
+    apr_pool_t *pool;          /* parent of all pools in the cache */
+    apr_thread_mutex_t *lock;
+    apr_array_header_t *spares;
+    int max_spares;
+    volatile apr_uint32_t hits;
+    volatile apr_uint32_t misses;
+} h2_slave_pool;
+
+static h2_slave_pool *slave_pool;
+
 static void check_modules(int force) 
 {
     static int checked = 0;
@@ -108,12 +128,108 @@ static void check_modules(int force)
     }
 }
 
+static apr_status_t slave_pool_init(apr_pool_t *pchild, int max_spares, 
+                                    int max_workers)
+{
+    apr_allocator_t *allocator;
+    apr_thread_mutex_t *mutex;
+    apr_pool_t *pool;
+    apr_status_t status;
+    
+    if (max_spares < 0) {
+        /* enough to keep every worker busy with a recycled pool */
+        max_spares = 2 * max_workers;
+    }
+    if (max_spares == 0) {
+        return APR_SUCCESS;
+    }
+    
+    /* Slave pools are created and destroyed in many threads, the 
+     * parent needs its own, synchronized allocator for this. */
+    status = apr_allocator_create(&allocator);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+    apr_allocator_max_free_set(allocator, ap_max_mem_free);
+    status = apr_pool_create_ex(&pool, pchild, NULL, allocator);
+    if (status != APR_SUCCESS) {
+        apr_allocator_destroy(allocator);
+        return status;
+    }
+    apr_allocator_owner_set(allocator, pool);
+    apr_pool_tag(pool, "h2_slave_pool");
+    
+    status = apr_thread_mutex_create(&mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+    if (status != APR_SUCCESS) {
+        apr_pool_destroy(pool);
+        return status;
+    }
+    apr_allocator_mutex_set(allocator, mutex);
+
+    slave_pool = apr_pcalloc(pool, sizeof(*slave_pool));
+    slave_pool->pool = pool;
+    slave_pool->lock = mutex;
+    slave_pool->max_spares = max_spares;
+    slave_pool->spares = apr_array_make(pool, max_spares, sizeof(apr_pool_t*));
+    return APR_SUCCESS;
+}
+
+static apr_pool_t *slave_pool_get(void)
+{
+    apr_pool_t *pool = NULL;
+    
+    if (slave_pool) {
+        apr_thread_mutex_lock(slave_pool->lock);
+        if (slave_pool->spares->nelts > 0) {
+            pool = *(apr_pool_t **)apr_array_pop(slave_pool->spares);
+        }
+        apr_thread_mutex_unlock(slave_pool->lock);
+        apr_atomic_inc32(pool? &slave_pool->hits : &slave_pool->misses);
+    }
+    return pool;
+}
+
+static int slave_pool_put(apr_pool_t *pool)
+{
+    int cached = 0;
+    
+    if (slave_pool && apr_pool_parent_get(pool) == slave_pool->pool) {
+        /* Clear outside the lock, this runs all cleanups of the slave
+         * and may take its time. The allocator stays with the pool. */
+        apr_pool_clear(pool);
+        apr_thread_mutex_lock(slave_pool->lock);
+        if (slave_pool->spares->nelts < slave_pool->max_spares) {
+            APR_ARRAY_PUSH(slave_pool->spares, apr_pool_t*) = pool;
+            cached = 1;
+        }
+        apr_thread_mutex_unlock(slave_pool->lock);
+    }
+    return cached;
+}
+
+void h2_slave_pool_stats(apr_uint32_t *phits, apr_uint32_t *pmisses, 
+                         int *pspares)
+{
+    *phits = *pmisses = 0;
+    *pspares = 0;
+    if (slave_pool) {
+        *phits = apr_atomic_read32(&slave_pool->hits);
+        *pmisses = apr_atomic_read32(&slave_pool->misses);
+        apr_thread_mutex_lock(slave_pool->lock);
+        *pspares = slave_pool->spares->nelts;
+        apr_thread_mutex_unlock(slave_pool->lock);
+    }
+}
+
 apr_status_t h2_conn_child_init(apr_pool_t *pool, server_rec *s)
 {
     apr_status_t status = APR_SUCCESS;
     int minw, maxw;
     int max_threads_per_child = 0;
     int idle_secs = 0;
+    int stealing;
+    int affinity;
+    int scaling;
 
     check_modules(1);
     ap_mpm_query(AP_MPMQ_MAX_THREADS, &max_threads_per_child);
@@ -124,16 +240,50 @@ apr_status_t h2_conn_child_init(apr_pool_t *pool, server_rec *s)
         async_mpm = 0;
         status = APR_SUCCESS;
     }
+#ifdef AP_MPMQ_CAN_POLL
+    if (!async_mpm || ap_mpm_query(AP_MPMQ_CAN_POLL, &mpm_can_poll) != APR_SUCCESS) {
+        mpm_can_poll = 0;
+    }
+#endif
 
     h2_config_init(pool);
     
     h2_get_num_workers(s, &minw, &maxw);
     
     idle_secs = h2_config_sgeti(s, H2_CONF_MAX_WORKER_IDLE_SECS);
+    stealing = h2_config_sgeti(s, H2_CONF_WORKER_STEALING);
+    affinity = h2_config_sgeti(s, H2_CONF_WORKER_AFFINITY);
+    scaling = h2_config_sgeti(s, H2_CONF_WORKER_SCALING);
     ap_log_error(APLOG_MARK, APLOG_TRACE3, 0, s,
-                 "h2_workers: min=%d max=%d, mthrpchild=%d, idle_secs=%d", 
-                 minw, maxw, max_threads_per_child, idle_secs);
-    workers = h2_workers_create(s, pool, minw, maxw, idle_secs);
+                 "h2_workers: min=%d max=%d, mthrpchild=%d, idle_secs=%d, "
+                 "stealing=%d, affinity=%d, scaling=%d", minw, maxw, 
+                 max_threads_per_child, idle_secs, stealing, affinity, scaling);
+    workers = h2_workers_create(s, pool, minw, maxw, idle_secs, stealing,
+                                affinity, scaling);
+    
+    status = slave_pool_init(pool, h2_config_sgeti(s, H2_CONF_SLAVE_POOL_SIZE),
+                             maxw);
+    if (status != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, status, s,
+                     "h2_conn: slave pool cache not available");
+        status = APR_SUCCESS;
+    }
+    
+    /* every worker may keep a stream's worth of data in a beam */
+    status = h2_beam_chunks_init(pool, (apr_size_t)maxw 
+                                 * h2_config_sgeti(s, H2_CONF_STREAM_MAX_MEM));
+    if (status != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, status, s,
+                     "h2_conn: beam transfer chunks not available");
+        status = APR_SUCCESS;
+    }
+    status = h2_beam_budget_init(pool, (apr_size_t)h2_config_sgeti64(
+                                 s, H2_CONF_BEAM_MEM_BUDGET));
+    if (status != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, status, s,
+                     "h2_conn: beam memory budget not available");
+        status = APR_SUCCESS;
+    }
  
     ap_register_input_filter("H2_IN", h2_filter_core_input,
                              NULL, AP_FTYPE_CONNECTION);
@@ -187,19 +337,100 @@ apr_status_t h2_conn_setup(conn_rec *c, request_rec *r, server_rec *s)
     if (APR_SUCCESS == (status = h2_session_create(&session, c, r, s, workers))) {
         ctx = h2_ctx_get(c, 1);
         h2_ctx_session_set(ctx, session);
+        /* suspending needs MPM support and is not for h2c upgrades */
+        session->async_suspend = (session->async_suspend && mpm_can_poll
+                                  && !r && c->cs);
     }
     
     return status;
 }
 
+#ifdef AP_MPMQ_CAN_POLL
+static void resume_session(void *baton)
+{
+    h2_session *session = baton;
+    conn_rec *c = session->c;
+    
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, c,
+                  H2_SSSN_MSG(session, "resume"));
+    /* the MPM is done with our pfds, release what it allocated for them */
+    apr_pool_clear(session->suspend_pool);
+    h2_mplx_resume(session->mplx);
+    /* look at what woke us before waiting again */
+    session->wait_us = 0;
+    h2_conn_run(c);
+    if (c->cs->state != CONN_STATE_SUSPENDED) {
+        /* done waiting on streams, the MPM takes over again */
+        ap_mpm_resume_suspended(c);
+    }
+}
+
+static apr_status_t suspend_session(h2_session *session)
+{
+    conn_rec *c = session->c;
+    apr_pollfd_t *pfd;
+    apr_file_t *notify;
+    apr_status_t status;
+    
+    status = h2_mplx_suspend(session->mplx, &notify);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+    if (!session->suspend_pfds) {
+        status = apr_pool_create(&session->suspend_pool, session->pool);
+        if (status != APR_SUCCESS) {
+            h2_mplx_resume(session->mplx);
+            return status;
+        }
+        apr_pool_tag(session->suspend_pool, "h2_suspend");
+        session->suspend_pfds = apr_array_make(session->pool, 2, 
+                                               sizeof(apr_pollfd_t));
+        pfd = apr_array_push(session->suspend_pfds);
+        memset(pfd, 0, sizeof(*pfd));
+        pfd->p = session->pool;
+        pfd->desc_type = APR_POLL_SOCKET;
+        pfd->reqevents = APR_POLLIN;
+        pfd->desc.s = ap_get_conn_socket(c);
+        
+        pfd = apr_array_push(session->suspend_pfds);
+        memset(pfd, 0, sizeof(*pfd));
+        pfd->p = session->pool;
+        pfd->desc_type = APR_POLL_FILE;
+        pfd->reqevents = APR_POLLIN;
+        pfd->desc.f = notify;
+    }
+    /* whatever comes first, client data, stream events or the timeout,
+     * we want to process the session again. */
+    status = ap_mpm_register_poll_callback_timeout(session->suspend_pool, 
+                                                   session->suspend_pfds,
+                                                   resume_session, 
+                                                   resume_session, 
+                                                   session, session->s->timeout);
+    if (status != APR_SUCCESS) {
+        apr_pool_clear(session->suspend_pool);
+        h2_mplx_resume(session->mplx);
+        return status;
+    }
+    c->cs->state = CONN_STATE_SUSPENDED;
+    return APR_SUCCESS;
+}
+#else
+static apr_status_t suspend_session(h2_session *session)
+{
+    (void)session;
+    return APR_ENOTIMPL;
+}
+#endif
+
 apr_status_t h2_conn_run(conn_rec *c)
 {
     apr_status_t status;
-    int mpm_state = 0;
+    int mpm_state = 0, retry;
     h2_session *session = h2_ctx_get_session(c);
     
     ap_assert(session);
     do {
+        retry = 0;
         if (c->cs) {
             c->cs->sense = CONN_SENSE_DEFAULT;
             c->cs->state = CONN_STATE_HANDLER;
@@ -207,6 +438,25 @@ apr_status_t h2_conn_run(conn_rec *c)
     
         status = h2_session_process(session, async_mpm);
         
+        if (session->want_suspend) {
+            session->want_suspend = 0;
+            status = suspend_session(session);
+            if (status == APR_SUCCESS) {
+                ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, c, 
+                              H2_SSSN_MSG(session, "suspended"));
+                return APR_SUCCESS;
+            }
+            else if (!APR_STATUS_IS_EAGAIN(status)) {
+                ap_log_cerror(APLOG_MARK, APLOG_DEBUG, status, c, 
+                              H2_SSSN_MSG(session, "suspend failed"));
+                session->async_suspend = 0;
+            }
+            /* go on processing the streams */
+            session->wait_us = 0;
+            retry = 1;
+            continue;
+        }
+        
         if (APR_STATUS_IS_EOF(status)) {
             ap_log_cerror(APLOG_MARK, APLOG_DEBUG, status, c, 
                           H2_SSSN_LOG(APLOGNO(03045), session, 
@@ -220,9 +470,9 @@ apr_status_t h2_conn_run(conn_rec *c)
         if (ap_mpm_query(AP_MPMQ_MPM_STATE, &mpm_state)) {
             break;
         }
-    } while (!async_mpm
+    } while (retry || (!async_mpm
              && c->keepalive == AP_CONN_KEEPALIVE 
-             && mpm_state != AP_MPMQ_STOPPING);
+             && mpm_state != AP_MPMQ_STOPPING));
 
     if (c->cs) {
         switch (session->state) {
@@ -280,17 +530,24 @@ conn_rec *h2_slave_create(conn_rec *master, int slave_id, apr_pool_t *parent)
      * independant of its parent pool in the sense that it can work in
      * another thread. Also, the new allocator needs its own mutex to
      * synchronize sub-pools.
+     * When the process wide slave pool is enabled, we recycle a cleared
+     * pool (and allocator) from there or create a new one as its child,
+     * so that it may be cached on destruction.
      */
-    apr_allocator_create(&allocator);
-    apr_allocator_max_free_set(allocator, ap_max_mem_free);
-    status = apr_pool_create_ex(&pool, parent, NULL, allocator);
-    if (status != APR_SUCCESS) {
-        ap_log_cerror(APLOG_MARK, APLOG_ERR, status, master, 
-                      APLOGNO(10004) "h2_session(%ld-%d): create slave pool",
-                      master->id, slave_id);
-        return NULL;
+    pool = slave_pool_get();
+    if (!pool) {
+        apr_allocator_create(&allocator);
+        apr_allocator_max_free_set(allocator, ap_max_mem_free);
+        status = apr_pool_create_ex(&pool, slave_pool? slave_pool->pool : parent, 
+                                    NULL, allocator);
+        if (status != APR_SUCCESS) {
+            ap_log_cerror(APLOG_MARK, APLOG_ERR, status, master, 
+                          APLOGNO(10004) "h2_session(%ld-%d): create slave pool",
+                          master->id, slave_id);
+            return NULL;
+        }
+        apr_allocator_owner_set(allocator, pool);
     }
-    apr_allocator_owner_set(allocator, pool);
     apr_pool_abort_set(abort_on_oom, pool);
     apr_pool_tag(pool, "h2_slave_conn");
 
@@ -354,7 +611,9 @@ void h2_slave_destroy(conn_rec *slave)
     ap_log_cerror(APLOG_MARK, APLOG_TRACE3, 0, slave,
                   "h2_slave(%s): destroy", slave->log_id);
     slave->sbh = NULL;
-    apr_pool_destroy(slave->pool);
+    if (!slave_pool_put(slave->pool)) {
+        apr_pool_destroy(slave->pool);
+    }
 }
 
 apr_status_t h2_slave_run_pre_connection(conn_rec *slave, apr_socket_t *csd)
@@ -71,6 +71,14 @@ int h2_mpm_supported(void);
 conn_rec *h2_slave_create(conn_rec *master, int slave_id, apr_pool_t *parent);
 void h2_slave_destroy(conn_rec *slave);
 
+/**
+ * Get the statistics of the process wide slave pool cache: the number of
+ * slave pools recycled from it, the number of pools newly created, and the
+ * number of pools currently waiting for reuse. All 0 when disabled.
+ */
+void h2_slave_pool_stats(apr_uint32_t *phits, apr_uint32_t *pmisses, 
+                         int *pspares);
+
 apr_status_t h2_slave_run_pre_connection(conn_rec *slave, apr_socket_t *csd);
 void h2_slave_run_connection(conn_rec *slave);
 
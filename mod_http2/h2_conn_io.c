@@ -16,8 +16,19 @@
  
 #include <assert.h>
 #include <apr_strings.h>
+#include <apr_portable.h>
 #include <ap_mpm.h>
 
+#if APR_HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#if APR_HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+#if APR_HAVE_NETINET_TCP_H
+#include <netinet/tcp.h>
+#endif
+
 #include <httpd.h>
 #include <http_core.h>
 #include <http_log.h>
@@ -28,7 +39,10 @@
 #include "h2_bucket_eos.h"
 #include "h2_config.h"
 #include "h2_conn_io.h"
+#include "h2_fcache.h"
 #include "h2_h2.h"
+#include "h2_metrics.h"
+#include "h2_probes.h"
 #include "h2_session.h"
 #include "h2_util.h"
 
@@ -52,6 +66,26 @@
  */
 #define WRITE_SIZE_MAX        (TLS_DATA_MAX) 
 
+/* File buckets smaller than this are copied into the scratch buffer even
+ * when the connection could pass them on. A sendfile() for a few bytes
+ * costs more than the memcpy.
+ */
+#define PASS_FILE_MIN         (4 * 1024)
+
+/* With TLS done in the kernel, records are framed there and we only care
+ * about the number of writes. Chunks grow with what the socket is ready
+ * to take, up to this limit.
+ */
+#define KTLS_WRITE_SIZE_MAX   (64 * 1024)
+
+#if defined(SOL_TCP) && defined(TCP_ULP)
+#define H2_KTLS_DETECT        1
+#endif
+
+/* Number of buffers given to one apr_socket_sendv() on the direct path,
+ * below any IOV_MAX. */
+#define SENDV_MAX             64
+
 #define BUF_REMAIN            ((apr_size_t)(bmax-off))
 
 static void h2_conn_io_bb_log(conn_rec *c, int stream_id, int level, 
@@ -129,23 +163,168 @@ static void h2_conn_io_bb_log(conn_rec *c, int stream_id, int level,
 
 }
 
+static int get_socket_fd(h2_conn_io *io, apr_os_sock_t *pfd)
+{
+    apr_socket_t *s = ap_get_conn_socket(io->c);
+    return s && apr_os_sock_get(pfd, s) == APR_SUCCESS;
+}
+
+/* Is the TLS on the master connection done by the kernel? mod_ssl does
+ * not tell us, but a kTLS socket carries the "tls" upper layer protocol. */
+static int detect_ktls(h2_conn_io *io)
+{
+#ifdef H2_KTLS_DETECT
+    apr_os_sock_t fd;
+    char ulp[16];
+    socklen_t len = sizeof(ulp);
+    
+    memset(ulp, 0, sizeof(ulp));
+    if (get_socket_fd(io, &fd) 
+        && !getsockopt(fd, SOL_TCP, TCP_ULP, ulp, &len)) {
+        return !strncmp("tls", ulp, sizeof(ulp));
+    }
+#endif
+    (void)io;
+    return 0;
+}
+
+#if defined(SOL_TCP) && defined(TCP_INFO)
+#define H2_HAVE_TCP_INFO      1
+#endif
+
+/* Look at the congestion state of the master socket and remember what
+ * we saw in io. Returns != 0 if the information is available. */
+static int read_tcp_info(h2_conn_io *io)
+{
+#ifdef H2_HAVE_TCP_INFO
+    apr_os_sock_t fd;
+    struct tcp_info ti;
+    socklen_t len = sizeof(ti);
+    
+    if (get_socket_fd(io, &fd) 
+        && !getsockopt(fd, SOL_TCP, TCP_INFO, &ti, &len)) {
+        io->cwnd      = ti.tcpi_snd_cwnd;
+        io->mss       = ti.tcpi_snd_mss;
+        io->unacked   = ti.tcpi_unacked;
+        io->rtt_usecs = ti.tcpi_rtt;
+        io->rto_usecs = ti.tcpi_rto;
+        io->retrans   = ti.tcpi_total_retrans;
+        return 1;
+    }
+#endif
+    (void)io;
+    return 0;
+}
+
+static apr_size_t ktls_write_size(h2_conn_io *io)
+{
+    apr_size_t size = 0;
+#if defined(SOL_TCP) && defined(TCP_NOTSENT_LOWAT)
+    apr_os_sock_t fd;
+    int lowat = 0;
+    socklen_t len = sizeof(lowat);
+    
+    if (get_socket_fd(io, &fd)
+        && !getsockopt(fd, SOL_TCP, TCP_NOTSENT_LOWAT, &lowat, &len) 
+        && lowat > 0) {
+        /* the admin told the kernel how much unsent data to keep */
+        size = (apr_size_t)lowat;
+    }
+#endif
+    if (!size && read_tcp_info(io)) {
+        /* what the congestion window lets us send in one go */
+        size = (apr_size_t)io->cwnd * io->mss;
+    }
+    if (size < WRITE_SIZE_MAX) {
+        size = WRITE_SIZE_MAX;
+    }
+    else if (size > KTLS_WRITE_SIZE_MAX) {
+        size = KTLS_WRITE_SIZE_MAX;
+    }
+    return size;
+}
+
+/* Size TLS writes after what TCP is able to send right now. Small 
+ * records, each fitting a segment, while the congestion window is small,
+ * after idle longer than the retransmission timeout and after loss. Larger
+ * ones, up to the TLS maximum, as the window opens.
+ * Returns != 0 if the write size could be determined this way. */
+static int adapt_write_size(h2_conn_io *io)
+{
+    apr_uint32_t retrans = io->retrans;
+    apr_size_t avail, size;
+    
+    if (!read_tcp_info(io)) {
+        return 0;
+    }
+    if (io->retrans > retrans || io->idle_usecs >= io->rto_usecs) {
+        size = WRITE_SIZE_INITIAL;
+    }
+    else {
+        avail = (io->cwnd > io->unacked)? 
+                 (apr_size_t)(io->cwnd - io->unacked) * io->mss : 0;
+        /* whole segments worth of records */
+        size = (avail / WRITE_SIZE_INITIAL) * WRITE_SIZE_INITIAL;
+        if (size < WRITE_SIZE_INITIAL) {
+            size = WRITE_SIZE_INITIAL;
+        }
+        else if (size > WRITE_SIZE_MAX) {
+            size = WRITE_SIZE_MAX;
+        }
+    }
+    if (size != io->write_size) {
+        ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, io->c,
+                      "h2_conn_io(%ld): write_size %ld -> %ld, cwnd=%lu, "
+                      "unacked=%lu, rtt=%luus, retrans=%lu", io->c->id, 
+                      (long)io->write_size, (long)size, 
+                      (unsigned long)io->cwnd, (unsigned long)io->unacked, 
+                      (unsigned long)io->rtt_usecs, 
+                      (unsigned long)io->retrans);
+        io->write_size = size;
+    }
+    return 1;
+}
+
 apr_status_t h2_conn_io_init(h2_conn_io *io, conn_rec *c, server_rec *s)
 {
+    const h2_config_values *config = h2_config_svalues(s);
+    
     io->c              = c;
     io->output         = apr_brigade_create(c->pool, c->bucket_alloc);
     io->is_tls         = h2_h2_is_tls(c);
     io->buffer_output  = io->is_tls;
-    io->flush_threshold = (apr_size_t)h2_config_sgeti64(s, H2_CONF_STREAM_MAX_MEM);
+    io->is_ktls        = io->is_tls && detect_ktls(io);
+    /* Plain sockets are not buffered, all buckets go to the core output
+     * as they are. With TLS in userspace, the ssl filters need to read
+     * file buckets into memory anyway. Only kTLS connections buffer and
+     * still gain from passing files on. */
+    io->pass_files     = io->is_ktls;
+    io->flush_threshold = (apr_size_t)H2_CONF_VAL64(config, H2_CONF_STREAM_MAX_MEM);
+    io->direct_send    = !io->is_tls && H2_CONF_VAL(config, H2_CONF_DIRECT_SEND) > 0;
+    io->flush_delay    = H2_CONF_VAL(config, H2_CONF_FLUSH_DELAY);
+    io->flush_batch    = (apr_size_t)H2_CONF_VAL(config, H2_CONF_FLUSH_BATCH);
 
-    if (io->is_tls) {
+    if (io->is_ktls) {
+        /* No userspace records to fit, warmup/cooldown do not apply. */
+        io->warmup_size    = 0;
+        io->cooldown_usecs = 0;
+        io->write_size     = ktls_write_size(io);
+    }
+    else if (io->is_tls) {
         /* This is what we start with, 
          * see https://issues.apache.org/jira/browse/TS-2503 
          */
-        io->warmup_size    = h2_config_sgeti64(s, H2_CONF_TLS_WARMUP_SIZE);
-        io->cooldown_usecs = (h2_config_sgeti(s, H2_CONF_TLS_COOLDOWN_SECS) 
+        io->warmup_size    = H2_CONF_VAL64(config, H2_CONF_TLS_WARMUP_SIZE);
+        io->cooldown_usecs = (H2_CONF_VAL(config, H2_CONF_TLS_COOLDOWN_SECS) 
                               * APR_USEC_PER_SEC);
         io->write_size     = (io->cooldown_usecs > 0? 
                               WRITE_SIZE_INITIAL : WRITE_SIZE_MAX); 
+        io->adaptive_size  = H2_CONF_VAL(config, H2_CONF_TLS_ADAPTIVE_SIZE) > 0;
+        if (io->adaptive_size) {
+            /* first write after the handshake, start small */
+            io->write_size = WRITE_SIZE_INITIAL;
+            read_tcp_info(io);
+        }
     }
     else {
         io->warmup_size    = 0;
@@ -155,9 +334,12 @@ apr_status_t h2_conn_io_init(h2_conn_io *io, conn_rec *c, server_rec *s)
 
     if (APLOGctrace1(c)) {
         ap_log_cerror(APLOG_MARK, APLOG_TRACE4, 0, io->c,
-                      "h2_conn_io(%ld): init, buffering=%d, warmup_size=%ld, "
-                      "cd_secs=%f", io->c->id, io->buffer_output, 
-                      (long)io->warmup_size,
+                      "h2_conn_io(%ld): init, buffering=%d, ktls=%d, "
+                      "pass_files=%d, direct=%d, warmup_size=%ld, "
+                      "write_size=%ld, cd_secs=%f", io->c->id, 
+                      io->buffer_output, io->is_ktls, io->pass_files, 
+                      io->direct_send, (long)io->warmup_size, 
+                      (long)io->write_size,
                       ((double)io->cooldown_usecs/APR_USEC_PER_SEC));
     }
 
@@ -223,6 +405,13 @@ static apr_status_t read_to_scratch(h2_conn_io *io, apr_bucket *b)
         }
         io->slen += len;
     }
+    else if (H2_BUCKET_IS_FCACHE(b)) {
+        /* same for buckets on a cached descriptor, only without a seek */
+        status = h2_fcache_bucket_copy(b, io->scratch + io->slen);
+        if (status == APR_SUCCESS) {
+            io->slen += b->length;
+        }
+    }
     else {
         status = apr_bucket_read(b, &data, &len, APR_BLOCK_READ);
         if (status == APR_SUCCESS) {
@@ -235,7 +424,13 @@ static apr_status_t read_to_scratch(h2_conn_io *io, apr_bucket *b)
 
 static void check_write_size(h2_conn_io *io) 
 {
-    if (io->write_size > WRITE_SIZE_INITIAL 
+    if (io->is_ktls) {
+        io->write_size = ktls_write_size(io);
+    }
+    else if (io->adaptive_size && adapt_write_size(io)) {
+        /* done */
+    }
+    else if (io->write_size > WRITE_SIZE_INITIAL 
         && (io->cooldown_usecs > 0)
         && (apr_time_now() - io->last_write) >= io->cooldown_usecs) {
         /* long time not written, reset write size */
@@ -249,12 +444,104 @@ static void check_write_size(h2_conn_io *io)
     }
 }
 
+/* The direct path is only taken when the core output filter is the only
+ * one left on the connection and the brigade holds nothing but memory 
+ * buckets. Since all our output is passed with a flush, the core filter
+ * has nothing buffered that we could overtake. */
+static int can_send_direct(h2_conn_io *io, apr_bucket_brigade *bb)
+{
+    ap_filter_t *f = io->c->output_filters;
+    apr_bucket *b;
+    
+    if (!f || f->next || strcasecmp("core", f->frec->name)) {
+        return 0;
+    }
+    for (b = APR_BRIGADE_FIRST(bb); 
+         b != APR_BRIGADE_SENTINEL(bb);
+         b = APR_BUCKET_NEXT(b)) {
+        if (!APR_BUCKET_IS_METADATA(b) 
+            && (b->length == ((apr_size_t)-1) || APR_BUCKET_IS_FILE(b))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static apr_status_t sendv_all(apr_socket_t *s, struct iovec *vec, int nvec)
+{
+    apr_status_t status = APR_SUCCESS;
+    apr_size_t written;
+    
+    while (nvec > 0) {
+        written = 0;
+        status = apr_socket_sendv(s, vec, nvec, &written);
+        if (status != APR_SUCCESS && !(APR_STATUS_IS_EAGAIN(status) && written)) {
+            break;
+        }
+        status = APR_SUCCESS;
+        /* skip what has been written, a partial buffer stays at the front */
+        while (nvec > 0 && written >= vec->iov_len) {
+            written -= vec->iov_len;
+            ++vec;
+            --nvec;
+        }
+        if (nvec > 0) {
+            vec->iov_base = (char *)vec->iov_base + written;
+            vec->iov_len -= written;
+        }
+    }
+    return status;
+}
+
+/* Write all data buckets with as few writev() calls as possible. The 
+ * buckets are destroyed afterwards, in order, as the core filter would. */
+static apr_status_t send_direct(h2_conn_io *io, apr_bucket_brigade *bb)
+{
+    apr_socket_t *s = ap_get_conn_socket(io->c);
+    struct iovec vec[SENDV_MAX];
+    apr_interval_time_t timeout;
+    apr_status_t status = APR_SUCCESS;
+    apr_bucket *b;
+    const char *data;
+    apr_size_t len;
+    int nvec = 0;
+    
+    /* the core filter may have left the socket non-blocking */
+    apr_socket_timeout_get(s, &timeout);
+    apr_socket_timeout_set(s, io->c->base_server->timeout);
+    for (b = APR_BRIGADE_FIRST(bb); 
+         b != APR_BRIGADE_SENTINEL(bb) && status == APR_SUCCESS;
+         b = APR_BUCKET_NEXT(b)) {
+        if (APR_BUCKET_IS_METADATA(b) || b->length == 0) {
+            continue;
+        }
+        status = apr_bucket_read(b, &data, &len, APR_BLOCK_READ);
+        if (status == APR_SUCCESS && len > 0) {
+            vec[nvec].iov_base = (void *)data;
+            vec[nvec].iov_len = len;
+            if (++nvec == SENDV_MAX) {
+                status = sendv_all(s, vec, nvec);
+                nvec = 0;
+            }
+        }
+    }
+    if (status == APR_SUCCESS && nvec > 0) {
+        status = sendv_all(s, vec, nvec);
+    }
+    apr_socket_timeout_set(s, timeout);
+    if (status != APR_SUCCESS) {
+        io->c->aborted = 1;
+    }
+    return status;
+}
+
 static apr_status_t pass_output(h2_conn_io *io, int flush)
 {
     conn_rec *c = io->c;
     apr_bucket_brigade *bb = io->output;
     apr_bucket *b;
     apr_off_t bblen;
+    apr_time_t now;
     apr_status_t status;
     
     append_scratch(io);
@@ -271,15 +558,29 @@ static apr_status_t pass_output(h2_conn_io *io, int flush)
     apr_brigade_length(bb, 0, &bblen);
     h2_conn_io_bb_log(c, 0, APLOG_TRACE2, "out", bb);
     
-    status = ap_pass_brigade(c->output_filters, bb);
+    if (io->direct_send && can_send_direct(io, bb)) {
+        status = send_direct(io, bb);
+    }
+    else {
+        status = ap_pass_brigade(c->output_filters, bb);
+    }
     if (status == APR_SUCCESS) {
         io->bytes_written += (apr_size_t)bblen;
-        io->last_write = apr_time_now();
+        H2_METRIC_ADD(bytes_out, bblen);
+        H2_PROBE3(conn_output, c->id, bblen, flush);
+        now = apr_time_now();
+        /* the write sizing runs after this, it needs the idle time
+         * that preceded the write, not the one since */
+        io->idle_usecs = io->last_write? (now - io->last_write) : 0;
+        io->last_write = now;
         if (flush) {
             io->is_flushed = 1;
         }
     }
     apr_brigade_cleanup(bb);
+    io->pending_len = 0;
+    io->pending_data = 0;
+    io->pending_since = 0;
 
     if (status != APR_SUCCESS) {
         ap_log_cerror(APLOG_MARK, APLOG_DEBUG, status, c, APLOGNO(03044)
@@ -289,6 +590,26 @@ static apr_status_t pass_output(h2_conn_io *io, int flush)
     return status;
 }
 
+static void add_pending(h2_conn_io *io, apr_size_t len)
+{
+    if (len > 0) {
+        if (!io->pending_since && io->flush_delay > 0) {
+            io->pending_since = apr_time_now();
+        }
+        io->pending_len += len;
+    }
+}
+
+apr_status_t h2_conn_io_flush_batched(h2_conn_io *io)
+{
+    if (io->flush_delay > 0 && !io->pending_data && io->pending_since
+        && io->pending_len < io->flush_batch
+        && (apr_time_now() - io->pending_since) < io->flush_delay) {
+        return APR_SUCCESS;
+    }
+    return h2_conn_io_flush(io);
+}
+
 int h2_conn_io_needs_flush(h2_conn_io *io)
 {
     if (!io->is_flushed) {
@@ -319,6 +640,7 @@ apr_status_t h2_conn_io_write(h2_conn_io *io, const char *data, size_t length)
     
     if (length > 0) {
         io->is_flushed = 0;
+        add_pending(io, length);
     }
     
     if (io->buffer_output) {
@@ -349,7 +671,15 @@ apr_status_t h2_conn_io_pass(h2_conn_io *io, apr_bucket_brigade *bb)
     apr_status_t status = APR_SUCCESS;
     
     if (!APR_BRIGADE_EMPTY(bb)) {
+        apr_off_t len;
+        
         io->is_flushed = 0;
+        apr_brigade_length(bb, 0, &len);
+        if (len != 0) {
+            /* DATA payload, nothing to hold back */
+            io->pending_data = 1;
+            add_pending(io, (len > 0)? (apr_size_t)len : 0);
+        }
     }
 
     while (!APR_BRIGADE_EMPTY(bb) && status == APR_SUCCESS) {
@@ -362,6 +692,15 @@ apr_status_t h2_conn_io_pass(h2_conn_io *io, apr_bucket_brigade *bb)
             APR_BUCKET_REMOVE(b);
             APR_BRIGADE_INSERT_TAIL(io->output, b);
         }
+        else if (io->pass_files 
+                 && APR_BUCKET_IS_FILE(b) && b->length >= PASS_FILE_MIN) {
+            /* Let the core output send the DATA payload from the file, 
+             * only the frame header (and pad length) goes in a small 
+             * memory bucket before it. */
+            append_scratch(io);
+            APR_BUCKET_REMOVE(b);
+            APR_BRIGADE_INSERT_TAIL(io->output, b);
+        }
         else if (io->buffer_output) {
             apr_size_t remain = assure_scratch_space(io);
             if (b->length > remain) {
@@ -31,21 +31,39 @@ typedef struct {
     apr_bucket_brigade *output;
 
     int is_tls;
+    int is_ktls;                 /* TLS records are done by the kernel */
     apr_time_t cooldown_usecs;
     apr_int64_t warmup_size;
     
     apr_size_t write_size;
     apr_time_t last_write;
+    apr_interval_time_t idle_usecs; /* gap before the last write */
     apr_int64_t bytes_read;
     apr_int64_t bytes_written;
     
     int buffer_output;
     apr_size_t flush_threshold;
     unsigned int is_flushed : 1;
+    unsigned int pass_files : 1; /* kTLS: forward file buckets, no copy */
+    unsigned int direct_send : 1;/* h2c: sendv() memory output ourself */
+    unsigned int pending_data : 1; /* DATA payload waits in the output */
+    
+    apr_interval_time_t flush_delay; /* max wait of control frames */
+    apr_size_t flush_batch;      /* control frame bytes that are flushed */
+    apr_size_t pending_len;      /* bytes buffered since last flush */
+    apr_time_t pending_since;    /* when the oldest of them were written */
     
     char *scratch;
     apr_size_t ssize;
     apr_size_t slen;
+    
+    int adaptive_size;           /* write_size follows the TCP state */
+    apr_uint32_t cwnd;           /* last seen TCP_INFO of the socket */
+    apr_uint32_t mss;
+    apr_uint32_t unacked;
+    apr_uint32_t rtt_usecs;
+    apr_uint32_t rto_usecs;
+    apr_uint32_t retrans;
 } h2_conn_io;
 
 apr_status_t h2_conn_io_init(h2_conn_io *io, conn_rec *c, server_rec *s);
@@ -59,6 +77,13 @@ apr_status_t h2_conn_io_write(h2_conn_io *io,
                          const char *buf,
                          size_t length);
 
+/**
+ * Append the buckets of the brigade to the buffered output. When buffering,
+ * data is copied into TLS record sized chunks, except for file buckets
+ * on connections that pass files on. Those are forwarded unchanged, so that
+ * the core output filter can sendfile() them.
+ * @param bb the brigade to take the buckets from, will be empty afterwards
+ */
 apr_status_t h2_conn_io_pass(h2_conn_io *io, apr_bucket_brigade *bb);
 
 /**
@@ -68,6 +93,16 @@ apr_status_t h2_conn_io_pass(h2_conn_io *io, apr_bucket_brigade *bb);
  */
 apr_status_t h2_conn_io_flush(h2_conn_io *io);
 
+/**
+ * Flush like h2_conn_io_flush(), unless the buffered output only consists
+ * of control frames, e.g. WINDOW_UPDATE and SETTINGS ACK, that are fewer
+ * than the H2FlushDelay bytes and have not waited the H2FlushDelay time.
+ * Those then go out together with later frames. Callers about to wait on 
+ * the connection need to h2_conn_io_flush() instead.
+ * @param io the connection io
+ */
+apr_status_t h2_conn_io_flush_batched(h2_conn_io *io);
+
 /**
  * Check if the buffered amount of data needs flushing.
  */
@@ -0,0 +1,550 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+
+#include <apr_hash.h>
+#include <apr_strings.h>
+#include <apr_thread_mutex.h>
+
+#ifndef WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <httpd.h>
+#include <http_core.h>
+#include <http_config.h>
+#include <http_log.h>
+#include <http_protocol.h>
+#include <http_request.h>
+
+#include "h2_private.h"
+#include "h2.h"
+#include "h2_ctx.h"
+#include "h2_metrics.h"
+#include "h2_task.h"
+#include "h2_fcache.h"
+
+typedef struct fcache_entry fcache_entry;
+struct fcache_entry {
+    fcache_entry *older;
+    fcache_entry *newer;
+    int fd;
+    apr_uint32_t refs;          /* buckets using it, +1 while cached */
+    apr_ino_t inode;
+    apr_dev_t device;
+    apr_off_t size;
+    apr_time_t mtime;
+    apr_size_t plen;
+    char path[1];
+};
+
+static int cache_max;
+
+/* the cache of this child, all access is under cache_mutex */
+static apr_thread_mutex_t *cache_mutex;
+static apr_hash_t *cache_entries;
+static fcache_entry *cache_oldest;
+static fcache_entry *cache_newest;
+static int cache_count;
+
+const char *h2_fcache_configure(cmd_parms *cmd, const char *value)
+{
+    apr_int64_t n = apr_atoi64(value);
+
+    (void)cmd;
+    if (n < 0 || n > INT_MAX) {
+        return "value must be 0 (disabled) or a positive number of files";
+    }
+    cache_max = (int)n;
+    return NULL;
+}
+
+void h2_fcache_pre_config(apr_pool_t *pconf)
+{
+    (void)pconf;
+    cache_max = 0;
+}
+
+#ifndef WIN32
+
+static void entry_destroy(fcache_entry *e)
+{
+    close(e->fd);
+    H2_METRIC_SUB(fcache_fds, 1);
+    free(e);
+}
+
+static void entry_unlink(fcache_entry *e)
+{
+    if (e->older) e->older->newer = e->newer;
+    else cache_oldest = e->newer;
+    if (e->newer) e->newer->older = e->older;
+    else cache_newest = e->older;
+    e->older = e->newer = NULL;
+}
+
+static void entry_link_newest(fcache_entry *e)
+{
+    e->older = cache_newest;
+    e->newer = NULL;
+    if (cache_newest) cache_newest->newer = e;
+    else cache_oldest = e;
+    cache_newest = e;
+}
+
+/* Called with the mutex held. The descriptor stays open for the
+ * responses still using it. */
+static void entry_evict(fcache_entry *e)
+{
+    apr_hash_set(cache_entries, e->path, (apr_ssize_t)e->plen, NULL);
+    entry_unlink(e);
+    --cache_count;
+    if (--e->refs == 0) {
+        entry_destroy(e);
+    }
+}
+
+static void entry_release(fcache_entry *e)
+{
+    apr_thread_mutex_t *mutex = cache_mutex;
+
+    /* after the cache is gone, the last buckets clean up unlocked */
+    if (mutex) apr_thread_mutex_lock(mutex);
+    if (--e->refs == 0) {
+        entry_destroy(e);
+    }
+    if (mutex) apr_thread_mutex_unlock(mutex);
+}
+
+static int entry_matches(const fcache_entry *e, const apr_finfo_t *finfo)
+{
+    return (e->inode == finfo->inode && e->device == finfo->device
+            && e->size == finfo->size && e->mtime == finfo->mtime);
+}
+
+/* Open the file outside the mutex, an open on a slow file system
+ * should not hold up hits. The descriptor needs to be the file that
+ * the request's directory walk saw, it may have been replaced since. */
+static fcache_entry *entry_open(const char *path, const apr_finfo_t *finfo)
+{
+    fcache_entry *e;
+    struct stat st;
+    apr_size_t plen = strlen(path);
+    int flags = O_RDONLY;
+
+#ifdef O_CLOEXEC
+    flags |= O_CLOEXEC;
+#endif
+    e = malloc(sizeof(*e) + plen);
+    if (!e) {
+        return NULL;
+    }
+    memset(e, 0, sizeof(*e));
+    do {
+        e->fd = open(path, flags);
+    } while (e->fd < 0 && errno == EINTR);
+    if (e->fd < 0) {
+        int err = errno;
+        free(e);
+        errno = err;
+        return NULL;
+    }
+    if (fstat(e->fd, &st) < 0 || !S_ISREG(st.st_mode)
+        || (apr_ino_t)st.st_ino != finfo->inode
+        || (apr_dev_t)st.st_dev != finfo->device
+        || (apr_off_t)st.st_size != finfo->size) {
+        close(e->fd);
+        free(e);
+        errno = ESTALE;
+        return NULL;
+    }
+    H2_METRIC_INC(fcache_opens);
+    H2_METRIC_ADD(fcache_fds, 1);
+    e->inode = finfo->inode;
+    e->device = finfo->device;
+    e->size = finfo->size;
+    e->mtime = finfo->mtime;
+    e->plen = plen;
+    memcpy(e->path, path, plen + 1);
+    return e;
+}
+
+/* Get the entry for the file of the request, with a reference for
+ * the caller, or NULL with errno set if it cannot be opened. ESTALE
+ * means the file is no longer the one the directory walk saw. */
+static fcache_entry *entry_get(request_rec *r)
+{
+    fcache_entry *e, *fresh;
+    apr_ssize_t klen = (apr_ssize_t)strlen(r->filename);
+
+    apr_thread_mutex_lock(cache_mutex);
+    e = apr_hash_get(cache_entries, r->filename, klen);
+    if (e && entry_matches(e, &r->finfo)) {
+        ++e->refs;
+        entry_unlink(e);
+        entry_link_newest(e);
+        apr_thread_mutex_unlock(cache_mutex);
+        H2_METRIC_INC(fcache_hits);
+        return e;
+    }
+    apr_thread_mutex_unlock(cache_mutex);
+
+    fresh = entry_open(r->filename, &r->finfo);
+    if (!fresh) {
+        return NULL;
+    }
+
+    apr_thread_mutex_lock(cache_mutex);
+    e = apr_hash_get(cache_entries, r->filename, klen);
+    if (e && entry_matches(e, &r->finfo)) {
+        /* another thread was faster */
+        ++e->refs;
+        apr_thread_mutex_unlock(cache_mutex);
+        entry_destroy(fresh);
+        return e;
+    }
+    if (e) {
+        /* the file changed */
+        entry_evict(e);
+    }
+    fresh->refs = 2;
+    apr_hash_set(cache_entries, fresh->path, (apr_ssize_t)fresh->plen, fresh);
+    entry_link_newest(fresh);
+    ++cache_count;
+    while (cache_count > cache_max && cache_oldest) {
+        entry_evict(cache_oldest);
+    }
+    apr_thread_mutex_unlock(cache_mutex);
+    return fresh;
+}
+
+static apr_status_t entry_read(fcache_entry *e, char *buf, apr_size_t len,
+                               apr_off_t offset)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = pread(e->fd, buf, len, (off_t)offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return apr_get_os_error();
+        }
+        if (n == 0) {
+            /* truncated since we opened it */
+            return APR_EOF;
+        }
+        buf += n;
+        len -= (apr_size_t)n;
+        offset += n;
+    }
+    return APR_SUCCESS;
+}
+
+/*******************************************************************************
+ * the H2FCACHE bucket
+ ******************************************************************************/
+
+typedef struct {
+    apr_bucket_refcount refcount;
+    fcache_entry *entry;
+} h2_bucket_fcache;
+
+static apr_bucket *bucket_make(apr_bucket *b, fcache_entry *e,
+                               apr_off_t start, apr_size_t len)
+{
+    h2_bucket_fcache *h;
+
+    h = apr_bucket_alloc(sizeof(*h), b->list);
+    h->entry = e;
+
+    b = apr_bucket_shared_make(b, h, start, len);
+    b->type = &h2_bucket_type_fcache;
+    return b;
+}
+
+/* Takes over the caller's reference on the entry */
+static apr_bucket *bucket_create(apr_bucket_alloc_t *list, fcache_entry *e,
+                                 apr_off_t start, apr_size_t len)
+{
+    apr_bucket *b = apr_bucket_alloc(sizeof(*b), list);
+
+    APR_BUCKET_INIT(b);
+    b->free = apr_bucket_free;
+    b->list = list;
+    return bucket_make(b, e, start, len);
+}
+
+static void bucket_destroy(void *data)
+{
+    h2_bucket_fcache *h = data;
+
+    if (apr_bucket_shared_destroy(h)) {
+        entry_release(h->entry);
+        apr_bucket_free(h);
+    }
+}
+
+/* Like a file bucket, read at most APR_BUCKET_BUFF_SIZE into a heap
+ * bucket and leave the rest in a new bucket after it. */
+static apr_status_t bucket_read(apr_bucket *b, const char **str,
+                                apr_size_t *len, apr_read_type_e block)
+{
+    h2_bucket_fcache *h = b->data;
+    apr_size_t n = H2MIN(b->length, APR_BUCKET_BUFF_SIZE);
+    apr_status_t status;
+    char *buf;
+
+    (void)block;
+    buf = apr_bucket_alloc(n, b->list);
+    status = entry_read(h->entry, buf, n, b->start);
+    if (status != APR_SUCCESS) {
+        apr_bucket_free(buf);
+        return status;
+    }
+    if (b->length > n) {
+        apr_bucket_split(b, n);
+    }
+    bucket_destroy(h);
+    apr_bucket_heap_make(b, buf, n, apr_bucket_free);
+    *str = buf;
+    *len = n;
+    return APR_SUCCESS;
+}
+
+apr_bucket *h2_fcache_bucket_dup(const apr_bucket *src,
+                                 apr_bucket_alloc_t *list)
+{
+    h2_bucket_fcache *h = src->data;
+
+    apr_thread_mutex_t *mutex = cache_mutex;
+
+    if (mutex) apr_thread_mutex_lock(mutex);
+    ++h->entry->refs;
+    if (mutex) apr_thread_mutex_unlock(mutex);
+    return bucket_create(list, h->entry, src->start, src->length);
+}
+
+apr_status_t h2_fcache_bucket_copy(apr_bucket *b, char *buf)
+{
+    h2_bucket_fcache *h = b->data;
+    return entry_read(h->entry, buf, b->length, b->start);
+}
+
+/* The core default handler serves files for any handler name nobody
+ * else took. We only serve what it would have served on purpose. */
+static int is_default_handler(request_rec *r)
+{
+    if (!r->handler || !strcmp(AP_DEFAULT_HANDLER_NAME, r->handler)) {
+        return 1;
+    }
+    /* without a handler, the content type is taken as its name */
+    return (r->content_type
+            && !strcmp(r->handler, ap_field_noparam(r->pool, r->content_type)));
+}
+
+/* Do what the core default handler does for a GET/HEAD of a file,
+ * with the descriptor from the cache. Everything else is declined
+ * and left to it. */
+static int fcache_handler(request_rec *r)
+{
+    conn_rec *c = r->connection;
+    core_dir_config *d;
+    struct h2_task *task;
+    fcache_entry *e;
+    apr_bucket_brigade *bb;
+    apr_bucket *b;
+    int status;
+
+    if (!cache_mutex || !c->master) {
+        return DECLINED;
+    }
+    task = h2_ctx_get_task(c);
+    if (!task || task->output.copy_files) {
+        return DECLINED;
+    }
+    if (r->method_number != M_GET || !is_default_handler(r)
+        || r->finfo.filetype != APR_REG
+        || (r->finfo.valid & APR_FINFO_IDENT) != APR_FINFO_IDENT
+        || (r->path_info && *r->path_info)
+        || (apr_off_t)(apr_size_t)r->finfo.size != r->finfo.size) {
+        return DECLINED;
+    }
+    d = ap_get_core_module_config(r->per_dir_config);
+    if (d->content_md5 == AP_CONTENT_MD5_ON) {
+        return DECLINED;
+    }
+
+    if (!(e = entry_get(r))) {
+        switch (errno) {
+            case ENOENT:
+            case ENOTDIR:
+                ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, r,
+                              "h2_fcache: file vanished: %s", r->filename);
+                return HTTP_NOT_FOUND;
+            case EACCES:
+            case EPERM:
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r,
+                              "h2_fcache: file permissions deny server "
+                              "access: %s", r->filename);
+                return HTTP_FORBIDDEN;
+            default:
+                /* replaced on disk or out of resources, the core
+                 * handler opens it anew */
+                return DECLINED;
+        }
+    }
+    if ((status = ap_discard_request_body(r)) != OK) {
+        entry_release(e);
+        return status;
+    }
+
+    ap_update_mtime(r, r->finfo.mtime);
+    ap_set_last_modified(r);
+    ap_set_etag(r);
+    ap_set_accept_ranges(r);
+    ap_set_content_length(r, r->finfo.size);
+
+    bb = apr_brigade_create(r->pool, c->bucket_alloc);
+    if ((status = ap_meets_conditions(r)) != OK) {
+        entry_release(e);
+        r->status = status;
+    }
+    else if (r->finfo.size > 0) {
+        b = bucket_create(c->bucket_alloc, e, 0, (apr_size_t)r->finfo.size);
+        APR_BRIGADE_INSERT_TAIL(bb, b);
+    }
+    else {
+        entry_release(e);
+    }
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r,
+                  "h2_fcache: serving %s", r->filename);
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(c->bucket_alloc));
+    return ap_pass_brigade_fchk(r, bb, "h2_fcache: pass brigade");
+}
+
+#else /* WIN32: no pread(), no cache and no buckets */
+
+static void bucket_destroy(void *data)
+{
+    (void)data;
+}
+
+static apr_status_t bucket_read(apr_bucket *b, const char **str,
+                                apr_size_t *len, apr_read_type_e block)
+{
+    (void)b; (void)str; (void)len; (void)block;
+    return APR_ENOTIMPL;
+}
+
+apr_bucket *h2_fcache_bucket_dup(const apr_bucket *src,
+                                 apr_bucket_alloc_t *list)
+{
+    (void)src; (void)list;
+    return NULL;
+}
+
+apr_status_t h2_fcache_bucket_copy(apr_bucket *b, char *buf)
+{
+    (void)b; (void)buf;
+    return APR_ENOTIMPL;
+}
+
+#endif /* !WIN32 */
+
+const apr_bucket_type_t h2_bucket_type_fcache = {
+    "H2FCACHE", 5, APR_BUCKET_DATA,
+    bucket_destroy,
+    bucket_read,
+    apr_bucket_setaside_noop,
+    apr_bucket_shared_split,
+    apr_bucket_shared_copy
+};
+
+/*******************************************************************************
+ * cache setup and the handler
+ ******************************************************************************/
+
+#ifndef WIN32
+
+static apr_status_t cache_cleanup(void *data)
+{
+    fcache_entry *e, *next;
+
+    (void)data;
+    for (e = cache_oldest; e; e = next) {
+        next = e->newer;
+        e->older = e->newer = NULL;
+        if (--e->refs == 0) {
+            entry_destroy(e);
+        }
+    }
+    cache_oldest = cache_newest = NULL;
+    cache_entries = NULL;
+    cache_mutex = NULL;
+    cache_count = 0;
+    return APR_SUCCESS;
+}
+
+void h2_fcache_child_init(apr_pool_t *pchild, server_rec *s)
+{
+    apr_pool_t *pool;
+    apr_status_t status;
+
+    if (cache_max == 0) {
+        return;
+    }
+    apr_pool_create(&pool, pchild);
+    apr_pool_tag(pool, "h2_fcache");
+    status = apr_thread_mutex_create(&cache_mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+    if (status != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, status, s,
+                     "h2_fcache: creating mutex");
+        cache_mutex = NULL;
+        return;
+    }
+    cache_entries = apr_hash_make(pool);
+    apr_pool_cleanup_register(pool, NULL, cache_cleanup, apr_pool_cleanup_null);
+}
+
+void h2_fcache_register_hooks(void)
+{
+    /* after all content handlers, right before the core one */
+    ap_hook_handler(fcache_handler, NULL, NULL, APR_HOOK_LAST);
+}
+
+#else /* WIN32 */
+
+void h2_fcache_child_init(apr_pool_t *pchild, server_rec *s)
+{
+    (void)pchild;
+    if (cache_max > 0) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s,
+                     "h2_fcache: H2FileCacheSize is not supported on this platform");
+    }
+}
+
+void h2_fcache_register_hooks(void)
+{
+}
+
+#endif /* !WIN32 */
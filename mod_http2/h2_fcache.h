@@ -0,0 +1,83 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __mod_h2__h2_fcache__
+#define __mod_h2__h2_fcache__
+
+/**
+ * A cache of open file descriptors, one per child process. Static files
+ * requested on slave connections are opened once and their descriptor
+ * is shared by all responses for that file, on all connections of the
+ * child, until it is evicted or the file changes. Entries are found by
+ * path and checked against the inode, size and modification time that
+ * the directory walk of the request already has.
+ *
+ * Responses carry H2FCACHE buckets that read with pread(), since the
+ * file position of a shared descriptor is no use with several threads
+ * reading. They pass through h2_bucket_beam without copying and keep a
+ * reference on their entry until they are destroyed.
+ *
+ * They are no FILE buckets, so nothing downstream can sendfile() them.
+ * On TLS, h2_conn_io pread()s them into its write buffer. On h2c and
+ * kTLS connections, where FILE buckets reach the core output and are
+ * sent with sendfile(), the core reads them into memory instead.
+ */
+
+/** Data from a cached file descriptor (H2FCACHE) bucket */
+extern const apr_bucket_type_t h2_bucket_type_fcache;
+
+#define H2_BUCKET_IS_FCACHE(e)     (e->type == &h2_bucket_type_fcache)
+
+/**
+ * Configure the maximum number of cached descriptors, from
+ * "H2FileCacheSize n". 0 disables the cache.
+ * @return NULL or an error message for the directive
+ */
+const char *h2_fcache_configure(cmd_parms *cmd, const char *value);
+
+/**
+ * Forget the size of a previous configuration.
+ */
+void h2_fcache_pre_config(apr_pool_t *pconf);
+
+/**
+ * Create the (empty) cache of a new child process.
+ */
+void h2_fcache_child_init(apr_pool_t *pchild, server_rec *s);
+
+/**
+ * Register the handler serving static files from cached descriptors.
+ */
+void h2_fcache_register_hooks(void);
+
+/**
+ * Create a bucket for the same data as an H2FCACHE bucket, sharing
+ * its descriptor. This is how such buckets are beamed to another thread.
+ * @param src the H2FCACHE bucket
+ * @param list the allocator of the new bucket
+ */
+apr_bucket *h2_fcache_bucket_dup(const apr_bucket *src,
+                                 apr_bucket_alloc_t *list);
+
+/**
+ * Read all data of an H2FCACHE bucket into a buffer, without changing
+ * the bucket.
+ * @param b the H2FCACHE bucket
+ * @param buf with room for b->length bytes
+ */
+apr_status_t h2_fcache_bucket_copy(apr_bucket *b, char *buf);
+
+#endif /* defined(__mod_h2__h2_fcache__) */
@@ -26,9 +26,12 @@
 
 #include "h2_private.h"
 #include "h2.h"
+#include "h2_bucket_beam.h"
 #include "h2_config.h"
+#include "h2_conn.h"
 #include "h2_conn_io.h"
 #include "h2_ctx.h"
+#include "h2_metrics.h"
 #include "h2_mplx.h"
 #include "h2_push.h"
 #include "h2_task.h"
@@ -72,6 +75,7 @@ static apr_status_t recv_RAW_DATA(conn_rec *c, h2_filter_cin *cin,
         }
         else {
             session->io.bytes_read += n;
+            H2_METRIC_ADD(bytes_in, n);
             if ((apr_ssize_t)len <= n) {
                 break;
             }
@@ -346,6 +350,7 @@ static int add_stream(h2_stream *stream, void *ctx)
 {
     stream_ctx_t *x = ctx;
     int32_t flowIn, flowOut;
+    h2_stream_timing t;
     
     flowIn = nghttp2_session_get_stream_effective_local_window_size(x->s->ngh2, stream->id); 
     flowOut = nghttp2_session_get_stream_remote_window_size(x->s->ngh2, stream->id);
@@ -355,7 +360,15 @@ static int add_stream(h2_stream *stream, void *ctx)
     bbout(x->bb, "    \"flowIn\": %d,\n", flowIn);
     bbout(x->bb, "    \"flowOut\": %d,\n", flowOut);
     bbout(x->bb, "    \"dataIn\": %"APR_OFF_T_FMT",\n", stream->in_data_octets);  
-    bbout(x->bb, "    \"dataOut\": %"APR_OFF_T_FMT"\n", stream->out_data_octets);  
+    bbout(x->bb, "    \"dataOut\": %"APR_OFF_T_FMT",\n", stream->out_data_octets);  
+    h2_stream_get_timing(stream, &t);
+    bbout(x->bb, "    \"timing\": {\n");
+    bbout(x->bb, "      \"task\": %ld,\n", (long)h2_stream_timing_since(&t, t.task_created));
+    bbout(x->bb, "      \"worker\": %ld,\n", (long)h2_stream_timing_since(&t, t.worker_started));
+    bbout(x->bb, "      \"firstOut\": %ld,\n", (long)h2_stream_timing_since(&t, t.first_out));
+    bbout(x->bb, "      \"firstData\": %ld,\n", (long)h2_stream_timing_since(&t, t.first_data));
+    bbout(x->bb, "      \"closed\": %ld\n", (long)h2_stream_timing_since(&t, t.closed));
+    bbout(x->bb, "    }\n");
     bbout(x->bb, "    }");
     
     ++x->idx;
@@ -374,6 +387,26 @@ static void add_streams(apr_bucket_brigade *bb, h2_session *s, int last)
     bbout(bb, "\n  }%s\n", last? "" : ",");
 }
 
+static void add_frames(apr_bucket_brigade *bb, h2_session *s, int last) 
+{
+    static const char *dirs[] = { "recv", "sent", "invalid" };
+    h2_frame_rec recs[H2_FRAME_REC_N];
+    apr_time_t now = apr_time_now();
+    int i, n;
+    
+    n = h2_session_frames_get(s, recs);
+    bbout(bb, "  \"frames\": [");
+    for (i = 0; i < n; ++i) {
+        bbout(bb, "%s\n    { \"dir\": \"%s\", \"type\": \"%s\", "
+              "\"stream\": %d, \"length\": %lu, \"flags\": %d, "
+              "\"usAgo\": %ld }", i? "," : "", dirs[recs[i].dir], 
+              h2_util_frame_type_str(recs[i].type), (int)recs[i].stream_id, 
+              (unsigned long)recs[i].length, recs[i].flags, 
+              (long)(now - recs[i].at));
+    }
+    bbout(bb, "\n  ]%s\n", last? "" : ",");
+}
+
 static void add_push(apr_bucket_brigade *bb, h2_session *s, 
                      h2_stream *stream, int last) 
 {
@@ -420,13 +453,102 @@ static void add_out(apr_bucket_brigade *bb, h2_session *s, int last)
     bbout(bb, "    }%s\n", last? "" : ",");
 }
 
+static void add_io(apr_bucket_brigade *bb, h2_session *s, int last) 
+{
+    bbout(bb, "    \"io\": {\n");
+    bbout(bb, "      \"writeSize\": %ld,\n", (long)s->io.write_size);
+    bbout(bb, "      \"adaptive\": %d,\n", s->io.adaptive_size);
+    bbout(bb, "      \"cwnd\": %lu,\n", (unsigned long)s->io.cwnd);
+    bbout(bb, "      \"rtt\": %lu\n", (unsigned long)s->io.rtt_usecs);
+    bbout(bb, "    }%s\n", last? "" : ",");
+}
+
+static void add_slave_pool(apr_bucket_brigade *bb, int last) 
+{
+    apr_uint32_t hits, misses;
+    int spares;
+    
+    h2_slave_pool_stats(&hits, &misses, &spares);
+    bbout(bb, "    \"slavePool\": {\n");
+    bbout(bb, "      \"hits\": %lu,\n", (unsigned long)hits);
+    bbout(bb, "      \"misses\": %lu,\n", (unsigned long)misses);
+    bbout(bb, "      \"spare\": %d\n", spares);
+    bbout(bb, "    }%s\n", last? "" : ",");
+}
+
+static void add_workers(apr_bucket_brigade *bb, h2_session *s, int last) 
+{
+    static const char *limiters[] = { "steps", "aimd", "drain" };
+    h2_mplx_limit_info info;
+    apr_time_t now = apr_time_now();
+    apr_interval_time_t wait_sum, wait_max;
+    apr_uint32_t waits;
+    int i;
+    
+    h2_mplx_limit_info_get(s->mplx, &info);
+    h2_mplx_queue_wait_get(s->mplx, &waits, &wait_sum, &wait_max);
+    bbout(bb, "    \"workers\": {\n");
+    bbout(bb, "      \"limiter\": \"%s\",\n", 
+          (info.limiter >= 0 && info.limiter < (int)H2_ALEN(limiters))? 
+          limiters[info.limiter] : "unknown");
+    bbout(bb, "      \"limit\": %d,\n", info.limit);
+    bbout(bb, "      \"max\": %d,\n", info.max);
+    bbout(bb, "      \"drainRate\": %"APR_OFF_T_FMT",\n", info.drain_rate);
+    bbout(bb, "      \"changes\": [");
+    for (i = 0; i < info.nchanges; ++i) {
+        bbout(bb, "%s{ \"limit\": %d, \"msAgo\": %ld }", i? ", " : "", 
+              info.changes[i].limit, 
+              (long)apr_time_as_msec(now - info.changes[i].at));
+    }
+    bbout(bb, "],\n");
+    bbout(bb, "      \"weight\": %d,\n", s->mplx->worker_weight);
+    bbout(bb, "      \"queueWait\": {\n");
+    bbout(bb, "        \"tasks\": %lu,\n", (unsigned long)waits);
+    bbout(bb, "        \"avgUsecs\": %ld,\n", 
+          waits? (long)(wait_sum / waits) : 0L);
+    bbout(bb, "        \"maxUsecs\": %ld\n", (long)wait_max);
+    bbout(bb, "      }\n");
+    bbout(bb, "    }%s\n", last? "" : ",");
+}
+
+static void add_stream_pools(apr_bucket_brigade *bb, h2_session *s, int last) 
+{
+    bbout(bb, "    \"streamPools\": {\n");
+    bbout(bb, "      \"reused\": %lu,\n", (unsigned long)s->stream_pools_reused);
+    bbout(bb, "      \"created\": %lu,\n", (unsigned long)s->stream_pools_created);
+#if APR_POOL_DEBUG
+    bbout(bb, "      \"bytesAvg\": %lu,\n", (unsigned long)
+          (s->stream_pool_bytes / H2MAX(1, s->stream_pools_done)));
+#endif
+    bbout(bb, "      \"spare\": %d\n", s->spare_stream_pools->nelts);
+    bbout(bb, "    }%s\n", last? "" : ",");
+}
+
+static void add_beam_chunks(apr_bucket_brigade *bb, int last) 
+{
+    apr_uint32_t in_use, idle;
+    apr_size_t mem;
+    
+    h2_beam_chunks_stats(&in_use, &idle, &mem);
+    bbout(bb, "    \"beamChunks\": {\n");
+    bbout(bb, "      \"inUse\": %lu,\n", (unsigned long)in_use);
+    bbout(bb, "      \"idle\": %lu,\n", (unsigned long)idle);
+    bbout(bb, "      \"bytes\": %lu\n", (unsigned long)mem);
+    bbout(bb, "    }%s\n", last? "" : ",");
+}
+
 static void add_stats(apr_bucket_brigade *bb, h2_session *s, 
                      h2_stream *stream, int last) 
 {
     bbout(bb, "  \"stats\": {\n");
     add_in(bb, s, 0);
     add_out(bb, s, 0);
-    add_push(bb, s, stream, 1);
+    add_io(bb, s, 0);
+    add_workers(bb, s, 0);
+    add_stream_pools(bb, s, 0);
+    add_push(bb, s, stream, 0);
+    add_slave_pool(bb, 0);
+    add_beam_chunks(bb, 1);
     bbout(bb, "  }%s\n", last? "" : ",");
 }
 
@@ -462,6 +584,7 @@ static apr_status_t h2_status_insert(h2_task *task, apr_bucket *b)
     bbout(bb, "  \"sentGoAway\": %d,\n", s->local.shutdown);
 
     add_streams(bb, s, 0);
+    add_frames(bb, s, 0);
     
     add_stats(bb, s, stream, 1);
     bbout(bb, "}\n");
@@ -98,9 +98,58 @@ static int uniq_field_values(void *d, const char *key, const char *val)
  * Vary fields with duplicate tokens, combine any multiples and remove
  * any duplicates.
  */
+static int vary_is_uniq(const char *val)
+{
+    const char *e = val, *start, *s2, *e2;
+    apr_size_t len;
+    
+    /* Check if the field value has no duplicate tokens, without copying
+     * it. Most responses carry a single 'Vary' with one or two tokens. */
+    while (1) {
+        while (*e == ',' || apr_isspace(*e)) {
+            ++e;
+        }
+        if (*e == '\0') {
+            return 1;
+        }
+        start = e;
+        while (*e != '\0' && *e != ',' && !apr_isspace(*e)) {
+            ++e;
+        }
+        len = (apr_size_t)(e - start);
+        for (s2 = e; *s2; s2 = e2) {
+            while (*s2 == ',' || apr_isspace(*s2)) {
+                ++s2;
+            }
+            e2 = s2;
+            while (*e2 != '\0' && *e2 != ',' && !apr_isspace(*e2)) {
+                ++e2;
+            }
+            if ((apr_size_t)(e2 - s2) == len && !ap_cstr_casecmpn(start, s2, len)) {
+                return 0;
+            }
+        }
+    }
+}
+
 static void fix_vary(request_rec *r)
 {
+    const apr_array_header_t *arr = apr_table_elts(r->headers_out);
+    const apr_table_entry_t *elts = (const apr_table_entry_t *)arr->elts;
     apr_array_header_t *varies;
+    const char *vary = NULL;
+    int i, count = 0;
+    
+    for (i = 0; i < arr->nelts; ++i) {
+        if (elts[i].key && !ap_cstr_casecmp("Vary", elts[i].key)) {
+            vary = elts[i].val;
+            ++count;
+        }
+    }
+    if (count == 0 || (count == 1 && vary_is_uniq(vary))) {
+        /* nothing to merge, leave it as it is */
+        return;
+    }
     
     varies = apr_array_make(r->pool, 5, sizeof(char *));
     
@@ -168,7 +217,8 @@ static int copy_header(void *ctx, const char *name, const char *value)
 {
     apr_table_t *headers = ctx;
     
-    apr_table_add(headers, name, value);
+    /* both tables live in r->pool, no need to copy */
+    apr_table_addn(headers, name, value);
     return 1;
 }
 
@@ -283,7 +333,8 @@ static h2_headers *create_response(h2_task *task, request_rec *r)
         apr_table_unset(r->headers_out, "Content-Length");
     }
     
-    headers = apr_table_make(r->pool, 10);
+    /* room for all of headers_out, plus Date and Server */
+    headers = apr_table_make(r->pool, apr_table_elts(r->headers_out)->nelts + 2);
     
     set_basic_http_header(headers, r, r->pool);
     if (r->status == HTTP_NOT_MODIFIED) {
@@ -407,7 +458,8 @@ static apr_table_t *make_table(h2_response_parser *parser)
             }
             
             if (!h2_util_ignore_header(hline)) {
-                apr_table_merge(headers, hline, sep);
+                /* hline was copied into task->pool by parse_header() */
+                apr_table_mergen(headers, hline, sep);
             }
         }
         return headers;
@@ -657,6 +709,21 @@ static int ser_header(void *ctx, const char *name, const char *value)
     return 1;
 }
 
+static apr_status_t send_continue(ap_filter_t *f)
+{
+    /* Same as the core HTTP_IN does, H2_PARSE_H1 turns this into
+     * an interim HEADERS response. */
+    apr_bucket_brigade *tmp;
+    apr_status_t status;
+    
+    tmp = apr_brigade_create(f->r->pool, f->c->bucket_alloc);
+    apr_brigade_puts(tmp, NULL, NULL, "HTTP/1.1 100 Continue" H2_CRLF H2_CRLF);
+    APR_BRIGADE_INSERT_TAIL(tmp, apr_bucket_flush_create(f->c->bucket_alloc));
+    status = ap_pass_brigade(f->c->output_filters, tmp);
+    apr_brigade_destroy(tmp);
+    return status;
+}
+
 static apr_status_t read_and_chunk(ap_filter_t *f, h2_task *task,
                                    apr_read_type_e block) {
     request_rec *r = f->r;
@@ -767,8 +834,49 @@ apr_status_t h2_filter_request_in(ap_filter_t* f,
 
     ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, f->r,
                   "h2_task(%s): request filter, exp=%d", task->id, r->expecting_100);
-    if (!task->request->chunked) {
+    if (task->input.raw_body) {
+        /* HTTP_IN is not there to do this for us. Like it, we hand
+         * out EOS again on every read after the end of the body. */
+        if (r->expecting_100) {
+            r->expecting_100 = 0;
+            if (!ap_is_HTTP_SUCCESS(r->status)) {
+                /* not going to read the body */
+                task->input.eos = 1;
+            }
+            else if (!(r->eos_sent || r->bytes_sent)) {
+                if ((status = send_continue(f)) != APR_SUCCESS) {
+                    return status;
+                }
+            }
+        }
+        if (task->input.eos) {
+            APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(f->c->bucket_alloc));
+            return APR_SUCCESS;
+        }
+    }
+    
+    if (!task->request->chunked || task->input.raw_body) {
         status = ap_get_brigade(f->next, bb, mode, block, readbytes);
+        if (APR_STATUS_IS_EOF(status) && task->input.raw_body) {
+            /* the beam is done, body readers want to see an EOS */
+            task->input.eos = 1;
+            APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(f->c->bucket_alloc));
+            return APR_SUCCESS;
+        }
+        if (status == APR_SUCCESS && task->input.raw_body && mode != AP_MODE_SPECULATIVE) {
+            apr_off_t limit = ap_get_limit_req_body(r), len = 0;
+            
+            apr_brigade_length(bb, 0, &len);
+            if (len > 0) {
+                task->input.raw_total += len;
+            }
+            if (limit && task->input.raw_total > limit) {
+                ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, r,
+                              "h2_task(%s): request body exceeds limit of %"
+                              APR_OFF_T_FMT, task->id, limit);
+                return APR_ENOSPC;
+            }
+        }
         /* pipe data through, just take care of trailers */
         for (b = APR_BRIGADE_FIRST(bb); 
              b != APR_BRIGADE_SENTINEL(bb); b = next) {
@@ -785,12 +893,20 @@ apr_status_t h2_filter_request_in(ap_filter_t* f,
                 }
                 APR_BUCKET_REMOVE(b);
                 apr_bucket_destroy(b);
-                ap_remove_input_filter(f);
+                if (!task->input.raw_body) {
+                    ap_remove_input_filter(f);
+                }
                 
                 if (headers->raw_bytes && h2_task_logio_add_bytes_in) {
                     h2_task_logio_add_bytes_in(task->c, headers->raw_bytes);
                 }
-                break;
+                if (!task->input.raw_body) {
+                    break;
+                }
+            }
+            else if (APR_BUCKET_IS_EOS(b) && task->input.raw_body
+                     && mode != AP_MODE_SPECULATIVE) {
+                task->input.eos = 1;
             }
         }
         return status;
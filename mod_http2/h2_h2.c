@@ -42,6 +42,8 @@
 #include "h2_filter.h"
 #include "h2_request.h"
 #include "h2_headers.h"
+#include "h2_mplx.h"
+#include "h2_rcache.h"
 #include "h2_session.h"
 #include "h2_util.h"
 #include "h2_h2.h"
@@ -463,59 +465,93 @@ int h2_h2_is_tls(conn_rec *c)
     return opt_ssl_is_https && opt_ssl_is_https(c);
 }
 
+const char *h2_h2_ssl_var(conn_rec *c, apr_pool_t *p, const char *name)
+{
+    if (opt_ssl_var_lookup && h2_h2_is_tls(c)) {
+        return opt_ssl_var_lookup(p, c->base_server, c, NULL, (char*)name);
+    }
+    return NULL;
+}
+
+/* Check TLS connection for modern TLS parameters, as defined in
+ * RFC 7540 and https://wiki.mozilla.org/Security/Server_Side_TLS#Modern_compatibility
+ * @return 1 if acceptable, 0 if not and -1 if protocol or cipher are
+ *         not known (yet)
+ */
+static int tls_verdict(conn_rec *c)
+{
+    apr_pool_t *pool = c->pool;
+    server_rec *s = c->base_server;
+    int verdict = 1;
+    char *val;
+    
+    /* Need Tlsv1.2 or higher, rfc 7540, ch. 9.2
+     */
+    val = opt_ssl_var_lookup(pool, s, c, NULL, (char*)"SSL_PROTOCOL");
+    if (val && *val) {
+        if (strncmp("TLS", val, 3) 
+            || !strcmp("TLSv1", val) 
+            || !strcmp("TLSv1.1", val)) {
+            ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, APLOGNO(03050)
+                          "h2_h2(%ld): tls protocol not suitable: %s", 
+                          (long)c->id, val);
+            return 0;
+        }
+    }
+    else {
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, APLOGNO(03051)
+                      "h2_h2(%ld): tls protocol is indetermined", (long)c->id);
+        verdict = -1;
+    }
+
+    /* Check TLS cipher blacklist
+     */
+    val = opt_ssl_var_lookup(pool, s, c, NULL, (char*)"SSL_CIPHER");
+    if (val && *val) {
+        const char *source;
+        if (cipher_is_blacklisted(val, &source)) {
+            ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, APLOGNO(03052)
+                          "h2_h2(%ld): tls cipher %s blacklisted by %s", 
+                          (long)c->id, val, source);
+            return 0;
+        }
+    }
+    else {
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, APLOGNO(03053)
+                      "h2_h2(%ld): tls cipher is indetermined", (long)c->id);
+        verdict = -1;
+    }
+    return verdict;
+}
+
 int h2_is_acceptable_connection(conn_rec *c, request_rec *r, int require_all) 
 {
     int is_tls = h2_h2_is_tls(c);
 
+    (void)r;
     if (is_tls && h2_config_cgeti(c, H2_CONF_MODERN_TLS_ONLY) > 0) {
-        /* Check TLS connection for modern TLS parameters, as defined in
-         * RFC 7540 and https://wiki.mozilla.org/Security/Server_Side_TLS#Modern_compatibility
-         */
-        apr_pool_t *pool = c->pool;
-        server_rec *s = c->base_server;
-        char *val;
-
+        const char *note;
+        int verdict;
+        
         if (!opt_ssl_var_lookup) {
             /* unable to check */
             return 0;
         }
         
-        /* Need Tlsv1.2 or higher, rfc 7540, ch. 9.2
-         */
-        val = opt_ssl_var_lookup(pool, s, c, NULL, (char*)"SSL_PROTOCOL");
-        if (val && *val) {
-            if (strncmp("TLS", val, 3) 
-                || !strcmp("TLSv1", val) 
-                || !strcmp("TLSv1.1", val)) {
-                ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, APLOGNO(03050)
-                              "h2_h2(%ld): tls protocol not suitable: %s", 
-                              (long)c->id, val);
-                return 0;
-            }
+        /* ALPN, process_conn and the session all ask. Protocol and cipher
+         * do not change on a connection, look them up only once a 
+         * verdict has been reached. */
+        note = apr_table_get(c->notes, H2_TLS_VERDICT_NOTE);
+        if (note) {
+            verdict = (*note == '1');
         }
-        else if (require_all) {
-            ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, APLOGNO(03051)
-                          "h2_h2(%ld): tls protocol is indetermined", (long)c->id);
-            return 0;
-        }
-
-        /* Check TLS cipher blacklist
-         */
-        val = opt_ssl_var_lookup(pool, s, c, NULL, (char*)"SSL_CIPHER");
-        if (val && *val) {
-            const char *source;
-            if (cipher_is_blacklisted(val, &source)) {
-                ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, APLOGNO(03052)
-                              "h2_h2(%ld): tls cipher %s blacklisted by %s", 
-                              (long)c->id, val, source);
-                return 0;
+        else {
+            verdict = tls_verdict(c);
+            if (verdict >= 0) {
+                apr_table_setn(c->notes, H2_TLS_VERDICT_NOTE, verdict? "1" : "0");
             }
         }
-        else if (require_all) {
-            ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, APLOGNO(03053)
-                          "h2_h2(%ld): tls cipher is indetermined", (long)c->id);
-            return 0;
-        }
+        return verdict > 0 || (verdict < 0 && !require_all);
     }
     return 1;
 }
@@ -694,9 +730,7 @@ static void check_push(request_rec *r, const char *tag)
                       tag, push_list->nelts);
         for (i = 0; i < push_list->nelts; ++i) {
             h2_push_res *push = &APR_ARRAY_IDX(push_list, i, h2_push_res);
-            apr_table_add(r->headers_out, "Link", 
-                           apr_psprintf(r->pool, "<%s>; rel=preload%s", 
-                                        push->uri_ref, push->critical? "; critical" : ""));
+            apr_table_addn(r->headers_out, "Link", push->link);
         }
         old_status = r->status;
         old_line = r->status_line;
@@ -723,6 +757,14 @@ static int h2_h2_post_read_req(request_rec *r)
             /* setup the correct filters to process the request for h2 */
             ap_add_input_filter("H2_REQUEST", task, r, r->connection);
             
+            /* A body without content-length would need chunk encoding
+             * for the core HTTP_IN filter, only to be decoded again. Our
+             * input brings its own EOS, so we pass the DATA directly. */
+            if (task->request->chunked && !task->request->serialize) {
+                ap_remove_input_filter_byhandle(r->input_filters, "HTTP_IN");
+                task->input.raw_body = 1;
+            }
+            
             /* replace the core http filter that formats response headers
              * in HTTP/1 with our own that collects status and headers */
             ap_remove_output_filter_byhandle(r->output_filters, "HTTP_HEADER");
@@ -755,6 +797,7 @@ static int h2_h2_late_fixups(request_rec *r)
                 h2_beam_on_file_beam(task->output.beam, h2_beam_no_files, NULL);
             }
             check_push(r, "late_fixup");
+            h2_rcache_add_filter(r, task->request, task->mplx->s);
         }
     }
     return DECLINED;
@@ -45,6 +45,10 @@ apr_status_t h2_h2_init(apr_pool_t *pool, server_rec *s);
  */
 int h2_h2_is_tls(conn_rec *c);
 
+/* Look up a mod_ssl variable of the connection, NULL if not available.
+ */
+const char *h2_h2_ssl_var(conn_rec *c, apr_pool_t *p, const char *name);
+
 /* Register apache hooks for h2 protocol
  */
 void h2_h2_register_hooks(void);
@@ -0,0 +1,264 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+ 
+#include <assert.h>
+#include <apr_shm.h>
+#include <apr_strings.h>
+
+#ifndef WIN32
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#else
+#include <process.h>
+#endif
+
+#include <httpd.h>
+#include <http_core.h>
+#include <http_log.h>
+#include <http_protocol.h>
+#include <http_request.h>
+#include <ap_mpm.h>
+
+#include "h2_private.h"
+#include "h2.h"
+#include "h2_metrics.h"
+
+typedef struct h2_metrics_slot {
+    apr_uint32_t pid;           /* owning child process or 0 */
+    h2_metrics m;
+} h2_metrics_slot;
+
+typedef struct h2_metrics_shm {
+    apr_uint32_t nslots;
+    h2_metrics_slot slots[1];
+} h2_metrics_shm;
+
+h2_metrics *h2_metrics_child;
+
+static h2_metrics_shm *metrics;
+static h2_metrics_slot *child_slot;
+
+static const char *FrameNames[] = {
+    "DATA", "HEADERS", "PRIORITY", "RST_STREAM", "SETTINGS", "PUSH_PROMISE", 
+    "PING", "GOAWAY", "WINDOW_UPDATE", "CONTINUATION", "UNKNOWN"
+};
+
+apr_status_t h2_metrics_post_config(apr_pool_t *pconf, server_rec *s)
+{
+    apr_shm_t *shm;
+    apr_size_t size;
+    apr_status_t status;
+    int nslots = 0;
+    
+    ap_mpm_query(AP_MPMQ_HARD_LIMIT_DAEMONS, &nslots);
+    nslots = H2MAX(nslots, 1);
+    size = sizeof(h2_metrics_shm) + (nslots - 1) * sizeof(h2_metrics_slot);
+    
+    /* anonymous memory is inherited by the children and gone on restart */
+    status = apr_shm_create(&shm, size, NULL, pconf);
+    if (status == APR_SUCCESS) {
+        metrics = apr_shm_baseaddr_get(shm);
+        memset(metrics, 0, size);
+    }
+    else {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, status, s,
+                     "h2_metrics: no shared memory, counting per process");
+        nslots = 1;
+        size = sizeof(h2_metrics_shm);
+        metrics = apr_pcalloc(pconf, size);
+    }
+    metrics->nslots = (apr_uint32_t)nslots;
+    return APR_SUCCESS;
+}
+
+static apr_status_t slot_release(void *data)
+{
+    h2_metrics_slot *slot = data;
+    
+    H2_ATOMIC_SET64(&slot->m.beam_chunk_bytes, 0);
+    H2_ATOMIC_SET64(&slot->m.beam_mem_bytes, 0);
+    H2_ATOMIC_SET64(&slot->m.workers_queued, 0);
+    H2_ATOMIC_SET64(&slot->m.workers_active, 0);
+    H2_ATOMIC_SET64(&slot->m.fcache_fds, 0);
+    h2_metrics_child = NULL;
+    child_slot = NULL;
+    apr_atomic_set32(&slot->pid, 0);
+    return APR_SUCCESS;
+}
+
+static int is_gone(apr_uint32_t pid)
+{
+#ifndef WIN32
+    return pid && kill((pid_t)pid, 0) < 0 && errno == ESRCH;
+#else
+    return 0;
+#endif
+}
+
+void h2_metrics_child_init(apr_pool_t *pchild, server_rec *s)
+{
+    apr_uint32_t i, pid, mypid = (apr_uint32_t)getpid();
+    h2_metrics_slot *slot;
+    
+    if (!metrics) {
+        return;
+    }
+    for (i = 0; i < metrics->nslots && !child_slot; ++i) {
+        slot = &metrics->slots[i];
+        if (apr_atomic_cas32(&slot->pid, mypid, 0) == 0) {
+            child_slot = slot;
+        }
+    }
+    /* take over a slot of a child that did not exit cleanly, keeping
+     * its counters, but not its gauges */
+    for (i = 0; i < metrics->nslots && !child_slot; ++i) {
+        slot = &metrics->slots[i];
+        pid = apr_atomic_read32(&slot->pid);
+        if (is_gone(pid) && apr_atomic_cas32(&slot->pid, mypid, pid) == pid) {
+            H2_ATOMIC_SET64(&slot->m.beam_chunk_bytes, 0);
+            H2_ATOMIC_SET64(&slot->m.beam_mem_bytes, 0);
+            H2_ATOMIC_SET64(&slot->m.workers_queued, 0);
+            H2_ATOMIC_SET64(&slot->m.workers_active, 0);
+            H2_ATOMIC_SET64(&slot->m.fcache_fds, 0);
+            child_slot = slot;
+        }
+    }
+    if (!child_slot) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s,
+                     "h2_metrics: no free slot for child %ld", (long)mypid);
+        return;
+    }
+    h2_metrics_child = &child_slot->m;
+    apr_pool_cleanup_register(pchild, child_slot, slot_release, 
+                              apr_pool_cleanup_null);
+}
+
+static void metric_out(request_rec *r, const char *name, const char *type, 
+                       const char *help, apr_uint64_t value)
+{
+    ap_rprintf(r, "# HELP %s %s\n# TYPE %s %s\n%s %"APR_UINT64_T_FMT"\n", 
+               name, help, name, type, name, value);
+}
+
+static void frames_out(request_rec *r, const char *name, const char *help,
+                       const apr_uint64_t *counts)
+{
+    int i;
+    
+    ap_rprintf(r, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+    for (i = 0; i <= H2_METRICS_FRAME_TYPES; ++i) {
+        ap_rprintf(r, "%s{type=\"%s\"} %"APR_UINT64_T_FMT"\n", 
+                   name, FrameNames[i], counts[i]);
+    }
+}
+
+int h2_metrics_handler(request_rec *r)
+{
+    h2_metrics sum;
+    h2_metrics_slot *slot;
+    apr_uint32_t i;
+    int j, status;
+    
+    if (strcmp(r->handler, "http2-metrics")) {
+        return DECLINED;
+    }
+    if (r->method_number != M_GET) {
+        return DECLINED;
+    }
+    if ((status = ap_discard_request_body(r)) != OK) {
+        return status;
+    }
+    if (!metrics) {
+        return HTTP_SERVICE_UNAVAILABLE;
+    }
+    
+    memset(&sum, 0, sizeof(sum));
+    for (i = 0; i < metrics->nslots; ++i) {
+        slot = &metrics->slots[i];
+        sum.streams_opened += H2_ATOMIC_GET64(&slot->m.streams_opened);
+        sum.streams_reset += H2_ATOMIC_GET64(&slot->m.streams_reset);
+        for (j = 0; j <= H2_METRICS_FRAME_TYPES; ++j) {
+            sum.frames_in[j] += H2_ATOMIC_GET64(&slot->m.frames_in[j]);
+            sum.frames_out[j] += H2_ATOMIC_GET64(&slot->m.frames_out[j]);
+        }
+        sum.bytes_in += H2_ATOMIC_GET64(&slot->m.bytes_in);
+        sum.bytes_out += H2_ATOMIC_GET64(&slot->m.bytes_out);
+        sum.pushes_promised += H2_ATOMIC_GET64(&slot->m.pushes_promised);
+        sum.push_diary_hits += H2_ATOMIC_GET64(&slot->m.push_diary_hits);
+        sum.beam_chunk_bytes += H2_ATOMIC_GET64(&slot->m.beam_chunk_bytes);
+        sum.beam_mem_bytes += H2_ATOMIC_GET64(&slot->m.beam_mem_bytes);
+        sum.beam_budget_waits += H2_ATOMIC_GET64(&slot->m.beam_budget_waits);
+        sum.workers_queued += H2_ATOMIC_GET64(&slot->m.workers_queued);
+        sum.workers_active += H2_ATOMIC_GET64(&slot->m.workers_active);
+        sum.workers_started += H2_ATOMIC_GET64(&slot->m.workers_started);
+        sum.workers_retired += H2_ATOMIC_GET64(&slot->m.workers_retired);
+        sum.fcache_hits += H2_ATOMIC_GET64(&slot->m.fcache_hits);
+        sum.fcache_opens += H2_ATOMIC_GET64(&slot->m.fcache_opens);
+        sum.fcache_fds += H2_ATOMIC_GET64(&slot->m.fcache_fds);
+    }
+    
+    ap_set_content_type(r, "text/plain; version=0.0.4");
+    apr_table_setn(r->subprocess_env, "no-gzip", "1");
+    if (r->header_only) {
+        return OK;
+    }
+    metric_out(r, "h2_streams_opened_total", "counter", 
+               "Streams opened by clients or pushes.", sum.streams_opened);
+    metric_out(r, "h2_streams_reset_total", "counter", 
+               "Streams reset by clients.", sum.streams_reset);
+    frames_out(r, "h2_frames_received_total", "Frames received by type.", 
+               sum.frames_in);
+    frames_out(r, "h2_frames_sent_total", "Frames sent by type.", 
+               sum.frames_out);
+    metric_out(r, "h2_bytes_received_total", "counter", 
+               "Bytes read from HTTP/2 connections.", sum.bytes_in);
+    metric_out(r, "h2_bytes_sent_total", "counter", 
+               "Bytes written to HTTP/2 connections.", sum.bytes_out);
+    metric_out(r, "h2_pushes_promised_total", "counter", 
+               "PUSH_PROMISEs sent.", sum.pushes_promised);
+    metric_out(r, "h2_push_diary_hits_total", "counter", 
+               "Pushes not done, since the client already had the resource.", 
+               sum.push_diary_hits);
+    metric_out(r, "h2_beam_chunk_bytes", "gauge", 
+               "Memory of beam chunks holding data between threads.", 
+               sum.beam_chunk_bytes);
+    metric_out(r, "h2_beam_mem_bytes", "gauge", 
+               "Bytes buffered in beams, when H2BeamMemBudget is set.", 
+               sum.beam_mem_bytes);
+    metric_out(r, "h2_beam_budget_waits_total", "counter", 
+               "Sends into a beam that waited for H2BeamMemBudget.", 
+               sum.beam_budget_waits);
+    metric_out(r, "h2_workers_queued", "gauge", 
+               "Connections waiting for a worker.", sum.workers_queued);
+    metric_out(r, "h2_workers_active", "gauge", 
+               "Worker threads, when H2WorkerScaling is on.", 
+               sum.workers_active);
+    metric_out(r, "h2_workers_started_total", "counter", 
+               "Worker threads started.", sum.workers_started);
+    metric_out(r, "h2_workers_retired_total", "counter", 
+               "Idle worker threads ended by H2WorkerScaling.", 
+               sum.workers_retired);
+    metric_out(r, "h2_fcache_hits_total", "counter", 
+               "Files served with a descriptor from H2FileCacheSize.", 
+               sum.fcache_hits);
+    metric_out(r, "h2_fcache_opens_total", "counter", 
+               "Files opened for the descriptor cache.", sum.fcache_opens);
+    metric_out(r, "h2_fcache_fds", "gauge", 
+               "Descriptors held open by the descriptor cache.", 
+               sum.fcache_fds);
+    return OK;
+}
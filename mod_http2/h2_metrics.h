@@ -0,0 +1,106 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __mod_h2__h2_metrics__
+#define __mod_h2__h2_metrics__
+
+#include <apr_version.h>
+#include <apr_atomic.h>
+
+/**
+ * Counters of all HTTP/2 connections in the server. Each child process has
+ * its own slot in shared memory, which it updates without locking. The
+ * "http2-metrics" handler sums up the slots and exports them in Prometheus
+ * text format.
+ */
+
+/* DATA up to CONTINUATION, with one more for all unknown frame types */
+#define H2_METRICS_FRAME_TYPES  10
+
+typedef struct h2_metrics {
+    /* counters, kept when a child exits */
+    apr_uint64_t streams_opened;
+    apr_uint64_t streams_reset;
+    apr_uint64_t frames_in[H2_METRICS_FRAME_TYPES+1];
+    apr_uint64_t frames_out[H2_METRICS_FRAME_TYPES+1];
+    apr_uint64_t bytes_in;
+    apr_uint64_t bytes_out;
+    apr_uint64_t pushes_promised;
+    apr_uint64_t push_diary_hits;
+    apr_uint64_t workers_started;       /* worker threads created */
+    apr_uint64_t workers_retired;       /* idle workers ended by scaling */
+    apr_uint64_t beam_budget_waits;     /* sends throttled by the budget */
+    apr_uint64_t fcache_hits;           /* files served from a cached fd */
+    apr_uint64_t fcache_opens;          /* files opened for the fd cache */
+    
+    /* gauges, cleared when a child exits */
+    apr_uint64_t beam_chunk_bytes;      /* beam chunk memory in use */
+    apr_uint64_t beam_mem_bytes;        /* bytes buffered in beams */
+    apr_uint64_t workers_queued;        /* connections waiting for workers */
+    apr_uint64_t workers_active;        /* worker threads, set by scaling */
+    apr_uint64_t fcache_fds;            /* descriptors open by the fd cache */
+} h2_metrics;
+
+/* The slot of this child, NULL before child init */
+extern h2_metrics *h2_metrics_child;
+
+/* Relaxed atomics where available. The counters are statistics, without
+ * them an increment may get lost under contention now and then. */
+#if defined(__ATOMIC_RELAXED)
+#define H2_ATOMIC_ADD64(p, n)   __atomic_fetch_add((p), (n), __ATOMIC_RELAXED)
+#define H2_ATOMIC_SET64(p, n)   __atomic_store_n((p), (n), __ATOMIC_RELAXED)
+#define H2_ATOMIC_GET64(p)      __atomic_load_n((p), __ATOMIC_RELAXED)
+#elif APR_VERSION_AT_LEAST(1,7,0)
+#define H2_ATOMIC_ADD64(p, n)   apr_atomic_add64((p), (n))
+#define H2_ATOMIC_SET64(p, n)   apr_atomic_set64((p), (n))
+#define H2_ATOMIC_GET64(p)      apr_atomic_read64(p)
+#else
+#define H2_ATOMIC_ADD64(p, n)   (*(p) += (n))
+#define H2_ATOMIC_SET64(p, n)   (*(p) = (n))
+#define H2_ATOMIC_GET64(p)      (*(volatile apr_uint64_t*)(p))
+#endif
+
+#define H2_METRIC_ADD(field, n) \
+    do { if (h2_metrics_child) \
+        H2_ATOMIC_ADD64(&h2_metrics_child->field, (apr_uint64_t)(n)); \
+    } while (0)
+#define H2_METRIC_SUB(field, n) H2_METRIC_ADD(field, -(apr_uint64_t)(n))
+#define H2_METRIC_INC(field)    H2_METRIC_ADD(field, 1)
+#define H2_METRIC_SET(field, n) \
+    do { if (h2_metrics_child) \
+        H2_ATOMIC_SET64(&h2_metrics_child->field, (apr_uint64_t)(n)); \
+    } while (0)
+#define H2_METRIC_FRAME(dir, type) \
+    H2_METRIC_INC(dir[((type) < H2_METRICS_FRAME_TYPES)? (type) : H2_METRICS_FRAME_TYPES])
+
+/**
+ * Create the shared memory for all child processes. Falls back to memory
+ * of this process where anonymous shared memory is not available.
+ */
+apr_status_t h2_metrics_post_config(apr_pool_t *pconf, server_rec *s);
+
+/**
+ * Claim a slot in the shared memory for this child process, given
+ * back at exit.
+ */
+void h2_metrics_child_init(apr_pool_t *pchild, server_rec *s);
+
+/**
+ * Handler for "http2-metrics", producing the Prometheus text format.
+ */
+int h2_metrics_handler(request_rec *r);
+
+#endif /* defined(__mod_h2__h2_metrics__) */
@@ -19,6 +19,7 @@
 #include <stdlib.h>
 
 #include <apr_atomic.h>
+#include <apr_poll.h>
 #include <apr_thread_mutex.h>
 #include <apr_thread_cond.h>
 #include <apr_strings.h>
@@ -40,6 +41,7 @@
 #include "h2_ctx.h"
 #include "h2_h2.h"
 #include "h2_mplx.h"
+#include "h2_probes.h"
 #include "h2_request.h"
 #include "h2_stream.h"
 #include "h2_session.h"
@@ -48,13 +50,6 @@
 #include "h2_util.h"
 
 
-/* utility for iterating over ihash stream sets */
-typedef struct {
-    h2_mplx *m;
-    h2_stream *stream;
-    apr_time_t now;
-} stream_iter_ctx;
-
 apr_status_t h2_mplx_child_init(apr_pool_t *pool, server_rec *s)
 {
     return APR_SUCCESS;
@@ -78,10 +73,15 @@ apr_status_t h2_mplx_child_init(apr_pool_t *pool, server_rec *s)
     if (lock) apr_thread_mutex_unlock(m->lock)
 
 static void check_data_for(h2_mplx *m, h2_stream *stream, int lock);
+static void notify_master(h2_mplx *m);
 
 static void stream_output_consumed(void *ctx, 
                                    h2_bucket_beam *beam, apr_off_t length)
 {
+    h2_stream *stream = ctx;
+    h2_mplx *m = stream->session->mplx;
+    /* counts how fast the client takes our output, for the worker limit */
+    apr_atomic_add32(&m->out_drained, (apr_uint32_t)length);
 }
 
 static void stream_input_ev(void *ctx, h2_bucket_beam *beam)
@@ -89,6 +89,7 @@ static void stream_input_ev(void *ctx, h2_bucket_beam *beam)
     h2_stream *stream = ctx;
     h2_mplx *m = stream->session->mplx;
     apr_atomic_set32(&m->event_pending, 1); 
+    notify_master(m);
 }
 
 static void stream_input_consumed(void *ctx, h2_bucket_beam *beam, apr_off_t length)
@@ -96,6 +97,23 @@ static void stream_input_consumed(void *ctx, h2_bucket_beam *beam, apr_off_t len
     h2_stream_in_consumed(ctx, length);
 }
 
+/* Tasks on a worker are kept in two heaps, so that the DoS protection
+ * finds timed out and repeatable ones without looking at all streams. */
+static void task_track(h2_mplx *m, h2_stream *stream, apr_time_t now)
+{
+    h2_iheap_add(m->tdeadline, stream->id, 
+                 (apr_uint64_t)(now + stream->task->timeout));
+    if (h2_task_can_redo(stream->task)) {
+        h2_iheap_add(m->tredo, stream->id, APR_UINT64_MAX - (apr_uint64_t)now);
+    }
+}
+
+static void task_untrack(h2_mplx *m, int stream_id)
+{
+    h2_iheap_remove(m->tdeadline, stream_id);
+    h2_iheap_remove(m->tredo, stream_id);
+}
+
 static void stream_joined(h2_mplx *m, h2_stream *stream)
 {
     ap_assert(!stream->task || stream->task->worker_done);
@@ -120,8 +138,9 @@ static void stream_cleanup(h2_mplx *m, h2_stream *stream)
     h2_stream_cleanup(stream);
 
     h2_ihash_remove(m->streams, stream->id);
-    h2_iq_remove(m->q, stream->id);
+    h2_iheap_remove(m->q, stream->id);
     h2_ififo_remove(m->readyq, stream->id);
+    task_untrack(m, stream->id);
     h2_ihash_add(m->shold, stream);
     
     if (!stream->task || stream->task->worker_done) {
@@ -156,6 +175,7 @@ h2_mplx *h2_mplx_create(conn_rec *c, server_rec *s, apr_pool_t *parent,
         m->id = c->id;
         m->c = c;
         m->s = s;
+        m->config = h2_config_svalues(s);
         
         /* We create a pool with its own allocator to be used for
          * processing slave connections. This is the only way to have the
@@ -190,26 +210,34 @@ h2_mplx *h2_mplx_create(conn_rec *c, server_rec *s, apr_pool_t *parent,
             return NULL;
         }
         
-        m->max_streams = h2_config_sgeti(s, H2_CONF_MAX_STREAMS);
-        m->stream_max_mem = h2_config_sgeti(s, H2_CONF_STREAM_MAX_MEM);
+        m->max_streams = H2_CONF_VAL(m->config, H2_CONF_MAX_STREAMS);
+        m->stream_max_mem = H2_CONF_VAL(m->config, H2_CONF_STREAM_MAX_MEM);
 
         m->streams = h2_ihash_create(m->pool, offsetof(h2_stream,id));
         m->sredo = h2_ihash_create(m->pool, offsetof(h2_stream,id));
         m->shold = h2_ihash_create(m->pool, offsetof(h2_stream,id));
         m->spurge = h2_ihash_create(m->pool, offsetof(h2_stream,id));
-        m->q = h2_iq_create(m->pool, m->max_streams);
+        m->q = h2_iheap_create(m->pool, m->max_streams);
+        m->tdeadline = h2_iheap_create(m->pool, m->max_streams);
+        m->tredo = h2_iheap_create(m->pool, m->max_streams);
 
-        status = h2_ififo_set_create(&m->readyq, m->pool, m->max_streams);
+        status = h2_ififo_create_ex(&m->readyq, m->pool, m->max_streams,
+                                    H2_FIFO_SET);
         if (status != APR_SUCCESS) {
             apr_pool_destroy(m->pool);
             return NULL;
         }
 
+        m->ready_batch = apr_pcalloc(m->pool, m->max_streams * sizeof(int));
+        
         m->workers = workers;
         m->max_active = workers->max_workers;
         m->limit_active = 6; /* the original h1 max parallel connections */
         m->last_limit_change = m->last_idle_block = apr_time_now();
         m->limit_change_interval = apr_time_from_msec(100);
+        m->limiter = H2_CONF_VAL(m->config, H2_CONF_WORKER_LIMITER);
+        m->drain_sampled_at = m->last_limit_change;
+        m->worker_weight = H2_CONF_VAL(m->config, H2_CONF_WORKER_WEIGHT);
         
         m->spare_slaves = apr_array_make(m->pool, 10, sizeof(conn_rec*));
     }
@@ -224,7 +252,7 @@ int h2_mplx_shutdown(h2_mplx *m)
 
     max_stream_started = m->max_stream_started;
     /* Clear schedule queue, disabling existing streams from starting */ 
-    h2_iq_clear(m->q);
+    h2_iheap_clear(m->q);
 
     H2_MPLX_LEAVE(m);
     return max_stream_started;
@@ -436,7 +464,7 @@ void h2_mplx_release_and_join(h2_mplx *m, apr_thread_cond_t *wait)
     
     /* 2. no more streams should be scheduled or in the active set */
     ap_assert(h2_ihash_empty(m->streams));
-    ap_assert(h2_iq_empty(m->q));
+    ap_assert(h2_iheap_empty(m->q));
     
     /* 3. while workers are busy on this connection, meaning they
      *    are processing tasks from this connection, wait on them finishing
@@ -466,6 +494,14 @@ void h2_mplx_release_and_join(h2_mplx *m, apr_thread_cond_t *wait)
         h2_ihash_iter(m->shold, unexpected_stream_iter, m);
     }
     
+    /* 5. Slave connections no longer go away with our pool, as they
+     *    may be recycled process wide. Destroy the ones we have left. */
+    purge_streams(m, 0);
+    while (m->spare_slaves->nelts > 0) {
+        conn_rec *slave = *(conn_rec **)apr_array_pop(m->spare_slaves);
+        h2_slave_destroy(slave);
+    }
+    
     m->c->aborted = old_aborted;
     H2_MPLX_LEAVE(m);
 
@@ -580,11 +616,151 @@ static apr_status_t out_close(h2_mplx *m, h2_task *task)
     return status;
 }
 
+/* Where the platform lets us, the master waits on worker output and 
+ * client input at the same time. Otherwise, it waits on a condition.
+ * The pollset costs file descriptors (with epoll, one for the set and
+ * two for its wakeup pipe), so it is only created once the master first
+ * waits for both. Only the master calls this. */
+static apr_pollset_t *get_pollset(h2_mplx *m)
+{
+    apr_pollset_t *pollset;
+    apr_pollfd_t pfd;
+    
+    if (m->pollset || m->pollset_failed) {
+        return m->pollset;
+    }
+    m->pollset_failed = 1;
+    if (apr_pollset_create(&pollset, 1, m->pool, 
+                           APR_POLLSET_WAKEABLE) != APR_SUCCESS) {
+        return NULL;
+    }
+    memset(&pfd, 0, sizeof(pfd));
+    pfd.p = m->pool;
+    pfd.desc_type = APR_POLL_SOCKET;
+    pfd.reqevents = APR_POLLIN;
+    pfd.desc.s = ap_get_conn_socket(m->c);
+    if (!pfd.desc.s || apr_pollset_add(pollset, &pfd) != APR_SUCCESS) {
+        apr_pollset_destroy(pollset);
+        return NULL;
+    }
+    m->pollset_failed = 0;
+    /* workers look at it only after they see us polling */
+    m->pollset = pollset;
+    return pollset;
+}
+
+static apr_status_t out_pollwait(h2_mplx *m, apr_interval_time_t timeout)
+{
+    const apr_pollfd_t *results;
+    apr_int32_t nresults;
+    apr_status_t status;
+    
+    /* Announce that we poll *before* looking at pending events. Whoever
+     * adds an event after that will wake us, even if the wakeup happens
+     * before we are in the poll. */
+    apr_atomic_set32(&m->polling, 1);
+    if (m->aborted) {
+        status = APR_ECONNABORTED;
+    }
+    else if (h2_mplx_has_master_events(m)) {
+        status = APR_SUCCESS;
+    }
+    else {
+        status = apr_pollset_poll(m->pollset, timeout, &nresults, &results);
+        if (APLOGctrace2(m->c)) {
+            ap_log_cerror(APLOG_MARK, APLOG_TRACE2, status, m->c,
+                          "h2_mplx(%ld): pollwait on data for %f ms)",
+                          m->id, timeout/1000.0);
+        }
+        if (h2_mplx_has_master_events(m)) {
+            status = APR_SUCCESS;
+        }
+        else if (status == APR_SUCCESS) {
+            /* the client has something for us */
+            status = APR_EAGAIN;
+        }
+        else if (APR_STATUS_IS_EINTR(status)) {
+            /* woken up or signal, either way look again */
+            status = APR_TIMEUP;
+        }
+    }
+    apr_atomic_set32(&m->polling, 0);
+    return status;
+}
+
+/* Wake up a master that polls or is suspended, without the lock held. */
+static void notify_master(h2_mplx *m)
+{
+    /* polling is announced after the pollset was created */
+    if (apr_atomic_read32(&m->polling) && m->pollset) {
+        apr_pollset_wakeup(m->pollset);
+    }
+    else if (apr_atomic_cas32(&m->suspended, 0, 1) == 1) {
+        /* first one to see it, let the MPM call us back */
+        apr_size_t len = 1;
+        apr_file_write(m->notify_out, "w", &len);
+    }
+}
+
+static void wakeup_master(h2_mplx *m)
+{
+    if (m->added_output) {
+        apr_thread_cond_signal(m->added_output);
+    }
+    else {
+        notify_master(m);
+    }
+}
+
+apr_status_t h2_mplx_suspend(h2_mplx *m, apr_file_t **pnotify)
+{
+    apr_status_t status;
+    
+    if (!m->notify_in) {
+        status = apr_file_pipe_create_ex(&m->notify_in, &m->notify_out, 
+                                         APR_FULL_NONBLOCK, m->pool);
+        if (status != APR_SUCCESS) {
+            m->notify_in = m->notify_out = NULL;
+            return status;
+        }
+    }
+    /* Announce first, check second. Events added in between will find
+     * us suspended and write to the pipe. */
+    apr_atomic_set32(&m->suspended, 1);
+    if (m->aborted || h2_mplx_has_master_events(m)) {
+        apr_atomic_set32(&m->suspended, 0);
+        return APR_EAGAIN;
+    }
+    *pnotify = m->notify_in;
+    return APR_SUCCESS;
+}
+
+void h2_mplx_resume(h2_mplx *m)
+{
+    char buffer[32];
+    apr_size_t len;
+    
+    apr_atomic_set32(&m->suspended, 0);
+    if (m->notify_in) {
+        do {
+            len = sizeof(buffer);
+        } while (apr_file_read(m->notify_in, buffer, &len) == APR_SUCCESS);
+    }
+}
+
 apr_status_t h2_mplx_out_trywait(h2_mplx *m, apr_interval_time_t timeout,
-                                 apr_thread_cond_t *iowait)
+                                 apr_thread_cond_t *iowait, int with_input)
 {
     apr_status_t status;
     
+    if (with_input && get_pollset(m)) {
+        H2_MPLX_ENTER(m);
+        purge_streams(m, 0);
+        h2_ihash_iter(m->streams, report_consumption_iter, m);
+        H2_MPLX_LEAVE(m);
+        return out_pollwait(m, timeout);
+    }
+    
     H2_MPLX_ENTER(m);
 
     if (m->aborted) {
@@ -615,27 +791,48 @@ static void check_data_for(h2_mplx *m, h2_stream *stream, int lock)
     if (h2_ififo_push(m->readyq, stream->id) == APR_SUCCESS) {
         apr_atomic_set32(&m->event_pending, 1);
         H2_MPLX_ENTER_MAYBE(m, lock);
-        if (m->added_output) {
-            apr_thread_cond_signal(m->added_output);
-        }
+        wakeup_master(m);
         H2_MPLX_LEAVE_MAYBE(m, lock);
     }
 }
 
-apr_status_t h2_mplx_reprioritize(h2_mplx *m, h2_stream_pri_cmp *cmp, void *ctx)
+typedef struct {
+    h2_mplx *m;
+    h2_stream_pri_rank *rank;
+    void *ctx;
+} rerank_ctx;
+
+static apr_uint64_t rerank_stream(int sid, void *ctx)
 {
-    apr_status_t status;
+    rerank_ctx *x = ctx;
+    h2_stream *stream = h2_ihash_get(x->m->streams, sid);
+    apr_uint64_t rank = x->rank(sid, x->ctx);
+    
+    if (stream) {
+        /* in case the stream gets queued again for a redo */
+        stream->pri_rank = rank;
+    }
+    return rank;
+}
+
+apr_status_t h2_mplx_reprioritize(h2_mplx *m, h2_stream_pri_rank *rank, void *ctx)
+{
+    apr_status_t status = APR_SUCCESS;
     
     H2_MPLX_ENTER(m);
 
     if (m->aborted) {
         status = APR_ECONNABORTED;
     }
-    else {
-        h2_iq_sort(m->q, cmp, ctx);
+    else if (!h2_iheap_empty(m->q)) {
+        rerank_ctx x;
+        
+        x.m = m;
+        x.rank = rank;
+        x.ctx = ctx;
+        h2_iheap_rerank(m->q, rerank_stream, &x);
         ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, m->c,
                       "h2_mplx(%ld): reprioritize tasks", m->id);
-        status = APR_SUCCESS;
     }
 
     H2_MPLX_LEAVE(m);
@@ -644,7 +841,7 @@ apr_status_t h2_mplx_reprioritize(h2_mplx *m, h2_stream_pri_cmp *cmp, void *ctx)
 
 static void register_if_needed(h2_mplx *m) 
 {
-    if (!m->aborted && !m->is_registered && !h2_iq_empty(m->q)) {
+    if (!m->aborted && !m->is_registered && !h2_iheap_empty(m->q)) {
         apr_status_t status = h2_workers_register(m->workers, m); 
         if (status == APR_SUCCESS) {
             m->is_registered = 1;
@@ -657,7 +854,7 @@ static void register_if_needed(h2_mplx *m)
 }
 
 apr_status_t h2_mplx_process(h2_mplx *m, struct h2_stream *stream, 
-                             h2_stream_pri_cmp *cmp, void *ctx)
+                             h2_stream_pri_rank *rank, void *ctx)
 {
     apr_status_t status;
     
@@ -668,6 +865,8 @@ apr_status_t h2_mplx_process(h2_mplx *m, struct h2_stream *stream,
     }
     else {
         status = APR_SUCCESS;
+        /* we run on the session's thread, its tasks better run nearby */
+        m->node = h2_workers_node(m->workers);
         h2_ihash_add(m->streams, stream);
         if (h2_stream_is_ready(stream)) {
             /* already have a response */
@@ -676,7 +875,9 @@ apr_status_t h2_mplx_process(h2_mplx *m, struct h2_stream *stream,
                           H2_STRM_MSG(stream, "process, add to readyq")); 
         }
         else {
-            h2_iq_add(m->q, stream->id, cmp, ctx);
+            stream->queued_at = apr_time_now();
+            stream->pri_rank = rank(stream->id, ctx);
+            h2_iheap_add(m->q, stream->id, stream->pri_rank);
             register_if_needed(m);                
             ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, m->c,
                           H2_STRM_MSG(stream, "process, added to q")); 
@@ -687,51 +888,106 @@ apr_status_t h2_mplx_process(h2_mplx *m, struct h2_stream *stream,
     return status;
 }
 
+static h2_task *stream_task(h2_mplx *m, h2_stream *stream)
+{
+    conn_rec *slave, **pslave;
+    apr_interval_time_t wait;
+    apr_time_t now;
+
+    pslave = (conn_rec **)apr_array_pop(m->spare_slaves);
+    if (pslave) {
+        slave = *pslave;
+        slave->aborted = 0;
+    }
+    else {
+        slave = h2_slave_create(m->c, stream->id, m->pool);
+    }
+    
+    if (!stream->task) {
+
+        if (stream->id > m->max_stream_started) {
+            m->max_stream_started = stream->id;
+        }
+        if (stream->input) {
+            h2_beam_on_consumed(stream->input, stream_input_ev, 
+                                stream_input_consumed, stream);
+        }
+        
+        stream->task = h2_task_create(slave, stream->id, 
+                                      stream->request, m, stream->input, 
+                                      stream->session->s->timeout,
+                                      m->stream_max_mem);
+        if (!stream->task) {
+            ap_log_cerror(APLOG_MARK, APLOG_ERR, APR_ENOMEM, slave,
+                          H2_STRM_LOG(APLOGNO(02941), stream, 
+                          "create task"));
+            if (slave) {
+                h2_slave_destroy(slave);
+            }
+            return NULL;
+        }
+        
+    }
+    
+    if (!stream->timing.task_created) {
+        stream->timing.task_created = h2_util_mono_now();
+    }
+    now = apr_time_now();
+    wait = now - stream->queued_at;
+    ++m->queue_waits;
+    m->queue_wait_sum += wait;
+    if (wait > m->queue_wait_max) {
+        m->queue_wait_max = wait;
+    }
+    h2_workers_task_waited(m->workers, wait);
+    task_track(m, stream, now);
+    ++m->tasks_active;
+    return stream->task;
+}
+
+apr_status_t h2_mplx_process_inline(h2_mplx *m, struct h2_stream *stream)
+{
+    h2_task *task = NULL;
+    apr_status_t status;
+    
+    H2_MPLX_ENTER(m);
+
+    if (m->aborted) {
+        status = APR_ECONNABORTED;
+    }
+    else {
+        h2_ihash_add(m->streams, stream);
+        stream->queued_at = apr_time_now();
+        task = stream_task(m, stream);
+        status = task? APR_SUCCESS : APR_ENOMEM;
+        if (task) {
+            /* we are the receiver of the output, the beam must never make 
+             * the task wait for it */
+            task->output.max_buffer = 0;
+        }
+    }
+
+    H2_MPLX_LEAVE(m);
+    
+    if (task) {
+        ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, m->c,
+                      H2_STRM_MSG(stream, "process inline")); 
+        h2_task_do(task, m->c->current_thread, 0);
+        h2_mplx_task_done(m, task, NULL);
+    }
+    return status;
+}
+
 static h2_task *next_stream_task(h2_mplx *m)
 {
     h2_stream *stream;
     int sid;
     while (!m->aborted && (m->tasks_active < m->limit_active)
-           && (sid = h2_iq_shift(m->q)) > 0) {
+           && (sid = h2_iheap_shift(m->q)) > 0) {
         
         stream = h2_ihash_get(m->streams, sid);
         if (stream) {
-            conn_rec *slave, **pslave;
-
-            pslave = (conn_rec **)apr_array_pop(m->spare_slaves);
-            if (pslave) {
-                slave = *pslave;
-                slave->aborted = 0;
-            }
-            else {
-                slave = h2_slave_create(m->c, stream->id, m->pool);
-            }
-            
-            if (!stream->task) {
-
-                if (sid > m->max_stream_started) {
-                    m->max_stream_started = sid;
-                }
-                if (stream->input) {
-                    h2_beam_on_consumed(stream->input, stream_input_ev, 
-                                        stream_input_consumed, stream);
-                }
-                
-                stream->task = h2_task_create(slave, stream->id, 
-                                              stream->request, m, stream->input, 
-                                              stream->session->s->timeout,
-                                              m->stream_max_mem);
-                if (!stream->task) {
-                    ap_log_cerror(APLOG_MARK, APLOG_ERR, APR_ENOMEM, slave,
-                                  H2_STRM_LOG(APLOGNO(02941), stream, 
-                                  "create task"));
-                    return NULL;
-                }
-                
-            }
-            
-            ++m->tasks_active;
-            return stream->task;
+            return stream_task(m, stream);
         }
     }
     return NULL;
@@ -754,7 +1010,10 @@ apr_status_t h2_mplx_pop_task(h2_mplx *m, h2_task **ptask)
     }
     else {
         *ptask = next_stream_task(m);
-        rv = (*ptask != NULL && !h2_iq_empty(m->q))? APR_EAGAIN : APR_SUCCESS;
+        if (*ptask) {
+            H2_PROBE2(task_pop, m->id, (*ptask)->stream_id);
+        }
+        rv = (*ptask != NULL && !h2_iheap_empty(m->q))? APR_EAGAIN : APR_SUCCESS;
     }
     if (APR_EAGAIN != rv) {
         m->is_registered = 0; /* h2_workers will discard this mplx */
@@ -763,6 +1022,155 @@ apr_status_t h2_mplx_pop_task(h2_mplx *m, h2_task **ptask)
     return rv;
 }
 
+/*******************************************************************************
+ * worker limit per connection
+ ******************************************************************************/
+
+static void limit_set(h2_mplx *m, int limit, apr_time_t now)
+{
+    limit = H2MIN(H2MAX(2, limit), m->max_active);
+    if (limit != m->limit_active) {
+        ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, m->c,
+                      "h2_mplx(%ld): %s worker limit to %d",
+                      m->id, (limit > m->limit_active)? "increase" : "decrease", 
+                      limit);
+        m->limit_active = limit;
+        m->limit_hist[m->limit_hist_count % H2_MPLX_LIMIT_HIST].at = now;
+        m->limit_hist[m->limit_hist_count % H2_MPLX_LIMIT_HIST].limit = limit;
+        ++m->limit_hist_count;
+    }
+    m->last_limit_change = now;
+}
+
+/* Determine how many output bytes the client consumed per second since
+ * the last sample, if that is long enough ago. Gives the number of bytes
+ * drained since the last sample in pdelta. Returns != 0 if a new sample 
+ * was taken. */
+static int drain_sample(h2_mplx *m, apr_time_t now, apr_uint32_t *pdelta)
+{
+    apr_uint32_t drained;
+    apr_interval_time_t elapsed = now - m->drain_sampled_at;
+    
+    drained = apr_atomic_read32(&m->out_drained);
+    *pdelta = drained - m->drained_sampled;
+    if (elapsed < m->limit_change_interval) {
+        return 0;
+    }
+    m->drain_rate = (apr_off_t)*pdelta * APR_USEC_PER_SEC / elapsed;
+    m->drained_sampled = drained;
+    m->drain_sampled_at = now;
+    return 1;
+}
+
+/* A task finished without the connection blocking. */
+static void limit_increase(h2_mplx *m, apr_time_t now)
+{
+    apr_off_t last_rate;
+    apr_uint32_t delta;
+    
+    if (now - m->last_limit_change < m->limit_change_interval
+        || m->limit_active >= m->max_active) {
+        return;
+    }
+    switch (m->limiter) {
+        case H2_LIMITER_AIMD:
+            limit_set(m, m->limit_active + 1, now);
+            break;
+        case H2_LIMITER_DRAIN:
+            /* only add workers while this makes the client take more */
+            last_rate = m->drain_rate;
+            if (drain_sample(m, now, &delta) && m->drain_rate >= last_rate) {
+                limit_set(m, m->limit_active + 1, now);
+            }
+            break;
+        default:
+            limit_set(m, m->limit_active * 2, now);
+            break;
+    }
+}
+
+/* The connection blocked while tasks were occupying workers. */
+static void limit_decrease(h2_mplx *m, apr_time_t now)
+{
+    apr_uint32_t delta;
+    
+    if (now - m->last_limit_change < m->limit_change_interval
+        || m->limit_active <= 2) {
+        return;
+    }
+    switch (m->limiter) {
+        case H2_LIMITER_AIMD:
+            limit_set(m, m->limit_active - H2MAX(1, m->limit_active / 4), now);
+            break;
+        case H2_LIMITER_DRAIN:
+            /* a client that still takes data costs one worker, a client 
+             * that took nothing at all half of them */
+            drain_sample(m, now, &delta);
+            if (delta > 0) {
+                limit_set(m, m->limit_active - 1, now);
+            }
+            else {
+                limit_set(m, m->limit_active / 2, now);
+            }
+            break;
+        default:
+            if (m->limit_active > 16) {
+                limit_set(m, 16, now);
+            }
+            else if (m->limit_active > 8) {
+                limit_set(m, 8, now);
+            }
+            else if (m->limit_active > 4) {
+                limit_set(m, 4, now);
+            }
+            else {
+                limit_set(m, 2, now);
+            }
+            break;
+    }
+}
+
+void h2_mplx_limit_info_get(h2_mplx *m, h2_mplx_limit_info *info)
+{
+    int i, n;
+    
+    H2_MPLX_ENTER_ALWAYS(m);
+    
+    info->limiter = m->limiter;
+    info->limit = m->limit_active;
+    info->max = m->max_active;
+    info->drain_rate = m->drain_rate;
+    n = H2MIN(m->limit_hist_count, H2_MPLX_LIMIT_HIST);
+    for (i = 0; i < n; ++i) {
+        info->changes[i] = 
+            m->limit_hist[(m->limit_hist_count - 1 - i) % H2_MPLX_LIMIT_HIST];
+    }
+    info->nchanges = n;
+    
+    H2_MPLX_LEAVE(m);
+}
+
+void h2_mplx_queue_wait_get(h2_mplx *m, apr_uint32_t *pcount, 
+                            apr_interval_time_t *psum, 
+                            apr_interval_time_t *pmax)
+{
+    H2_MPLX_ENTER_ALWAYS(m);
+    *pcount = m->queue_waits;
+    *psum = m->queue_wait_sum;
+    *pmax = m->queue_wait_max;
+    H2_MPLX_LEAVE(m);
+}
+
+static void timing_from_task(h2_stream *stream, h2_task *task)
+{
+    if (!stream->timing.worker_started) {
+        stream->timing.worker_started = task->mono_started;
+    }
+    if (!stream->timing.first_out) {
+        stream->timing.first_out = task->mono_first_out;
+    }
+}
+
 static void task_done(h2_mplx *m, h2_task *task)
 {
     h2_stream *stream;
@@ -773,6 +1181,9 @@ static void task_done(h2_mplx *m, h2_task *task)
     
     task->worker_done = 1;
     task->done_at = apr_time_now();
+    task_untrack(m, task->stream_id);
+    H2_PROBE3(task_done, m->id, task->stream_id, 
+              task->done_at - task->started_at);
     ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, m->c,
                   "h2_mplx(%s): request done, %f ms elapsed", task->id, 
                   (task->done_at - task->started_at) / 1000.0);
@@ -781,16 +1192,8 @@ static void task_done(h2_mplx *m, h2_task *task)
         /* this task finished without causing an 'idle block', e.g.
          * a block by flow control.
          */
-        if (task->done_at- m->last_limit_change >= m->limit_change_interval
-            && m->limit_active < m->max_active) {
-            /* Well behaving stream, allow it more workers */
-            m->limit_active = H2MIN(m->limit_active * 2, 
-                                     m->max_active);
-            m->last_limit_change = task->done_at;
-            ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, m->c,
-                          "h2_mplx(%ld): increase worker limit to %d",
-                          m->id, m->limit_active);
-        }
+        /* Well behaving stream, allow it more workers */
+        limit_increase(m, task->done_at);
     }
 
     ap_assert(task->done_done == 0);
@@ -803,13 +1206,15 @@ static void task_done(h2_mplx *m, h2_task *task)
             task->worker_done = 0;
             h2_task_redo(task);
             h2_ihash_remove(m->sredo, stream->id);
-            h2_iq_add(m->q, stream->id, NULL, NULL);
+            stream->queued_at = apr_time_now();
+            h2_iheap_add(m->q, stream->id, stream->pri_rank);
             ap_log_cerror(APLOG_MARK, APLOG_INFO, 0, m->c,
                           H2_STRM_MSG(stream, "redo, added to q")); 
         }
         else {
             /* stream not cleaned up, stay around */
             task->done_done = 1;
+            timing_from_task(stream, task);
             ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, m->c,
                           H2_STRM_MSG(stream, "task_done, stream open")); 
             if (stream->input) {
@@ -823,6 +1228,7 @@ static void task_done(h2_mplx *m, h2_task *task)
     else if ((stream = h2_ihash_get(m->shold, task->stream_id)) != NULL) {
         /* stream is done, was just waiting for this. */
         task->done_done = 1;
+        timing_from_task(stream, task);
         ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, m->c,
                       H2_STRM_MSG(stream, "task_done, in hold"));
         if (stream->input) {
@@ -866,58 +1272,56 @@ void h2_mplx_task_done(h2_mplx *m, h2_task *task, h2_task **ptask)
  * h2_mplx DoS protection
  ******************************************************************************/
 
-static int latest_repeatable_unsubmitted_iter(void *data, void *val)
+/* The repeatable task started last, whose response has not been
+ * submitted yet. Entries that no longer qualify are dropped, they
+ * only get back in when their task is started again. */
+static h2_stream *get_latest_repeatable_unsubmitted_stream(h2_mplx *m) 
 {
-    stream_iter_ctx *ctx = data;
-    h2_stream *stream = val;
+    h2_stream *stream;
+    int sid;
     
-    if (stream->task && !stream->task->worker_done 
-        && h2_task_can_redo(stream->task) 
-        && !h2_ihash_get(ctx->m->sredo, stream->id)) {
-        if (!h2_stream_is_ready(stream)) {
+    while ((sid = h2_iheap_peek(m->tredo, NULL)) > 0) {
+        stream = h2_ihash_get(m->streams, sid);
+        if (stream && stream->task && !stream->task->worker_done 
+            && h2_task_can_redo(stream->task)
+            && !h2_ihash_get(m->sredo, stream->id)
+            && !h2_stream_is_ready(stream)) {
             /* this task occupies a worker, the response has not been submitted 
              * yet, not been cancelled and it is a repeatable request
              * -> it can be re-scheduled later */
-            if (!ctx->stream 
-                || (ctx->stream->task->started_at < stream->task->started_at)) {
-                /* we did not have one or this one was started later */
-                ctx->stream = stream;
-            }
+            return stream;
         }
+        h2_iheap_shift(m->tredo);
     }
-    return 1;
-}
-
-static h2_stream *get_latest_repeatable_unsubmitted_stream(h2_mplx *m) 
-{
-    stream_iter_ctx ctx;
-    ctx.m = m;
-    ctx.stream = NULL;
-    h2_ihash_iter(m->streams, latest_repeatable_unsubmitted_iter, &ctx);
-    return ctx.stream;
-}
-
-static int timed_out_busy_iter(void *data, void *val)
-{
-    stream_iter_ctx *ctx = data;
-    h2_stream *stream = val;
-    if (stream->task && !stream->task->worker_done
-        && (ctx->now - stream->task->started_at) > stream->task->timeout) {
-        /* timed out stream occupying a worker, found */
-        ctx->stream = stream;
-        return 0;
-    }
-    return 1;
+    return NULL;
 }
 
+/* The task with the earliest deadline, if that has passed. The deadline
+ * is taken when the task starts. A request that raised its timeout
+ * for its virtual host is ranked again. */
 static h2_stream *get_timed_out_busy_stream(h2_mplx *m) 
 {
-    stream_iter_ctx ctx;
-    ctx.m = m;
-    ctx.stream = NULL;
-    ctx.now = apr_time_now();
-    h2_ihash_iter(m->streams, timed_out_busy_iter, &ctx);
-    return ctx.stream;
+    h2_stream *stream;
+    apr_uint64_t deadline;
+    apr_time_t now = apr_time_now();
+    int sid;
+    
+    while ((sid = h2_iheap_peek(m->tdeadline, &deadline)) > 0
+           && deadline < (apr_uint64_t)now) {
+        stream = h2_ihash_get(m->streams, sid);
+        if (!stream || !stream->task || stream->task->worker_done) {
+            h2_iheap_shift(m->tdeadline);
+        }
+        else if ((now - stream->task->started_at) > stream->task->timeout) {
+            /* timed out stream occupying a worker, found */
+            return stream;
+        }
+        else {
+            h2_iheap_add(m->tdeadline, sid, (apr_uint64_t)
+                         (stream->task->started_at + stream->task->timeout));
+        }
+    }
+    return NULL;
 }
 
 static apr_status_t unschedule_slow_tasks(h2_mplx *m) 
@@ -975,34 +1379,16 @@ apr_status_t h2_mplx_idle(h2_mplx *m)
              */
             now = apr_time_now();
             m->last_idle_block = now;
-            if (m->limit_active > 2 
-                && now - m->last_limit_change >= m->limit_change_interval) {
-                if (m->limit_active > 16) {
-                    m->limit_active = 16;
-                }
-                else if (m->limit_active > 8) {
-                    m->limit_active = 8;
-                }
-                else if (m->limit_active > 4) {
-                    m->limit_active = 4;
-                }
-                else if (m->limit_active > 2) {
-                    m->limit_active = 2;
-                }
-                m->last_limit_change = now;
-                ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, m->c,
-                              "h2_mplx(%ld): decrease worker limit to %d",
-                              m->id, m->limit_active);
-            }
+            limit_decrease(m, now);
             
             if (m->tasks_active > m->limit_active) {
                 status = unschedule_slow_tasks(m);
             }
         }
-        else if (!h2_iq_empty(m->q)) {
+        else if (!h2_iheap_empty(m->q)) {
             ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, m->c,
                           "h2_mplx(%ld): idle, but %d streams to process",
-                          m->id, (int)h2_iq_count(m->q));
+                          m->id, h2_iheap_count(m->q));
             status = APR_EAGAIN;
         }
         else {
@@ -1054,7 +1440,7 @@ apr_status_t h2_mplx_dispatch_master_events(h2_mplx *m,
                                             void *on_ctx)
 {
     h2_stream *stream;
-    int n, id;
+    int i, n, max, id;
     
     ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, m->c, 
                   "h2_mplx(%ld): dispatch events", m->id);        
@@ -1064,11 +1450,21 @@ apr_status_t h2_mplx_dispatch_master_events(h2_mplx *m,
     h2_ihash_iter(m->streams, report_consumption_iter, m);    
     purge_streams(m, 1);
     
-    n = h2_ififo_count(m->readyq);
-    while (n > 0 
-           && (h2_ififo_try_pull(m->readyq, &id) == APR_SUCCESS)) {
-        --n;
+    /* Collect the output of all ready streams first, before resuming any 
+     * of them. nghttp2 then sends from the stream buffers and does not 
+     * have to go to the beam for every frame. */
+    max = H2MIN(h2_ififo_count(m->readyq), m->max_streams);
+    for (i = n = 0; i < max 
+         && (h2_ififo_try_pull(m->readyq, &id) == APR_SUCCESS); ++i) {
         stream = h2_ihash_get(m->streams, id);
+        if (stream) {
+            m->ready_batch[n++] = id;
+            h2_stream_out_preload(stream);
+        }
+    }
+    for (i = 0; i < n; ++i) {
+        /* resuming one stream may have closed another one */
+        stream = h2_ihash_get(m->streams, m->ready_batch[i]);
         if (stream) {
             on_resume(on_ctx, stream);
         }
@@ -1093,7 +1489,7 @@ int h2_mplx_awaits_data(h2_mplx *m)
         waiting = 0;
     }
     else if (!m->tasks_active && !h2_ififo_count(m->readyq)
-             && h2_iq_empty(m->q)) {
+             && h2_iheap_empty(m->q)) {
         waiting = 0;
     }
 
@@ -52,11 +52,19 @@ struct h2_iqueue;
 
 typedef struct h2_mplx h2_mplx;
 
+#define H2_MPLX_LIMIT_HIST      8
+
+typedef struct {
+    apr_time_t at;                   /* when the limit changed */
+    int limit;                       /* the new limit */
+} h2_mplx_limit_change;
+
 struct h2_mplx {
     long id;
     conn_rec *c;
     apr_pool_t *pool;
     server_rec *s;                  /* server for master conn */
+    const struct h2_config_values *config; /* resolved config of s */
 
     unsigned int event_pending;
     unsigned int aborted;
@@ -67,8 +75,11 @@ struct h2_mplx {
     struct h2_ihash_t *shold;       /* all streams done with task ongoing */
     struct h2_ihash_t *spurge;      /* all streams done, ready for destroy */
     
-    struct h2_iqueue *q;            /* all stream ids that need to be started */
+    struct h2_iheap *q;             /* all stream ids that need to be started */
     struct h2_ififo *readyq;        /* all stream ids ready for output */
+    struct h2_iheap *tdeadline;     /* stream ids on a worker, by task deadline */
+    struct h2_iheap *tredo;         /* ids of repeatable ones, latest first */
+    int *ready_batch;               /* ids taken from readyq in one go */
         
     struct h2_ihash_t *redo_tasks;  /* all tasks that need to be redone */
     
@@ -81,9 +92,29 @@ struct h2_mplx {
                                       * streams were ready */
     apr_time_t last_limit_change;    /* last time, worker limit changed */
     apr_interval_time_t limit_change_interval;
+    int limiter;                     /* h2_worker_limiter in use */
+    volatile apr_uint32_t out_drained; /* output bytes consumed, wraps */
+    apr_uint32_t drained_sampled;    /* out_drained at last sample */
+    apr_time_t drain_sampled_at;     /* time of last drain sample */
+    apr_off_t drain_rate;            /* output bytes/sec at last sample */
+    h2_mplx_limit_change limit_hist[H2_MPLX_LIMIT_HIST];
+    int limit_hist_count;            /* # of changes recorded in total */
+    int worker_weight;               /* share of worker time, relative */
+    int node;                        /* NUMA node the session last ran on */
+    volatile apr_uint32_t worker_credit; /* apr_int32_t usecs of worker time
+                                      * left in this round, see h2_workers */
+    apr_uint32_t queue_waits;        /* # of tasks taken from the queue */
+    apr_interval_time_t queue_wait_sum; /* sum of their time in queue */
+    apr_interval_time_t queue_wait_max; /* longest time in queue */
 
     apr_thread_mutex_t *lock;
     struct apr_thread_cond_t *added_output;
+    struct apr_pollset_t *pollset;  /* master socket + worker wakeup, or NULL */
+    unsigned int pollset_failed;    /* pollset could not be created */
+    volatile apr_uint32_t polling;  /* master waits in pollset */
+    struct apr_file_t *notify_in;   /* readable when suspended master */
+    struct apr_file_t *notify_out;  /* has events, written by workers */
+    volatile apr_uint32_t suspended;/* master conn suspended in MPM */
     struct apr_thread_cond_t *join_wait;
     
     apr_size_t stream_max_mem;
@@ -102,6 +133,28 @@ struct h2_mplx {
 
 apr_status_t h2_mplx_child_init(apr_pool_t *pool, server_rec *s);
 
+typedef struct {
+    int limiter;                     /* h2_worker_limiter in use */
+    int limit;                       /* current limit on active tasks */
+    int max;                         /* hard limit on active tasks */
+    apr_off_t drain_rate;            /* output bytes/sec at last sample */
+    int nchanges;                    /* # of changes, most recent first */
+    h2_mplx_limit_change changes[H2_MPLX_LIMIT_HIST];
+} h2_mplx_limit_info;
+
+/**
+ * Get the current worker limit of the mplx and its latest changes.
+ */
+void h2_mplx_limit_info_get(h2_mplx *m, h2_mplx_limit_info *info);
+
+/**
+ * Get the number of tasks started by the mplx, their total and maximum
+ * time waiting for a worker.
+ */
+void h2_mplx_queue_wait_get(h2_mplx *m, apr_uint32_t *pcount, 
+                            apr_interval_time_t *psum, 
+                            apr_interval_time_t *pmax);
+
 /**
  * Create the multiplexer for the given HTTP2 session. 
  * Implicitly has reference count 1.
@@ -149,13 +202,33 @@ apr_status_t h2_mplx_stream_cleanup(h2_mplx *m, struct h2_stream *stream);
 
 /**
  * Waits on output data from any stream in this session to become available. 
- * Returns APR_TIMEUP if no data arrived in the given time.
+ * Where the platform supports it and with_input is != 0, this also returns 
+ * when the client sends more data on the master connection.
+ * Returns APR_TIMEUP if no data arrived in the given time, APR_EAGAIN if
+ * there is input to read on the master connection.
  */
 apr_status_t h2_mplx_out_trywait(h2_mplx *m, apr_interval_time_t timeout,
-                                 struct apr_thread_cond_t *iowait);
+                                 struct apr_thread_cond_t *iowait,
+                                 int with_input);
 
 apr_status_t h2_mplx_keep_active(h2_mplx *m, struct h2_stream *stream);
 
+/**
+ * The master connection is about to be suspended in the MPM while streams
+ * are still being processed. Gives the file that becomes readable once
+ * there are events for the master connection.
+ * @param m the multiplexer
+ * @param pnotify on success, the file to poll for reading
+ * @return APR_SUCCESS, APR_EAGAIN when events are already pending or 
+ *         an error creating the notifier
+ */
+apr_status_t h2_mplx_suspend(h2_mplx *m, struct apr_file_t **pnotify);
+
+/**
+ * The master connection is processing again, after a h2_mplx_suspend().
+ */
+void h2_mplx_resume(h2_mplx *m);
+
 /*******************************************************************************
  * Stream processing.
  ******************************************************************************/
@@ -166,20 +239,31 @@ apr_status_t h2_mplx_keep_active(h2_mplx *m, struct h2_stream *stream);
  * @param m the multiplexer
  * @param stream the identifier of the stream
  * @param r the request to be processed
- * @param cmp the stream priority compare function
- * @param ctx context data for the compare function
+ * @param rank the stream priority rank function
+ * @param ctx context data for the rank function
  */
 apr_status_t h2_mplx_process(h2_mplx *m, struct h2_stream *stream, 
-                             h2_stream_pri_cmp *cmp, void *ctx);
+                             h2_stream_pri_rank *rank, void *ctx);
+
+/**
+ * Process a stream request on the calling thread, which is the one serving
+ * the master connection. The request must be complete, e.g. have no body
+ * to read, and the task's output is buffered without limit. Returns when
+ * the task is done, its response being ready for the session.
+ * 
+ * @param m the multiplexer
+ * @param stream the stream to process
+ */
+apr_status_t h2_mplx_process_inline(h2_mplx *m, struct h2_stream *stream);
 
 /**
  * Stream priorities have changed, reschedule pending requests.
  * 
  * @param m the multiplexer
- * @param cmp the stream priority compare function
- * @param ctx context data for the compare function
+ * @param rank the stream priority rank function
+ * @param ctx context data for the rank function
  */
-apr_status_t h2_mplx_reprioritize(h2_mplx *m, h2_stream_pri_cmp *cmp, void *ctx);
+apr_status_t h2_mplx_reprioritize(h2_mplx *m, h2_stream_pri_rank *rank, void *ctx);
 
 typedef apr_status_t stream_ev_callback(void *ctx, struct h2_stream *stream);
 
@@ -0,0 +1,63 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __mod_h2__h2_probes__
+#define __mod_h2__h2_probes__
+
+/**
+ * USDT probes of provider "mod_http2", for tracing with bpftrace,
+ * systemtap or dtrace. Built with "configure --enable-usdt", where
+ * <sys/sdt.h> is available. Otherwise the probes compile to nothing. A
+ * probe that is not attached costs a nop instruction. Only pass values
+ * at hand as arguments, they are computed whether traced or not.
+ *
+ *  session_state(conn id, old state, new state)
+ *  stream_state(conn id, stream id, old state, new state)
+ *  task_pop(conn id, stream id)
+ *  task_done(conn id, stream id, usecs on the worker)
+ *  beam_send(beam id, tag, bytes added)
+ *  beam_receive(beam id, tag, bytes taken)
+ *  conn_output(conn id, bytes, flush)
+ *
+ * States are the values of h2_session_state and h2_stream_state_t.
+ * For example:
+ *   bpftrace -e 'usdt:/usr/lib/apache2/modules/mod_http2.so:mod_http2:beam_send
+ *                { @[str(arg1)] = sum(arg2); }'
+ */
+
+#ifdef H2_USDT
+#include <sys/sdt.h>
+
+#define H2_PROBE2(n, a1, a2) \
+    DTRACE_PROBE2(mod_http2, n, a1, a2)
+#define H2_PROBE3(n, a1, a2, a3) \
+    DTRACE_PROBE3(mod_http2, n, a1, a2, a3)
+#define H2_PROBE4(n, a1, a2, a3, a4) \
+    DTRACE_PROBE4(mod_http2, n, a1, a2, a3, a4)
+
+#else /* H2_USDT */
+
+/* use the arguments, so that variables only set for a probe do not warn */
+#define H2_PROBE2(n, a1, a2) \
+    do { (void)(a1); (void)(a2); } while (0)
+#define H2_PROBE3(n, a1, a2, a3) \
+    do { (void)(a1); (void)(a2); (void)(a3); } while (0)
+#define H2_PROBE4(n, a1, a2, a3, a4) \
+    do { (void)(a1); (void)(a2); (void)(a3); (void)(a4); } while (0)
+
+#endif /* H2_USDT */
+
+#endif /* defined(__mod_h2__h2_probes__) */
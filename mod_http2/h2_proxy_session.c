@@ -15,6 +15,9 @@
  */
  
 #include <stddef.h>
+#include <stdlib.h>
+#include <apr_atomic.h>
+#include <apr_poll.h>
 #include <apr_strings.h>
 #include <nghttp2/nghttp2.h>
 
@@ -45,6 +48,7 @@ typedef struct h2_proxy_stream {
     unsigned int suspended : 1;
     unsigned int waiting_on_100 : 1;
     unsigned int waiting_on_ping : 1;
+    unsigned int notified : 1;      /* front wakes us on request input */
     uint32_t error_code;
 
     apr_bucket_brigade *input;
@@ -56,12 +60,65 @@ typedef struct h2_proxy_stream {
 } h2_proxy_stream;
 
 
+/* Send a PING on busy sessions when the last one is this old, to keep
+ * the round trip time measurement current. */
+#define H2_PROXY_PING_INTERVAL      apr_time_from_sec(5)
+
+/* With autotuning windows, the connection window allows this many streams
+ * to use their full window at the same time. */
+#define H2_PROXY_WINDOW_STREAMS     8
+
+/* Longest wait on the backend while streams are suspended on request
+ * input, when the front notifies us of its arrival. Without notifications,
+ * the input is polled at least every 100ms. */
+#define H2_PROXY_WAIT_MAX           apr_time_from_sec(1)
+
+/* In zero_copy mode, the backend is read into a malloc'ed buffer and
+ * response DATA is passed on as heap buckets pointing into it. The
+ * buckets are destroyed by the front connection, possibly in another
+ * thread, so the buffer is counted atomically and never allocated from
+ * the backend connection's bucket allocator. */
+typedef struct h2_proxy_rbuf {
+    apr_uint32_t refs;
+} h2_proxy_rbuf;
+
+#define H2_PROXY_RBUF_SIZE          (64 * 1024)
+/* The beam counts only the length of a slice, but the slice keeps the
+ * whole buffer alive. Smaller slices are copied, so the memory held by
+ * response DATA is never more than 4 times what the beam accounts for. */
+#define H2_PROXY_RBUF_SLICE_MIN     (H2_PROXY_RBUF_SIZE / 4)
+#define H2_PROXY_RBUF_HDR_LEN       APR_ALIGN_DEFAULT(sizeof(h2_proxy_rbuf))
+#define H2_PROXY_RBUF_DATA(rb)      (((char*)(rb)) + H2_PROXY_RBUF_HDR_LEN)
+#define H2_PROXY_RBUF_OF(data)      ((h2_proxy_rbuf*)(((char*)(data)) - H2_PROXY_RBUF_HDR_LEN))
+
 static void dispatch_event(h2_proxy_session *session, h2_proxys_event_t ev, 
                            int arg, const char *msg);
 static void ping_arrived(h2_proxy_session *session);
 static apr_status_t check_suspended(h2_proxy_session *session);
 static void stream_resume(h2_proxy_stream *stream);
+static void stream_notify_off(h2_proxy_stream *stream);
+static int notify_off_iter(void *udata, void *val);
+
+
+static void rbuf_free(void *data)
+{
+    h2_proxy_rbuf *rb = H2_PROXY_RBUF_OF(data);
+    
+    if (apr_atomic_dec32(&rb->refs) == 0) {
+        free(rb);
+    }
+}
 
+static apr_status_t rbuf_cleanup(void *data)
+{
+    h2_proxy_session *session = data;
+    
+    if (session->rbuf) {
+        rbuf_free(H2_PROXY_RBUF_DATA(session->rbuf));
+        session->rbuf = NULL;
+    }
+    return APR_SUCCESS;
+}
 
 static apr_status_t proxy_session_pre_close(void *theconn)
 {
@@ -74,6 +131,7 @@ static apr_status_t proxy_session_pre_close(void *theconn)
                       session->id, session->state, 
                       (int)h2_proxy_ihash_count(session->streams));
         session->aborted = 1;
+        h2_proxy_ihash_iter(session->streams, notify_off_iter, NULL);
         dispatch_event(session, H2_PROXYS_EV_PRE_CLOSE, 0, NULL);
         nghttp2_session_del(session->ngh2);
         session->ngh2 = NULL;
@@ -135,6 +193,84 @@ static ssize_t raw_send(nghttp2_session *ngh2, const uint8_t *data,
     return length;
 }
 
+static int submit_ping(h2_proxy_session *session)
+{
+    int rv;
+    
+    if (session->ping_outstanding) {
+        /* one PING at a time, its ACK serves whoever waits for it and
+         * ping_sent stays the time that ACK answers */
+        return 0;
+    }
+    rv = nghttp2_submit_ping(session->ngh2, 0, (const uint8_t *)"nevergonnagiveyouup");
+    if (!rv) {
+        session->ping_outstanding = 1;
+        session->ping_sent = apr_time_now();
+        session->bdp_bytes = 0;
+    }
+    return rv;
+}
+
+/* The DATA received during a PING round trip estimates the bandwidth-delay
+ * product of the link. When it comes close to the stream window, the backend
+ * probably waited for WINDOW_UPDATEs and the windows are grown to twice the
+ * estimate, up to window_max. This is what gRPC does. */
+static void window_autotune(h2_proxy_session *session)
+{
+    nghttp2_settings_entry settings[1];
+    apr_size_t window, conn_window;
+    
+    if (session->window_stream >= session->window_max
+        || session->bdp_bytes < (apr_off_t)(session->window_stream / 3 * 2)) {
+        return;
+    }
+    window = (apr_size_t)H2MIN(2 * session->bdp_bytes, 
+                               (apr_off_t)session->window_max);
+    window = H2MIN(window, (apr_size_t)NGHTTP2_MAX_WINDOW_SIZE);
+    if (window <= session->window_stream) {
+        return;
+    }
+    /* a new initial window applies to the open streams as well */
+    settings[0].settings_id = NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE;
+    settings[0].value = (uint32_t)window;
+    if (nghttp2_submit_settings(session->ngh2, NGHTTP2_FLAG_NONE, settings, 
+                                H2_ALEN(settings))) {
+        return;
+    }
+    session->window_stream = window;
+    
+    conn_window = H2MIN(window * H2_PROXY_WINDOW_STREAMS, 
+                        ((apr_size_t)1 << session->window_bits_connection) - 1);
+    if (conn_window > session->window_conn
+        && !nghttp2_submit_window_update(session->ngh2, NGHTTP2_FLAG_NONE, 0, 
+                         (int32_t)(conn_window - session->window_conn))) {
+        session->window_conn = conn_window;
+    }
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, session->c, 
+                  "h2_proxy_session(%s): %ld bytes in %ld usec, windows now "
+                  "%ld for streams, %ld for connection", session->id, 
+                  (long)session->bdp_bytes, (long)session->rtt, 
+                  (long)session->window_stream, (long)session->window_conn);
+}
+
+static void ping_ack(h2_proxy_session *session)
+{
+    apr_interval_time_t sample;
+    
+    if (!session->ping_outstanding) {
+        return;
+    }
+    session->ping_outstanding = 0;
+    sample = apr_time_now() - session->ping_sent;
+    session->rtt = session->rtt? (7 * session->rtt + sample) / 8 : sample;
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, session->c, 
+                  "h2_proxy_session(%s): PING rtt %ldus, smoothed %ldus", 
+                  session->id, (long)sample, (long)session->rtt);
+    if (session->window_max) {
+        window_autotune(session);
+    }
+}
+
 static int on_frame_recv(nghttp2_session *ngh2, const nghttp2_frame *frame,
                          void *user_data) 
 {
@@ -193,6 +329,11 @@ static int on_frame_recv(nghttp2_session *ngh2, const nghttp2_frame *frame,
             stream_resume(stream);
             break;
         case NGHTTP2_PING:
+            if (!(frame->hd.flags & NGHTTP2_FLAG_ACK)) {
+                /* the backend pinging us, nghttp2 answers that */
+                break;
+            }
+            ping_ack(session);
             if (session->check_ping) {
                 session->check_ping = 0;
                 ping_arrived(session);
@@ -407,9 +548,31 @@ static int stream_response_data(nghttp2_session *ngh2, uint8_t flags,
         h2_proxy_stream_end_headers_out(stream);
     }
     stream->data_received += len;
+    session->bdp_bytes += len;
+    if (session->window_max && session->window_stream < session->window_max) {
+        /* measure how much arrives until the PING comes back */
+        submit_ping(session);
+    }
     
-    b = apr_bucket_transient_create((const char*)data, len, 
-                                    stream->r->connection->bucket_alloc);
+    if (session->rbuf_len && len >= H2_PROXY_RBUF_SLICE_MIN
+        && (const char*)data >= H2_PROXY_RBUF_DATA(session->rbuf)
+        && (const char*)data + len <= (H2_PROXY_RBUF_DATA(session->rbuf) 
+                                       + session->rbuf_len)) {
+        /* a slice of the read buffer, kept alive until sent */
+        char *base = H2_PROXY_RBUF_DATA(session->rbuf);
+        apr_size_t offset = (apr_size_t)((const char*)data - base);
+        
+        apr_atomic_inc32(&session->rbuf->refs);
+        /* alloc_len ends with the slice, so nothing appends to it */
+        b = apr_bucket_heap_create(base, offset + len, rbuf_free,
+                                   stream->r->connection->bucket_alloc);
+        b->start = offset;
+        b->length = len;
+    }
+    else {
+        b = apr_bucket_transient_create((const char*)data, len, 
+                                        stream->r->connection->bucket_alloc);
+    }
     APR_BRIGADE_INSERT_TAIL(stream->output, b);
     /* always flush after a DATA frame, as we have no other indication
      * of buffer use */
@@ -511,7 +674,60 @@ static ssize_t stream_request_data(nghttp2_session *ngh2, int32_t stream_id,
                       stream->session->id, stream->id);
     }
 
-    if (status == APR_SUCCESS) {
+    if (status == APR_SUCCESS && stream->session->zero_copy) {
+        /* Only measure what we have, the buckets are passed on in
+         * stream_send_data() without copying them into nghttp2's buffer. */
+        apr_off_t readlen = 0;
+        apr_bucket *b;
+        
+        while (status == APR_SUCCESS && !APR_BRIGADE_EMPTY(stream->input)) {
+            b = APR_BRIGADE_FIRST(stream->input);
+            if (!APR_BUCKET_IS_METADATA(b)) {
+                break;
+            }
+            if (APR_BUCKET_IS_EOS(b)) {
+                *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+            }
+            apr_bucket_delete(b);
+        }
+        for (b = APR_BRIGADE_FIRST(stream->input);
+             status == APR_SUCCESS && readlen < (apr_off_t)length
+             && b != APR_BRIGADE_SENTINEL(stream->input);
+             b = APR_BUCKET_NEXT(b)) {
+            if (APR_BUCKET_IS_METADATA(b)) {
+                if (APR_BUCKET_IS_EOS(b)) {
+                    *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+                }
+                break;
+            }
+            if (b->length == ((apr_size_t)-1)) {
+                const char *bdata;
+                apr_size_t blen;
+                status = apr_bucket_read(b, &bdata, &blen, APR_BLOCK_READ);
+            }
+            if (status == APR_SUCCESS) {
+                readlen += b->length;
+            }
+        }
+        if (status == APR_SUCCESS && !readlen 
+            && !(*data_flags & NGHTTP2_DATA_FLAG_EOF)) {
+            /* only meta data, nothing to send */
+            status = APR_EAGAIN;
+        }
+        else if (status == APR_SUCCESS) {
+            if (readlen > (apr_off_t)length) {
+                readlen = (apr_off_t)length;
+                *data_flags &= ~NGHTTP2_DATA_FLAG_EOF;
+            }
+            *data_flags |= NGHTTP2_DATA_FLAG_NO_COPY;
+            ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, stream->r, 
+                          "h2_proxy_stream(%s-%d): request DATA %ld, "
+                          "no copy, flags=%d", stream->session->id, 
+                          stream->id, (long)readlen, (int)*data_flags);
+            return (ssize_t)readlen;
+        }
+    }
+    else if (status == APR_SUCCESS) {
         ssize_t readlen = 0;
         while (status == APR_SUCCESS 
                && (readlen < length)
@@ -552,7 +768,8 @@ static ssize_t stream_request_data(nghttp2_session *ngh2, int32_t stream_id,
                       (int)*data_flags);
         return readlen;
     }
-    else if (APR_STATUS_IS_EAGAIN(status)) {
+    
+    if (APR_STATUS_IS_EAGAIN(status)) {
         /* suspended stream, needs to be re-awakened */
         ap_log_rerror(APLOG_MARK, APLOG_TRACE2, status, stream->r, 
                       "h2_proxy_stream(%s-%d): suspending", 
@@ -568,6 +785,83 @@ static ssize_t stream_request_data(nghttp2_session *ngh2, int32_t stream_id,
     }
 }
 
+static int stream_send_data(nghttp2_session *ngh2, nghttp2_frame *frame,
+                            const uint8_t *framehd, size_t length,
+                            nghttp2_data_source *source, void *user_data)
+{
+    h2_proxy_session *session = user_data;
+    h2_proxy_stream *stream;
+    apr_bucket *b, *e;
+    apr_status_t status;
+    
+    (void)source;
+    stream = nghttp2_session_get_stream_user_data(ngh2, frame->hd.stream_id);
+    if (!stream || frame->data.padlen) {
+        /* we never ask for padding */
+        return NGHTTP2_ERR_CALLBACK_FAILURE;
+    }
+    
+    b = apr_bucket_transient_create((const char*)framehd, 9, 
+                                    session->c->bucket_alloc);
+    APR_BRIGADE_INSERT_TAIL(session->output, b);
+    if (length) {
+        status = apr_brigade_partition(stream->input, (apr_off_t)length, &e);
+        if (status != APR_SUCCESS) {
+            apr_brigade_cleanup(session->output);
+            return NGHTTP2_ERR_CALLBACK_FAILURE;
+        }
+        if (session->p_conn->is_ssl || session->c->data_in_output_filters) {
+            /* The pass may not complete: mod_ssl or the core set buckets
+             * aside when the backend is not writable. These must not refer
+             * to memory of the front connection, copy the data. */
+            char *buf = apr_bucket_alloc(length, session->c->bucket_alloc);
+            apr_size_t blen = length;
+            
+            status = apr_brigade_flatten(stream->input, buf, &blen);
+            if (status != APR_SUCCESS || blen != length) {
+                apr_bucket_free(buf);
+                apr_brigade_cleanup(session->output);
+                return NGHTTP2_ERR_CALLBACK_FAILURE;
+            }
+            while ((b = APR_BRIGADE_FIRST(stream->input)) != e) {
+                apr_bucket_delete(b);
+            }
+            b = apr_bucket_heap_create(buf, length, apr_bucket_free, 
+                                       session->c->bucket_alloc);
+            APR_BRIGADE_INSERT_TAIL(session->output, b);
+        }
+        else {
+            /* The buckets belong to the front connection. The flush below
+             * writes them before we return, they are gone before the 
+             * request. */
+            while ((b = APR_BRIGADE_FIRST(stream->input)) != e) {
+                APR_BUCKET_REMOVE(b);
+                APR_BRIGADE_INSERT_TAIL(session->output, b);
+            }
+        }
+    }
+    
+    status = proxy_pass_brigade(session->c->bucket_alloc,  
+                                session->p_conn, session->c, 
+                                session->output, 1);
+    while (status == APR_SUCCESS && session->c->data_in_output_filters) {
+        /* the core kept some of it, which may be front buckets: 
+         * flush until they are written */
+        status = proxy_pass_brigade(session->c->bucket_alloc,  
+                                    session->p_conn, session->c, 
+                                    session->output, 1);
+    }
+    stream->data_sent += length;
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, status, stream->r, 
+                  "h2_proxy_stream(%s-%d): request DATA %ld, %ld total", 
+                  session->id, stream->id, (long)length, 
+                  (long)stream->data_sent);
+    if (status != APR_SUCCESS) {
+        return NGHTTP2_ERR_CALLBACK_FAILURE;
+    }
+    return 0;
+}
+
 #ifdef H2_NG2_INVALID_HEADER_CB
 static int on_invalid_header_cb(nghttp2_session *ngh2, 
                                 const nghttp2_frame *frame, 
@@ -621,6 +915,8 @@ h2_proxy_session *h2_proxy_session_setup(const char *id, proxy_conn_rec *p_conn,
     
         session->input = apr_brigade_create(session->pool, session->c->bucket_alloc);
         session->output = apr_brigade_create(session->pool, session->c->bucket_alloc);
+        apr_pool_cleanup_register(session->pool, session, rbuf_cleanup,
+                                  apr_pool_cleanup_null);
     
         nghttp2_session_callbacks_new(&cbs);
         nghttp2_session_callbacks_set_on_frame_recv_callback(cbs, on_frame_recv);
@@ -629,6 +925,7 @@ h2_proxy_session *h2_proxy_session_setup(const char *id, proxy_conn_rec *p_conn,
         nghttp2_session_callbacks_set_on_header_callback(cbs, on_header);
         nghttp2_session_callbacks_set_before_frame_send_callback(cbs, before_frame_send);
         nghttp2_session_callbacks_set_send_callback(cbs, raw_send);
+        nghttp2_session_callbacks_set_send_data_callback(cbs, stream_send_data);
 #ifdef H2_NG2_INVALID_HEADER_CB
         nghttp2_session_callbacks_set_on_invalid_header_callback(cbs, on_invalid_header_cb);
 #endif
@@ -651,7 +948,7 @@ h2_proxy_session *h2_proxy_session_setup(const char *id, proxy_conn_rec *p_conn,
             apr_interval_time_t age = apr_time_now() - session->last_frame_received;
             if (age > apr_time_from_sec(1)) {
                 session->check_ping = 1;
-                nghttp2_submit_ping(session->ngh2, 0, (const uint8_t *)"nevergonnagiveyouup");
+                submit_ping(session);
             }
         }
     }
@@ -679,8 +976,17 @@ static apr_status_t session_start(h2_proxy_session *session)
     rv = nghttp2_submit_settings(session->ngh2, NGHTTP2_FLAG_NONE, settings, 
                                  H2_ALEN(settings));
     
+    session->window_stream = settings[1].value;
+    session->window_conn = (1 << session->window_bits_connection) - 1;
+    if (session->window_max) {
+        /* autotuning starts small and grows both */
+        session->window_conn = H2MIN(session->window_conn, 
+                                     session->window_stream * H2_PROXY_WINDOW_STREAMS);
+        session->window_conn = H2MAX(session->window_conn, 
+                                     NGHTTP2_INITIAL_CONNECTION_WINDOW_SIZE);
+    }
     /* If the connection window is larger than our default, trigger a WINDOW_UPDATE */
-    add_conn_window = ((1 << session->window_bits_connection) - 1 -
+    add_conn_window = ((int)session->window_conn -
                        NGHTTP2_INITIAL_CONNECTION_WINDOW_SIZE);
     if (!rv && add_conn_window != 0) {
         rv = nghttp2_submit_window_update(session->ngh2, NGHTTP2_FLAG_NONE, 0, add_conn_window);
@@ -774,6 +1080,83 @@ static apr_status_t open_stream(h2_proxy_session *session, const char *url,
     return APR_SUCCESS;
 }
 
+/* Called by mod_http2 in the thread of the front connection. */
+static void stream_input_arrived(void *ctx)
+{
+    h2_proxy_session *session = ctx;
+    
+    if (apr_atomic_xchg32(&session->input_ready, 1) == 0) {
+        /* first one since the session last looked */
+        apr_pollset_wakeup(session->wait_set);
+    }
+}
+
+apr_status_t h2_proxy_session_make_wakeable(h2_proxy_session *session)
+{
+    apr_pollset_t *set;
+    apr_pollfd_t pfd;
+    apr_status_t status;
+    
+    if (session->wait_set) {
+        return APR_SUCCESS;
+    }
+    status = apr_pollset_create(&set, 1, session->pool, APR_POLLSET_WAKEABLE);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+    memset(&pfd, 0, sizeof(pfd));
+    pfd.p = session->pool;
+    pfd.desc_type = APR_POLL_SOCKET;
+    pfd.reqevents = APR_POLLIN;
+    pfd.desc.s = ap_get_conn_socket(session->c);
+    if (!pfd.desc.s) {
+        return APR_ENOTSOCK;
+    }
+    status = apr_pollset_add(set, &pfd);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+    session->wait_set = set;
+    return APR_SUCCESS;
+}
+
+void h2_proxy_session_wakeup(h2_proxy_session *session)
+{
+    if (session->wait_set) {
+        stream_input_arrived(session);
+    }
+}
+
+static void stream_notify_on(h2_proxy_session *session, h2_proxy_stream *stream)
+{
+    if (!session->input_notify) {
+        return;
+    }
+    if (h2_proxy_session_make_wakeable(session) != APR_SUCCESS) {
+        session->input_notify = NULL;
+        return;
+    }
+    if (session->input_notify(stream->r, stream_input_arrived, 
+                              session) == APR_SUCCESS) {
+        stream->notified = 1;
+    }
+}
+
+static void stream_notify_off(h2_proxy_stream *stream)
+{
+    if (stream->notified) {
+        stream->session->input_notify(stream->r, NULL, NULL);
+        stream->notified = 0;
+    }
+}
+
+static int notify_off_iter(void *udata, void *val)
+{
+    (void)udata;
+    stream_notify_off(val);
+    return 1;
+}
+
 static apr_status_t submit_stream(h2_proxy_session *session, h2_proxy_stream *stream)
 {
     h2_proxy_ngheader *hd;
@@ -815,6 +1198,9 @@ static apr_status_t submit_stream(h2_proxy_session *session, h2_proxy_stream *st
         stream->id = rv;
         stream->state = H2_STREAM_ST_OPEN;
         h2_proxy_ihash_add(session->streams, stream);
+        if (pp) {
+            stream_notify_on(session, stream);
+        }
         dispatch_event(session, H2_PROXYS_EV_STREAM_SUBMITTED, rv, NULL);
         
         return APR_SUCCESS;
@@ -869,11 +1255,87 @@ static apr_status_t feed_brigade(h2_proxy_session *session, apr_bucket_brigade *
     return status;
 }
 
+/* Reading the socket directly only gives the same data as the filter
+ * chain if there is nothing on the backend connection but the core
+ * input filter. */
+static int has_plain_input(conn_rec *c)
+{
+    ap_filter_t *f = c->input_filters;
+    
+    return (f && !f->next && f->frec->name 
+            && !strcasecmp("core_in", f->frec->name));
+}
+
+/* Read from the plain backend socket into the shared buffer and feed
+ * nghttp2 from there. A buffer that still has slices in flight is left
+ * to them and a new one is allocated. */
+static apr_status_t read_shared(h2_proxy_session *session, int block, 
+                                apr_interval_time_t timeout)
+{
+    apr_socket_t *socket;
+    apr_interval_time_t save_timeout;
+    apr_size_t len = H2_PROXY_RBUF_SIZE;
+    apr_status_t status;
+    ssize_t n;
+    
+    socket = ap_get_conn_socket(session->c);
+    if (!socket) {
+        return APR_ENOTIMPL;
+    }
+    if (session->rbuf && apr_atomic_read32(&session->rbuf->refs) > 1) {
+        rbuf_cleanup(session);
+    }
+    if (!session->rbuf) {
+        session->rbuf = malloc(H2_PROXY_RBUF_HDR_LEN + H2_PROXY_RBUF_SIZE);
+        if (!session->rbuf) {
+            return APR_ENOMEM;
+        }
+        apr_atomic_set32(&session->rbuf->refs, 1);
+    }
+    
+    apr_socket_timeout_get(socket, &save_timeout);
+    apr_socket_timeout_set(socket, block? timeout : 0);
+    status = apr_socket_recv(socket, H2_PROXY_RBUF_DATA(session->rbuf), &len);
+    apr_socket_timeout_set(socket, save_timeout);
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE3, status, session->c, 
+                  "h2_proxy_session(%s): read %ld bytes from socket", 
+                  session->id, (long)len);
+    if (status != APR_SUCCESS || len == 0) {
+        return (status != APR_SUCCESS)? status : APR_EOF;
+    }
+    
+    session->rbuf_len = len;
+    n = nghttp2_session_mem_recv(session->ngh2, 
+                                 (const uint8_t *)H2_PROXY_RBUF_DATA(session->rbuf), 
+                                 len);
+    session->rbuf_len = 0;
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, session->c, 
+                  "h2_proxy_session(%s): feeding %ld bytes -> %ld", 
+                  session->id, (long)len, (long)n);
+    if (n < 0 && nghttp2_is_fatal((int)n)) {
+        return APR_EGENERAL;
+    }
+    return APR_SUCCESS;
+}
+
 static apr_status_t h2_proxy_session_read(h2_proxy_session *session, int block, 
                                           apr_interval_time_t timeout)
 {
     apr_status_t status = APR_SUCCESS;
     
+    if (session->zero_copy && !session->p_conn->is_ssl
+        && APR_BRIGADE_EMPTY(session->input) && has_plain_input(session->c)) {
+        status = read_shared(session, block, timeout);
+        if (status == APR_SUCCESS || APR_STATUS_IS_TIMEUP(status)
+            || APR_STATUS_IS_EAGAIN(status)) {
+            return status;
+        }
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, status, session->c,
+                      "h2_proxy_session(%s): read error", session->id);
+        dispatch_event(session, H2_PROXYS_EV_CONN_ERROR, status, NULL);
+        return status;
+    }
+    
     if (APR_BRIGADE_EMPTY(session->input)) {
         apr_socket_t *socket = NULL;
         apr_time_t save_timeout = -1;
@@ -950,6 +1412,54 @@ static void stream_resume(h2_proxy_stream *stream)
     dispatch_event(session, H2_PROXYS_EV_STREAM_RESUMED, 0, NULL);
 }
 
+/* Wait for the backend to send something or, when the front notifies us,
+ * for request input to arrive. Returns APR_EAGAIN when woken up by the
+ * front and APR_TIMEUP when nothing happened. */
+static apr_status_t wait_io(h2_proxy_session *session, 
+                            apr_interval_time_t timeout)
+{
+    const apr_pollfd_t *results;
+    apr_int32_t nresults;
+    apr_status_t status;
+    
+    if (!session->wait_set) {
+        return h2_proxy_session_read(session, 1, timeout);
+    }
+    if (apr_atomic_read32(&session->input_ready)) {
+        return APR_EAGAIN;
+    }
+    /* the filters may hold data the socket poll does not see */
+    status = h2_proxy_session_read(session, 0, 0);
+    if (!APR_STATUS_IS_EAGAIN(status)) {
+        return status;
+    }
+    status = apr_pollset_poll(session->wait_set, timeout, &nresults, &results);
+    if (status == APR_SUCCESS) {
+        status = h2_proxy_session_read(session, 0, 0);
+    }
+    else if (APR_STATUS_IS_EINTR(status)) {
+        /* woken up or signal, either way look again */
+        status = APR_EAGAIN;
+    }
+    return status;
+}
+
+/* If all suspended streams get notified of input, we may wait longer. */
+static int all_notified(h2_proxy_session *session)
+{
+    h2_proxy_stream *stream;
+    int i;
+    
+    for (i = 0; i < session->suspended->nelts; ++i) {
+        stream = nghttp2_session_get_stream_user_data(session->ngh2, 
+                                                      session->suspended->elts[i]);
+        if (stream && !stream->notified) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
 static apr_status_t check_suspended(h2_proxy_session *session)
 {
     h2_proxy_stream *stream;
@@ -1040,6 +1550,11 @@ static int is_accepting_streams(h2_proxy_session *session)
     }
 }
 
+int h2_proxy_session_is_accepting(h2_proxy_session *session)
+{
+    return is_accepting_streams(session);
+}
+
 static void transit(h2_proxy_session *session, const char *action, 
                     h2_proxys_state nstate)
 {
@@ -1233,6 +1748,7 @@ static void ev_stream_done(h2_proxy_session *session, int stream_id,
         }
         
         stream->state = H2_STREAM_ST_CLOSED;
+        stream_notify_off(stream);
         h2_proxy_ihash_remove(session->streams, stream_id);
         h2_proxy_iq_remove(session->suspended, stream_id);
         if (session->done) {
@@ -1404,6 +1920,13 @@ run_loop:
             break;
             
         case H2_PROXYS_ST_WAIT:
+            if (!session->ping_outstanding 
+                && apr_time_now() - session->ping_sent > H2_PROXY_PING_INTERVAL) {
+                submit_ping(session);
+                send_loop(session);
+            }
+            /* input arriving from now on, wakes the wait below */
+            apr_atomic_set32(&session->input_ready, 0);
             if (check_suspended(session) == APR_EAGAIN) {
                 /* no stream has become resumed. Do a blocking read with
                  * ever increasing timeouts... */
@@ -1411,11 +1934,13 @@ run_loop:
                     session->wait_timeout = 25;
                 }
                 else {
-                    session->wait_timeout = H2MIN(apr_time_from_msec(100), 
-                                                  2*session->wait_timeout);
+                    session->wait_timeout = H2MIN(
+                        (session->wait_set && all_notified(session))?
+                        H2_PROXY_WAIT_MAX : apr_time_from_msec(100), 
+                        2*session->wait_timeout);
                 }
                 
-                status = h2_proxy_session_read(session, 1, session->wait_timeout);
+                status = wait_io(session, session->wait_timeout);
                 ap_log_cerror(APLOG_MARK, APLOG_TRACE3, status, session->c, 
                               APLOGNO(03365)
                               "h2_proxy_session(%s): WAIT read, timeout=%fms", 
@@ -1493,6 +2018,7 @@ static int done_iter(void *udata, void *val)
     h2_proxy_stream *stream = val;
     int touched = (stream->data_sent || 
                    stream->id <= ctx->session->last_stream_id);
+    stream_notify_off(stream);
     ctx->done(ctx->session, stream->r, APR_ECONNABORTED, touched);
     return 1;
 }
@@ -76,6 +76,8 @@ struct h2_proxy_session {
     unsigned int aborted : 1;
     unsigned int check_ping : 1;
     unsigned int h2_front : 1; /* if front-end connection is HTTP/2 */
+    unsigned int zero_copy : 1; /* slice response DATA from a shared read buffer,
+                                   pass request DATA on without copying */
 
     h2_proxy_request_done *done;
     void *user_data;
@@ -92,6 +94,25 @@ struct h2_proxy_session {
     int last_stream_id;     /* last stream id processed by backend, or 0 */
     apr_time_t last_frame_received;
     
+    unsigned int ping_outstanding : 1;
+    apr_time_t ping_sent;   /* when the last PING was sent */
+    apr_interval_time_t rtt; /* smoothed PING round trip time, 0 if unknown */
+    
+    apr_size_t window_max;    /* limit for autotuned stream windows, 0 if off */
+    apr_size_t window_stream; /* current initial stream window */
+    apr_size_t window_conn;   /* current connection window */
+    apr_off_t bdp_bytes;      /* DATA received since the last PING was sent */
+    
+    struct h2_proxy_rbuf *rbuf; /* shared read buffer, if zero_copy */
+    apr_size_t rbuf_len;        /* bytes in rbuf being fed to nghttp2 */
+    
+    /* the http2_req_input_notify() of mod_http2, if the front is HTTP/2 */
+    apr_status_t (*input_notify)(request_rec *r, void (*cb)(void *ctx), 
+                                 void *ctx);
+    struct apr_pollset_t *wait_set; /* backend socket, woken on request input
+                                     * or h2_proxy_session_wakeup() */
+    volatile apr_uint32_t input_ready; /* request input arrived while waiting */
+    
     apr_bucket_brigade *input;
     apr_bucket_brigade *output;
 };
@@ -116,6 +137,30 @@ apr_status_t h2_proxy_session_submit(h2_proxy_session *s, const char *url,
  */
 apr_status_t h2_proxy_session_process(h2_proxy_session *s);
 
+/**
+ * Check if the session may still open new streams.
+ * @param s the session to check
+ * @return != 0 iff new requests may be submitted
+ */
+int h2_proxy_session_is_accepting(h2_proxy_session *s);
+
+/**
+ * Let a session wait on its backend so that h2_proxy_session_wakeup()
+ * interrupts it. Call from the thread processing the session.
+ * @param s the session to prepare
+ * @return APR_SUCCESS or the error creating the pollset
+ */
+apr_status_t h2_proxy_session_make_wakeable(h2_proxy_session *s);
+
+/**
+ * Make the thread processing the session return from 
+ * h2_proxy_session_process() soon, when it waits on the backend. May be
+ * called from any thread while the session exists. Does nothing unless
+ * h2_proxy_session_make_wakeable() succeeded before.
+ * @param s the session to wake up
+ */
+void h2_proxy_session_wakeup(h2_proxy_session *s);
+
 void h2_proxy_session_cancel_all(h2_proxy_session *s);
 
 void h2_proxy_session_cleanup(h2_proxy_session *s, h2_proxy_request_done *done);
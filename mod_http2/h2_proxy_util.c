@@ -29,6 +29,7 @@
 #include <nghttp2/nghttp2.h>
 
 #include "h2.h"
+#include "h2_chars.h"
 #include "h2_proxy_util.h"
 
 APLOG_USE_MODULE(proxy_http2);
@@ -66,79 +67,161 @@ unsigned char h2_proxy_log2(int n)
 /*******************************************************************************
  * ihash - hash for structs with int identifier
  ******************************************************************************/
+/* An open addressing table with linear probing, keyed directly on the int.
+ * Stream ids of one side are all odd or all even and increase monotonically.
+ * Dropping the lowest bit puts the streams open at a time into consecutive
+ * slots, the odd and even ids each into their own half of the table.
+ * Removal shifts the rest of a probe run back, so there are no deleted
+ * markers to clean up later.
+ */
+#define H2_IHASH_MIN_SIZE   16
+
+typedef struct {
+    int id;
+    void *val;
+} h2_proxy_ihash_slot;
+
 struct h2_proxy_ihash_t {
-    apr_hash_t *hash;
+    apr_pool_t *pool;
+    h2_proxy_ihash_slot *slots;
+    apr_uint32_t mask;
+    size_t count;
     size_t ioff;
 };
 
-static unsigned int ihash(const char *key, apr_ssize_t *klen)
+#define IH_ID(ih, val)      (*((int*)((char *)(val) + (ih)->ioff)))
+
+static apr_uint32_t ihash_home(h2_proxy_ihash_t *ih, int id)
 {
-    return (unsigned int)(*((int*)key));
+    apr_uint32_t u = (apr_uint32_t)id;
+    return ((u >> 1) + (u & 1) * ((ih->mask + 1) >> 1)) & ih->mask;
+}
+
+/* Index of the slot holding id or of the empty slot it would go into. There 
+ * is always an empty slot, as the table never fills beyond 3/4. */
+static apr_uint32_t ihash_find(h2_proxy_ihash_t *ih, int id)
+{
+    apr_uint32_t i = ihash_home(ih, id);
+    
+    while (ih->slots[i].val && ih->slots[i].id != id) {
+        i = (i + 1) & ih->mask;
+    }
+    return i;
+}
+
+static void ihash_resize(h2_proxy_ihash_t *ih, apr_uint32_t size)
+{
+    h2_proxy_ihash_slot *old = ih->slots;
+    apr_uint32_t i, old_size = ih->mask + 1;
+    
+    ih->slots = apr_pcalloc(ih->pool, size * sizeof(h2_proxy_ihash_slot));
+    ih->mask = size - 1;
+    for (i = 0; i < old_size; ++i) {
+        if (old[i].val) {
+            ih->slots[ihash_find(ih, old[i].id)] = old[i];
+        }
+    }
+}
+
+static void ihash_remove_at(h2_proxy_ihash_t *ih, apr_uint32_t i)
+{
+    apr_uint32_t j, home;
+    
+    ih->slots[i].val = NULL;
+    --ih->count;
+    for (j = (i + 1) & ih->mask; ih->slots[j].val; j = (j + 1) & ih->mask) {
+        home = ihash_home(ih, ih->slots[j].id);
+        /* move into the hole, unless the home slot lies after it */
+        if (((j - home) & ih->mask) >= ((j - i) & ih->mask)) {
+            ih->slots[i] = ih->slots[j];
+            ih->slots[j].val = NULL;
+            i = j;
+        }
+    }
 }
 
 h2_proxy_ihash_t *h2_proxy_ihash_create(apr_pool_t *pool, size_t offset_of_int)
 {
     h2_proxy_ihash_t *ih = apr_pcalloc(pool, sizeof(h2_proxy_ihash_t));
-    ih->hash = apr_hash_make_custom(pool, ihash);
+    ih->pool = pool;
+    ih->slots = apr_pcalloc(pool, 
+                            H2_IHASH_MIN_SIZE * sizeof(h2_proxy_ihash_slot));
+    ih->mask = H2_IHASH_MIN_SIZE - 1;
     ih->ioff = offset_of_int;
     return ih;
 }
 
 size_t h2_proxy_ihash_count(h2_proxy_ihash_t *ih)
 {
-    return apr_hash_count(ih->hash);
+    return ih->count;
 }
 
 int h2_proxy_ihash_empty(h2_proxy_ihash_t *ih)
 {
-    return apr_hash_count(ih->hash) == 0;
+    return ih->count == 0;
 }
 
 void *h2_proxy_ihash_get(h2_proxy_ihash_t *ih, int id)
 {
-    return apr_hash_get(ih->hash, &id, sizeof(id));
-}
-
-typedef struct {
-    h2_proxy_ihash_iter_t *iter;
-    void *ctx;
-} iter_ctx;
-
-static int ihash_iter(void *ctx, const void *key, apr_ssize_t klen, 
-                     const void *val)
-{
-    iter_ctx *ictx = ctx;
-    return ictx->iter(ictx->ctx, (void*)val); /* why is this passed const?*/
+    return ih->slots[ihash_find(ih, id)].val;
 }
 
 int h2_proxy_ihash_iter(h2_proxy_ihash_t *ih, h2_proxy_ihash_iter_t *fn, void *ctx)
 {
-    iter_ctx ictx;
-    ictx.iter = fn;
-    ictx.ctx = ctx;
-    return apr_hash_do(ihash_iter, &ictx, ih->hash);
+    apr_uint32_t i, n;
+    
+    if (ih->count == 0) {
+        return 1;
+    }
+    /* Walk backwards, starting at an empty slot. Removing the current
+     * member only moves members already visited, so fn may do that. */
+    for (i = 0; ih->slots[i].val; ++i) {
+        /* find the empty slot */
+    }
+    for (n = ih->mask; n > 0; --n) {
+        i = (i - 1) & ih->mask;
+        if (ih->slots[i].val && !fn(ctx, ih->slots[i].val)) {
+            return 0;
+        }
+    }
+    return 1;
 }
 
 void h2_proxy_ihash_add(h2_proxy_ihash_t *ih, void *val)
 {
-    apr_hash_set(ih->hash, ((char *)val + ih->ioff), sizeof(int), val);
+    int id = IH_ID(ih, val);
+    apr_uint32_t i = ihash_find(ih, id);
+    
+    if (!ih->slots[i].val) {
+        if ((ih->count + 1) * 4 > (ih->mask + 1) * 3) {
+            ihash_resize(ih, (ih->mask + 1) * 2);
+            i = ihash_find(ih, id);
+        }
+        ih->slots[i].id = id;
+        ++ih->count;
+    }
+    ih->slots[i].val = val;
 }
 
 void h2_proxy_ihash_remove(h2_proxy_ihash_t *ih, int id)
 {
-    apr_hash_set(ih->hash, &id, sizeof(id), NULL);
+    apr_uint32_t i = ihash_find(ih, id);
+    
+    if (ih->slots[i].val) {
+        ihash_remove_at(ih, i);
+    }
 }
 
 void h2_proxy_ihash_remove_val(h2_proxy_ihash_t *ih, void *val)
 {
-    int id = *((int*)((char *)val + ih->ioff));
-    apr_hash_set(ih->hash, &id, sizeof(id), NULL);
+    h2_proxy_ihash_remove(ih, IH_ID(ih, val));
 }
 
 
 void h2_proxy_ihash_clear(h2_proxy_ihash_t *ih)
 {
-    apr_hash_clear(ih->hash);
+    memset(ih->slots, 0, (ih->mask + 1) * sizeof(h2_proxy_ihash_slot));
+    ih->count = 0;
 }
 
 typedef struct {
@@ -504,20 +587,7 @@ int h2_proxy_res_ignore_header(const char *name, size_t len)
 
 void h2_proxy_util_camel_case_header(char *s, size_t len)
 {
-    size_t start = 1;
-    size_t i;
-    for (i = 0; i < len; ++i) {
-        if (start) {
-            if (s[i] >= 'a' && s[i] <= 'z') {
-                s[i] -= 'a' - 'A';
-            }
-            
-            start = 0;
-        }
-        else if (s[i] == '-') {
-            start = 1;
-        }
-    }
+    h2_chars_camel_case(s, len);
 }
 
 /*******************************************************************************
@@ -730,63 +800,6 @@ typedef struct {
     int link_end;
 } link_ctx;
 
-static int attr_char(char c) 
-{
-    switch (c) {
-        case '!':
-        case '#':
-        case '$':
-        case '&':
-        case '+':
-        case '-':
-        case '.':
-        case '^':
-        case '_':
-        case '`':
-        case '|':
-        case '~':
-            return 1;
-        default:
-            return apr_isalnum(c);
-    }
-}
-
-static int ptoken_char(char c) 
-{
-    switch (c) {
-        case '!':
-        case '#':
-        case '$':
-        case '&':
-        case '\'':
-        case '(':
-        case ')':
-        case '*':
-        case '+':
-        case '-':
-        case '.':
-        case '/':
-        case ':':
-        case '<':
-        case '=':
-        case '>':
-        case '?':
-        case '@':
-        case '[':
-        case ']':
-        case '^':
-        case '_':
-        case '`':
-        case '{':
-        case '|':
-        case '}':
-        case '~':
-            return 1;
-        default:
-            return apr_isalnum(c);
-    }
-}
-
 static int skip_ws(link_ctx *ctx)
 {
     char c;
@@ -833,10 +846,9 @@ static int skip_qstring(link_ctx *ctx)
 static int skip_ptoken(link_ctx *ctx)
 {
     if (skip_ws(ctx)) {
-        int i;
-        for (i = ctx->i; i < ctx->slen && ptoken_char(ctx->s[i]); ++i) {
-            /* nop */
-        }
+        int i = ctx->i + (int)h2_chars_span(ctx->s + ctx->i, 
+                                            (apr_size_t)(ctx->slen - ctx->i), 
+                                            H2_CHAR_PTOKEN);
         if (i > ctx->i) {
             ctx->i = i;
             return 1;
@@ -864,10 +876,9 @@ static int read_link(link_ctx *ctx)
 static int skip_pname(link_ctx *ctx)
 {
     if (skip_ws(ctx)) {
-        int i;
-        for (i = ctx->i; i < ctx->slen && attr_char(ctx->s[i]); ++i) {
-            /* nop */
-        }
+        int i = ctx->i + (int)h2_chars_span(ctx->s + ctx->i, 
+                                            (apr_size_t)(ctx->slen - ctx->i), 
+                                            H2_CHAR_ATTR);
         if (i > ctx->i) {
             ctx->i = i;
             return 1;
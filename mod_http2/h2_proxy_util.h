@@ -44,7 +44,8 @@ void *h2_proxy_ihash_get(h2_proxy_ihash_t *ih, int id);
 
 /**
  * Iterate over the hash members (without defined order) and invoke
- * fn for each member until 0 is returned.
+ * fn for each member until 0 is returned. fn may remove the member it
+ * is invoked on, but must not add new ones.
  * @param ih the hash to iterate over
  * @param fn the function to invoke on each member
  * @param ctx user supplied data passed into each iteration call
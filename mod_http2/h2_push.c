@@ -21,6 +21,7 @@
 #include <apr_strings.h>
 #include <apr_hash.h>
 #include <apr_time.h>
+#include <apr_thread_mutex.h>
 
 #ifdef H2_OPENSSL
 #include <openssl/sha.h>
@@ -31,11 +32,15 @@
 #include <http_log.h>
 
 #include "h2_private.h"
+#include "h2_chars.h"
+#include "h2_config.h"
 #include "h2_h2.h"
 #include "h2_util.h"
 #include "h2_push.h"
+#include "h2_push_cache.h"
 #include "h2_request.h"
 #include "h2_headers.h"
+#include "h2_metrics.h"
 #include "h2_session.h"
 #include "h2_stream.h"
 
@@ -57,11 +62,21 @@ static const char *policy_str(h2_push_policy policy)
     }
 }
 
+/* A "rel=preload" link found in a Link header, before it is checked 
+ * against the authority of the request. */
+typedef struct {
+    const char *scheme;     /* NULL for relative references */
+    const char *hostinfo;   /* NULL for relative references */
+    const char *path;       /* path and query of the resource */
+    int critical;
+} link_push;
+
 typedef struct {
     const h2_request *req;
     apr_uint32_t push_policy;
     apr_pool_t *pool;
     apr_array_header_t *pushes;
+    apr_array_header_t *links;
     const char *s;
     size_t slen;
     size_t i;
@@ -71,63 +86,6 @@ typedef struct {
     char b[4096];
 } link_ctx;
 
-static int attr_char(char c) 
-{
-    switch (c) {
-        case '!':
-        case '#':
-        case '$':
-        case '&':
-        case '+':
-        case '-':
-        case '.':
-        case '^':
-        case '_':
-        case '`':
-        case '|':
-        case '~':
-            return 1;
-        default:
-            return apr_isalnum(c);
-    }
-}
-
-static int ptoken_char(char c) 
-{
-    switch (c) {
-        case '!':
-        case '#':
-        case '$':
-        case '&':
-        case '\'':
-        case '(':
-        case ')':
-        case '*':
-        case '+':
-        case '-':
-        case '.':
-        case '/':
-        case ':':
-        case '<':
-        case '=':
-        case '>':
-        case '?':
-        case '@':
-        case '[':
-        case ']':
-        case '^':
-        case '_':
-        case '`':
-        case '{':
-        case '|':
-        case '}':
-        case '~':
-            return 1;
-        default:
-            return apr_isalnum(c);
-    }
-}
-
 static int skip_ws(link_ctx *ctx)
 {
     char c;
@@ -183,10 +141,8 @@ static int read_qstring(link_ctx *ctx, const char **ps)
 static int read_ptoken(link_ctx *ctx, const char **ps)
 {
     if (skip_ws(ctx)) {
-        size_t i;
-        for (i = ctx->i; i < ctx->slen && ptoken_char(ctx->s[i]); ++i) {
-            /* nop */
-        }
+        size_t i = ctx->i + h2_chars_span(ctx->s + ctx->i, 
+                                          ctx->slen - ctx->i, H2_CHAR_PTOKEN);
         if (i > ctx->i) {
             *ps = mk_str(ctx, i);
             ctx->i = i;
@@ -213,10 +169,8 @@ static int read_link(link_ctx *ctx)
 static int read_pname(link_ctx *ctx, const char **pname)
 {
     if (skip_ws(ctx)) {
-        size_t i;
-        for (i = ctx->i; i < ctx->slen && attr_char(ctx->s[i]); ++i) {
-            /* nop */
-        }
+        size_t i = ctx->i + h2_chars_span(ctx->s + ctx->i, 
+                                          ctx->slen - ctx->i, H2_CHAR_ATTR);
         if (i > ctx->i) {
             *pname = mk_str(ctx, i);
             ctx->i = i;
@@ -267,12 +221,12 @@ static void init_params(link_ctx *ctx)
     }
 }
 
-static int same_authority(const h2_request *req, const apr_uri_t *uri)
+static int same_authority(const h2_request *req, const link_push *link)
 {
-    if (uri->scheme != NULL && strcmp(uri->scheme, req->scheme)) {
+    if (link->scheme != NULL && strcmp(link->scheme, req->scheme)) {
         return 0;
     }
-    if (uri->hostinfo != NULL && strcmp(uri->hostinfo, req->authority)) {
+    if (link->hostinfo != NULL && strcmp(link->hostinfo, req->authority)) {
         return 0;
     }
     return 1;
@@ -315,60 +269,73 @@ static int has_relation(link_ctx *ctx, const char *rel)
     return 0;
 }
 
-static int add_push(link_ctx *ctx)
+static int add_link(link_ctx *ctx)
 {
     /* so, we have read a Link header and need to decide
      * if we transform it into a push.
      */
     if (has_relation(ctx, "preload") && !has_param(ctx, "nopush")) {
         apr_uri_t uri;
-        if (apr_uri_parse(ctx->pool, ctx->link, &uri) == APR_SUCCESS) {
-            if (uri.path && same_authority(ctx->req, &uri)) {
-                char *path;
-                const char *method;
-                apr_table_t *headers;
-                h2_request *req;
-                h2_push *push;
-                
-                /* We only want to generate pushes for resources in the
-                 * same authority than the original request.
-                 * icing: i think that is wise, otherwise we really need to
-                 * check that the vhost/server is available and uses the same
-                 * TLS (if any) parameters.
-                 */
-                path = apr_uri_unparse(ctx->pool, &uri, APR_URI_UNP_OMITSITEPART);
-                push = apr_pcalloc(ctx->pool, sizeof(*push));
-                switch (ctx->push_policy) {
-                    case H2_PUSH_HEAD:
-                        method = "HEAD";
-                        break;
-                    default:
-                        method = "GET";
-                        break;
-                }
-                headers = apr_table_make(ctx->pool, 5);
-                apr_table_do(set_push_header, headers, ctx->req->headers, NULL);
-                req = h2_req_create(0, ctx->pool, method, ctx->req->scheme,
-                                    ctx->req->authority, path, headers,
-                                    ctx->req->serialize);
-                /* atm, we do not push on pushes */
-                h2_request_end_headers(req, ctx->pool, 1, 0);
-                push->req = req;
-                if (has_param(ctx, "critical")) {
-                    h2_priority *prio = apr_pcalloc(ctx->pool, sizeof(*prio));
-                    prio->dependency = H2_DEPENDANT_BEFORE;
-                    push->priority = prio;
-                }
-                if (!ctx->pushes) {
-                    ctx->pushes = apr_array_make(ctx->pool, 5, sizeof(h2_push*));
-                }
-                APR_ARRAY_PUSH(ctx->pushes, h2_push*) = push;
+        if (apr_uri_parse(ctx->pool, ctx->link, &uri) == APR_SUCCESS && uri.path) {
+            link_push *link;
+            
+            if (!ctx->links) {
+                ctx->links = apr_array_make(ctx->pool, 5, sizeof(link_push));
             }
+            link = (link_push *)apr_array_push(ctx->links);
+            link->scheme = uri.scheme;
+            link->hostinfo = uri.hostinfo;
+            link->path = apr_uri_unparse(ctx->pool, &uri, APR_URI_UNP_OMITSITEPART);
+            link->critical = has_param(ctx, "critical");
         }
     }
     return 0;
 }
 
+static void add_push(link_ctx *ctx, const link_push *link)
+{
+    const char *method;
+    apr_table_t *headers;
+    h2_request *req;
+    h2_push *push;
+    
+    /* We only want to generate pushes for resources in the
+     * same authority than the original request.
+     * icing: i think that is wise, otherwise we really need to
+     * check that the vhost/server is available and uses the same
+     * TLS (if any) parameters.
+     */
+    if (!same_authority(ctx->req, link)) {
+        return;
+    }
+    push = apr_pcalloc(ctx->pool, sizeof(*push));
+    switch (ctx->push_policy) {
+        case H2_PUSH_HEAD:
+            method = "HEAD";
+            break;
+        default:
+            method = "GET";
+            break;
+    }
+    headers = apr_table_make(ctx->pool, 5);
+    apr_table_do(set_push_header, headers, ctx->req->headers, NULL);
+    req = h2_req_create(0, ctx->pool, method, ctx->req->scheme,
+                        ctx->req->authority, link->path, headers,
+                        ctx->req->serialize);
+    /* atm, we do not push on pushes */
+    h2_request_end_headers(req, ctx->pool, 1, 0);
+    push->req = req;
+    if (link->critical) {
+        h2_priority *prio = apr_pcalloc(ctx->pool, sizeof(*prio));
+        prio->dependency = H2_DEPENDANT_BEFORE;
+        push->priority = prio;
+    }
+    if (!ctx->pushes) {
+        ctx->pushes = apr_array_make(ctx->pool, 5, sizeof(h2_push*));
+    }
+    APR_ARRAY_PUSH(ctx->pushes, h2_push*) = push;
+}
+
 static void inspect_link(link_ctx *ctx, const char *s, size_t slen)
 {
     /* RFC 5988 <https://tools.ietf.org/html/rfc5988#section-6.2.1>
@@ -418,17 +385,108 @@ static void inspect_link(link_ctx *ctx, const char *s, size_t slen)
         while (read_param(ctx)) {
             /* nop */
         }
-        add_push(ctx);
+        add_link(ctx);
         if (!read_sep(ctx)) {
             break;
         }
      }
 }
 
+/*******************************************************************************
+ * link cache
+ *
+ * Responses from the same handler tend to carry the very same Link headers,
+ * e.g. the ones added for H2PushResource. Each child keeps the links parsed
+ * from a header value, so that only the authority check and the creation of
+ * the push requests remain per response.
+ * Entries are never removed. Once the cache is full, new values are parsed
+ * every time, which keeps lookups safe without reference counting.
+ ******************************************************************************/
+
+#define H2_LINK_CACHE_MAX       1000  /* max # of header values cached */
+#define H2_LINK_CACHE_MAX_LEN   4096  /* max length of a header value cached */
+
+static apr_thread_mutex_t *link_cache_mutex;
+static apr_pool_t *link_cache_pool;
+static apr_hash_t *link_cache;
+
+void h2_push_child_init(apr_pool_t *pchild, server_rec *s)
+{
+    apr_status_t status;
+    
+    link_cache = NULL;
+    status = apr_thread_mutex_create(&link_cache_mutex, 
+                                     APR_THREAD_MUTEX_DEFAULT, pchild);
+    if (status == APR_SUCCESS) {
+        status = apr_pool_create(&link_cache_pool, pchild);
+    }
+    if (status != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, status, s,
+                     "h2_push: link cache disabled");
+        return;
+    }
+    apr_pool_tag(link_cache_pool, "h2_link_cache");
+    link_cache = apr_hash_make(link_cache_pool);
+}
+
+static apr_array_header_t *links_copy(apr_pool_t *p, const apr_array_header_t *links)
+{
+    apr_array_header_t *copy;
+    int i;
+    
+    copy = apr_array_make(p, links? links->nelts : 0, sizeof(link_push));
+    for (i = 0; links && i < links->nelts; ++i) {
+        const link_push *link = &APR_ARRAY_IDX(links, i, link_push);
+        link_push *lcopy = (link_push *)apr_array_push(copy);
+        
+        lcopy->scheme = apr_pstrdup(p, link->scheme);
+        lcopy->hostinfo = apr_pstrdup(p, link->hostinfo);
+        lcopy->path = apr_pstrdup(p, link->path);
+        lcopy->critical = link->critical;
+    }
+    return copy;
+}
+
+static const apr_array_header_t *get_links(link_ctx *ctx, const char *value)
+{
+    apr_size_t vlen = strlen(value);
+    const apr_array_header_t *links = NULL;
+    int cacheable = (link_cache && vlen <= H2_LINK_CACHE_MAX_LEN);
+    
+    if (cacheable) {
+        apr_thread_mutex_lock(link_cache_mutex);
+        links = apr_hash_get(link_cache, value, (apr_ssize_t)vlen);
+        apr_thread_mutex_unlock(link_cache_mutex);
+        if (links) {
+            return links;
+        }
+    }
+    
+    ctx->links = NULL;
+    inspect_link(ctx, value, vlen);
+    
+    if (cacheable) {
+        apr_thread_mutex_lock(link_cache_mutex);
+        if (apr_hash_count(link_cache) < H2_LINK_CACHE_MAX 
+            && !apr_hash_get(link_cache, value, (apr_ssize_t)vlen)) {
+            /* values without any push are remembered as empty arrays */
+            apr_hash_set(link_cache, apr_pstrmemdup(link_cache_pool, value, vlen),
+                         (apr_ssize_t)vlen, links_copy(link_cache_pool, ctx->links));
+        }
+        apr_thread_mutex_unlock(link_cache_mutex);
+    }
+    return ctx->links;
+}
+
 static int head_iter(void *ctx, const char *key, const char *value) 
 {
     if (!apr_strnatcasecmp("link", key)) {
-        inspect_link(ctx, value, strlen(value));
+        const apr_array_header_t *links = get_links(ctx, value);
+        int i;
+        
+        for (i = 0; links && i < links->nelts; ++i) {
+            add_push(ctx, &APR_ARRAY_IDX(links, i, link_push));
+        }
     }
     return 1;
 }
@@ -473,9 +531,10 @@ apr_array_header_t *h2_push_collect(apr_pool_t *p, const h2_request *req,
  * - Lacking openssl, it uses 'apr_hashfunc_default' for the value
  * - with openssl, it uses SHA256 to calculate the hash value
  * - whatever the method to generate the hash, the diary keeps a maximum of 64
- *   bits per hash, limiting the memory consumption to about 
- *      H2PushDiarySize * 8 
- *   bytes. Entries are sorted by most recently used and oldest entries are
+ *   bits per hash. With LRU links and the lookup table, memory consumption
+ *   is about 
+ *      H2PushDiarySize * 24 
+ *   bytes. Entries are ordered by most recent use and oldest entries are
  *   forgotten first.
  * - Clients can initialize/replace the push diary by sending a 'Cache-Digest'
  *   header. Currently, this is the base64url encoded value of the cache digest
@@ -493,8 +552,15 @@ apr_array_header_t *h2_push_collect(apr_pool_t *p, const h2_request *req,
  
 #define GCSLOG_LEVEL   APLOG_TRACE1
 
+/* Entries sit in a fixed array and are chained in LRU order. A table of
+ * twice their number, with linear probing on the hash, finds them. The
+ * oldest entry is recycled once the diary is full, so lookup, use and
+ * eviction are all O(1).
+ */
 typedef struct h2_push_diary_entry {
     apr_uint64_t hash;
+    int older;                  /* previous in LRU order, -1 for none */
+    int newer;                  /* next in LRU order, -1 for none */
 } h2_push_diary_entry;
 
 
@@ -568,6 +634,7 @@ static h2_push_diary *diary_create(apr_pool_t *p, h2_push_digest_type dtype,
     if (N > 0) {
         diary = apr_pcalloc(p, sizeof(*diary));
         
+        diary->pool        = p;
         diary->NMax        = ceil_power_of_2(N);
         diary->N           = diary->NMax;
         /* the mask we use in value comparison depends on where we got
@@ -576,8 +643,10 @@ static h2_push_diary *diary_create(apr_pool_t *p, h2_push_digest_type dtype,
          * If we set the diary via a compressed golomb set, we have less
          * relevant bits and need to use a smaller mask. */
         diary->mask_bits   = 64;
-        /* grows by doubling, start with a power of 2 */
-        diary->entries     = apr_array_make(p, 16, sizeof(h2_push_diary_entry));
+        diary->entries     = apr_pcalloc(p, diary->NMax * sizeof(h2_push_diary_entry));
+        diary->slot_mask   = 2 * diary->NMax - 1;
+        diary->slots       = apr_pcalloc(p, (diary->slot_mask + 1) * sizeof(apr_uint32_t));
+        diary->lru_oldest  = diary->lru_newest = -1;
         
         switch (dtype) {
 #ifdef H2_OPENSSL
@@ -601,61 +670,131 @@ h2_push_diary *h2_push_diary_create(apr_pool_t *p, int N)
     return diary_create(p, H2_PUSH_DIGEST_SHA256, N);
 }
 
-static int h2_push_diary_find(h2_push_diary *diary, apr_uint64_t hash)
+static apr_uint32_t diary_slot_home(h2_push_diary *diary, apr_uint64_t hash)
 {
-    if (diary) {
-        h2_push_diary_entry *e;
-        int i;
+    /* hashes from a cache digest may have only few relevant bits */
+    return (apr_uint32_t)((hash * APR_UINT64_C(0x9E3779B97F4A7C15)) >> 32) 
+           & diary->slot_mask;
+}
 
-        /* search from the end, where the last accessed digests are */
-        for (i = diary->entries->nelts-1; i >= 0; --i) {
-            e = &APR_ARRAY_IDX(diary->entries, i, h2_push_diary_entry);
-            if (e->hash == hash) {
-                return i;
-            }
+/* Index of the slot referring to the entry with hash or of the empty slot 
+ * it would go into. The table is never more than half full. */
+static apr_uint32_t diary_slot_find(h2_push_diary *diary, apr_uint64_t hash)
+{
+    apr_uint32_t i = diary_slot_home(diary, hash);
+    
+    while (diary->slots[i] && diary->entries[diary->slots[i]-1].hash != hash) {
+        i = (i + 1) & diary->slot_mask;
+    }
+    return i;
+}
+
+static void diary_slot_remove(h2_push_diary *diary, apr_uint32_t i)
+{
+    apr_uint32_t j, home, mask = diary->slot_mask;
+    
+    diary->slots[i] = 0;
+    for (j = (i + 1) & mask; diary->slots[j]; j = (j + 1) & mask) {
+        home = diary_slot_home(diary, diary->entries[diary->slots[j]-1].hash);
+        /* move into the hole, unless the home slot lies after it */
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            diary->slots[i] = diary->slots[j];
+            diary->slots[j] = 0;
+            i = j;
         }
     }
-    return -1;
 }
 
-static h2_push_diary_entry *move_to_last(h2_push_diary *diary, apr_size_t idx)
+static void diary_lru_unlink(h2_push_diary *diary, int idx)
+{
+    h2_push_diary_entry *e = &diary->entries[idx];
+    
+    if (e->older >= 0) {
+        diary->entries[e->older].newer = e->newer;
+    }
+    else {
+        diary->lru_oldest = e->newer;
+    }
+    if (e->newer >= 0) {
+        diary->entries[e->newer].older = e->older;
+    }
+    else {
+        diary->lru_newest = e->older;
+    }
+}
+
+static void diary_lru_append(h2_push_diary *diary, int idx)
 {
-    h2_push_diary_entry *entries = (h2_push_diary_entry*)diary->entries->elts;
-    h2_push_diary_entry e;
-    apr_size_t lastidx = (apr_size_t)diary->entries->nelts;
+    h2_push_diary_entry *e = &diary->entries[idx];
     
-    /* move entry[idx] to the end */
-    if (idx+1 < lastidx) {
-        e =  entries[idx];
-        memmove(entries+idx, entries+idx+1, sizeof(e) * (lastidx - idx));
-        entries[lastidx] = e;
+    e->older = diary->lru_newest;
+    e->newer = -1;
+    if (diary->lru_newest >= 0) {
+        diary->entries[diary->lru_newest].newer = idx;
+    }
+    else {
+        diary->lru_oldest = idx;
+    }
+    diary->lru_newest = idx;
+}
+
+static void diary_clear(h2_push_diary *diary)
+{
+    memset(diary->slots, 0, (diary->slot_mask + 1) * sizeof(apr_uint32_t));
+    diary->nentries = 0;
+    diary->lru_oldest = diary->lru_newest = -1;
+}
+
+static int h2_push_diary_find(h2_push_diary *diary, apr_uint64_t hash)
+{
+    if (diary) {
+        apr_uint32_t i = diary_slot_find(diary, hash);
+        return diary->slots[i]? (int)diary->slots[i] - 1 : -1;
+    }
+    return -1;
+}
+
+static void move_to_last(h2_push_diary *diary, int idx)
+{
+    if (idx != diary->lru_newest) {
+        diary_lru_unlink(diary, idx);
+        diary_lru_append(diary, idx);
     }
-    return &entries[lastidx];
 }
 
-static void h2_push_diary_append(h2_push_diary *diary, h2_push_diary_entry *e)
+static void h2_push_diary_append(h2_push_diary *diary, apr_uint64_t hash)
 {
-    h2_push_diary_entry *ne;
+    apr_uint32_t i = diary_slot_find(diary, hash);
+    int idx;
     
-    if (diary->entries->nelts < diary->N) {
-        /* append a new diary entry at the end */
-        APR_ARRAY_PUSH(diary->entries, h2_push_diary_entry) = *e;
-        ne = &APR_ARRAY_IDX(diary->entries, diary->entries->nelts-1, h2_push_diary_entry);
+    if (diary->slots[i]) {
+        /* already known, e.g. a duplicate in a cache digest */
+        move_to_last(diary, (int)diary->slots[i] - 1);
+        return;
+    }
+    if (diary->nentries < diary->N) {
+        /* use a new entry */
+        idx = diary->nentries++;
     }
     else {
-        /* replace content with new digest. keeps memory usage constant once diary is full */
-        ne = move_to_last(diary, 0);
-        *ne = *e;
+        /* recycle the oldest. keeps memory usage constant once diary is full */
+        idx = diary->lru_oldest;
+        diary_slot_remove(diary, diary_slot_find(diary, diary->entries[idx].hash));
+        diary_lru_unlink(diary, idx);
+        i = diary_slot_find(diary, hash);
     }
+    diary->entries[idx].hash = hash;
+    diary->slots[i] = (apr_uint32_t)idx + 1;
+    diary_lru_append(diary, idx);
     /* Intentional no APLOGNO */
-    ap_log_perror(APLOG_MARK, GCSLOG_LEVEL, 0, diary->entries->pool,
-                  "push_diary_append: %"APR_UINT64_T_HEX_FMT, ne->hash);
+    ap_log_perror(APLOG_MARK, GCSLOG_LEVEL, 0, diary->pool,
+                  "push_diary_append: %"APR_UINT64_T_HEX_FMT, hash);
 }
 
 apr_array_header_t *h2_push_diary_update(h2_session *session, apr_array_header_t *pushes)
 {
     apr_array_header_t *npushes = pushes;
-    h2_push_diary_entry e;
+    apr_uint64_t hash;
     int i, idx;
     
     if (session->push_diary && pushes) {
@@ -665,13 +804,14 @@ apr_array_header_t *h2_push_diary_update(h2_session *session, apr_array_header_t
             h2_push *push;
             
             push = APR_ARRAY_IDX(pushes, i, h2_push*);
-            session->push_diary->dcalc(session->push_diary, &e.hash, push);
-            idx = h2_push_diary_find(session->push_diary, e.hash);
+            session->push_diary->dcalc(session->push_diary, &hash, push);
+            idx = h2_push_diary_find(session->push_diary, hash);
             if (idx >= 0) {
                 /* Intentional no APLOGNO */
                 ap_log_cerror(APLOG_MARK, GCSLOG_LEVEL, 0, session->c,
                               "push_diary_update: already there PUSH %s", push->req->path);
-                move_to_last(session->push_diary, (apr_size_t)idx);
+                move_to_last(session->push_diary, idx);
+                H2_METRIC_INC(push_diary_hits);
             }
             else {
                 /* Intentional no APLOGNO */
@@ -681,20 +821,63 @@ apr_array_header_t *h2_push_diary_update(h2_session *session, apr_array_header_t
                     npushes = apr_array_make(pushes->pool, 5, sizeof(h2_push_diary_entry*));
                 }
                 APR_ARRAY_PUSH(npushes, h2_push*) = push;
-                h2_push_diary_append(session->push_diary, &e);
+                h2_push_diary_append(session->push_diary, hash);
             }
         }
     }
     return npushes;
 }
     
+static const char *cookie_value(apr_pool_t *p, const char *cookies, const char *name)
+{
+    apr_size_t nlen = strlen(name);
+    const char *s = cookies, *end;
+    
+    while (s && *s) {
+        while (*s == ' ' || *s == ';') {
+            ++s;
+        }
+        end = ap_strchr_c(s, ';');
+        if (!strncmp(s, name, nlen) && s[nlen] == '=') {
+            s += nlen + 1;
+            return end? apr_pstrmemdup(p, s, (apr_size_t)(end - s)) : apr_pstrdup(p, s);
+        }
+        s = end;
+    }
+    return NULL;
+}
+
+/* The key identifying the client for the shared diary cache, as configured
+ * by H2PushDiaryKey. Allocated from the session pool as it is needed for
+ * the lifetime of the connection. */
+static const char *diary_key(h2_session *session, const struct h2_request *req)
+{
+    const char *spec = h2_config_push_diary_key(session->s);
+    const char *val = NULL;
+    
+    if (!spec) {
+        return NULL;
+    }
+    else if (!strcmp("tls-session", spec)) {
+        val = h2_h2_ssl_var(session->c, session->pool, "SSL_SESSION_ID");
+    }
+    else if (!strncmp("cookie:", spec, 7)) {
+        val = cookie_value(session->pool, apr_table_get(req->headers, "Cookie"), 
+                           spec + 7);
+    }
+    else if (!strncmp("header:", spec, 7)) {
+        val = apr_table_get(req->headers, spec + 7);
+    }
+    return (val && *val)? apr_pstrcat(session->pool, spec, "=", val, NULL) : NULL;
+}
+
 apr_array_header_t *h2_push_collect_update(h2_stream *stream, 
                                            const struct h2_request *req, 
                                            const struct h2_headers *res)
 {
     h2_session *session = stream->session;
     const char *cache_digest = apr_table_get(req->headers, "Cache-Digest");
-    apr_array_header_t *pushes;
+    apr_array_header_t *pushes, *npushes;
     apr_status_t status;
     
     if (cache_digest && session->push_diary) {
@@ -706,8 +889,32 @@ apr_array_header_t *h2_push_collect_update(h2_stream *stream,
                           "push diary set from Cache-Digest: %s"), cache_digest);
         }
     }
+    else if (!session->push_diary_keyed && session->push_diary 
+             && h2_push_cache_enabled()) {
+        /* first request, add what we pushed to this client before */
+        session->push_diary_keyed = 1;
+        session->push_diary_key = diary_key(session, req);
+        if (session->push_diary_key) {
+            status = h2_push_cache_load(session->push_diary, session->s, 
+                                        session->push_diary_key, stream->pool);
+            ap_log_cerror(APLOG_MARK, APLOG_TRACE1, status, session->c,
+                          H2_SSSN_MSG(session, "push diary loaded for %s, "
+                          "%d entries"), session->push_diary_key, 
+                          session->push_diary->nentries);
+        }
+    }
     pushes = h2_push_collect(stream->pool, req, stream->push_policy, res);
-    return h2_push_diary_update(stream->session, pushes);
+    npushes = h2_push_diary_update(stream->session, pushes);
+    if (npushes && session->push_diary_key) {
+        status = h2_push_cache_save(session->push_diary, session->s, 
+                                    session->push_diary_key, stream->pool);
+        if (status != APR_SUCCESS) {
+            ap_log_cerror(APLOG_MARK, APLOG_DEBUG, status, session->c,
+                          H2_SSSN_MSG(session, "storing push diary for %s"),
+                          session->push_diary_key);
+        }
+    }
+    return npushes;
 }
 
 static apr_int32_t h2_log2inv(unsigned char log2)
@@ -829,7 +1036,7 @@ apr_status_t h2_push_diary_digest_get(h2_push_diary *diary, apr_pool_t *pool,
     apr_uint64_t *hashes;
     apr_size_t hash_count;
     
-    nelts = diary->entries->nelts;
+    nelts = diary->nentries;
     
     if ((apr_uint32_t)nelts > APR_UINT32_MAX) {
         /* should not happen */
@@ -872,11 +1079,10 @@ apr_status_t h2_push_diary_digest_get(h2_push_diary *diary, apr_pool_t *pool,
                   
     if (!authority || !diary->authority 
         || !strcmp("*", authority) || !strcmp(diary->authority, authority)) {
-        hash_count = diary->entries->nelts;
-        hashes = apr_pcalloc(encoder.pool, hash_count);
+        hash_count = diary->nentries;
+        hashes = apr_pcalloc(encoder.pool, hash_count * sizeof(apr_uint64_t));
         for (i = 0; i < hash_count; ++i) {
-            hashes[i] = ((&APR_ARRAY_IDX(diary->entries, i, h2_push_diary_entry))->hash 
-                         >> encoder.delta_bits);
+            hashes[i] = diary->entries[i].hash >> encoder.delta_bits;
         }
         
         qsort(hashes, hash_count, sizeof(apr_uint64_t), cmp_puint64);
@@ -974,8 +1180,8 @@ apr_status_t h2_push_diary_digest_set(h2_push_diary *diary, const char *authorit
     gset_decoder decoder;
     unsigned char log2n, log2p;
     int N, i;
-    apr_pool_t *pool = diary->entries->pool;
-    h2_push_diary_entry e;
+    apr_pool_t *pool = diary->pool;
+    apr_uint64_t hash;
     apr_status_t status = APR_SUCCESS;
     
     if (len < 2) {
@@ -991,12 +1197,12 @@ apr_status_t h2_push_diary_digest_set(h2_push_diary *diary, const char *authorit
     }
     
     /* whatever is in the digest, it replaces the diary entries */
-    apr_array_clear(diary->entries);
+    diary_clear(diary);
     if (!authority || !strcmp("*", authority)) {
         diary->authority = NULL;
     }
     else if (!diary->authority || strcmp(diary->authority, authority)) {
-        diary->authority = apr_pstrdup(diary->entries->pool, authority);
+        diary->authority = apr_pstrdup(diary->pool, authority);
     }
 
     N = h2_log2inv(log2n + log2p);
@@ -1033,17 +1239,17 @@ apr_status_t h2_push_diary_digest_set(h2_push_diary *diary, const char *authorit
                   (int)decoder.log2p);
                   
     for (i = 0; i < diary->N; ++i) {
-        if (gset_decode_next(&decoder, &e.hash) != APR_SUCCESS) {
+        if (gset_decode_next(&decoder, &hash) != APR_SUCCESS) {
             /* the data may have less than N values */
             break;
         }
-        h2_push_diary_append(diary, &e);
+        h2_push_diary_append(diary, hash);
     }
     
     /* Intentional no APLOGNO */
     ap_log_perror(APLOG_MARK, GCSLOG_LEVEL, 0, pool,
                   "h2_push_diary_digest_set: diary now with %d entries, mask_bits=%d", 
-                  (int)diary->entries->nelts, diary->mask_bits);
+                  diary->nentries, diary->mask_bits);
     return status;
 }
 
@@ -1059,3 +1265,65 @@ apr_status_t h2_push_diary_digest64_set(h2_push_diary *diary, const char *author
     return h2_push_diary_digest_set(diary, authority, data, len);
 }
 
+
+/*******************************************************************************
+ * diary export/import
+ *
+ * The format is one byte with the number of hash bits in use, followed
+ * by the 64 bit hash values in network byte order, oldest first.
+ ******************************************************************************/
+
+void h2_push_diary_export(h2_push_diary *diary, apr_pool_t *p, 
+                          const char **pdata, apr_size_t *plen)
+{
+    unsigned char *data, *d;
+    apr_uint64_t hash;
+    int idx, i;
+    
+    data = d = apr_palloc(p, 1 + 8 * (apr_size_t)diary->nentries);
+    *d++ = (unsigned char)diary->mask_bits;
+    for (idx = diary->lru_oldest; idx >= 0; idx = diary->entries[idx].newer) {
+        hash = diary->entries[idx].hash;
+        for (i = 7; i >= 0; --i) {
+            *d++ = (unsigned char)(hash >> (8 * i));
+        }
+    }
+    *pdata = (const char *)data;
+    *plen = (apr_size_t)(d - data);
+}
+
+apr_status_t h2_push_diary_import(h2_push_diary *diary, 
+                                  const char *data, apr_size_t len)
+{
+    const unsigned char *d = (const unsigned char *)data;
+    apr_uint64_t *current, hash;
+    int ncurrent, idx, i, k;
+    
+    if (len < 1 || (len - 1) % 8 || d[0] != diary->mask_bits) {
+        return APR_EINVAL;
+    }
+    
+    /* stored entries are older than the ones of this connection, insert
+     * them first and re-add the current ones on top. */
+    ncurrent = diary->nentries;
+    current = NULL;
+    if (ncurrent > 0) {
+        current = apr_palloc(diary->pool, sizeof(apr_uint64_t) * (apr_size_t)ncurrent);
+        for (k = 0, idx = diary->lru_oldest; idx >= 0; idx = diary->entries[idx].newer) {
+            current[k++] = diary->entries[idx].hash;
+        }
+    }
+    diary_clear(diary);
+    
+    for (++d, len -= 1; len >= 8; d += 8, len -= 8) {
+        hash = 0;
+        for (i = 0; i < 8; ++i) {
+            hash = (hash << 8) | d[i];
+        }
+        h2_push_diary_append(diary, hash);
+    }
+    for (k = 0; k < ncurrent; ++k) {
+        h2_push_diary_append(diary, current[k]);
+    }
+    return APR_SUCCESS;
+}
@@ -39,8 +39,16 @@ typedef struct h2_push_diary h2_push_diary;
 
 typedef void h2_push_digest_calc(h2_push_diary *diary, apr_uint64_t *phash, h2_push *push);
 
+struct h2_push_diary_entry;
+
 struct h2_push_diary {
-    apr_array_header_t  *entries;
+    apr_pool_t          *pool;
+    struct h2_push_diary_entry *entries; /* NMax entries, nentries in use */
+    int         nentries;
+    apr_uint32_t        *slots; /* open addressing on hash, entry index + 1 */
+    apr_uint32_t         slot_mask;
+    int         lru_oldest;     /* entry evicted next, -1 if none */
+    int         lru_newest;     /* entry used last, -1 if none */
     int         NMax; /* Maximum for N, should size change be necessary */
     int         N;    /* Current maximum number of entries, power of 2 */
     apr_uint64_t         mask; /* mask for relevant bits */
@@ -64,6 +72,11 @@ apr_array_header_t *h2_push_collect(apr_pool_t *p,
                                     apr_uint32_t push_policy, 
                                     const struct h2_headers *res);
 
+/**
+ * Set up the cache of parsed Link header values in a new child process.
+ */
+void h2_push_child_init(apr_pool_t *pchild, server_rec *s);
+
 /**
  * Create a new push diary for the given maximum number of entries.
  * 
@@ -117,4 +130,28 @@ apr_status_t h2_push_diary_digest_set(h2_push_diary *diary, const char *authorit
 apr_status_t h2_push_diary_digest64_set(h2_push_diary *diary, const char *authority, 
                                         const char *data64url, apr_pool_t *pool);
 
+/**
+ * Serialize the entries of the diary, oldest first, for storing them
+ * outside the connection.
+ * 
+ * @param diary the diary to export
+ * @param p the pool to allocate the data from
+ * @param pdata on return, the binary data
+ * @param plen on return, the length of the binary data
+ */
+void h2_push_diary_export(h2_push_diary *diary, apr_pool_t *p, 
+                          const char **pdata, apr_size_t *plen);
+
+/**
+ * Add entries exported by h2_push_diary_export() to the diary. They are
+ * considered older than the entries already present.
+ * 
+ * @param diary the diary to import into
+ * @param data the binary data
+ * @param len the length of the binary data
+ * @return APR_EINVAL if the data is malformed or uses other hash bits
+ */
+apr_status_t h2_push_diary_import(h2_push_diary *diary, 
+                                  const char *data, apr_size_t len);
+
 #endif /* defined(__mod_h2__h2_push__) */
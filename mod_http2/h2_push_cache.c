@@ -0,0 +1,198 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <apr_global_mutex.h>
+#include <apr_md5.h>
+#include <apr_strings.h>
+
+#include <httpd.h>
+#include <http_core.h>
+#include <http_config.h>
+#include <http_log.h>
+#include <ap_provider.h>
+#include <ap_socache.h>
+#include <util_mutex.h>
+
+#include "h2_private.h"
+#include "h2.h"
+#include "h2_push.h"
+#include "h2_push_cache.h"
+
+#define H2_PUSH_CACHE_MUTEX     "h2-push-diary"
+#define H2_PUSH_CACHE_ID        "mod_http2-push-diary"
+/* how long a client's diary is kept after its last update */
+#define H2_PUSH_CACHE_TIMEOUT   apr_time_from_sec(24 * 60 * 60)
+
+static const ap_socache_provider_t *cache_provider;
+static ap_socache_instance_t *cache_instance;
+static apr_global_mutex_t *cache_mutex;
+
+const char *h2_push_cache_configure(cmd_parms *cmd, const char *spec)
+{
+    const char *name, *args, *err;
+    
+    cache_provider = NULL;
+    cache_instance = NULL;
+    if (!strcasecmp(spec, "none")) {
+        return NULL;
+    }
+    
+    args = ap_strchr_c(spec, ':');
+    name = args? apr_pstrmemdup(cmd->temp_pool, spec, (apr_size_t)(args - spec)) : spec;
+    if (args) {
+        ++args;
+    }
+    cache_provider = ap_lookup_provider(AP_SOCACHE_PROVIDER_GROUP, name,
+                                        AP_SOCACHE_PROVIDER_VERSION);
+    if (!cache_provider) {
+        return apr_psprintf(cmd->pool, "unknown socache provider '%s', maybe "
+                            "you need to load mod_socache_%s?", name, name);
+    }
+    err = cache_provider->create(&cache_instance, args, cmd->temp_pool, cmd->pool);
+    if (err) {
+        cache_provider = NULL;
+        return apr_pstrcat(cmd->pool, "H2PushDiaryCache: ", err, NULL);
+    }
+    return NULL;
+}
+
+void h2_push_cache_pre_config(apr_pool_t *pconf)
+{
+    cache_provider = NULL;
+    cache_instance = NULL;
+    cache_mutex = NULL;
+    ap_mutex_register(pconf, H2_PUSH_CACHE_MUTEX, NULL, APR_LOCK_DEFAULT, 0);
+}
+
+static apr_status_t cache_cleanup(void *data)
+{
+    server_rec *s = data;
+    
+    if (cache_provider) {
+        cache_provider->destroy(cache_instance, s);
+        cache_provider = NULL;
+        cache_instance = NULL;
+    }
+    return APR_SUCCESS;
+}
+
+apr_status_t h2_push_cache_post_config(apr_pool_t *pconf, server_rec *s)
+{
+    struct ap_socache_hints hints;
+    apr_status_t status;
+    
+    if (!cache_provider) {
+        return APR_SUCCESS;
+    }
+    if (cache_provider->flags & AP_SOCACHE_FLAG_NOTMPSAFE) {
+        status = ap_global_mutex_create(&cache_mutex, NULL, H2_PUSH_CACHE_MUTEX,
+                                        NULL, s, pconf, 0);
+        if (status != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, status, s,
+                         "h2_push_cache: creating mutex");
+            return status;
+        }
+    }
+    
+    memset(&hints, 0, sizeof(hints));
+    hints.avg_id_len = APR_MD5_DIGESTSIZE;
+    hints.avg_obj_size = 1 + 8 * 256;
+    hints.expiry_interval = 60;
+    status = cache_provider->init(cache_instance, H2_PUSH_CACHE_ID, &hints, s, pconf);
+    if (status != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, status, s,
+                     "h2_push_cache: initializing socache provider");
+        return status;
+    }
+    apr_pool_cleanup_register(pconf, s, cache_cleanup, apr_pool_cleanup_null);
+    return APR_SUCCESS;
+}
+
+void h2_push_cache_child_init(apr_pool_t *pchild, server_rec *s)
+{
+    apr_status_t status;
+    
+    if (cache_mutex) {
+        status = apr_global_mutex_child_init(&cache_mutex, 
+                                             apr_global_mutex_lockfile(cache_mutex), 
+                                             pchild);
+        if (status != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, status, s,
+                         "h2_push_cache: re-opening mutex in child");
+        }
+    }
+}
+
+int h2_push_cache_enabled(void)
+{
+    return cache_provider != NULL;
+}
+
+apr_status_t h2_push_cache_load(struct h2_push_diary *diary, server_rec *s,
+                                const char *key, apr_pool_t *p)
+{
+    unsigned char id[APR_MD5_DIGESTSIZE];
+    unsigned int len;
+    unsigned char *data;
+    apr_status_t status;
+    
+    if (!cache_provider) {
+        return APR_ENOTIMPL;
+    }
+    apr_md5(id, key, strlen(key));
+    len = 1 + 8 * (unsigned int)diary->NMax;
+    data = apr_palloc(p, len);
+    
+    if (cache_mutex) {
+        apr_global_mutex_lock(cache_mutex);
+    }
+    /* a diary stored with a larger H2PushDiarySize fails with APR_ENOSPC */
+    status = cache_provider->retrieve(cache_instance, s, id, sizeof(id), data, &len, p);
+    if (cache_mutex) {
+        apr_global_mutex_unlock(cache_mutex);
+    }
+    
+    if (status == APR_SUCCESS) {
+        status = h2_push_diary_import(diary, (const char *)data, len);
+    }
+    return status;
+}
+
+apr_status_t h2_push_cache_save(struct h2_push_diary *diary, server_rec *s,
+                                const char *key, apr_pool_t *p)
+{
+    unsigned char id[APR_MD5_DIGESTSIZE];
+    const char *data;
+    apr_size_t len;
+    apr_status_t status;
+    
+    if (!cache_provider) {
+        return APR_ENOTIMPL;
+    }
+    apr_md5(id, key, strlen(key));
+    h2_push_diary_export(diary, p, &data, &len);
+    
+    if (cache_mutex) {
+        apr_global_mutex_lock(cache_mutex);
+    }
+    status = cache_provider->store(cache_instance, s, id, sizeof(id), 
+                                   apr_time_now() + H2_PUSH_CACHE_TIMEOUT,
+                                   (unsigned char *)data, (unsigned int)len, p);
+    if (cache_mutex) {
+        apr_global_mutex_unlock(cache_mutex);
+    }
+    return status;
+}
@@ -0,0 +1,69 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __mod_h2__h2_push_cache__
+#define __mod_h2__h2_push_cache__
+
+/**
+ * A store for push diaries shared between connections, and between child
+ * processes if the socache provider supports it. Diaries are stored by a
+ * key identifying the client (see H2PushDiaryKey), so that a client opening
+ * a new connection is not pushed the resources it received before.
+ */
+
+struct h2_push_diary;
+
+/**
+ * Configure the socache provider from "provider[:args]" or "none".
+ * @return NULL or an error message for the directive
+ */
+const char *h2_push_cache_configure(cmd_parms *cmd, const char *spec);
+
+/**
+ * Register the mutex and forget the provider of a previous configuration.
+ */
+void h2_push_cache_pre_config(apr_pool_t *pconf);
+
+/**
+ * Create the mutex, when needed, and initialize the configured socache.
+ */
+apr_status_t h2_push_cache_post_config(apr_pool_t *pconf, server_rec *s);
+
+/**
+ * Re-open the mutex in a new child process.
+ */
+void h2_push_cache_child_init(apr_pool_t *pchild, server_rec *s);
+
+/**
+ * @return != 0 iff a cache has been configured
+ */
+int h2_push_cache_enabled(void);
+
+/**
+ * Add the entries stored for the client key to the diary.
+ * @return APR_NOTFOUND if nothing was stored, APR_EINVAL if the stored
+ *         entries do not fit the diary.
+ */
+apr_status_t h2_push_cache_load(struct h2_push_diary *diary, server_rec *s,
+                                const char *key, apr_pool_t *p);
+
+/**
+ * Store the entries of the diary for the client key.
+ */
+apr_status_t h2_push_cache_save(struct h2_push_diary *diary, server_rec *s,
+                                const char *key, apr_pool_t *p);
+
+#endif /* defined(__mod_h2__h2_push_cache__) */
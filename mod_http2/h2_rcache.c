@@ -0,0 +1,618 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <apr_date.h>
+#include <apr_hash.h>
+#include <apr_strings.h>
+#include <apr_thread_mutex.h>
+
+#include <httpd.h>
+#include <http_core.h>
+#include <http_config.h>
+#include <http_log.h>
+#include <http_protocol.h>
+#include <http_request.h>
+
+#include "h2_private.h"
+#include "h2.h"
+#include "h2_config.h"
+#include "h2_headers.h"
+#include "h2_request.h"
+#include "h2_stream.h"
+#include "h2_util.h"
+#include "h2_session.h"
+#include "h2_rcache.h"
+
+#define H2_RCACHE_DEF_SIZE      (1024 * 1024)
+#define H2_RCACHE_DEF_ENTRY     (64 * 1024)
+
+typedef struct rcache_entry rcache_entry;
+struct rcache_entry {
+    rcache_entry *older;
+    rcache_entry *newer;
+    const char *key;
+    apr_size_t klen;
+    apr_size_t size;            /* bytes allocated for the entry */
+    apr_time_t stored;
+    apr_time_t expires;
+    apr_time_t last_modified;   /* 0 if unknown */
+    const char *etag;           /* NULL if none */
+    int status;
+    int nheaders;
+    const char **headers;       /* nheaders name/value pairs */
+    const char *body;
+    apr_size_t body_len;
+};
+
+static apr_size_t cache_max = H2_RCACHE_DEF_SIZE;
+static apr_size_t entry_max = H2_RCACHE_DEF_ENTRY;
+
+/* the cache of this child, all access is under cache_mutex */
+static apr_thread_mutex_t *cache_mutex;
+static apr_hash_t *cache_entries;
+static rcache_entry *cache_oldest;
+static rcache_entry *cache_newest;
+static apr_size_t cache_size;
+
+static ap_filter_rec_t *rcache_filter_handle;
+
+const char *h2_rcache_configure(cmd_parms *cmd, const char *total, 
+                                const char *max_entry)
+{
+    apr_int64_t n = apr_atoi64(total);
+    apr_int64_t m = max_entry? apr_atoi64(max_entry) : H2MIN(n, H2_RCACHE_DEF_ENTRY);
+    
+    (void)cmd;
+    if (n < 0) {
+        return "total size must be 0 (disabled) or a positive number of bytes";
+    }
+    if (m < 0 || m > n) {
+        return "maximum entry size must be between 0 and the total size";
+    }
+    cache_max = (apr_size_t)n;
+    entry_max = (apr_size_t)m;
+    return NULL;
+}
+
+void h2_rcache_pre_config(apr_pool_t *pconf)
+{
+    (void)pconf;
+    cache_max = H2_RCACHE_DEF_SIZE;
+    entry_max = H2_RCACHE_DEF_ENTRY;
+}
+
+static apr_status_t cache_cleanup(void *data)
+{
+    rcache_entry *e, *next;
+    
+    (void)data;
+    for (e = cache_oldest; e; e = next) {
+        next = e->newer;
+        free(e);
+    }
+    cache_oldest = cache_newest = NULL;
+    cache_entries = NULL;
+    cache_mutex = NULL;
+    cache_size = 0;
+    return APR_SUCCESS;
+}
+
+void h2_rcache_child_init(apr_pool_t *pchild, server_rec *s)
+{
+    apr_pool_t *pool;
+    apr_status_t status;
+    
+    if (cache_max == 0 || entry_max == 0) {
+        return;
+    }
+    apr_pool_create(&pool, pchild);
+    apr_pool_tag(pool, "h2_rcache");
+    status = apr_thread_mutex_create(&cache_mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+    if (status != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, status, s,
+                     "h2_rcache: creating mutex");
+        cache_mutex = NULL;
+        return;
+    }
+    cache_entries = apr_hash_make(pool);
+    apr_pool_cleanup_register(pool, NULL, cache_cleanup, apr_pool_cleanup_null);
+}
+
+/* Responses are only shared among connections to the same server, the 
+ * one their session started on. */
+static const char *make_key(apr_pool_t *p, server_rec *s, const h2_request *req)
+{
+    return apr_psprintf(p, "%pp %s://%s%s", (void *)s, 
+                        req->scheme, req->authority, req->path);
+}
+
+static void entry_unlink(rcache_entry *e)
+{
+    if (e->older) e->older->newer = e->newer;
+    else cache_oldest = e->newer;
+    if (e->newer) e->newer->older = e->older;
+    else cache_newest = e->older;
+    e->older = e->newer = NULL;
+}
+
+static void entry_link_newest(rcache_entry *e)
+{
+    e->older = cache_newest;
+    e->newer = NULL;
+    if (cache_newest) cache_newest->newer = e;
+    else cache_oldest = e;
+    cache_newest = e;
+}
+
+static void entry_remove(rcache_entry *e)
+{
+    apr_hash_set(cache_entries, e->key, (apr_ssize_t)e->klen, NULL);
+    entry_unlink(e);
+    cache_size -= e->size;
+    free(e);
+}
+
+/* Headers that must not be replayed from the cache */
+static int is_volatile_header(const char *name)
+{
+    return (!strcasecmp("Date", name) || !strcasecmp("Age", name));
+}
+
+/* Create an entry in a single malloc'ed block: the struct, the header
+ * pointers and then all strings and the body. */
+static rcache_entry *entry_create(const char *key, const h2_headers *response,
+                                  apr_time_t expires, 
+                                  const char *body, apr_size_t body_len)
+{
+    const apr_array_header_t *elts = apr_table_elts(response->headers);
+    const apr_table_entry_t *te = (const apr_table_entry_t *)elts->elts;
+    rcache_entry *e;
+    apr_size_t size, klen = strlen(key);
+    const char *s;
+    char *d;
+    int i, n = 0;
+    
+    size = sizeof(*e) + klen + 1 + body_len;
+    for (i = 0; i < elts->nelts; ++i) {
+        if (te[i].key && te[i].val && !is_volatile_header(te[i].key)) {
+            size += 2 * sizeof(char*) + strlen(te[i].key) + strlen(te[i].val) + 2;
+            ++n;
+        }
+    }
+    
+    e = malloc(size);
+    if (!e) {
+        return NULL;
+    }
+    memset(e, 0, sizeof(*e));
+    e->size = size;
+    e->stored = apr_time_now();
+    e->expires = expires;
+    e->status = response->status;
+    e->headers = (const char **)(e + 1);
+    d = (char*)(e->headers + 2 * n);
+    
+    memcpy(d, key, klen + 1);
+    e->key = d;
+    e->klen = klen;
+    d += klen + 1;
+    for (i = 0; i < elts->nelts; ++i) {
+        if (te[i].key && te[i].val && !is_volatile_header(te[i].key)) {
+            apr_size_t len = strlen(te[i].key) + 1;
+            memcpy(d, te[i].key, len);
+            e->headers[2 * e->nheaders] = d;
+            d += len;
+            len = strlen(te[i].val) + 1;
+            memcpy(d, te[i].val, len);
+            e->headers[2 * e->nheaders + 1] = d;
+            d += len;
+            if (!strcasecmp("ETag", te[i].key)) {
+                e->etag = e->headers[2 * e->nheaders + 1];
+            }
+            ++e->nheaders;
+        }
+    }
+    if (body_len > 0) {
+        memcpy(d, body, body_len);
+        e->body = d;
+    }
+    e->body_len = body_len;
+    
+    s = apr_table_get(response->headers, "Last-Modified");
+    if (s) {
+        e->last_modified = apr_date_parse_http(s);
+        if (e->last_modified == APR_DATE_BAD) {
+            e->last_modified = 0;
+        }
+    }
+    return e;
+}
+
+static void cache_put(rcache_entry *e)
+{
+    rcache_entry *old;
+    
+    apr_thread_mutex_lock(cache_mutex);
+    old = apr_hash_get(cache_entries, e->key, (apr_ssize_t)e->klen);
+    if (old) {
+        entry_remove(old);
+    }
+    while (cache_oldest && cache_size + e->size > cache_max) {
+        entry_remove(cache_oldest);
+    }
+    if (cache_size + e->size <= cache_max) {
+        apr_hash_set(cache_entries, e->key, (apr_ssize_t)e->klen, e);
+        entry_link_newest(e);
+        cache_size += e->size;
+        e = NULL;
+    }
+    apr_thread_mutex_unlock(cache_mutex);
+    if (e) {
+        free(e);
+    }
+}
+
+/* @return the time until the response may be served from the cache, 
+ *         0 if it may not be cached at all */
+static apr_time_t fresh_until(apr_pool_t *p, const h2_headers *response, 
+                              apr_time_t now)
+{
+    const char *cc;
+    char *tok, *last;
+    apr_int64_t max_age = -1, s_maxage = -1;
+    
+    cc = apr_table_get(response->headers, "Cache-Control");
+    if (!cc 
+        || apr_table_get(response->headers, "Set-Cookie")
+        || apr_table_get(response->headers, "Vary")) {
+        return 0;
+    }
+    for (tok = apr_strtok(apr_pstrdup(p, cc), ",", &last); tok; 
+         tok = apr_strtok(NULL, ",", &last)) {
+        while (apr_isspace(*tok)) ++tok;
+        if (!strncasecmp("no-store", tok, 8)
+            || !strncasecmp("no-cache", tok, 8)
+            || !strncasecmp("private", tok, 7)) {
+            return 0;
+        }
+        else if (!strncasecmp("max-age=", tok, 8)) {
+            max_age = apr_atoi64(tok + 8);
+        }
+        else if (!strncasecmp("s-maxage=", tok, 9)) {
+            s_maxage = apr_atoi64(tok + 9);
+        }
+    }
+    if (s_maxage >= 0) {
+        max_age = s_maxage;
+    }
+    return (max_age > 0)? now + apr_time_from_sec(max_age) : 0;
+}
+
+typedef struct {
+    const char *key;
+    h2_headers *response;
+    apr_time_t expires;
+    char *body;
+    apr_size_t len;
+    apr_size_t expected;
+} rcache_ctx;
+
+static int start_capture(request_rec *r, rcache_ctx *ctx, h2_headers *response)
+{
+    const char *s;
+    apr_int64_t clen;
+    
+    if (response->status != HTTP_OK) {
+        return 0;
+    }
+    ctx->expires = fresh_until(r->pool, response, apr_time_now());
+    if (!ctx->expires) {
+        return 0;
+    }
+    s = apr_table_get(response->headers, "Content-Length");
+    clen = s? apr_atoi64(s) : -1;
+    if (clen < 0 || (apr_uint64_t)clen > entry_max) {
+        return 0;
+    }
+    ctx->response = response;
+    ctx->expected = (apr_size_t)clen;
+    ctx->body = apr_palloc(r->pool, ctx->expected + 1);
+    return 1;
+}
+
+static apr_status_t rcache_capture(ap_filter_t *f, apr_bucket_brigade *bb)
+{
+    rcache_ctx *ctx = f->ctx;
+    apr_bucket *b;
+    const char *data;
+    apr_size_t len;
+    
+    for (b = APR_BRIGADE_FIRST(bb); 
+         b != APR_BRIGADE_SENTINEL(bb);
+         b = APR_BUCKET_NEXT(b)) {
+        if (H2_BUCKET_IS_HEADERS(b)) {
+            /* a second HEADERS are trailers, we do not store those */
+            if (ctx->response 
+                || !start_capture(f->r, ctx, h2_bucket_headers_get(b))) {
+                goto give_up;
+            }
+        }
+        else if (APR_BUCKET_IS_EOS(b)) {
+            if (ctx->response && ctx->len == ctx->expected) {
+                rcache_entry *e = entry_create(ctx->key, ctx->response, 
+                                               ctx->expires, ctx->body, ctx->len);
+                if (e) {
+                    cache_put(e);
+                    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, f->r,
+                                  "h2_rcache: stored %s, %ld bytes", 
+                                  ctx->key, (long)ctx->len);
+                }
+            }
+            goto give_up;
+        }
+        else if (AP_BUCKET_IS_ERROR(b)) {
+            goto give_up;
+        }
+        else if (APR_BUCKET_IS_METADATA(b)) {
+            continue;
+        }
+        else {
+            if (!ctx->response || b->length == (apr_size_t)-1
+                || ctx->len + b->length > ctx->expected) {
+                goto give_up;
+            }
+            if (apr_bucket_read(b, &data, &len, APR_BLOCK_READ) != APR_SUCCESS
+                || ctx->len + len > ctx->expected) {
+                goto give_up;
+            }
+            memcpy(ctx->body + ctx->len, data, len);
+            ctx->len += len;
+        }
+    }
+    return ap_pass_brigade(f->next, bb);
+    
+give_up:
+    ap_remove_output_filter(f);
+    return ap_pass_brigade(f->next, bb);
+}
+
+void h2_rcache_register_hooks(void)
+{
+    rcache_filter_handle = ap_register_output_filter("H2_RCACHE", rcache_capture,
+                                                     NULL, AP_FTYPE_PROTOCOL);
+}
+
+/* The address nobody has, from TEST-NET-1 (RFC 5737) */
+#define H2_RCACHE_ANON_IP       "192.0.2.1"
+
+/* Cached responses are served without running access checks. Only capture
+ * what anyone would get: run the access and authorization checks again on
+ * a copy of the request without user, headers other than Host and 
+ * environment, coming from an address nobody has. Access that needs a 
+ * user, an address, a header or an environment variable then fails, 
+ * 'Require all granted' passes. Logging of that copy is silenced. */
+static int access_is_public(request_rec *r)
+{
+    static const struct ap_logconf quiet = { NULL, APLOG_EMERG };
+    request_rec *rr;
+    apr_sockaddr_t *sa;
+    const char *host;
+    int rv;
+    
+    if (r->user || r->ap_auth_type || ap_some_authn_required(r)) {
+        return 0;
+    }
+    if (apr_sockaddr_info_get(&sa, H2_RCACHE_ANON_IP, APR_INET, 0, 0, 
+                              r->pool) != APR_SUCCESS) {
+        return 0;
+    }
+    rr = apr_pmemdup(r->pool, r, sizeof(*r));
+    rr->log = &quiet;
+    rr->useragent_addr = sa;
+    rr->useragent_ip = apr_pstrdup(r->pool, H2_RCACHE_ANON_IP);
+    rr->headers_in = apr_table_make(r->pool, 1);
+    if ((host = apr_table_get(r->headers_in, "Host"))) {
+        apr_table_setn(rr->headers_in, "Host", host);
+    }
+    rr->subprocess_env = apr_table_make(r->pool, 1);
+    rr->notes = apr_table_copy(r->pool, r->notes);
+    rr->headers_out = apr_table_make(r->pool, 1);
+    rr->err_headers_out = apr_table_make(r->pool, 1);
+    
+    rv = ap_run_access_checker(rr);
+    if (rv == OK || rv == DECLINED) {
+        rv = ap_run_access_checker_ex(rr);
+    }
+    if (rv == OK || rv == DECLINED) {
+        rv = ap_run_auth_checker(rr);
+    }
+    return (rv == OK || rv == DECLINED);
+}
+
+void h2_rcache_add_filter(request_rec *r, const h2_request *req, server_rec *s)
+{
+    rcache_ctx *ctx;
+    ap_filter_t *f;
+    
+    if (!cache_entries || r->method_number != M_GET || r->header_only
+        || h2_config_sgeti(s, H2_CONF_RESPONSE_CACHE) <= 0
+        || h2_config_rgeti(r, H2_CONF_RESPONSE_CACHE) <= 0
+        || apr_table_get(req->headers, "Authorization")) {
+        return;
+    }
+    if (r->server != s) {
+        /* handled by another vhost than the connection's, as a hit
+         * would skip the checks for that, e.g. the 421 on a mismatch
+         * of SNI and Host. */
+        return;
+    }
+    if (!access_is_public(r)) {
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r,
+                      "h2_rcache: not caching, access depends on the request");
+        return;
+    }
+    /* fixups run again on internal redirects */
+    for (f = r->output_filters; f; f = f->next) {
+        if (f->frec == rcache_filter_handle) {
+            return;
+        }
+    }
+    ctx = apr_pcalloc(r->pool, sizeof(*ctx));
+    ctx->key = make_key(r->pool, s, req);
+    ap_add_output_filter_handle(rcache_filter_handle, ctx, r, r->connection);
+}
+
+static int etag_matches(const char *list, const char *etag)
+{
+    const char *tok;
+    apr_size_t len;
+    
+    if (!strncmp("W/", etag, 2)) {
+        etag += 2;
+    }
+    len = strlen(etag);
+    for (tok = list; *tok; ) {
+        while (*tok == ',' || apr_isspace(*tok)) ++tok;
+        if (*tok == '*') {
+            return 1;
+        }
+        if (!strncmp("W/", tok, 2)) {
+            tok += 2;
+        }
+        if (!strncmp(tok, etag, len) 
+            && (!tok[len] || tok[len] == ',' || apr_isspace(tok[len]))) {
+            return 1;
+        }
+        while (*tok && *tok != ',') ++tok;
+    }
+    return 0;
+}
+
+/* Does the client want the response from the origin server? */
+static int wants_revalidation(apr_pool_t *p, const h2_request *req)
+{
+    const char *s;
+    char *tok, *last;
+    
+    if ((s = apr_table_get(req->headers, "Cache-Control"))) {
+        for (tok = apr_strtok(apr_pstrdup(p, s), ",", &last); tok; 
+             tok = apr_strtok(NULL, ",", &last)) {
+            while (apr_isspace(*tok)) ++tok;
+            if (!strncasecmp("no-cache", tok, 8)
+                || !strncasecmp("no-store", tok, 8)
+                || (!strncasecmp("max-age=", tok, 8) 
+                    && apr_atoi64(tok + 8) <= 0)) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    s = apr_table_get(req->headers, "Pragma");
+    return s && ap_find_token(p, s, "no-cache");
+}
+
+static int not_modified(const h2_request *req, const char *etag, 
+                        apr_time_t last_modified)
+{
+    const char *s;
+    apr_time_t ims;
+    
+    if ((s = apr_table_get(req->headers, "If-None-Match"))) {
+        return etag && etag_matches(s, etag);
+    }
+    if (last_modified && (s = apr_table_get(req->headers, "If-Modified-Since"))) {
+        ims = apr_date_parse_http(s);
+        return ims != APR_DATE_BAD && last_modified <= ims;
+    }
+    return 0;
+}
+
+apr_status_t h2_rcache_serve(h2_stream *stream)
+{
+    const h2_request *req = stream->request;
+    server_rec *s = stream->session->s;
+    apr_pool_t *p = stream->pool;
+    rcache_entry *e;
+    const char *key, *etag = NULL, *body = NULL;
+    apr_size_t klen, body_len = 0;
+    apr_table_t *headers = NULL;
+    apr_time_t now, stored = 0, last_modified = 0;
+    h2_headers *response;
+    char *date;
+    int i, status = 0, head;
+    
+    if (!cache_entries || !req || stream->state != H2_SS_CLOSED_R) {
+        return APR_NOTFOUND;
+    }
+    head = !strcmp("HEAD", req->method);
+    if ((!head && strcmp("GET", req->method))
+        || apr_table_get(req->headers, "Authorization")
+        || h2_config_sgeti(s, H2_CONF_RESPONSE_CACHE) <= 0
+        || wants_revalidation(p, req)) {
+        return APR_NOTFOUND;
+    }
+    
+    key = make_key(p, s, req);
+    klen = strlen(key);
+    now = apr_time_now();
+    
+    apr_thread_mutex_lock(cache_mutex);
+    e = apr_hash_get(cache_entries, key, (apr_ssize_t)klen);
+    if (e && e->expires <= now) {
+        entry_remove(e);
+        e = NULL;
+    }
+    if (e) {
+        entry_unlink(e);
+        entry_link_newest(e);
+        status = e->status;
+        stored = e->stored;
+        last_modified = e->last_modified;
+        headers = apr_table_make(p, e->nheaders + 2);
+        for (i = 0; i < e->nheaders; ++i) {
+            apr_table_add(headers, e->headers[2*i], e->headers[2*i + 1]);
+        }
+        if (e->etag) {
+            etag = apr_table_get(headers, "ETag");
+        }
+        if (!head && e->body_len > 0) {
+            body = apr_pmemdup(p, e->body, e->body_len);
+            body_len = e->body_len;
+        }
+    }
+    apr_thread_mutex_unlock(cache_mutex);
+    
+    if (!headers) {
+        return APR_NOTFOUND;
+    }
+    if (not_modified(req, etag, last_modified)) {
+        status = HTTP_NOT_MODIFIED;
+        apr_table_unset(headers, "Content-Length");
+        apr_table_unset(headers, "Content-Type");
+        body = NULL;
+        body_len = 0;
+    }
+    date = apr_palloc(p, APR_RFC822_DATE_LEN);
+    apr_rfc822_date(date, now);
+    apr_table_setn(headers, "Date", date);
+    apr_table_setn(headers, "Age", apr_psprintf(p, "%" APR_TIME_T_FMT, 
+                                                apr_time_sec(now - stored)));
+    
+    response = h2_headers_create(status, headers, NULL, 0, p);
+    return h2_stream_respond(stream, response, body, body_len);
+}
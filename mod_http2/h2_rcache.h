@@ -0,0 +1,81 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __mod_h2__h2_rcache__
+#define __mod_h2__h2_rcache__
+
+/**
+ * A small in-memory cache of complete responses, one per child process.
+ * Responses from locations with "H2ResponseCache on" are stored by the
+ * worker that produced them when they are small, have a Content-Length
+ * and are fresh for a while according to their Cache-Control max-age.
+ * Later GET/HEAD requests for the same resource are answered by the 
+ * session on the master connection, without scheduling a worker.
+ *
+ * Like the quick handler of mod_cache, a hit bypasses all request
+ * processing, including access checks and logging. Entries are therefore
+ * only stored when the request was handled by the server its connection
+ * started on, and when access is granted to any client regardless of its
+ * address, user, headers and environment. They are only served on 
+ * connections to the same server, which needs H2ResponseCache on.
+ * Requests with 'Cache-Control: no-cache' go to a worker.
+ */
+
+struct h2_request;
+struct h2_stream;
+
+/**
+ * Configure the total size of the cache and the maximum size of a single
+ * response body, from "H2ResponseCacheSize total [max-entry]".
+ * @return NULL or an error message for the directive
+ */
+const char *h2_rcache_configure(cmd_parms *cmd, const char *total, 
+                                const char *max_entry);
+
+/**
+ * Forget the sizes of a previous configuration.
+ */
+void h2_rcache_pre_config(apr_pool_t *pconf);
+
+/**
+ * Create the (empty) cache of a new child process.
+ */
+void h2_rcache_child_init(apr_pool_t *pchild, server_rec *s);
+
+/**
+ * Register the filter that captures cacheable responses.
+ */
+void h2_rcache_register_hooks(void);
+
+/**
+ * Add the capturing filter to a request on a slave connection, if the 
+ * response cache is enabled for its location and the request could
+ * get a cacheable response.
+ * @param r the request on the slave connection
+ * @param req the HTTP/2 request it was created from
+ * @param s the server the session of the master connection started on
+ */
+void h2_rcache_add_filter(request_rec *r, const struct h2_request *req,
+                          server_rec *s);
+
+/**
+ * Answer the request of the stream from the cache. On success, the 
+ * stream has its complete response in its output buffer.
+ * @return APR_SUCCESS or APR_NOTFOUND if there is no fresh cached response
+ */
+apr_status_t h2_rcache_serve(struct h2_stream *stream);
+
+#endif /* defined(__mod_h2__h2_rcache__) */
@@ -206,6 +206,13 @@ h2_request *h2_request_clone(apr_pool_t *p, const h2_request *src)
     return dst;
 }
 
+int h2_request_is_repeatable(const h2_request *req)
+{
+    return (!strcmp("GET", req->method)
+            || !strcmp("HEAD", req->method)
+            || !strcmp("OPTIONS", req->method));
+}
+
 #if !AP_MODULE_MAGIC_AT_LEAST(20150222, 13)
 static request_rec *my_ap_create_request(conn_rec *c)
 {
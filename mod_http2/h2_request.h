@@ -34,6 +34,13 @@ apr_status_t h2_request_end_headers(h2_request *req, apr_pool_t *pool, int eos,
 
 h2_request *h2_request_clone(apr_pool_t *p, const h2_request *src);
 
+/**
+ * Is the request safe to process more than once, as when it is redone?
+ * Only the method is looked at, callers need to check that no request
+ * body was read.
+ */
+int h2_request_is_repeatable(const h2_request *req);
+
 /**
  * Create a request_rec representing the h2_request to be
  * processed on the given connection.
@@ -18,6 +18,7 @@
 #include <stddef.h>
 #include <apr_thread_cond.h>
 #include <apr_base64.h>
+#include <apr_hash.h>
 #include <apr_strings.h>
 
 #include <ap_mpm.h>
@@ -34,14 +35,18 @@
 #include "h2.h"
 #include "h2_bucket_beam.h"
 #include "h2_bucket_eos.h"
+#include "h2_chars.h"
 #include "h2_config.h"
 #include "h2_ctx.h"
 #include "h2_filter.h"
 #include "h2_h2.h"
+#include "h2_metrics.h"
 #include "h2_mplx.h"
 #include "h2_push.h"
+#include "h2_probes.h"
 #include "h2_request.h"
 #include "h2_headers.h"
+#include "h2_rcache.h"
 #include "h2_stream.h"
 #include "h2_task.h"
 #include "h2_session.h"
@@ -104,6 +109,28 @@ static int rst_unprocessed_stream(h2_stream *stream, void *ctx)
     return 1;
 }
 
+void h2_session_stream_pool_done(h2_session *session, apr_pool_t *pool)
+{
+    /* Keep as many pools as streams were open at the same time. A pool,
+     * once cleared, keeps its first block and is ready for a new stream
+     * without asking the allocator. */
+    ++session->stream_pools_done;
+#if APR_POOL_DEBUG
+    session->stream_pool_bytes += apr_pool_num_bytes(pool, 1);
+#endif
+    if (session->open_streams + 1 > session->max_spare_stream_pools) {
+        session->max_spare_stream_pools = H2MIN(session->open_streams + 1, 
+                                                (int)session->max_stream_count);
+    }
+    if (session->spare_stream_pools->nelts < session->max_spare_stream_pools) {
+        apr_pool_clear(pool);
+        APR_ARRAY_PUSH(session->spare_stream_pools, apr_pool_t*) = pool;
+    }
+    else {
+        apr_pool_destroy(pool);
+    }
+}
+
 static void cleanup_unprocessed_streams(h2_session *session)
 {
     h2_mplx_stream_do(session->mplx, rst_unprocessed_stream, session);
@@ -113,70 +140,83 @@ static h2_stream *h2_session_open_stream(h2_session *session, int stream_id,
                                          int initiated_on)
 {
     h2_stream * stream;
-    apr_pool_t *stream_pool;
+    apr_pool_t *stream_pool = NULL;
     
-    apr_pool_create(&stream_pool, session->pool);
-    apr_pool_tag(stream_pool, "h2_stream");
+    if (session->spare_stream_pools->nelts > 0) {
+        stream_pool = *(apr_pool_t **)apr_array_pop(session->spare_stream_pools);
+        ++session->stream_pools_reused;
+    }
+    else {
+        apr_pool_create(&stream_pool, session->pool);
+        apr_pool_tag(stream_pool, "h2_stream");
+        ++session->stream_pools_created;
+    }
     
     stream = h2_stream_create(stream_id, stream_pool, session, 
                               session->monitor, initiated_on);
     if (stream) {
         nghttp2_session_set_stream_user_data(session->ngh2, stream_id, stream);
+        H2_METRIC_INC(streams_opened);
     }
     return stream;
 }
 
 /**
  * Determine the importance of streams when scheduling tasks.
- * - if both stream depend on the same one, compare weights
- * - if one stream is closer to the root, prioritize that one
- * - if both are on the same level, use the weight of their root
- *   level ancestors
+ * - streams closer to the root come first
+ * - on the same level, the stream whose ancestors have the higher weights,
+ *   compared from the root downwards at the first ancestors that differ
+ * The rank has the depth in its top byte, followed by inverted weights
+ * of the H2_PRI_RANK_LEVELS ancestors nearest to the root. Streams
+ * deeper in the tree are only told apart by these. Ranks change only
+ * when the dependency tree does, e.g. on PRIORITY frames.
+ */
+#define H2_PRI_RANK_LEVELS      7
+
+/**
+ * With RFC 9218 priorities the rank is the urgency + 1 in the top byte,
+ * in place of the depth, and the stream id. Streams of equal urgency are
+ * started in the order they were opened. A client normally signals one
+ * scheme or the other on a connection.
  */
-static int spri_cmp(int sid1, nghttp2_stream *s1, 
-                    int sid2, nghttp2_stream *s2, h2_session *session)
+static apr_uint64_t stream_extpri_rank(h2_stream *stream)
 {
-    nghttp2_stream *p1, *p2;
-    
-    p1 = nghttp2_stream_get_parent(s1);
-    p2 = nghttp2_stream_get_parent(s2);
-    
-    if (p1 == p2) {
-        int32_t w1, w2;
-        
-        w1 = nghttp2_stream_get_weight(s1);
-        w2 = nghttp2_stream_get_weight(s2);
-        return w2 - w1;
-    }
-    else if (!p1) {
-        /* stream 1 closer to root */
-        return -1;
-    }
-    else if (!p2) {
-        /* stream 2 closer to root */
-        return 1;
-    }
-    return spri_cmp(sid1, p1, sid2, p2, session);
+    return ((((apr_uint64_t)H2_EXTPRI_URGENCY(stream->extpri)) + 1) << 56)
+           | (apr_uint32_t)stream->id;
 }
 
-static int stream_pri_cmp(int sid1, int sid2, void *ctx)
+static apr_uint64_t stream_pri_rank(int sid, void *ctx)
 {
     h2_session *session = ctx;
-    nghttp2_stream *s1, *s2;
-    
-    s1 = nghttp2_session_find_stream(session->ngh2, sid1);
-    s2 = nghttp2_session_find_stream(session->ngh2, sid2);
-
-    if (s1 == s2) {
-        return 0;
+    nghttp2_stream *s;
+    int32_t weights[H2_PRI_RANK_LEVELS+1];
+    apr_uint64_t rank;
+    int depth = 0, i;
+    
+    if (session->ext_prio) {
+        h2_stream *stream = get_stream(session, sid);
+        if (stream && (stream->has_extpri || session->ext_prio_ng2)) {
+            return stream_extpri_rank(stream);
+        }
     }
-    else if (!s1) {
-        return 1;
+    s = nghttp2_session_find_stream(session->ngh2, sid);
+    if (!s) {
+        return APR_UINT64_MAX;
     }
-    else if (!s2) {
-        return -1;
+    /* walk up to the root, remembering the last weights seen */
+    for (; s && nghttp2_stream_get_stream_id(s) != 0; 
+         s = nghttp2_stream_get_parent(s)) {
+        weights[depth % (H2_PRI_RANK_LEVELS+1)] = nghttp2_stream_get_weight(s);
+        ++depth;
     }
-    return spri_cmp(sid1, s1, sid2, s2, session);
+    
+    rank = ((apr_uint64_t)H2MIN(depth, 255)) << 56;
+    for (i = 0; i < H2MIN(depth, H2_PRI_RANK_LEVELS); ++i) {
+        /* weights are 1-256, higher ones first */
+        int32_t w = weights[(depth - 1 - i) % (H2_PRI_RANK_LEVELS+1)];
+        rank |= ((apr_uint64_t)(256 - w)) << (48 - 8 * i);
+    }
+    return rank;
 }
 
 /*
@@ -203,6 +243,62 @@ static ssize_t send_cb(nghttp2_session *ngh2,
     return h2_session_status_from_apr_status(status);
 }
 
+static void frame_rec(h2_session *session, const nghttp2_frame *frame,
+                      h2_frame_rec_dir dir)
+{
+    h2_frame_rec *rec;
+    
+    rec = &session->frame_recs[session->frame_recs_count++ 
+                               & (H2_FRAME_REC_N - 1)];
+    rec->at = apr_time_now();
+    rec->stream_id = frame->hd.stream_id;
+    rec->length = (apr_uint32_t)frame->hd.length;
+    rec->type = frame->hd.type;
+    rec->flags = frame->hd.flags;
+    rec->dir = (apr_byte_t)dir;
+}
+
+int h2_session_frames_get(h2_session *session, h2_frame_rec *recs)
+{
+    apr_uint32_t i, n, start;
+    
+    n = H2MIN(session->frame_recs_count, H2_FRAME_REC_N);
+    start = session->frame_recs_count - n;
+    for (i = 0; i < n; ++i) {
+        recs[i] = session->frame_recs[(start + i) & (H2_FRAME_REC_N - 1)];
+    }
+    return (int)n;
+}
+
+/* Log the recorded frames once, when the session ends for the reason. */
+static void frames_log(h2_session *session, const char *reason)
+{
+    static const char *dirs[] = { "recv", "sent", "invalid" };
+    h2_frame_rec recs[H2_FRAME_REC_N];
+    apr_time_t now;
+    int i, n;
+    
+    if (session->frame_recs_logged || !APLOGcinfo(session->c)) {
+        return;
+    }
+    session->frame_recs_logged = 1;
+    n = h2_session_frames_get(session, recs);
+    now = apr_time_now();
+    ap_log_cerror(APLOG_MARK, APLOG_INFO, 0, session->c, 
+                  H2_SSSN_MSG(session, "%s, last %d of %ld frames"),
+                  reason, n, (long)(session->frames_received 
+                                    + session->frames_sent));
+    for (i = 0; i < n; ++i) {
+        ap_log_cerror(APLOG_MARK, APLOG_INFO, 0, session->c, 
+                      H2_SSSN_MSG(session, "frame[%d] -%ldus %s %s"
+                      "[length=%lu, flags=0x%02x, stream=%d]"), 
+                      i - n, (long)(now - recs[i].at), 
+                      dirs[recs[i].dir], h2_util_frame_type_str(recs[i].type), 
+                      (unsigned long)recs[i].length, recs[i].flags,
+                      (int)recs[i].stream_id);
+    }
+}
+
 static int on_invalid_frame_recv_cb(nghttp2_session *ngh2,
                                     const nghttp2_frame *frame,
                                     int error, void *userp)
@@ -210,6 +306,7 @@ static int on_invalid_frame_recv_cb(nghttp2_session *ngh2,
     h2_session *session = (h2_session *)userp;
     (void)ngh2;
     
+    frame_rec(session, frame, H2_FRAME_REC_INVALID);
     if (APLOGcdebug(session->c)) {
         char buffer[256];
         
@@ -287,9 +384,44 @@ static int on_begin_headers_cb(nghttp2_session *ngh2,
     else {
         s = h2_session_open_stream(userp, frame->hd.stream_id, 0);
     }
+    if (s) {
+        h2_stream_begin_headers(s, frame->hd.length);
+    }
     return s? 0 : NGHTTP2_ERR_START_STREAM_NOT_ALLOWED;
 }
 
+/**
+ * When nghttp2 does not schedule DATA by RFC 9218 priorities itself, make
+ * the stream a child of the root, with the default weight for the default
+ * urgency, doubled for every level of urgency above and halved below.
+ */
+static void extpri_to_tree(h2_session *session, h2_stream *stream)
+{
+#ifdef H2_NG2_CHANGE_PRIO
+    nghttp2_priority_spec ps;
+    int u = H2_EXTPRI_URGENCY(stream->extpri), w, rv;
+    
+    w = (u <= 3)? (NGHTTP2_DEFAULT_WEIGHT << (3 - u)) 
+                : (NGHTTP2_DEFAULT_WEIGHT >> (u - 3));
+    nghttp2_priority_spec_init(&ps, 0, w, 0);
+    rv = nghttp2_session_change_stream_priority(session->ngh2, stream->id, &ps);
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, session->c, 
+                  H2_STRM_MSG(stream, "urgency %d as weight %d, returned=%d"), 
+                  u, w, rv);
+#else
+    (void)session;
+    (void)stream;
+#endif
+}
+
+static void set_extpri(h2_session *session, h2_stream *stream, 
+                       const uint8_t *value, size_t len)
+{
+    (void)session;
+    stream->extpri = h2_util_priority_parse((const char*)value, len);
+    stream->has_extpri = 1;
+}
+
 static int on_header_cb(nghttp2_session *ngh2, const nghttp2_frame *frame,
                         const uint8_t *name, size_t namelen,
                         const uint8_t *value, size_t valuelen,
@@ -309,6 +441,11 @@ static int on_header_cb(nghttp2_session *ngh2, const nghttp2_frame *frame,
         return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
     }
     
+    if (session->ext_prio && namelen == 8 
+        && frame->headers.cat == NGHTTP2_HCAT_REQUEST
+        && !ap_cstr_casecmpn("priority", (const char *)name, 8)) {
+        set_extpri(session, stream, value, valuelen);
+    }
     status = h2_stream_add_header(stream, (const char *)name, namelen,
                                   (const char *)value, valuelen);
     if (status != APR_SUCCESS && !h2_stream_is_ready(stream)) {
@@ -342,6 +479,8 @@ static int on_frame_recv_cb(nghttp2_session *ng2s,
     }
 
     ++session->frames_received;
+    H2_METRIC_FRAME(frames_in, frame->hd.type);
+    frame_rec(session, frame, H2_FRAME_REC_RECV);
     switch (frame->hd.type) {
         case NGHTTP2_HEADERS:
             /* This can be HEADERS for a new stream, defining the request,
@@ -351,6 +490,10 @@ static int on_frame_recv_cb(nghttp2_session *ng2s,
             if (stream) {
                 rv = h2_stream_recv_frame(stream, NGHTTP2_HEADERS, frame->hd.flags, 
                     frame->hd.length + H2_FRAME_HDR_LEN);
+                if (stream->has_extpri && !session->ext_prio_ng2
+                    && frame->headers.cat == NGHTTP2_HCAT_REQUEST) {
+                    extpri_to_tree(session, stream);
+                }
             }
             break;
         case NGHTTP2_DATA:
@@ -374,6 +517,33 @@ static int on_frame_recv_cb(nghttp2_session *ng2s,
                           frame->priority.pri_spec.stream_id,
                           frame->priority.pri_spec.exclusive);
             break;
+#ifdef H2_NG2_EXTPRI
+        case NGHTTP2_PRIORITY_UPDATE:
+            if (session->ext_prio) {
+                const nghttp2_ext_priority_update *pu = frame->ext.payload;
+                
+                /* nghttp2 remembers updates for streams not yet opened,
+                 * we see them again in the Priority header. */
+                stream = get_stream(session, pu->stream_id);
+                if (stream) {
+                    set_extpri(session, stream, pu->field_value, 
+                               pu->field_value_len);
+                    if (stream->scheduled) {
+                        /* only queued streams need to be sorted again, 
+                         * the others are ranked when they are added */
+                        session->reprioritize = 1;
+                    }
+                    if (!session->ext_prio_ng2) {
+                        extpri_to_tree(session, stream);
+                    }
+                    ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, session->c,
+                                  H2_STRM_MSG(stream, "PRIORITY_UPDATE u=%d i=%d"), 
+                                  H2_EXTPRI_URGENCY(stream->extpri),
+                                  H2_EXTPRI_INC(stream->extpri));
+                }
+            }
+            break;
+#endif
         case NGHTTP2_WINDOW_UPDATE:
             ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, session->c,
                           "h2_stream(%ld-%d): WINDOW_UPDATE incr=%d", 
@@ -394,6 +564,7 @@ static int on_frame_recv_cb(nghttp2_session *ng2s,
             }
             else {
                 ++session->streams_reset;
+                H2_METRIC_INC(streams_reset);
             }
             break;
         case NGHTTP2_GOAWAY:
@@ -409,6 +580,17 @@ static int on_frame_recv_cb(nghttp2_session *ng2s,
             }
             break;
         case NGHTTP2_SETTINGS:
+#ifdef H2_NG2_EXTPRI
+            if (session->ext_prio && !(frame->hd.flags & NGHTTP2_FLAG_ACK)) {
+                size_t i;
+                for (i = 0; i < frame->settings.niv; ++i) {
+                    if (frame->settings.iv[i].settings_id 
+                        == NGHTTP2_SETTINGS_NO_RFC7540_PRIORITIES) {
+                        session->ext_prio_ng2 = (frame->settings.iv[i].value == 1);
+                    }
+                }
+            }
+#endif
             if (APLOGctrace2(session->c)) {
                 ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, session->c,
                               H2_SSSN_MSG(session, "SETTINGS, len=%ld"), (long)frame->hd.length);
@@ -486,7 +668,6 @@ static int on_send_data_cb(nghttp2_session *ngh2,
     unsigned char padlen;
     int eos;
     h2_stream *stream;
-    apr_bucket *b;
     apr_off_t len = length;
     
     (void)ngh2;
@@ -538,14 +719,12 @@ static int on_send_data_cb(nghttp2_session *ngh2,
         return NGHTTP2_ERR_CALLBACK_FAILURE;
     }
     
-    if (padlen) {
-        b = apr_bucket_immortal_create(immortal_zeros, padlen, 
-                                       session->c->bucket_alloc);
-        APR_BRIGADE_INSERT_TAIL(session->bbtmp, b);
-    }
-    
     status = h2_conn_io_pass(&session->io, session->bbtmp);
     apr_brigade_cleanup(session->bbtmp);
+    if (padlen && status == APR_SUCCESS) {
+        /* copied into the output buffer, no bucket needed */
+        status = h2_conn_io_write(&session->io, immortal_zeros, padlen);
+    }
     
     if (status == APR_SUCCESS) {
         stream->out_data_frames++;
@@ -568,6 +747,8 @@ static int on_frame_send_cb(nghttp2_session *ngh2,
     int stream_id = frame->hd.stream_id;
     
     ++session->frames_sent;
+    H2_METRIC_FRAME(frames_out, frame->hd.type);
+    frame_rec(session, frame, H2_FRAME_REC_SENT);
     switch (frame->hd.type) {
         case NGHTTP2_PUSH_PROMISE:
             /* PUSH_PROMISE we report on the promised stream */
@@ -621,6 +802,38 @@ static int on_invalid_header_cb(nghttp2_session *ngh2,
 }
 #endif
 
+/* Padding lengths need to be unpredictable for an observer, but not 
+ * cryptographically strong. A xorshift64* generator per session, seeded 
+ * once, avoids the global lock of ap_random_pick() on every frame. Each 
+ * step gives 8 padding lengths of up to 255 bytes. */
+static void padding_seed(h2_session *session)
+{
+    do {
+        ap_random_insecure_bytes(&session->padding_rng, sizeof(session->padding_rng));
+    } while (!session->padding_rng);
+    session->padding_batch_left = 0;
+}
+
+static int padding_next(h2_session *session)
+{
+    int n;
+    
+    if (session->padding_batch_left <= 0) {
+        apr_uint64_t x = session->padding_rng;
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        session->padding_rng = x;
+        session->padding_batch = x * APR_UINT64_C(0x2545F4914F6CDD1D);
+        session->padding_batch_left = 8;
+    }
+    n = (int)(session->padding_batch & 0xff);
+    session->padding_batch >>= 8;
+    --session->padding_batch_left;
+    /* padding_max is 2^bits - 1 */
+    return n & session->padding_max;
+}
+
 static ssize_t select_padding_cb(nghttp2_session *ngh2, 
                                  const nghttp2_frame *frame, 
                                  size_t max_payloadlen, void *user_data)
@@ -633,7 +846,7 @@ static ssize_t select_padding_cb(nghttp2_session *ngh2,
      * the number my be capped by the ui.write_size that currently applies. 
      */
     if (session->padding_max) {
-        int n = ap_random_pick(0, session->padding_max);
+        int n = padding_next(session);
         padded_len = H2MIN(max_payloadlen + H2_FRAME_HDR_LEN, frame_len + n); 
     }
 
@@ -654,6 +867,31 @@ static ssize_t select_padding_cb(nghttp2_session *ngh2,
     return frame->hd.length;
 }
 
+#ifdef H2_NG2_READ_LENGTH_CB
+static ssize_t data_source_read_length_cb(nghttp2_session *ngh2, 
+                                          uint8_t frame_type, int32_t stream_id,
+                                          int32_t session_remote_window_size,
+                                          int32_t stream_remote_window_size,
+                                          uint32_t remote_max_frame_size,
+                                          void *user_data)
+{
+    h2_session *session = user_data;
+    h2_stream *stream;
+    apr_size_t len = H2_DATA_CHUNK_SIZE;
+    
+    (void)ngh2;
+    (void)frame_type;
+    stream = get_stream(session, stream_id);
+    if (stream) {
+        len = h2_session_data_chunk(session, stream);
+    }
+    len = H2MIN(len, remote_max_frame_size);
+    len = H2MIN(len, (apr_size_t)H2MAX(session_remote_window_size, 1));
+    len = H2MIN(len, (apr_size_t)H2MAX(stream_remote_window_size, 1));
+    return (ssize_t)len;
+}
+#endif
+
 #define NGH2_SET_CALLBACK(callbacks, name, fn)\
 nghttp2_session_callbacks_set_##name##_callback(callbacks, fn)
 
@@ -680,6 +918,9 @@ static apr_status_t init_callbacks(conn_rec *c, nghttp2_session_callbacks **pcb)
     NGH2_SET_CALLBACK(*pcb, on_invalid_header, on_invalid_header_cb);
 #endif
     NGH2_SET_CALLBACK(*pcb, select_padding, select_padding_cb);
+#ifdef H2_NG2_READ_LENGTH_CB
+    NGH2_SET_CALLBACK(*pcb, data_source_read_length, data_source_read_length_cb);
+#endif
     return APR_SUCCESS;
 }
 
@@ -850,6 +1091,7 @@ apr_status_t h2_session_create(h2_session **psession, conn_rec *c, request_rec *
     session->c = c;
     session->r = r;
     session->s = s;
+    session->config = h2_config_svalues(s);
     session->pool = pool;
     session->workers = workers;
     
@@ -857,8 +1099,17 @@ apr_status_t h2_session_create(h2_session **psession, conn_rec *c, request_rec *
     session->local.accepting = 1;
     session->remote.accepting = 1;
     
-    session->max_stream_count = h2_config_sgeti(s, H2_CONF_MAX_STREAMS);
-    session->max_stream_mem = h2_config_sgeti(s, H2_CONF_STREAM_MAX_MEM);
+    session->max_stream_count = H2_CONF_VAL(session->config, H2_CONF_MAX_STREAMS);
+    session->max_stream_mem = H2_CONF_VAL(session->config, H2_CONF_STREAM_MAX_MEM);
+    session->async_suspend = H2_CONF_VAL(session->config, H2_CONF_ASYNC_SUSPEND) > 0;
+    session->early_dispatch = H2_CONF_VAL(session->config, H2_CONF_EARLY_DISPATCH) > 0;
+    session->win_autotune = H2_CONF_VAL(session->config, H2_CONF_WIN_AUTOTUNE) > 0;
+    session->ext_prio = H2_CONF_VAL(session->config, H2_CONF_EXT_PRIORITIES) > 0;
+    session->win_budget = H2_CONF_VAL(session->config, H2_CONF_WIN_BUDGET);
+    session->win_min = H2_CONF_VAL(session->config, H2_CONF_WIN_SIZE);
+    session->upload_spool = H2_CONF_VAL64(session->config, H2_CONF_UPLOAD_SPOOL);
+    session->upload_spool_max = H2_CONF_VAL64(session->config, H2_CONF_UPLOAD_SPOOL_MAX);
+    session->hpack_policy = h2_config_shpack_policy(s);
     
     status = apr_thread_cond_create(&session->iowait, session->pool);
     if (status != APR_SUCCESS) {
@@ -878,6 +1129,9 @@ apr_status_t h2_session_create(h2_session **psession, conn_rec *c, request_rec *
         return APR_ENOMEM;
     }
     
+    session->spare_stream_pools = apr_array_make(session->pool, 10, 
+                                                 sizeof(apr_pool_t*));
+    
     session->monitor = apr_pcalloc(pool, sizeof(h2_stream_monitor));
     if (session->monitor == NULL) {
         apr_pool_destroy(pool);
@@ -895,11 +1149,12 @@ apr_status_t h2_session_create(h2_session **psession, conn_rec *c, request_rec *
     ap_add_input_filter("H2_IN", session->cin, r, c);
     
     h2_conn_io_init(&session->io, c, s);
-    session->padding_max = h2_config_sgeti(s, H2_CONF_PADDING_BITS);
+    session->padding_max = H2_CONF_VAL(session->config, H2_CONF_PADDING_BITS);
     if (session->padding_max) {
         session->padding_max = (0x01 << session->padding_max) - 1; 
+        padding_seed(session);
     }
-    session->padding_always = h2_config_sgeti(s, H2_CONF_PADDING_ALWAYS);
+    session->padding_always = H2_CONF_VAL(session->config, H2_CONF_PADDING_ALWAYS);
     session->bbtmp = apr_brigade_create(session->pool, c->bucket_alloc);
     
     status = init_callbacks(c, &callbacks);
@@ -922,6 +1177,23 @@ apr_status_t h2_session_create(h2_session **psession, conn_rec *c, request_rec *
     /* We need to handle window updates ourself, otherwise we
      * get flooded by nghttp2. */
     nghttp2_option_set_no_auto_window_update(options, 1);
+    n = H2_CONF_VAL(session->config, H2_CONF_HPACK_TABLE_SIZE);
+#ifdef H2_NG2_DEFLATE_TABLE_SIZE
+    nghttp2_option_set_max_deflate_dynamic_table_size(options, (size_t)n);
+#else
+    if (n != 4096) {
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c,
+                      "H2HpackTableSize needs a newer nghttp2, using 4096");
+    }
+#endif
+#ifdef H2_NG2_EXTPRI
+    if (session->ext_prio) {
+        /* clients that do not announce RFC 9218 keep the dependency tree */
+        nghttp2_option_set_builtin_recv_extension_type(options, 
+                                                       NGHTTP2_PRIORITY_UPDATE);
+        nghttp2_option_set_server_fallback_rfc7540_priorities(options, 1);
+    }
+#endif
     
     rv = nghttp2_session_server_new2(&session->ngh2, callbacks,
                                      session, options);
@@ -936,7 +1208,7 @@ apr_status_t h2_session_create(h2_session **psession, conn_rec *c, request_rec *
         return APR_ENOMEM;
     }
     
-    n = h2_config_sgeti(s, H2_CONF_PUSH_DIARY_SIZE);
+    n = H2_CONF_VAL(session->config, H2_CONF_PUSH_DIARY_SIZE);
     session->push_diary = h2_push_diary_create(session->pool, n);
     
     if (APLOGcdebug(c)) {
@@ -961,7 +1233,7 @@ apr_status_t h2_session_create(h2_session **psession, conn_rec *c, request_rec *
 static apr_status_t h2_session_start(h2_session *session, int *rv)
 {
     apr_status_t status = APR_SUCCESS;
-    nghttp2_settings_entry settings[3];
+    nghttp2_settings_entry settings[4];
     size_t slen;
     int win_size;
     
@@ -1022,12 +1294,19 @@ static apr_status_t h2_session_start(h2_session *session, int *rv)
     settings[slen].settings_id = NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS;
     settings[slen].value = (uint32_t)session->max_stream_count;
     ++slen;
-    win_size = h2_config_sgeti(session->s, H2_CONF_WIN_SIZE);
+    win_size = H2_CONF_VAL(session->config, H2_CONF_WIN_SIZE);
     if (win_size != H2_INITIAL_WINDOW_SIZE) {
         settings[slen].settings_id = NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE;
         settings[slen].value = win_size;
         ++slen;
     }
+#ifdef H2_NG2_EXTPRI
+    if (session->ext_prio) {
+        settings[slen].settings_id = NGHTTP2_SETTINGS_NO_RFC7540_PRIORITIES;
+        settings[slen].value = 1;
+        ++slen;
+    }
+#endif
     
     ap_log_cerror(APLOG_MARK, APLOG_DEBUG, status, session->c, 
                   H2_SSSN_LOG(APLOGNO(03201), session, 
@@ -1065,6 +1344,30 @@ static apr_status_t h2_session_start(h2_session *session, int *rv)
     return status;
 }
 
+/* Mark the headers H2HpackIndex wants never indexed, so that values that
+ * change all the time do not push useful entries out of the table. */
+static void apply_hpack_policy(h2_session *session, h2_ngheader *ngh)
+{
+    const h2_hpack_policy *policy;
+    char name[64];
+    apr_size_t i;
+    
+    if (!session->hpack_policy) {
+        return;
+    }
+    for (i = 0; i < ngh->nvlen; ++i) {
+        nghttp2_nv *nv = &ngh->nv[i];
+        if (nv->namelen >= sizeof(name)) {
+            continue;
+        }
+        h2_chars_lower(name, (const char *)nv->name, nv->namelen);
+        policy = apr_hash_get(session->hpack_policy, name, (apr_ssize_t)nv->namelen);
+        if (policy && *policy == H2_HPACK_NEVER) {
+            nv->flags |= NGHTTP2_NV_FLAG_NO_INDEX;
+        }
+    }
+}
+
 static apr_status_t on_stream_headers(h2_session *session, h2_stream *stream,  
                                       h2_headers *headers, apr_off_t len,
                                       int eos);
@@ -1166,6 +1469,7 @@ struct h2_stream *h2_session_push(h2_session *session, h2_stream *is,
         return NULL;
     }
     ++session->pushes_promised;
+    H2_METRIC_INC(pushes_promised);
     
     ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, session->c, 
                   H2_STRM_LOG(APLOGNO(03076), is, "SERVER_PUSH %d for %s %s on %d"),
@@ -1195,6 +1499,48 @@ static int valid_weight(float f)
             (w > NGHTTP2_MAX_WEIGHT)? NGHTTP2_MAX_WEIGHT : w);
 }
 
+#ifdef H2_NG2_EXTPRI
+/**
+ * A PUSHed stream with RFC 9218 priorities gets the urgency of the
+ * initiating stream, one level higher for BEFORE and one lower for AFTER.
+ * INTERLEAVED streams are sent incrementally.
+ */
+static apr_status_t set_push_extpri(h2_session *session, h2_stream *stream, 
+                                    const h2_priority *prio)
+{
+    h2_stream *initiator = get_stream(session, stream->initiated_on);
+    apr_byte_t pri = initiator? initiator->extpri : H2_EXTPRI_DEFAULT;
+    nghttp2_extpri ep;
+    int rv;
+    
+    ep.urgency = H2_EXTPRI_URGENCY(pri);
+    ep.inc = H2_EXTPRI_INC(pri);
+    switch (prio->dependency) {
+        case H2_DEPENDANT_BEFORE:
+            ep.urgency = (ep.urgency > 0)? ep.urgency - 1 : 0;
+            break;
+        case H2_DEPENDANT_INTERLEAVED:
+            ep.inc = 1;
+            break;
+        case H2_DEPENDANT_AFTER:
+        default:
+            ep.urgency = (ep.urgency < 7)? ep.urgency + 1 : 7;
+            break;
+    }
+    stream->extpri = H2_EXTPRI(ep.urgency, ep.inc);
+    stream->has_extpri = 1;
+    if (stream->scheduled) {
+        session->reprioritize = 1;
+    }
+    rv = nghttp2_session_change_extpri_stream_priority(session->ngh2, 
+                                                       stream->id, &ep, 1);
+    ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, session->c, 
+                  H2_STRM_MSG(stream, "PUSH u=%d i=%d, returned=%d"),
+                  (int)ep.urgency, ep.inc, rv);
+    return (rv < 0)? APR_EGENERAL : APR_SUCCESS;
+}
+#endif
+
 apr_status_t h2_session_set_prio(h2_session *session, h2_stream *stream, 
                                  const h2_priority *prio)
 {
@@ -1206,6 +1552,11 @@ apr_status_t h2_session_set_prio(h2_session *session, h2_stream *stream,
         /* we treat this as a NOP */
         return APR_SUCCESS;
     }
+#ifdef H2_NG2_EXTPRI
+    if (session->ext_prio_ng2) {
+        return set_push_extpri(session, stream, prio);
+    }
+#endif
     s = nghttp2_session_find_stream(session->ngh2, stream->id);
     if (!s) {
         ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, session->c,
@@ -1298,11 +1649,51 @@ int h2_session_push_enabled(h2_session *session)
 {
     /* iff we can and they can and want */
     return (session->remote.accepting /* remote GOAWAY received */
-            && h2_config_sgeti(session->s, H2_CONF_PUSH)
+            && H2_CONF_VAL(session->config, H2_CONF_PUSH)
             && nghttp2_session_get_remote_settings(session->ngh2, 
                    NGHTTP2_SETTINGS_ENABLE_PUSH));
 }
 
+/* A stream that does not share the connection with others that are
+ * as important, gets large frames. */
+static int data_alone(h2_session *session, h2_stream *stream)
+{
+    if (session->open_streams <= 1) {
+        return 1;
+    }
+    return (session->ext_prio 
+            && (H2_EXTPRI_URGENCY(stream->extpri) 
+                < H2_EXTPRI_URGENCY(H2_EXTPRI_DEFAULT))
+            && !H2_EXTPRI_INC(stream->extpri));
+}
+
+apr_size_t h2_session_data_chunk(h2_session *session, h2_stream *stream)
+{
+    apr_size_t chunk = H2_DATA_CHUNK_SIZE;
+    
+#ifdef H2_NG2_READ_LENGTH_CB
+    if (data_alone(session, stream)) {
+        chunk = nghttp2_session_get_remote_settings(session->ngh2, 
+                    NGHTTP2_SETTINGS_MAX_FRAME_SIZE);
+        /* a frame is buffered whole before it is sent, never let it
+         * grow beyond what a stream may buffer */
+        if (session->max_stream_mem > 0) {
+            chunk = H2MIN(chunk, session->max_stream_mem);
+        }
+        chunk = H2MAX(chunk, H2_DATA_CHUNK_SIZE);
+    }
+#else
+    (void)data_alone;
+    (void)stream;
+#endif
+    /* We can reduce the size in case the master connection operates 
+     * in smaller chunks. (TLS warmup) */
+    if (session->io.write_size > H2_FRAME_HDR_LEN) {
+        chunk = H2MIN(chunk, session->io.write_size - H2_FRAME_HDR_LEN);
+    }
+    return chunk;
+}
+
 static apr_status_t h2_session_send(h2_session *session)
 {
     apr_interval_time_t saved_timeout;
@@ -1356,6 +1747,9 @@ static apr_status_t on_stream_headers(h2_session *session, h2_stream *stream,
         h2_ngheader *nh;
         
         status = h2_res_create_ngtrailer(&nh, stream->pool, headers);
+        if (status == APR_SUCCESS) {
+            apply_hpack_policy(session, nh);
+        }
         
         ap_log_cerror(APLOG_MARK, APLOG_DEBUG, status, session->c, 
                       H2_STRM_LOG(APLOGNO(03072), stream, "submit %d trailers"), 
@@ -1437,7 +1831,7 @@ static apr_status_t on_stream_headers(h2_session *session, h2_stream *stream,
         }
         
         if (headers->status == 103 
-            && !h2_config_sgeti(session->s, H2_CONF_EARLY_HINTS)) {
+            && !H2_CONF_VAL(session->config, H2_CONF_EARLY_HINTS)) {
             /* suppress sending this to the client, it might have triggered 
              * pushes and served its purpose nevertheless */
             rv = 0;
@@ -1446,6 +1840,7 @@ static apr_status_t on_stream_headers(h2_session *session, h2_stream *stream,
         
         status = h2_res_create_ngheader(&ngh, stream->pool, headers);
         if (status == APR_SUCCESS) {
+            apply_hpack_policy(session, ngh);
             rv = nghttp2_submit_response(session->ngh2, stream->id,
                                          ngh->nv, ngh->nvlen, pprovider);
             stream->has_response = h2_headers_are_response(headers);
@@ -1538,6 +1933,31 @@ send_headers:
     return status;
 }
 
+static void schedule_stream(h2_session *session, h2_stream *stream)
+{
+    if (h2_rcache_serve(stream) == APR_SUCCESS) {
+        /* answered from the response cache, no task needed */
+        on_stream_resume(session, stream);
+    }
+    else if (h2_stream_prep_processing(stream) == APR_SUCCESS) {
+        /* Body data that came along with the headers goes into the
+         * input beam first. A request that arrived complete is then 
+         * taken by the worker in a single receive. */
+        h2_stream_flush_input(stream);
+        if (!stream->input 
+            && h2_config_sinline(session->s, stream->request->path)) {
+            /* H2Inline location and nothing to read */
+            h2_mplx_process_inline(session->mplx, stream);
+        }
+        else {
+            h2_mplx_process(session->mplx, stream, stream_pri_rank, session);
+        }
+    }
+    else {
+        h2_stream_rst(stream, H2_ERR_INTERNAL_ERROR);
+    }
+}
+
 static void h2_session_in_flush(h2_session *session)
 {
     int id;
@@ -1546,18 +1966,24 @@ static void h2_session_in_flush(h2_session *session)
         h2_stream *stream = get_stream(session, id);
         if (stream) {
             ap_assert(!stream->scheduled);
-            if (h2_stream_prep_processing(stream) == APR_SUCCESS) {
-                h2_mplx_process(session->mplx, stream, stream_pri_cmp, session);
-            }
-            else {
-                h2_stream_rst(stream, H2_ERR_INTERNAL_ERROR);
+            if (!h2_stream_spool_start(stream)) {
+                schedule_stream(session, stream);
             }
         }
     }
 
     while ((id = h2_iq_shift(session->in_pending)) > 0) {
         h2_stream *stream = get_stream(session, id);
-        if (stream) {
+        if (!stream) {
+            continue;
+        }
+        if (stream->spooling) {
+            /* body held by us until complete, no worker waits on it */
+            if (h2_stream_spool_done(stream) && !stream->rst_error) {
+                schedule_stream(session, stream);
+            }
+        }
+        else {
             h2_stream_flush_input(stream);
         }
     }
@@ -1583,6 +2009,10 @@ static apr_status_t session_read(h2_session *session, apr_size_t readlen, int bl
             case APR_SUCCESS:
                 /* successful read, reset our idle timers */
                 rstatus = APR_SUCCESS;
+                if (session->early_dispatch) {
+                    /* start what we have, do not wait for the read to end */
+                    h2_session_in_flush(session);
+                }
                 if (block) {
                     /* successful blocked read, try unblocked to
                      * get more. */
@@ -1680,6 +2110,7 @@ static void transit(h2_session *session, const char *action, h2_session_state ns
     if (session->state != nstate) {
         ostate = session->state;
         session->state = nstate;
+        H2_PROBE3(session_state, session->id, ostate, nstate);
         
         loglvl = APLOG_DEBUG;
         if ((ostate == H2_SESSION_ST_BUSY && nstate == H2_SESSION_ST_WAIT)
@@ -1749,6 +2180,9 @@ static void h2_session_ev_init(h2_session *session, int arg, const char *msg)
 
 static void h2_session_ev_local_goaway(h2_session *session, int arg, const char *msg)
 {
+    if (arg) {
+        frames_log(session, "sent GOAWAY with error");
+    }
     cleanup_unprocessed_streams(session);
     if (!session->remote.shutdown) {
         update_child_status(session, SERVER_CLOSING, "local goaway");
@@ -1758,6 +2192,9 @@ static void h2_session_ev_local_goaway(h2_session *session, int arg, const char
 
 static void h2_session_ev_remote_goaway(h2_session *session, int arg, const char *msg)
 {
+    if (arg) {
+        frames_log(session, "received GOAWAY with error");
+    }
     if (!session->remote.shutdown) {
         session->remote.error = arg;
         session->remote.accepting = 0;
@@ -1788,6 +2225,7 @@ static void h2_session_ev_conn_error(h2_session *session, int arg, const char *m
 
 static void h2_session_ev_proto_error(h2_session *session, int arg, const char *msg)
 {
+    frames_log(session, "protocol error");
     if (!session->local.shutdown) {
         ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, session->c, 
                       H2_SSSN_LOG(APLOGNO(03402), session, 
@@ -1798,6 +2236,10 @@ static void h2_session_ev_proto_error(h2_session *session, int arg, const char *
 
 static void h2_session_ev_conn_timeout(h2_session *session, int arg, const char *msg)
 {
+    if (session->open_streams) {
+        /* not an idle connection, something stalled */
+        frames_log(session, "timeout with open streams");
+    }
     transit(session, msg, H2_SESSION_ST_DONE);
     if (!session->local.shutdown) {
         h2_session_shutdown(session, arg, msg, 1);
@@ -2268,7 +2710,8 @@ apr_status_t h2_session_process(h2_session *session, int async)
                     ap_update_child_status(session->c->sbh, SERVER_BUSY_WRITE, NULL);
                     status = h2_session_send(session);
                     if (status == APR_SUCCESS) {
-                        status = h2_conn_io_flush(&session->io);
+                        /* we stay busy, control frames may wait for more */
+                        status = h2_conn_io_flush_batched(&session->io);
                     }
                     if (status != APR_SUCCESS) {
                         dispatch_event(session, H2_SESSION_EV_CONN_ERROR, 
@@ -2300,13 +2743,25 @@ apr_status_t h2_session_process(h2_session *session, int async)
                     session->wait_us = H2MIN(session->wait_us*2, MAX_WAIT_MICROS);
                 }
 
+                if (async && session->async_suspend 
+                    && session->wait_us >= MAX_WAIT_MICROS) {
+                    /* Waited a while already without anything happening,
+                     * let the MPM have the thread until there is. */
+                    ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, c,
+                                  H2_SSSN_MSG(session, "suspend, %d streams open"),
+                                  session->open_streams);
+                    session->want_suspend = 1;
+                    goto out;
+                }
+                
                 if (trace) {
                     ap_log_cerror(APLOG_MARK, APLOG_TRACE3, 0, c,
                                   "h2_session: wait for data, %ld micros", 
                                   (long)session->wait_us);
                 }
                 status = h2_mplx_out_trywait(session->mplx, session->wait_us, 
-                                             session->iowait);
+                                             session->iowait, 
+                                             nghttp2_session_want_read(session->ngh2));
                 if (status == APR_SUCCESS) {
                     session->wait_us = 0;
                         dispatch_event(session, H2_SESSION_EV_STREAM_CHANGE, 0, NULL);
@@ -2316,6 +2771,11 @@ apr_status_t h2_session_process(h2_session *session, int async)
                     transit(session, "wait cycle", session->local.shutdown? 
                             H2_SESSION_ST_DONE : H2_SESSION_ST_BUSY);
                 }
+                else if (APR_STATUS_IS_EAGAIN(status)) {
+                    /* client sent something, go read it */
+                    session->wait_us = 0;
+                    transit(session, "input ready", H2_SESSION_ST_BUSY);
+                }
                 else if (APR_STATUS_IS_ECONNRESET(status) 
                          || APR_STATUS_IS_ECONNABORTED(status)) {
                     dispatch_event(session, H2_SESSION_EV_CONN_ERROR, 0, NULL);
@@ -2342,7 +2802,7 @@ apr_status_t h2_session_process(h2_session *session, int async)
             dispatch_event(session, H2_SESSION_EV_NGH2_DONE, 0, NULL); 
         }
         if (session->reprioritize) {
-            h2_mplx_reprioritize(session->mplx, stream_pri_cmp, session);
+            h2_mplx_reprioritize(session->mplx, stream_pri_rank, session);
             session->reprioritize = 0;
         }
     }
@@ -73,6 +73,26 @@ typedef enum {
     H2_SESSION_EV_STREAM_CHANGE,    /* a stream (state/input/output) changed */
 } h2_session_event_t;
 
+/* The last frames received and sent are kept in a ring, at the cost of a
+ * few stores per frame. They are only formatted when the session ends on
+ * an error or in the "http2-status" handler. Must be a power of 2. */
+#define H2_FRAME_REC_N      32
+
+typedef enum {
+    H2_FRAME_REC_RECV,              /* frame received */
+    H2_FRAME_REC_SENT,              /* frame sent */
+    H2_FRAME_REC_INVALID,           /* frame received, rejected by nghttp2 */
+} h2_frame_rec_dir;
+
+typedef struct h2_frame_rec {
+    apr_time_t at;                  /* when the frame was seen */
+    apr_int32_t stream_id;
+    apr_uint32_t length;            /* payload length */
+    apr_byte_t type;
+    apr_byte_t flags;
+    apr_byte_t dir;                 /* h2_frame_rec_dir */
+} h2_frame_rec;
+
 typedef struct h2_session {
     long id;                        /* identifier of this session, unique
                                      * inside a httpd process */
@@ -80,6 +100,7 @@ typedef struct h2_session {
     request_rec *r;                 /* the request that started this in case
                                      * of 'h2c', NULL otherwise */
     server_rec *s;                  /* server/vhost we're starting on */
+    const struct h2_config_values *config; /* resolved config of s */
     apr_pool_t *pool;               /* pool to use in session */
     struct h2_mplx *mplx;           /* multiplexer for stream data */
     struct h2_workers *workers;     /* for executing stream tasks */
@@ -87,6 +108,9 @@ typedef struct h2_session {
     h2_conn_io io;                  /* io on httpd conn filters */
     int padding_max;                /* max number of padding bytes */
     int padding_always;             /* padding has precedence over I/O optimizations */
+    apr_uint64_t padding_rng;       /* xorshift state for padding lengths */
+    apr_uint64_t padding_batch;     /* random bytes not used yet */
+    int padding_batch_left;         /* # of bytes left in padding_batch */
     struct nghttp2_session *ngh2;   /* the nghttp2 session (internal use) */
 
     h2_session_state state;         /* state session is in */
@@ -98,9 +122,17 @@ typedef struct h2_session {
     unsigned int flush         : 1; /* flushing output necessary */
     unsigned int have_read     : 1; /* session has read client data */
     unsigned int have_written  : 1; /* session did write data to client */
+    unsigned int async_suspend : 1; /* may suspend while waiting on tasks */
+    unsigned int want_suspend  : 1; /* process returned to suspend the conn */
+    unsigned int early_dispatch : 1; /* start streams while still reading */
+    unsigned int win_autotune : 1;  /* grow stream windows as input drains */
+    unsigned int ext_prio     : 1;  /* RFC 9218 priorities are enabled */
+    unsigned int ext_prio_ng2 : 1;  /* nghttp2 schedules DATA by them */
     apr_interval_time_t  wait_us;   /* timeout during BUSY_WAIT state, micro secs */
     
     struct h2_push_diary *push_diary; /* remember pushes, avoid duplicates */
+    const char *push_diary_key;     /* client key in the shared diary cache, or NULL */
+    unsigned int push_diary_keyed : 1; /* push_diary_key has been determined */
     
     struct h2_stream_monitor *monitor;/* monitor callbacks for streams */
     int open_streams;               /* number of client streams open */
@@ -115,9 +147,19 @@ typedef struct h2_session {
     
     apr_size_t frames_received;     /* number of http/2 frames received */
     apr_size_t frames_sent;         /* number of http/2 frames sent */
+    h2_frame_rec frame_recs[H2_FRAME_REC_N]; /* ring of the last frames */
+    apr_uint32_t frame_recs_count;  /* number of frames recorded in total */
+    unsigned int frame_recs_logged : 1; /* ring has been logged already */
     
     apr_size_t max_stream_count;    /* max number of open streams */
     apr_size_t max_stream_mem;      /* max buffer memory for a single stream */
+    apr_size_t win_budget;          /* max sum of autotuned stream windows */
+    apr_size_t win_sum;             /* sum of open stream windows, if autotuned */
+    int win_min;                    /* the configured H2WindowSize */
+    apr_off_t upload_spool;         /* body bytes in memory before spooling, 0 off */
+    apr_off_t upload_spool_max;     /* max bytes spooled for all streams */
+    apr_off_t upload_spooled;       /* bytes spooled for streams not yet scheduled */
+    struct apr_hash_t *hpack_policy; /* H2HpackIndex names, or NULL */
     
     apr_time_t idle_until;          /* Time we shut down due to sheer boredom */
     apr_time_t idle_sync_until;     /* Time we sync wait until keepalive handling kicks in */
@@ -126,6 +168,8 @@ typedef struct h2_session {
     
     apr_bucket_brigade *bbtmp;      /* brigade for keeping temporary data */
     struct apr_thread_cond_t *iowait; /* our cond when trywaiting for data */
+    struct apr_array_header_t *suspend_pfds; /* polled by MPM when suspended */
+    apr_pool_t *suspend_pool;       /* registration with the MPM, cleared on resume */
     
     char status[64];                /* status message for scoreboard */
     int last_status_code;           /* the one already reported */
@@ -133,6 +177,13 @@ typedef struct h2_session {
     
     struct h2_iqueue *in_pending;   /* all streams with input pending */
     struct h2_iqueue *in_process;   /* all streams ready for processing on slave */
+    
+    struct apr_array_header_t *spare_stream_pools; /* cleared stream pools */
+    int max_spare_stream_pools;     /* most streams open at once, so far */
+    apr_uint32_t stream_pools_reused; /* streams opened with a spare pool */
+    apr_uint32_t stream_pools_created; /* streams opened with a new pool */
+    apr_uint32_t stream_pools_done; /* streams that gave back their pool */
+    apr_size_t stream_pool_bytes;   /* bytes used by those, pool debug only */
 
 } h2_session;
 
@@ -163,6 +214,14 @@ void h2_session_event(h2_session *session, h2_session_event_t ev,
  */
 apr_status_t h2_session_process(h2_session *session, int async);
 
+/**
+ * Give back the pool of a destroyed stream. The session keeps it, cleared, 
+ * for one of its next streams, or destroys it.
+ * @param session the session the stream belonged to
+ * @param pool the pool of the stream
+ */
+void h2_session_stream_pool_done(h2_session *session, apr_pool_t *pool);
+
 /**
  * Last chance to do anything before the connection is closed.
  */
@@ -187,6 +246,15 @@ void h2_session_close(h2_session *session);
  */
 int h2_session_push_enabled(h2_session *session);
 
+/**
+ * Get the maximum DATA payload the stream should send in one frame. A
+ * stream that is alone or urgent may use frames up to the peer's
+ * SETTINGS_MAX_FRAME_SIZE, but no more than H2StreamMaxMemSize. Otherwise
+ * frames stay at H2_DATA_CHUNK_SIZE, so that the streams interleave. The
+ * size never exceeds the current write size on the connection.
+ */
+apr_size_t h2_session_data_chunk(h2_session *session, struct h2_stream *stream);
+
 /**
  * Submit a push promise on the stream and schedule the new steam for
  * processing..
@@ -203,6 +271,15 @@ apr_status_t h2_session_set_prio(h2_session *session,
                                  struct h2_stream *stream, 
                                  const struct h2_priority *prio);
 
+/**
+ * Give the frames recorded, oldest first, of which there are at most
+ * H2_FRAME_REC_N.
+ * @param session the session
+ * @param recs receives up to H2_FRAME_REC_N recorded frames
+ * @return the number of frames in recs
+ */
+int h2_session_frames_get(h2_session *session, h2_frame_rec *recs);
+
 #define H2_SSSN_MSG(s, msg)     \
     "h2_session(%ld,%s,%d): "msg, s->id, h2_session_state_str(s->state), \
                             s->open_streams
@@ -34,6 +34,7 @@
 #include "h2_h2.h"
 #include "h2_mplx.h"
 #include "h2_push.h"
+#include "h2_probes.h"
 #include "h2_request.h"
 #include "h2_headers.h"
 #include "h2_session.h"
@@ -184,7 +185,7 @@ static void H2_STREAM_OUT_LOG(int lvl, h2_stream *s, const char *tag)
 
 static apr_status_t setup_input(h2_stream *stream) {
     if (stream->input == NULL) {
-        int empty = (stream->input_eof 
+        int empty = (stream->input_eof && !stream->in_spool
                      && (!stream->in_buffer 
                          || APR_BRIGADE_EMPTY(stream->in_buffer)));
         if (!empty) {
@@ -203,6 +204,10 @@ static apr_status_t close_input(h2_stream *stream)
     apr_status_t status = APR_SUCCESS;
 
     stream->input_eof = 1;
+    if (stream->spooling) {
+        /* the session schedules the stream now */
+        h2_stream_dispatch(stream, H2_SEV_IN_DATA_PENDING);
+    }
     if (stream->input && h2_beam_is_closed(stream->input)) {
         return APR_SUCCESS;
     }
@@ -300,6 +305,8 @@ static apr_status_t transit(h2_stream *stream, int new_state)
     
     ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, stream->session->c, 
                   H2_STRM_MSG(stream, "transit to [%s]"), h2_ss_str(new_state));
+    H2_PROBE4(stream_state, stream->session->id, stream->id, 
+              stream->state, new_state);
     stream->state = new_state;
     switch (new_state) {
         case H2_SS_IDLE:
@@ -323,6 +330,20 @@ static apr_status_t transit(h2_stream *stream, int new_state)
             if (stream->out_buffer) {
                 apr_brigade_cleanup(stream->out_buffer);
             }
+            stream->timing.closed = h2_util_mono_now();
+            if (APLOGctrace1(stream->session->c)) {
+                h2_stream_timing t;
+                
+                h2_stream_get_timing(stream, &t);
+                ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, stream->session->c,
+                              H2_STRM_MSG(stream, "timing (usec after HEADERS): "
+                              "task=%ld worker=%ld out=%ld data=%ld closed=%ld"),
+                              (long)h2_stream_timing_since(&t, t.task_created),
+                              (long)h2_stream_timing_since(&t, t.worker_started),
+                              (long)h2_stream_timing_since(&t, t.first_out),
+                              (long)h2_stream_timing_since(&t, t.first_data),
+                              (long)h2_stream_timing_since(&t, t.closed));
+            }
             break;
         case H2_SS_CLEANUP:
             break;
@@ -366,7 +387,7 @@ static void set_policy_for(h2_stream *stream, h2_request *r)
 {
     int enabled = h2_session_push_enabled(stream->session);
     stream->push_policy = h2_push_policy_determine(r->headers, stream->pool, enabled);
-    r->serialize = h2_config_sgeti(stream->session->s, H2_CONF_SER_HEADERS);
+    r->serialize = H2_CONF_VAL(stream->session->config, H2_CONF_SER_HEADERS);
 }
 
 apr_status_t h2_stream_send_frame(h2_stream *stream, int ftype, int flags, size_t frame_len)
@@ -387,6 +408,9 @@ apr_status_t h2_stream_send_frame(h2_stream *stream, int ftype, int flags, size_
     switch (ftype) {
         case NGHTTP2_DATA:
             eos = (flags & NGHTTP2_FLAG_END_STREAM);
+            if (!stream->timing.first_data) {
+                stream->timing.first_data = h2_util_mono_now();
+            }
             break;
             
         case NGHTTP2_HEADERS:
@@ -404,6 +428,7 @@ apr_status_t h2_stream_send_frame(h2_stream *stream, int ftype, int flags, size_
                 set_policy_for(stream, stream->rtmp);
                 stream->request = stream->rtmp;
                 stream->rtmp = NULL;
+                stream->timing.headers_in = h2_util_mono_now();
             break;
             
         default:
@@ -462,6 +487,7 @@ apr_status_t h2_stream_recv_frame(h2_stream *stream, int ftype, int flags, size_
                 set_policy_for(stream, stream->rtmp);
                 stream->request = stream->rtmp;
                 stream->rtmp = NULL;
+                stream->timing.headers_in = h2_util_mono_now();
             }
             break;
             
@@ -479,6 +505,26 @@ apr_status_t h2_stream_flush_input(h2_stream *stream)
 {
     apr_status_t status = APR_SUCCESS;
     
+    if (stream->spooling) {
+        return APR_SUCCESS;
+    }
+    if (stream->in_spool) {
+        /* spooled data goes first, the file is read in the slave */
+        apr_bucket_alloc_t *ba = stream->session->c->bucket_alloc;
+        apr_bucket_brigade *bb;
+        
+        if (!stream->in_buffer) {
+            stream->in_buffer = apr_brigade_create(stream->pool, ba);
+        }
+        if (stream->in_spool_len > 0) {
+            bb = apr_brigade_create(stream->pool, ba);
+            apr_brigade_insert_file(bb, stream->in_spool, 0, 
+                                    stream->in_spool_len, stream->pool);
+            APR_BRIGADE_PREPEND(stream->in_buffer, bb);
+            apr_brigade_destroy(bb);
+        }
+        stream->in_spool = NULL;
+    }
     if (stream->in_buffer && !APR_BRIGADE_EMPTY(stream->in_buffer)) {
         setup_input(stream);
         status = h2_beam_send(stream->input, stream->in_buffer, APR_BLOCK_READ);
@@ -491,6 +537,147 @@ apr_status_t h2_stream_flush_input(h2_stream *stream)
     return status;
 }
 
+/* Acknowledge data the session holds for a spooling stream, so that the 
+ * client may send more. Remembered, as the input beam reports it again
+ * when the slave reads it. */
+static void spool_consume(h2_stream *stream, apr_off_t len)
+{
+    h2_session *session = stream->session;
+    apr_off_t consumed = len;
+    
+    while (consumed > 0) {
+        int n = (consumed > INT_MAX)? INT_MAX : (int)consumed;
+        nghttp2_session_consume(session->ngh2, stream->id, n);
+        consumed -= n;
+    }
+    stream->in_preconsumed += len;
+}
+
+/* How many more body bytes a spooling stream may acknowledge. The 
+ * session shares H2UploadSpool's limit among its spooling streams, so 
+ * that streams without a worker cannot fill the disk. */
+static apr_off_t spool_room(h2_stream *stream)
+{
+    h2_session *session = stream->session;
+    apr_off_t room = session->upload_spool_max - session->upload_spooled;
+    
+    if (stream->in_spool_limit > 0) {
+        room = H2MIN(room, stream->in_spool_limit - stream->in_preconsumed);
+    }
+    return room;
+}
+
+/* Stop spooling, the stream is scheduled and its worker reads the rest.
+ * Nothing is consumed by a worker while spooling, so all that was 
+ * preconsumed is ours in the session budget. */
+static void spool_end(h2_stream *stream)
+{
+    if (stream->spooling) {
+        stream->session->upload_spooled -= stream->in_preconsumed;
+        stream->spooling = 0;
+    }
+}
+
+/* Move the buffered body into the spool file, once there is more than
+ * the configured amount in memory. */
+static apr_status_t spool_write(h2_stream *stream)
+{
+    h2_session *session = stream->session;
+    apr_off_t len;
+    apr_status_t status;
+    
+    apr_brigade_length(stream->in_buffer, 0, &len);
+    if (len <= session->upload_spool) {
+        return APR_SUCCESS;
+    }
+    if (!stream->in_spool) {
+        const char *tmpdir, *template;
+        
+        status = apr_temp_dir_get(&tmpdir, stream->pool);
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+        template = apr_pstrcat(stream->pool, tmpdir, "/h2-spool-XXXXXX", NULL);
+        /* default flags, the file is removed when the stream pool goes */
+        status = apr_file_mktemp(&stream->in_spool, (char *)template, 0, 
+                                 stream->pool);
+        if (status != APR_SUCCESS) {
+            stream->in_spool = NULL;
+            return status;
+        }
+    }
+    while (!APR_BRIGADE_EMPTY(stream->in_buffer)) {
+        apr_bucket *b = APR_BRIGADE_FIRST(stream->in_buffer);
+        const char *data;
+        apr_size_t dlen;
+        
+        status = apr_bucket_read(b, &data, &dlen, APR_BLOCK_READ);
+        if (status == APR_SUCCESS && dlen > 0) {
+            status = apr_file_write_full(stream->in_spool, data, dlen, NULL);
+        }
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+        stream->in_spool_len += (apr_off_t)dlen;
+        apr_bucket_delete(b);
+    }
+    return APR_SUCCESS;
+}
+
+int h2_stream_spool_start(h2_stream *stream)
+{
+    h2_session *session = stream->session;
+    core_dir_config *d;
+    const char *expect, *clen;
+    apr_off_t len = 0;
+    
+    if (session->upload_spool <= 0 || stream->input_eof || !stream->request) {
+        return 0;
+    }
+    expect = apr_table_get(stream->request->headers, "Expect");
+    if (expect && !ap_cstr_casecmp(expect, "100-continue")) {
+        /* the client waits for the handler to ask for the body */
+        return 0;
+    }
+    d = ap_get_core_module_config(session->s->lookup_defaults);
+    stream->in_spool_limit = (d && d->limit_req_body > 0)? d->limit_req_body : 0;
+    clen = apr_table_get(stream->request->headers, "Content-Length");
+    if (clen && stream->in_spool_limit > 0
+        && (apr_strtoff(&len, clen, NULL, 10) != APR_SUCCESS 
+            || len > stream->in_spool_limit)) {
+        /* the handler will refuse it, do not take it in first */
+        return 0;
+    }
+    len = 0;
+    if (stream->in_buffer) {
+        apr_brigade_length(stream->in_buffer, 0, &len);
+    }
+    if (len >= spool_room(stream)) {
+        return 0;
+    }
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, session->c,
+                  H2_STRM_MSG(stream, "spooling request body"));
+    stream->spooling = 1;
+    stream->spool_full = 0;
+    if (len > 0) {
+        spool_consume(stream, len);
+        session->upload_spooled += len;
+    }
+    return 1;
+}
+
+int h2_stream_spool_done(h2_stream *stream)
+{
+    if (stream->spooling && (stream->input_eof || stream->spool_full)) {
+        ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, stream->session->c,
+                      H2_STRM_MSG(stream, "spooled %ld bytes to file, eof=%d"), 
+                      (long)stream->in_spool_len, stream->input_eof);
+        spool_end(stream);
+        return 1;
+    }
+    return 0;
+}
+
 apr_status_t h2_stream_recv_DATA(h2_stream *stream, uint8_t flags,
                                     const uint8_t *data, size_t len)
 {
@@ -515,6 +702,30 @@ apr_status_t h2_stream_recv_DATA(h2_stream *stream, uint8_t flags,
                                                    session->c->bucket_alloc);
         }
         apr_brigade_write(stream->in_buffer, NULL, NULL, (const char *)data, len);
+        if (stream->spooling && !stream->spool_full) {
+            if ((apr_off_t)len > spool_room(stream)) {
+                /* no room, this stays unacknowledged in memory and the 
+                 * client waits on flow control until a worker reads */
+                stream->spool_full = 1;
+            }
+            else {
+                spool_consume(stream, (apr_off_t)len);
+                session->upload_spooled += (apr_off_t)len;
+                status = spool_write(stream);
+                if (status != APR_SUCCESS) {
+                    /* Data acknowledged to the client is lost, the body can
+                     * no longer arrive in full. Fail the stream. */
+                    ap_log_cerror(APLOG_MARK, APLOG_WARNING, status, session->c,
+                                  H2_STRM_MSG(stream, "writing upload spool"));
+                    spool_end(stream);
+                    h2_stream_rst(stream, H2_ERR_INTERNAL_ERROR);
+                    return APR_SUCCESS;
+                }
+                if (spool_room(stream) <= 0) {
+                    stream->spool_full = 1;
+                }
+            }
+        }
         h2_stream_dispatch(stream, H2_SEV_IN_DATA_PENDING);
     }
     return status;
@@ -534,6 +745,7 @@ h2_stream *h2_stream_create(int id, apr_pool_t *pool, h2_session *session,
     
     stream->id           = id;
     stream->initiated_on = initiated_on;
+    stream->extpri       = H2_EXTPRI_DEFAULT;
     stream->created      = apr_time_now();
     stream->state        = H2_SS_IDLE;
     stream->pool         = pool;
@@ -545,6 +757,9 @@ h2_stream *h2_stream_create(int id, apr_pool_t *pool, h2_session *session,
     stream->in_window_size = 
         nghttp2_session_get_stream_local_window_size(
             stream->session->ngh2, stream->id);
+    if (session->win_autotune) {
+        session->win_sum += stream->in_window_size;
+    }
 #endif
 
     ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, session->c, 
@@ -581,7 +796,13 @@ void h2_stream_destroy(h2_stream *stream)
     ap_assert(stream);
     ap_log_cerror(APLOG_MARK, APLOG_TRACE3, 0, stream->session->c, 
                   H2_STRM_MSG(stream, "destroy"));
-    apr_pool_destroy(stream->pool);
+    spool_end(stream);
+#ifdef H2_NG2_LOCAL_WIN_SIZE
+    if (stream->session->win_autotune) {
+        stream->session->win_sum -= stream->in_window_size;
+    }
+#endif
+    h2_session_stream_pool_done(stream->session, stream->pool);
 }
 
 apr_status_t h2_stream_prep_processing(h2_stream *stream)
@@ -687,6 +908,21 @@ static apr_status_t add_trailer(h2_stream *stream,
     return APR_SUCCESS;
 }
 
+void h2_stream_begin_headers(h2_stream *stream, size_t frame_len)
+{
+    if (H2_SS_IDLE == stream->state && !stream->rtmp) {
+        /* HPACK encodes most headers in a few bytes. Size the table from
+         * the frame so that it rarely has to grow while headers come in. */
+        int max = stream->session->s->limit_req_fields;
+        int nelts = H2MAX(10, (int)(frame_len / 8));
+        
+        if (nelts > max && max > 0) {
+            nelts = max;
+        }
+        stream->request_headers_hint = nelts;
+    }
+}
+
 apr_status_t h2_stream_add_header(h2_stream *stream,
                                   const char *name, size_t nlen,
                                   const char *value, size_t vlen)
@@ -734,7 +970,11 @@ apr_status_t h2_stream_add_header(h2_stream *stream,
     else if (H2_SS_IDLE == stream->state) {
         if (!stream->rtmp) {
             stream->rtmp = h2_req_create(stream->id, stream->pool, 
-                                         NULL, NULL, NULL, NULL, NULL, 0);
+                                         NULL, NULL, NULL, NULL, 
+                                         stream->request_headers_hint?
+                                         apr_table_make(stream->pool, 
+                                             stream->request_headers_hint)
+                                         : NULL, 0);
         }
         status = h2_request_add_header(stream->rtmp, stream->pool,
                                        name, nlen, value, vlen);
@@ -835,7 +1075,7 @@ apr_status_t h2_stream_out_prepare(h2_stream *stream, apr_off_t *plen,
                                    int *peos, h2_headers **pheaders)
 {
     apr_status_t status = APR_SUCCESS;
-    apr_off_t requested, missing, max_chunk = H2_DATA_CHUNK_SIZE;
+    apr_off_t requested, missing, max_chunk;
     conn_rec *c;
     int complete;
 
@@ -851,11 +1091,8 @@ apr_status_t h2_stream_out_prepare(h2_stream *stream, apr_off_t *plen,
     prep_output(stream);
 
     /* determine how much we'd like to send. We cannot send more than
-     * is requested. But we can reduce the size in case the master
-     * connection operates in smaller chunks. (TSL warmup) */
-    if (stream->session->io.write_size > 0) {
-        max_chunk = stream->session->io.write_size - H2_FRAME_HDR_LEN; 
-    }
+     * is requested. */
+    max_chunk = (apr_off_t)h2_session_data_chunk(stream->session, stream);
     requested = (*plen > 0)? H2MIN(*plen, max_chunk) : max_chunk;
     
     /* count the buffered data until eos or a headers bucket */
@@ -926,6 +1163,50 @@ apr_status_t h2_stream_out_prepare(h2_stream *stream, apr_off_t *plen,
     return status;
 }
 
+apr_status_t h2_stream_respond(h2_stream *stream, h2_headers *response,
+                               const char *body, apr_size_t len)
+{
+    conn_rec *c = stream->session->c;
+    apr_bucket *b;
+    
+    if (stream->scheduled || stream->output 
+        || (stream->out_buffer && !APR_BRIGADE_EMPTY(stream->out_buffer))) {
+        return APR_EINVAL;
+    }
+    prep_output(stream);
+    b = h2_bucket_headers_create(c->bucket_alloc, response);
+    APR_BRIGADE_INSERT_TAIL(stream->out_buffer, b);
+    if (len > 0) {
+        b = apr_bucket_pool_create(body, len, stream->pool, c->bucket_alloc);
+        APR_BRIGADE_INSERT_TAIL(stream->out_buffer, b);
+    }
+    b = apr_bucket_eos_create(c->bucket_alloc);
+    APR_BRIGADE_INSERT_TAIL(stream->out_buffer, b);
+    return APR_SUCCESS;
+}
+
+apr_status_t h2_stream_out_preload(h2_stream *stream)
+{
+    apr_off_t buffered = 0;
+    apr_status_t rv;
+    
+    if (stream->rst_error || !stream->output) {
+        return APR_SUCCESS;
+    }
+    prep_output(stream);
+    apr_brigade_length(stream->out_buffer, 0, &buffered);
+    if (buffered < 0 || buffered >= stream->max_mem) {
+        return APR_SUCCESS;
+    }
+    H2_STREAM_OUT_LOG(APLOG_TRACE2, stream, "pre preload");
+    rv = h2_beam_receive(stream->output, stream->out_buffer, 
+                         APR_NONBLOCK_READ, stream->max_mem - buffered);
+    H2_STREAM_OUT_LOG(APLOG_TRACE2, stream, "post preload");
+    /* EOF and EAGAIN are for h2_stream_out_prepare() to find out again */
+    return (rv == APR_SUCCESS || APR_STATUS_IS_EOF(rv) 
+            || APR_STATUS_IS_EAGAIN(rv))? APR_SUCCESS : rv;
+}
+
 static int is_not_headers(apr_bucket *b)
 {
     return !H2_BUCKET_IS_HEADERS(b);
@@ -1014,10 +1295,85 @@ int h2_stream_was_closed(const h2_stream *stream)
     }
 }
 
+#ifdef H2_NG2_LOCAL_WIN_SIZE
+/* Adapt the receive window of a stream to how fast its input is consumed.
+ * If the window is mostly open again when consumption is reported, the
+ * slave is waiting on the client and the window limits the upload: double
+ * it, as long as the windows of all streams stay within the session's
+ * budget. If it stays mostly full, shrink it to what is consumed in a
+ * second, but not below H2WindowSize. */
+static void window_autotune(h2_stream *stream, apr_off_t amount)
+{
+    h2_session *session = stream->session;
+    apr_time_t now = apr_time_now();
+    int cur_size, win = stream->in_window_size;
+    apr_off_t sample;
+    
+    if (stream->in_consumed_at && now > stream->in_consumed_at) {
+        sample = amount * APR_USEC_PER_SEC / (now - stream->in_consumed_at);
+        stream->in_drain_rate = (stream->in_drain_rate?
+                                 (3 * stream->in_drain_rate + sample) / 4 : sample);
+    }
+    stream->in_consumed_at = now;
+    
+    cur_size = nghttp2_session_get_stream_local_window_size(session->ngh2, 
+                                                            stream->id);
+    if (cur_size > win * 8/10) {
+        apr_size_t avail = (session->win_budget > session->win_sum)? 
+                           session->win_budget - session->win_sum : 0;
+        apr_size_t grow = H2MIN((apr_size_t)win, avail);
+        
+        win = (int)H2MIN((apr_size_t)win + grow, NGHTTP2_MAX_WINDOW_SIZE);
+    }
+    else if (cur_size < win * 2/10 && stream->in_drain_rate 
+             && stream->in_drain_rate < win) {
+        win = H2MAX(session->win_min, (int)stream->in_drain_rate);
+    }
+    
+    if (win != stream->in_window_size 
+        && !nghttp2_session_set_local_window_size(session->ngh2, 
+                NGHTTP2_FLAG_NONE, stream->id, win)) {
+        session->win_sum += win;
+        session->win_sum -= stream->in_window_size;
+        stream->in_window_size = win;
+    }
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, session->c,
+                  "h2_stream(%ld-%d): consumed %ld bytes at %ld bytes/s, "
+                  "window now %d/%d", session->id, stream->id, (long)amount,
+                  (long)stream->in_drain_rate, cur_size, stream->in_window_size);
+}
+#endif
+
+void h2_stream_get_timing(h2_stream *stream, h2_stream_timing *t)
+{
+    *t = stream->timing;
+    if (stream->task) {
+        /* still running or not yet reported done */
+        if (!t->worker_started) {
+            t->worker_started = stream->task->mono_started;
+        }
+        if (!t->first_out) {
+            t->first_out = stream->task->mono_first_out;
+        }
+    }
+}
+
+apr_interval_time_t h2_stream_timing_since(const h2_stream_timing *t, 
+                                           apr_time_t at)
+{
+    return (at && t->headers_in)? at - t->headers_in : -1;
+}
+
 apr_status_t h2_stream_in_consumed(h2_stream *stream, apr_off_t amount)
 {
     h2_session *session = stream->session;
     
+    if (stream->in_preconsumed > 0) {
+        /* acknowledged already when it was spooled */
+        apr_off_t n = H2MIN(amount, stream->in_preconsumed);
+        stream->in_preconsumed -= n;
+        amount -= n;
+    }
     if (amount > 0) {
         apr_off_t consumed = amount;
         
@@ -1028,7 +1384,10 @@ apr_status_t h2_stream_in_consumed(h2_stream *stream, apr_off_t amount)
         }
 
 #ifdef H2_NG2_LOCAL_WIN_SIZE
-        if (1) {
+        if (session->win_autotune) {
+            window_autotune(stream, amount);
+        }
+        else {
             int cur_size = nghttp2_session_get_stream_local_window_size(
                 session->ngh2, stream->id);
             int win = stream->in_window_size;
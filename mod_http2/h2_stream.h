@@ -51,6 +51,19 @@ typedef void h2_stream_event_cb(void *ctx, h2_stream *stream,
 /**
  * Callback structure for events and stream state transisitions
  */
+/**
+ * Monotonic times (h2_util_mono_now()) of events in the life of a stream,
+ * 0 when not yet happened.
+ */
+typedef struct h2_stream_timing {
+    apr_time_t headers_in;      /* request HEADERS complete */
+    apr_time_t task_created;    /* task handed to a worker */
+    apr_time_t worker_started;  /* worker started processing */
+    apr_time_t first_out;       /* first response bucket sent to the beam */
+    apr_time_t first_data;      /* first DATA frame sent */
+    apr_time_t closed;          /* stream closed */
+} h2_stream_timing;
+
 typedef struct h2_stream_monitor {
     void *ctx;
     h2_stream_state_cb *on_state_enter;   /* called when a state is entered */
@@ -70,16 +83,26 @@ struct h2_stream {
     h2_stream_state_t state;    /* state of this stream */
     
     apr_time_t created;         /* when stream was created */
+    apr_time_t queued_at;       /* when last queued for a worker */
+    apr_uint64_t pri_rank;      /* scheduling rank when last queued */
+    h2_stream_timing timing;    /* when things happened, for tracing */
     
     const struct h2_request *request; /* the request made in this stream */
     struct h2_request *rtmp;    /* request being assembled */
     apr_table_t *trailers;      /* optional incoming trailers */
     int request_headers_added;  /* number of request headers added */
+    int request_headers_hint;   /* expected # of request headers, or 0 */
     
     struct h2_bucket_beam *input;
     apr_bucket_brigade *in_buffer;
     int in_window_size;
     apr_time_t in_last_write;
+    apr_time_t in_consumed_at;  /* when input consumption was last reported */
+    apr_off_t in_drain_rate;    /* smoothed bytes/sec the input is consumed */
+    struct apr_file_t *in_spool; /* temp file of request body, see H2UploadSpool */
+    apr_off_t in_spool_len;     /* bytes written to in_spool */
+    apr_off_t in_preconsumed;   /* bytes reported consumed when spooled */
+    apr_off_t in_spool_limit;   /* LimitRequestBody while spooling, 0 none */
     
     struct h2_bucket_beam *output;
     apr_bucket_brigade *out_buffer;
@@ -91,6 +114,10 @@ struct h2_stream {
     unsigned int has_response : 1; /* response headers are known */
     unsigned int input_eof : 1; /* no more request data coming */
     unsigned int out_checked : 1; /* output eof was double checked */
+    unsigned int spooling : 1;  /* body is buffered before the stream is scheduled */
+    unsigned int spool_full : 1; /* spool limit or session budget reached */
+    unsigned int has_extpri : 1; /* extpri was signalled by the client */
+    apr_byte_t extpri;          /* RFC 9218 priority, see H2_EXTPRI */
     unsigned int push_policy;   /* which push policy to use for this request */
     
     struct h2_task *task;       /* assigned task to fullfill request */
@@ -185,6 +212,16 @@ void h2_stream_set_request(h2_stream *stream, const h2_request *r);
 apr_status_t h2_stream_set_request_rec(h2_stream *stream, 
                                        request_rec *r, int eos);
 
+/*
+ * A HEADERS frame starts on the stream. For the request headers, remember
+ * how many the frame probably carries. The request is still created with
+ * the first header.
+ *
+ * @param stream stream the headers are for
+ * @param frame_len the length of the HEADERS frame payload
+ */
+void h2_stream_begin_headers(h2_stream *stream, size_t frame_len);
+
 /*
  * Add a HTTP/2 header (including pseudo headers) or trailer 
  * to the given stream, depending on stream state.
@@ -215,6 +252,24 @@ apr_status_t h2_stream_recv_DATA(h2_stream *stream, uint8_t flags,
 
 apr_status_t h2_stream_flush_input(h2_stream *stream);
 
+/**
+ * Check if the request body should be buffered by the session before the
+ * stream is scheduled, following H2UploadSpool. Spooled data is acknowledged
+ * to the client right away; beyond the configured size, it goes into a
+ * temporary file. A stream spools no more than the server's LimitRequestBody
+ * and all spooling streams of a session share the H2UploadSpool limit.
+ * @param stream the stream about to be scheduled
+ * @return != 0 if the stream is spooling and must not be scheduled yet
+ */
+int h2_stream_spool_start(h2_stream *stream);
+
+/**
+ * @return != 0 if a spooling stream has its body complete or ran out of
+ *         spool room. It then is no longer spooling and may be scheduled,
+ *         the rest of its body is flow controlled as usual.
+ */
+int h2_stream_spool_done(h2_stream *stream);
+
 /**
  * Reset the stream. Stream write/reads will return errors afterwards.
  *
@@ -233,6 +288,31 @@ void h2_stream_rst(h2_stream *stream, int error_code);
  */
 int h2_stream_was_closed(const h2_stream *stream);
 
+/**
+ * Give the stream a complete response that did not come from a task,
+ * e.g. one served from the response cache. The stream must not have
+ * been scheduled for processing.
+ * 
+ * @param stream the stream to respond on
+ * @param response the response status and headers
+ * @param body the response body, allocated from the stream's pool
+ * @param len the length of the body, 0 for none
+ * @return APR_SUCCESS or APR_EINVAL if the stream already has output
+ */
+apr_status_t h2_stream_respond(h2_stream *stream, h2_headers *response,
+                               const char *body, apr_size_t len);
+
+/**
+ * Take as much output from the stream's beam as its memory limit allows
+ * into the stream's buffer, without blocking. A following 
+ * h2_stream_out_prepare()/h2_stream_read_to() then works on buffered data
+ * and does not need to lock the beam for every frame.
+ * 
+ * @param stream the stream to preload output for
+ * @return APR_SUCCESS, unless reading the beam failed
+ */
+apr_status_t h2_stream_out_preload(h2_stream *stream);
+
 /**
  * Do a speculative read on the stream output to determine the 
  * amount of data that can be read.
@@ -295,6 +375,19 @@ const struct h2_priority *h2_stream_get_priority(h2_stream *stream,
  */
 const char *h2_stream_state_str(h2_stream *stream);
 
+/**
+ * Get the times of events in the stream so far, including those of
+ * its task.
+ */
+void h2_stream_get_timing(h2_stream *stream, h2_stream_timing *t);
+
+/**
+ * Microseconds from the request HEADERS to the given time of a timing,
+ * -1 if one of them has not happened.
+ */
+apr_interval_time_t h2_stream_timing_since(const h2_stream_timing *t, 
+                                           apr_time_t at);
+
 /**
  * Determine if stream is ready for submitting a response or a RST
  * @param stream the stream to check
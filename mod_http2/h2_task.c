@@ -97,6 +97,9 @@ static apr_status_t send_out(h2_task *task, apr_bucket_brigade* bb, int block)
     apr_brigade_length(bb, 0, &written);
     H2_TASK_OUT_LOG(APLOG_TRACE2, task, bb, "h2_task send_out");
     h2_beam_log(task->output.beam, task->c, APLOG_TRACE2, "send_out(before)");
+    if (!task->mono_first_out && !APR_BRIGADE_EMPTY(bb)) {
+        task->mono_first_out = h2_util_mono_now();
+    }
 
     status = h2_beam_send(task->output.beam, bb, 
                           block? APR_BLOCK_READ : APR_NONBLOCK_READ);
@@ -401,9 +404,7 @@ int h2_task_can_redo(h2_task *task) {
         /* cannot repeat that. */
         return 0;
     }
-    return (!strcmp("GET", task->request->method)
-            || !strcmp("HEAD", task->request->method)
-            || !strcmp("OPTIONS", task->request->method));
+    return h2_request_is_repeatable(task->request);
 }
 
 void h2_task_redo(h2_task *task)
@@ -548,6 +549,7 @@ apr_status_t h2_task_do(h2_task *task, apr_thread_t *thread, int worker_id)
     c = task->c;
     task->worker_started = 1;
     task->started_at = apr_time_now();
+    task->mono_started = h2_util_mono_now();
     
     if (c->master) {
         /* Each conn_rec->id is supposed to be unique at a point in time. Since
@@ -65,6 +65,8 @@ struct h2_task {
         apr_bucket_brigade *bb;
         apr_bucket_brigade *bbchunk;
         apr_off_t chunked_total;
+        unsigned int raw_body : 1;  /* body passed without HTTP_IN */
+        apr_off_t raw_total;
     } input;
     struct {
         struct h2_bucket_beam *beam;
@@ -86,6 +88,8 @@ struct h2_task {
     
     apr_time_t started_at;           /* when processing started */
     apr_time_t done_at;              /* when processing was done */
+    apr_time_t mono_started;         /* monotonic time processing started */
+    apr_time_t mono_first_out;       /* monotonic time of first beam output */
     apr_bucket *eor;
 };
 
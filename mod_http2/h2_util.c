@@ -15,9 +15,13 @@
  */
  
 #include <assert.h>
+#include <time.h>
+#include <apr_atomic.h>
+#include <apr_lib.h>
 #include <apr_strings.h>
 #include <apr_thread_mutex.h>
 #include <apr_thread_cond.h>
+#include <apr_thread_proc.h>
 
 #include <httpd.h>
 #include <http_core.h>
@@ -27,6 +31,7 @@
 #include <nghttp2/nghttp2.h>
 
 #include "h2.h"
+#include "h2_chars.h"
 #include "h2_util.h"
 
 /* h2_log2(n) iff n is a power of 2 */
@@ -59,6 +64,18 @@ unsigned char h2_log2(int n)
     return 31 - lz;
 }
 
+apr_time_t h2_util_mono_now(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+        return apr_time_from_sec(ts.tv_sec) + (ts.tv_nsec / 1000);
+    }
+#endif
+    return apr_time_now();
+}
+
 size_t h2_util_hex_dump(char *buffer, size_t maxlen,
                         const char *data, size_t datalen)
 {
@@ -97,20 +114,7 @@ size_t h2_util_header_print(char *buffer, size_t maxlen,
 
 void h2_util_camel_case_header(char *s, size_t len)
 {
-    size_t start = 1;
-    size_t i;
-    for (i = 0; i < len; ++i) {
-        if (start) {
-            if (s[i] >= 'a' && s[i] <= 'z') {
-                s[i] -= 'a' - 'A';
-            }
-            
-            start = 0;
-        }
-        else if (s[i] == '-') {
-            start = 1;
-        }
-    }
+    h2_chars_camel_case(s, len);
 }
 
 /* base64 url encoding */
@@ -230,79 +234,160 @@ const char *h2_util_base64url_encode(const char *data,
 /*******************************************************************************
  * ihash - hash for structs with int identifier
  ******************************************************************************/
+/* An open addressing table with linear probing, keyed directly on the int.
+ * Stream ids of one side are all odd or all even and increase monotonically.
+ * Dropping the lowest bit puts the streams open at a time into consecutive
+ * slots, the odd and even ids each into their own half of the table.
+ * Removal shifts the rest of a probe run back, so there are no deleted
+ * markers to clean up later.
+ */
+#define H2_IHASH_MIN_SIZE   16
+
+typedef struct {
+    int id;
+    void *val;
+} h2_ihash_slot;
+
 struct h2_ihash_t {
-    apr_hash_t *hash;
+    apr_pool_t *pool;
+    h2_ihash_slot *slots;
+    apr_uint32_t mask;
+    size_t count;
     size_t ioff;
 };
 
-static unsigned int ihash(const char *key, apr_ssize_t *klen)
+#define IH_ID(ih, val)      (*((int*)((char *)(val) + (ih)->ioff)))
+
+static apr_uint32_t ihash_home(h2_ihash_t *ih, int id)
+{
+    apr_uint32_t u = (apr_uint32_t)id;
+    return ((u >> 1) + (u & 1) * ((ih->mask + 1) >> 1)) & ih->mask;
+}
+
+/* Index of the slot holding id or of the empty slot it would go into. There 
+ * is always an empty slot, as the table never fills beyond 3/4. */
+static apr_uint32_t ihash_find(h2_ihash_t *ih, int id)
 {
-    return (unsigned int)(*((int*)key));
+    apr_uint32_t i = ihash_home(ih, id);
+    
+    while (ih->slots[i].val && ih->slots[i].id != id) {
+        i = (i + 1) & ih->mask;
+    }
+    return i;
+}
+
+static void ihash_resize(h2_ihash_t *ih, apr_uint32_t size)
+{
+    h2_ihash_slot *old = ih->slots;
+    apr_uint32_t i, old_size = ih->mask + 1;
+    
+    ih->slots = apr_pcalloc(ih->pool, size * sizeof(h2_ihash_slot));
+    ih->mask = size - 1;
+    for (i = 0; i < old_size; ++i) {
+        if (old[i].val) {
+            ih->slots[ihash_find(ih, old[i].id)] = old[i];
+        }
+    }
+}
+
+static void ihash_remove_at(h2_ihash_t *ih, apr_uint32_t i)
+{
+    apr_uint32_t j, home;
+    
+    ih->slots[i].val = NULL;
+    --ih->count;
+    for (j = (i + 1) & ih->mask; ih->slots[j].val; j = (j + 1) & ih->mask) {
+        home = ihash_home(ih, ih->slots[j].id);
+        /* move into the hole, unless the home slot lies after it */
+        if (((j - home) & ih->mask) >= ((j - i) & ih->mask)) {
+            ih->slots[i] = ih->slots[j];
+            ih->slots[j].val = NULL;
+            i = j;
+        }
+    }
 }
 
 h2_ihash_t *h2_ihash_create(apr_pool_t *pool, size_t offset_of_int)
 {
     h2_ihash_t *ih = apr_pcalloc(pool, sizeof(h2_ihash_t));
-    ih->hash = apr_hash_make_custom(pool, ihash);
+    ih->pool = pool;
+    ih->slots = apr_pcalloc(pool, H2_IHASH_MIN_SIZE * sizeof(h2_ihash_slot));
+    ih->mask = H2_IHASH_MIN_SIZE - 1;
     ih->ioff = offset_of_int;
     return ih;
 }
 
 size_t h2_ihash_count(h2_ihash_t *ih)
 {
-    return apr_hash_count(ih->hash);
+    return ih->count;
 }
 
 int h2_ihash_empty(h2_ihash_t *ih)
 {
-    return apr_hash_count(ih->hash) == 0;
+    return ih->count == 0;
 }
 
 void *h2_ihash_get(h2_ihash_t *ih, int id)
 {
-    return apr_hash_get(ih->hash, &id, sizeof(id));
-}
-
-typedef struct {
-    h2_ihash_iter_t *iter;
-    void *ctx;
-} iter_ctx;
-
-static int ihash_iter(void *ctx, const void *key, apr_ssize_t klen, 
-                     const void *val)
-{
-    iter_ctx *ictx = ctx;
-    return ictx->iter(ictx->ctx, (void*)val); /* why is this passed const?*/
+    return ih->slots[ihash_find(ih, id)].val;
 }
 
 int h2_ihash_iter(h2_ihash_t *ih, h2_ihash_iter_t *fn, void *ctx)
 {
-    iter_ctx ictx;
-    ictx.iter = fn;
-    ictx.ctx = ctx;
-    return apr_hash_do(ihash_iter, &ictx, ih->hash);
+    apr_uint32_t i, n;
+    
+    if (ih->count == 0) {
+        return 1;
+    }
+    /* Walk backwards, starting at an empty slot. Removing the current
+     * member only moves members already visited, so fn may do that. */
+    for (i = 0; ih->slots[i].val; ++i) {
+        /* find the empty slot */
+    }
+    for (n = ih->mask; n > 0; --n) {
+        i = (i - 1) & ih->mask;
+        if (ih->slots[i].val && !fn(ctx, ih->slots[i].val)) {
+            return 0;
+        }
+    }
+    return 1;
 }
 
 void h2_ihash_add(h2_ihash_t *ih, void *val)
 {
-    apr_hash_set(ih->hash, ((char *)val + ih->ioff), sizeof(int), val);
+    int id = IH_ID(ih, val);
+    apr_uint32_t i = ihash_find(ih, id);
+    
+    if (!ih->slots[i].val) {
+        if ((ih->count + 1) * 4 > (ih->mask + 1) * 3) {
+            ihash_resize(ih, (ih->mask + 1) * 2);
+            i = ihash_find(ih, id);
+        }
+        ih->slots[i].id = id;
+        ++ih->count;
+    }
+    ih->slots[i].val = val;
 }
 
 void h2_ihash_remove(h2_ihash_t *ih, int id)
 {
-    apr_hash_set(ih->hash, &id, sizeof(id), NULL);
+    apr_uint32_t i = ihash_find(ih, id);
+    
+    if (ih->slots[i].val) {
+        ihash_remove_at(ih, i);
+    }
 }
 
 void h2_ihash_remove_val(h2_ihash_t *ih, void *val)
 {
-    int id = *((int*)((char *)val + ih->ioff));
-    apr_hash_set(ih->hash, &id, sizeof(id), NULL);
+    h2_ihash_remove(ih, IH_ID(ih, val));
 }
 
 
 void h2_ihash_clear(h2_ihash_t *ih)
 {
-    apr_hash_clear(ih->hash);
+    memset(ih->slots, 0, (ih->mask + 1) * sizeof(h2_ihash_slot));
+    ih->count = 0;
 }
 
 typedef struct {
@@ -539,11 +624,635 @@ int h2_iq_contains(h2_iqueue *q, int sid)
     return 0;
 }
 
+/*******************************************************************************
+ * iheap - int ids ordered by a precomputed rank
+ ******************************************************************************/
+
+typedef struct {
+    int id;
+    int pos;                    /* index in heap array */
+    apr_uint64_t rank;
+} iheap_node;
+
+struct h2_iheap {
+    apr_pool_t *pool;
+    iheap_node **heap;
+    int nelts;
+    int nalloc;
+    h2_ihash_t *nodes;          /* id -> node of all ids in heap */
+    apr_array_header_t *spare;  /* nodes no longer in use */
+};
+
+#define IHEAP_LESS(n1, n2)  (((n1)->rank < (n2)->rank) \
+                             || ((n1)->rank == (n2)->rank && (n1)->id < (n2)->id))
+
+static void iheap_set(h2_iheap *h, int i, iheap_node *n)
+{
+    h->heap[i] = n;
+    n->pos = i;
+}
+
+static void iheap_up(h2_iheap *h, int i)
+{
+    iheap_node *n = h->heap[i];
+    int parent;
+    
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (!IHEAP_LESS(n, h->heap[parent])) {
+            break;
+        }
+        iheap_set(h, i, h->heap[parent]);
+        i = parent;
+    }
+    iheap_set(h, i, n);
+}
+
+static void iheap_down(h2_iheap *h, int i)
+{
+    iheap_node *n = h->heap[i];
+    int child;
+    
+    while ((child = 2 * i + 1) < h->nelts) {
+        if (child + 1 < h->nelts 
+            && IHEAP_LESS(h->heap[child + 1], h->heap[child])) {
+            ++child;
+        }
+        if (!IHEAP_LESS(h->heap[child], n)) {
+            break;
+        }
+        iheap_set(h, i, h->heap[child]);
+        i = child;
+    }
+    iheap_set(h, i, n);
+}
+
+static void iheap_remove_at(h2_iheap *h, int i)
+{
+    iheap_node *n = h->heap[i];
+    
+    h2_ihash_remove(h->nodes, n->id);
+    APR_ARRAY_PUSH(h->spare, iheap_node*) = n;
+    if (i != --h->nelts) {
+        /* fill the gap with the last node and move that into place */
+        n = h->heap[h->nelts];
+        iheap_set(h, i, n);
+        iheap_up(h, i);
+        iheap_down(h, n->pos);
+    }
+}
+
+h2_iheap *h2_iheap_create(apr_pool_t *pool, int capacity)
+{
+    h2_iheap *h = apr_pcalloc(pool, sizeof(h2_iheap));
+    
+    h->pool = pool;
+    h->nalloc = (capacity > 0)? capacity : 16;
+    h->heap = apr_pcalloc(pool, h->nalloc * sizeof(iheap_node*));
+    h->nodes = h2_ihash_create(pool, offsetof(iheap_node, id));
+    h->spare = apr_array_make(pool, 16, sizeof(iheap_node*));
+    return h;
+}
+
+int h2_iheap_empty(h2_iheap *h)
+{
+    return h->nelts == 0;
+}
+
+int h2_iheap_count(h2_iheap *h)
+{
+    return h->nelts;
+}
+
+int h2_iheap_add(h2_iheap *h, int id, apr_uint64_t rank)
+{
+    iheap_node *n = h2_ihash_get(h->nodes, id);
+    
+    if (n) {
+        if (n->rank != rank) {
+            n->rank = rank;
+            iheap_up(h, n->pos);
+            iheap_down(h, n->pos);
+        }
+        return 0;
+    }
+    
+    if (h->nelts >= h->nalloc) {
+        iheap_node **nheap = apr_pcalloc(h->pool, 2 * h->nalloc * sizeof(iheap_node*));
+        memcpy(nheap, h->heap, h->nelts * sizeof(iheap_node*));
+        h->heap = nheap;
+        h->nalloc *= 2;
+    }
+    if (h->spare->nelts > 0) {
+        n = *(iheap_node**)apr_array_pop(h->spare);
+    }
+    else {
+        n = apr_palloc(h->pool, sizeof(*n));
+    }
+    n->id = id;
+    n->rank = rank;
+    h2_ihash_add(h->nodes, n);
+    iheap_set(h, h->nelts++, n);
+    iheap_up(h, n->pos);
+    return 1;
+}
+
+int h2_iheap_remove(h2_iheap *h, int id)
+{
+    iheap_node *n = h2_ihash_get(h->nodes, id);
+    
+    if (n) {
+        iheap_remove_at(h, n->pos);
+        return 1;
+    }
+    return 0;
+}
+
+void h2_iheap_clear(h2_iheap *h)
+{
+    int i;
+    for (i = 0; i < h->nelts; ++i) {
+        APR_ARRAY_PUSH(h->spare, iheap_node*) = h->heap[i];
+    }
+    h2_ihash_clear(h->nodes);
+    h->nelts = 0;
+}
+
+int h2_iheap_shift(h2_iheap *h)
+{
+    int id;
+    
+    if (h->nelts <= 0) {
+        return 0;
+    }
+    id = h->heap[0]->id;
+    iheap_remove_at(h, 0);
+    return id;
+}
+
+int h2_iheap_peek(h2_iheap *h, apr_uint64_t *prank)
+{
+    if (h->nelts <= 0) {
+        return 0;
+    }
+    if (prank) {
+        *prank = h->heap[0]->rank;
+    }
+    return h->heap[0]->id;
+}
+
+int h2_iheap_contains(h2_iheap *h, int id)
+{
+    return h2_ihash_get(h->nodes, id) != NULL;
+}
+
+int h2_iheap_get_rank(h2_iheap *h, int id, apr_uint64_t *prank)
+{
+    iheap_node *n = h2_ihash_get(h->nodes, id);
+    
+    if (n) {
+        *prank = n->rank;
+        return 1;
+    }
+    return 0;
+}
+
+void h2_iheap_rerank(h2_iheap *h, h2_iheap_rank_fn *fn, void *ctx)
+{
+    int i;
+    
+    for (i = 0; i < h->nelts; ++i) {
+        h->heap[i]->rank = fn(h->heap[i]->id, ctx);
+    }
+    for (i = h->nelts / 2 - 1; i >= 0; --i) {
+        iheap_down(h, i);
+    }
+}
+
+/*******************************************************************************
+ * lock-free ring, used by FIFO queues created with H2_FIFO_LOCKFREE
+ ******************************************************************************/
+
+/* A bounded multi-producer/multi-consumer ring where each cell carries a
+ * sequence number telling producers and consumers whose turn it is (the
+ * design by D. Vyukov). Cells must be *claimed* by consumers, so that
+ * h2_fifo_remove() can take elements out of the middle of the ring.
+ * Neither producers nor consumers lock unless they want to wait on an
+ * empty or full ring. There is no set mode, a membership check cannot
+ * be made atomic with the push without a lock around both, and FIFO
+ * sets use the locked queue.
+ */
+#define H2_LF_PAD       64
+
+typedef struct {
+    volatile apr_uint32_t seq;   /* pos+1 when filled, pos+size when free */
+    volatile apr_uint32_t claim; /* seq of the last lap that was claimed */
+    void *elem;
+} h2_lfcell;
+
+typedef struct {
+    h2_lfcell *cells;
+    apr_uint32_t size;
+    apr_uint32_t mask;
+    volatile int aborted;
+    char pad1[H2_LF_PAD];
+    volatile apr_uint32_t head;  /* next position to pull */
+    char pad2[H2_LF_PAD];
+    volatile apr_uint32_t tail;  /* next position to push */
+    char pad3[H2_LF_PAD];
+    volatile apr_uint32_t count;
+    volatile apr_uint32_t epoch;
+    volatile apr_uint32_t peeking[2];
+    volatile void *removing;     /* elem a remove is taking out, or NULL */
+    volatile apr_uint32_t dropped; /* elems peeks dropped for a remove */
+    volatile apr_uint32_t empty_waits;
+    volatile apr_uint32_t full_waits;
+    apr_thread_mutex_t *lock;
+    apr_thread_mutex_t *rm_lock;
+    apr_thread_cond_t  *not_empty;
+    apr_thread_cond_t  *not_full;
+} h2_lfring;
+
+/* Read a cell sequence with full barrier semantics */
+#define LF_SYNC_READ(p)     apr_atomic_cas32((p), 0, 0)
+#define LF_DIFF(a, b)       ((apr_int32_t)((a) - (b)))
+/* All cells in use, removed ones included until they reach the head */
+#define LF_FULL(r)          (LF_DIFF((r)->tail, (r)->head) >= (apr_int32_t)(r)->size)
+
+/* ints are kept in the ring as pointer values */
+#define H2_INT2PTR(i)       ((void*)(apr_intptr_t)(i))
+#define H2_PTR2INT(p)       ((int)(apr_intptr_t)(p))
+
+static apr_status_t lfring_destroy(void *data) 
+{
+    h2_lfring *ring = data;
+
+    apr_thread_cond_destroy(ring->not_empty);
+    apr_thread_cond_destroy(ring->not_full);
+    apr_thread_mutex_destroy(ring->rm_lock);
+    apr_thread_mutex_destroy(ring->lock);
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t lfring_create(h2_lfring **pring, apr_pool_t *pool, 
+                                  int capacity)
+{
+    apr_status_t rv;
+    h2_lfring *ring;
+    apr_uint32_t i;
+    
+    ring = apr_pcalloc(pool, sizeof(*ring));
+    if (ring == NULL) {
+        return APR_ENOMEM;
+    }
+    rv = apr_thread_mutex_create(&ring->lock, APR_THREAD_MUTEX_UNNESTED, pool);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    rv = apr_thread_mutex_create(&ring->rm_lock, APR_THREAD_MUTEX_UNNESTED, pool);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    rv = apr_thread_cond_create(&ring->not_empty, pool);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    rv = apr_thread_cond_create(&ring->not_full, pool);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    for (ring->size = 2; ring->size < (apr_uint32_t)capacity; ring->size <<= 1) {
+        /* next power of 2 */
+    }
+    ring->mask = ring->size - 1;
+    ring->cells = apr_pcalloc(pool, ring->size * sizeof(h2_lfcell));
+    if (ring->cells == NULL) {
+        return APR_ENOMEM;
+    }
+    for (i = 0; i < ring->size; ++i) {
+        ring->cells[i].seq = i;
+        ring->cells[i].claim = i;
+    }
+    
+    *pring = ring;
+    apr_pool_cleanup_register(pool, ring, lfring_destroy, apr_pool_cleanup_null);
+    return APR_SUCCESS;
+}
+
+static apr_status_t lfring_interrupt(h2_lfring *ring)
+{
+    apr_status_t rv;
+    if ((rv = apr_thread_mutex_lock(ring->lock)) == APR_SUCCESS) {
+        apr_thread_cond_broadcast(ring->not_empty);
+        apr_thread_cond_broadcast(ring->not_full);
+        apr_thread_mutex_unlock(ring->lock);
+    }
+    return rv;
+}
+
+/* Claim the lap <seq> of a cell, either by a consumer or by a remove. 
+ * Exactly one party can succeed for each lap. */
+static int lfcell_claim(h2_lfcell *cell, apr_uint32_t seq)
+{
+    apr_uint32_t c = cell->claim;
+    
+    while (LF_DIFF(seq, c) > 0) {
+        apr_uint32_t prev = apr_atomic_cas32(&cell->claim, seq, c);
+        if (prev == c) {
+            return 1;
+        }
+        c = prev;
+    }
+    return 0;
+}
+
+/* Wake up threads waiting on cond, if there are any */
+static void lfring_wake(h2_lfring *ring, volatile apr_uint32_t *pwaits,
+                        apr_thread_cond_t *cond)
+{
+    if (apr_atomic_read32(pwaits)) {
+        apr_thread_mutex_lock(ring->lock);
+        apr_thread_cond_broadcast(cond);
+        apr_thread_mutex_unlock(ring->lock);
+    }
+}
+
+/* Take the cell at the head if it was claimed by a remove. */
+static int lfring_skip_removed(h2_lfring *ring)
+{
+    apr_uint32_t pos = ring->head;
+    h2_lfcell *cell = &ring->cells[pos & ring->mask];
+    
+    if (LF_DIFF(LF_SYNC_READ(&cell->seq), pos + 1) == 0
+        && LF_DIFF(cell->claim, pos + 1) == 0
+        && apr_atomic_cas32(&ring->head, pos + 1, pos) == pos) {
+        apr_atomic_set32(&cell->seq, pos + ring->size);
+        return 1;
+    }
+    return 0;
+}
+
+static apr_status_t lfring_push_int(h2_lfring *ring, void *elem)
+{
+    h2_lfcell *cell;
+    apr_uint32_t pos, seq;
+
+    for (;;) {
+        pos = ring->tail;
+        cell = &ring->cells[pos & ring->mask];
+        seq = cell->seq;
+        if (LF_DIFF(seq, pos) == 0) {
+            if (apr_atomic_cas32(&ring->tail, pos + 1, pos) == pos) {
+                break;
+            }
+        }
+        else if (LF_DIFF(seq, pos) < 0) {
+            /* full, unless the cells ahead of us were removed */
+            if (!lfring_skip_removed(ring)) {
+                return APR_EAGAIN;
+            }
+        }
+    }
+    cell->elem = elem;
+    /* count first, a consumer or remove may take the cell as soon as 
+     * its seq is set and must not decrement below 0 */
+    apr_atomic_inc32(&ring->count);
+    apr_atomic_set32(&cell->seq, pos + 1);
+    
+    lfring_wake(ring, &ring->empty_waits, ring->not_empty);
+    return APR_SUCCESS;
+}
+
+static apr_status_t lfring_pull_int(h2_lfring *ring, void **pelem)
+{
+    h2_lfcell *cell;
+    apr_uint32_t pos, seq;
+    void *elem;
+    int claimed, freed = 0;
+    
+    for (;;) {
+        pos = ring->head;
+        cell = &ring->cells[pos & ring->mask];
+        seq = cell->seq;
+        if (LF_DIFF(seq, pos + 1) == 0) {
+            if (apr_atomic_cas32(&ring->head, pos + 1, pos) == pos) {
+                elem = cell->elem;
+                claimed = lfcell_claim(cell, pos + 1);
+                apr_atomic_set32(&cell->seq, pos + ring->size);
+                freed = 1;
+                if (claimed) {
+                    break;
+                }
+                /* removed, try the next one */
+            }
+        }
+        else if (LF_DIFF(seq, pos + 1) < 0) {
+            if (freed) {
+                lfring_wake(ring, &ring->full_waits, ring->not_full);
+            }
+            *pelem = NULL;
+            return APR_EAGAIN;
+        }
+    }
+    
+    apr_atomic_dec32(&ring->count);
+    lfring_wake(ring, &ring->full_waits, ring->not_full);
+    *pelem = elem;
+    return APR_SUCCESS;
+}
+
+/* Apply fn to all unclaimed cells holding elem, stop when fn returns 0 */
+static int lfring_scan(h2_lfring *ring, void *elem, 
+                       int fn(h2_lfcell *cell, apr_uint32_t seq, void *ctx),
+                       void *ctx)
+{
+    apr_uint32_t pos, end, seq;
+    h2_lfcell *cell;
+    
+    end = ring->tail;
+    for (pos = ring->head; LF_DIFF(end, pos) > 0; ++pos) {
+        cell = &ring->cells[pos & ring->mask];
+        seq = LF_SYNC_READ(&cell->seq);
+        if (LF_DIFF(seq, pos + 1) == 0 && cell->elem == elem
+            && LF_DIFF(pos + 1, cell->claim) > 0) {
+            if (!fn(cell, seq, ctx)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+typedef struct {
+    h2_lfring *ring;
+    int removed;
+} lf_remove_ctx;
+
+static int lfcell_remove(h2_lfcell *cell, apr_uint32_t seq, void *ctx)
+{
+    lf_remove_ctx *x = ctx;
+    
+    if (lfcell_claim(cell, seq)) {
+        apr_atomic_dec32(&x->ring->count);
+        ++x->removed;
+    }
+    return 1;
+}
+
+static apr_status_t lfring_wait(h2_lfring *ring, volatile apr_uint32_t *pwaits,
+                                apr_thread_cond_t *cond, int for_empty)
+{
+    apr_status_t rv = APR_SUCCESS;
+    
+    apr_thread_mutex_lock(ring->lock);
+    apr_atomic_inc32(pwaits);
+    while (!ring->aborted) {
+        if (for_empty? (apr_atomic_read32(&ring->count) > 0) : !LF_FULL(ring)) {
+            break;
+        }
+        apr_thread_cond_wait(cond, ring->lock);
+    }
+    apr_atomic_dec32(pwaits);
+    if (ring->aborted) {
+        rv = APR_EOF;
+    }
+    apr_thread_mutex_unlock(ring->lock);
+    return rv;
+}
+
+static apr_status_t lfring_push(h2_lfring *ring, void *elem, int block)
+{
+    apr_status_t rv;
+    
+    if (ring->aborted) {
+        return APR_EOF;
+    }
+    while ((rv = lfring_push_int(ring, elem)) == APR_EAGAIN && block) {
+        if ((rv = lfring_wait(ring, &ring->full_waits, 
+                              ring->not_full, 0)) != APR_SUCCESS) {
+            break;
+        }
+    }
+    return rv;
+}
+
+static apr_status_t lfring_pull(h2_lfring *ring, void **pelem, int block)
+{
+    apr_status_t rv;
+    
+    if (ring->aborted) {
+        return APR_EOF;
+    }
+    while ((rv = lfring_pull_int(ring, pelem)) == APR_EAGAIN && block) {
+        if ((rv = lfring_wait(ring, &ring->empty_waits, 
+                              ring->not_empty, 1)) != APR_SUCCESS) {
+            break;
+        }
+    }
+    return rv;
+}
+
+/* Is a remove of elem under way? Then a peek must neither hand
+ * it to its callback nor push it back, but drop it. */
+static int lfring_dropped(h2_lfring *ring, void *elem)
+{
+    if (apr_atomic_casptr(&ring->removing, NULL, NULL) == elem) {
+        apr_atomic_inc32(&ring->dropped);
+        return 1;
+    }
+    return 0;
+}
+
+static apr_status_t lfring_peek(h2_lfring *ring, h2_fifo_peek_fn *fn, 
+                                void *ctx, int block)
+{
+    apr_status_t rv;
+    apr_uint32_t epoch;
+    void *elem;
+    
+    for (;;) {
+        if (ring->aborted) {
+            return APR_EOF;
+        }
+        /* announce the peek, so that a concurrent remove waits for
+         * an element we might re-push */
+        for (;;) {
+            epoch = apr_atomic_read32(&ring->epoch);
+            apr_atomic_inc32(&ring->peeking[epoch & 1]);
+            if (apr_atomic_read32(&ring->epoch) == epoch) {
+                break;
+            }
+            apr_atomic_dec32(&ring->peeking[epoch & 1]);
+        }
+        
+        rv = lfring_pull_int(ring, &elem);
+        if (rv == APR_SUCCESS && lfring_dropped(ring, elem)) {
+            apr_atomic_dec32(&ring->peeking[epoch & 1]);
+            continue;
+        }
+        if (rv == APR_SUCCESS) {
+            switch (fn(elem, ctx)) {
+                case H2_FIFO_OP_PULL:
+                    break;
+                case H2_FIFO_OP_REPUSH:
+                    if (!lfring_dropped(ring, elem)) {
+                        rv = lfring_push(ring, elem, block);
+                    }
+                    break;
+            }
+        }
+        apr_atomic_dec32(&ring->peeking[epoch & 1]);
+        
+        if (rv != APR_EAGAIN || !block) {
+            return rv;
+        }
+        if ((rv = lfring_wait(ring, &ring->empty_waits, 
+                              ring->not_empty, 1)) != APR_SUCCESS) {
+            return rv;
+        }
+    }
+}
+
+static apr_status_t lfring_remove(h2_lfring *ring, void *elem)
+{
+    lf_remove_ctx x;
+    apr_uint32_t epoch, dropped;
+    
+    if (ring->aborted) {
+        return APR_EOF;
+    }
+    x.ring = ring;
+    x.removed = 0;
+    apr_thread_mutex_lock(ring->rm_lock);
+    /* Peeks that see the marker drop elem. The ones that started before
+     * it was set may still hand elem to their callback or re-push it, 
+     * wait for them before taking elem out of the cells. */
+    dropped = apr_atomic_read32(&ring->dropped);
+    apr_atomic_xchgptr(&ring->removing, elem);
+    epoch = apr_atomic_inc32(&ring->epoch);
+    while (apr_atomic_read32(&ring->peeking[epoch & 1]) > 0) {
+        apr_thread_yield();
+    }
+    lfring_scan(ring, elem, lfcell_remove, &x);
+    apr_atomic_xchgptr(&ring->removing, NULL);
+    x.removed += (int)(apr_atomic_read32(&ring->dropped) - dropped);
+    apr_thread_mutex_unlock(ring->rm_lock);
+    
+    while (lfring_skip_removed(ring)) {
+        /* free cells at the head */
+    }
+    lfring_wake(ring, &ring->full_waits, ring->not_full);
+    return x.removed? APR_SUCCESS : APR_EAGAIN;
+}
+
 /*******************************************************************************
  * FIFO queue
  ******************************************************************************/
 
 struct h2_fifo {
+    h2_lfring *ring;
     void **elems;
     int nelems;
     int set;
@@ -584,15 +1293,24 @@ static int index_of(h2_fifo *fifo, void *elem)
 }
 
 static apr_status_t create_int(h2_fifo **pfifo, apr_pool_t *pool, 
-                               int capacity, int as_set)
+                               int capacity, int flags)
 {
     apr_status_t rv;
     h2_fifo *fifo;
+    int as_set = (flags & H2_FIFO_SET);
     
     fifo = apr_pcalloc(pool, sizeof(*fifo));
     if (fifo == NULL) {
         return APR_ENOMEM;
     }
+    if ((flags & H2_FIFO_LOCKFREE) && !as_set) {
+        rv = lfring_create(&fifo->ring, pool, capacity);
+        if (rv == APR_SUCCESS) {
+            fifo->nelems = capacity;
+            *pfifo = fifo;
+        }
+        return rv;
+    }
 
     rv = apr_thread_mutex_create(&fifo->lock,
                                  APR_THREAD_MUTEX_UNNESTED, pool);
@@ -630,12 +1348,22 @@ apr_status_t h2_fifo_create(h2_fifo **pfifo, apr_pool_t *pool, int capacity)
 
 apr_status_t h2_fifo_set_create(h2_fifo **pfifo, apr_pool_t *pool, int capacity)
 {
-    return create_int(pfifo, pool, capacity, 1);
+    return create_int(pfifo, pool, capacity, H2_FIFO_SET);
+}
+
+apr_status_t h2_fifo_create_ex(h2_fifo **pfifo, apr_pool_t *pool, 
+                               int capacity, int flags)
+{
+    return create_int(pfifo, pool, capacity, flags);
 }
 
 apr_status_t h2_fifo_term(h2_fifo *fifo)
 {
     apr_status_t rv;
+    if (fifo->ring) {
+        fifo->ring->aborted = 1;
+        return APR_SUCCESS;
+    }
     if ((rv = apr_thread_mutex_lock(fifo->lock)) == APR_SUCCESS) {
         fifo->aborted = 1;
         apr_thread_mutex_unlock(fifo->lock);
@@ -646,6 +1374,9 @@ apr_status_t h2_fifo_term(h2_fifo *fifo)
 apr_status_t h2_fifo_interrupt(h2_fifo *fifo)
 {
     apr_status_t rv;
+    if (fifo->ring) {
+        return lfring_interrupt(fifo->ring);
+    }
     if ((rv = apr_thread_mutex_lock(fifo->lock)) == APR_SUCCESS) {
         apr_thread_cond_broadcast(fifo->not_empty);
         apr_thread_cond_broadcast(fifo->not_full);
@@ -656,6 +1387,9 @@ apr_status_t h2_fifo_interrupt(h2_fifo *fifo)
 
 int h2_fifo_count(h2_fifo *fifo)
 {
+    if (fifo->ring) {
+        return (int)apr_atomic_read32(&fifo->ring->count);
+    }
     return fifo->count;
 }
 
@@ -710,6 +1444,9 @@ static apr_status_t fifo_push(h2_fifo *fifo, void *elem, int block)
 {
     apr_status_t rv;
     
+    if (fifo->ring) {
+        return lfring_push(fifo->ring, elem, block);
+    }
     if (fifo->aborted) {
         return APR_EOF;
     }
@@ -754,6 +1491,9 @@ static apr_status_t fifo_pull(h2_fifo *fifo, void **pelem, int block)
 {
     apr_status_t rv;
     
+    if (fifo->ring) {
+        return lfring_pull(fifo->ring, pelem, block);
+    }
     if (fifo->aborted) {
         return APR_EOF;
     }
@@ -780,6 +1520,9 @@ static apr_status_t fifo_peek(h2_fifo *fifo, h2_fifo_peek_fn *fn, void *ctx, int
     apr_status_t rv;
     void *elem;
     
+    if (fifo->ring) {
+        return lfring_peek(fifo->ring, fn, ctx, block);
+    }
     if (fifo->aborted) {
         return APR_EOF;
     }
@@ -813,6 +1556,9 @@ apr_status_t h2_fifo_remove(h2_fifo *fifo, void *elem)
 {
     apr_status_t rv;
     
+    if (fifo->ring) {
+        return lfring_remove(fifo->ring, elem);
+    }
     if (fifo->aborted) {
         return APR_EOF;
     }
@@ -852,6 +1598,7 @@ apr_status_t h2_fifo_remove(h2_fifo *fifo, void *elem)
  ******************************************************************************/
 
 struct h2_ififo {
+    h2_lfring *ring;
     int *elems;
     int nelems;
     int set;
@@ -892,15 +1639,24 @@ static int iindex_of(h2_ififo *fifo, int id)
 }
 
 static apr_status_t icreate_int(h2_ififo **pfifo, apr_pool_t *pool, 
-                                int capacity, int as_set)
+                                int capacity, int flags)
 {
     apr_status_t rv;
     h2_ififo *fifo;
+    int as_set = (flags & H2_FIFO_SET);
     
     fifo = apr_pcalloc(pool, sizeof(*fifo));
     if (fifo == NULL) {
         return APR_ENOMEM;
     }
+    if ((flags & H2_FIFO_LOCKFREE) && !as_set) {
+        rv = lfring_create(&fifo->ring, pool, capacity);
+        if (rv == APR_SUCCESS) {
+            fifo->nelems = capacity;
+            *pfifo = fifo;
+        }
+        return rv;
+    }
 
     rv = apr_thread_mutex_create(&fifo->lock,
                                  APR_THREAD_MUTEX_UNNESTED, pool);
@@ -938,12 +1694,22 @@ apr_status_t h2_ififo_create(h2_ififo **pfifo, apr_pool_t *pool, int capacity)
 
 apr_status_t h2_ififo_set_create(h2_ififo **pfifo, apr_pool_t *pool, int capacity)
 {
-    return icreate_int(pfifo, pool, capacity, 1);
+    return icreate_int(pfifo, pool, capacity, H2_FIFO_SET);
+}
+
+apr_status_t h2_ififo_create_ex(h2_ififo **pfifo, apr_pool_t *pool, 
+                                int capacity, int flags)
+{
+    return icreate_int(pfifo, pool, capacity, flags);
 }
 
 apr_status_t h2_ififo_term(h2_ififo *fifo)
 {
     apr_status_t rv;
+    if (fifo->ring) {
+        fifo->ring->aborted = 1;
+        return APR_SUCCESS;
+    }
     if ((rv = apr_thread_mutex_lock(fifo->lock)) == APR_SUCCESS) {
         fifo->aborted = 1;
         apr_thread_mutex_unlock(fifo->lock);
@@ -954,6 +1720,9 @@ apr_status_t h2_ififo_term(h2_ififo *fifo)
 apr_status_t h2_ififo_interrupt(h2_ififo *fifo)
 {
     apr_status_t rv;
+    if (fifo->ring) {
+        return lfring_interrupt(fifo->ring);
+    }
     if ((rv = apr_thread_mutex_lock(fifo->lock)) == APR_SUCCESS) {
         apr_thread_cond_broadcast(fifo->not_empty);
         apr_thread_cond_broadcast(fifo->not_full);
@@ -964,6 +1733,9 @@ apr_status_t h2_ififo_interrupt(h2_ififo *fifo)
 
 int h2_ififo_count(h2_ififo *fifo)
 {
+    if (fifo->ring) {
+        return (int)apr_atomic_read32(&fifo->ring->count);
+    }
     return fifo->count;
 }
 
@@ -1018,6 +1790,9 @@ static apr_status_t ififo_push(h2_ififo *fifo, int id, int block)
 {
     apr_status_t rv;
     
+    if (fifo->ring) {
+        return lfring_push(fifo->ring, H2_INT2PTR(id), block);
+    }
     if (fifo->aborted) {
         return APR_EOF;
     }
@@ -1062,6 +1837,12 @@ static apr_status_t ififo_pull(h2_ififo *fifo, int *pi, int block)
 {
     apr_status_t rv;
     
+    if (fifo->ring) {
+        void *elem;
+        rv = lfring_pull(fifo->ring, &elem, block);
+        *pi = (rv == APR_SUCCESS)? H2_PTR2INT(elem) : 0;
+        return rv;
+    }
     if (fifo->aborted) {
         return APR_EOF;
     }
@@ -1083,11 +1864,28 @@ apr_status_t h2_ififo_try_pull(h2_ififo *fifo, int *pi)
     return ififo_pull(fifo, pi, 0);
 }
 
+typedef struct {
+    h2_ififo_peek_fn *fn;
+    void *ctx;
+} ipeek_ctx;
+
+static h2_fifo_op_t ipeek_adapt(void *head, void *ctx)
+{
+    ipeek_ctx *x = ctx;
+    return x->fn(H2_PTR2INT(head), x->ctx);
+}
+
 static apr_status_t ififo_peek(h2_ififo *fifo, h2_ififo_peek_fn *fn, void *ctx, int block)
 {
     apr_status_t rv;
     int id;
     
+    if (fifo->ring) {
+        ipeek_ctx x;
+        x.fn = fn;
+        x.ctx = ctx;
+        return lfring_peek(fifo->ring, ipeek_adapt, &x, block);
+    }
     if (fifo->aborted) {
         return APR_EOF;
     }
@@ -1121,6 +1919,9 @@ apr_status_t h2_ififo_remove(h2_ififo *fifo, int id)
 {
     apr_status_t rv;
     
+    if (fifo->ring) {
+        return lfring_remove(fifo->ring, H2_INT2PTR(id));
+    }
     if (fifo->aborted) {
         return APR_EOF;
     }
@@ -1596,37 +2397,110 @@ apr_off_t h2_brigade_mem_size(apr_bucket_brigade *bb)
  * h2_ngheader
  ******************************************************************************/
  
+/* Header names checked against fixed sets. The length and first character
+ * select the only candidate(s), so each lookup does at most two string 
+ * compares instead of scanning all literals. */
+#define H2_LIT_IS(l, name)  (!ap_cstr_casecmpn((l), (name), sizeof(l) - 1))
+
 int h2_util_ignore_header(const char *name) 
 {
     /* never forward, ch. 8.1.2.2 */
-    return (H2_HD_MATCH_LIT_CS("connection", name)
-            || H2_HD_MATCH_LIT_CS("proxy-connection", name)
-            || H2_HD_MATCH_LIT_CS("upgrade", name)
-            || H2_HD_MATCH_LIT_CS("keep-alive", name)
-            || H2_HD_MATCH_LIT_CS("transfer-encoding", name));
+    switch (strlen(name)) {
+        case 7:
+            return H2_LIT_IS("upgrade", name);
+        case 10:
+            return (apr_tolower(name[0]) == 'c')? 
+                H2_LIT_IS("connection", name) : H2_LIT_IS("keep-alive", name);
+        case 16:
+            return H2_LIT_IS("proxy-connection", name);
+        case 17:
+            return H2_LIT_IS("transfer-encoding", name);
+        default:
+            return 0;
+    }
 }
 
-static int count_header(void *ctx, const char *key, const char *value)
+static const char *inv_field_name_chr(const char *token, apr_size_t len)
 {
-    if (!h2_util_ignore_header(key)) {
-        (*((size_t*)ctx))++;
-    }
-    return 1;
+    apr_size_t i = (len && *token == ':')? 1 : 0;
+    
+    i += h2_chars_span(token + i, len - i, H2_CHAR_TOKEN);
+    return (i < len)? token + i : NULL;
 }
 
-static const char *inv_field_name_chr(const char *token)
+static const char *inv_field_value_chr(const char *token, apr_size_t len)
 {
-    const char *p = ap_scan_http_token(token);
-    if (p == token && *p == ':') {
-        p = ap_scan_http_token(++p);
-    }
-    return (p && *p)? p : NULL;
+    apr_size_t i = h2_chars_span(token, len, H2_CHAR_FIELD);
+    return (i < len)? token + i : NULL;
 }
 
-static const char *inv_field_value_chr(const char *token)
+/* Lowercase names of the headers most responses carry. nghttp2 does not 
+ * need to copy and lowercase these, they live forever. */
+#define H2_LC_NAME(lc, n, len)  \
+    if ((len) == sizeof(lc) - 1 && !ap_cstr_casecmpn((lc), (n), (len))) \
+        return (lc)
+
+static const char *lc_header_name(const char *name, size_t len)
 {
-    const char *p = ap_scan_http_field_content(token);
-    return (p && *p)? p : NULL;
+    switch (len) {
+        case 3:
+            H2_LC_NAME("age", name, len);
+            break;
+        case 4:
+            H2_LC_NAME("date", name, len);
+            H2_LC_NAME("etag", name, len);
+            H2_LC_NAME("vary", name, len);
+            H2_LC_NAME("link", name, len);
+            break;
+        case 6:
+            H2_LC_NAME("server", name, len);
+            break;
+        case 7:
+            H2_LC_NAME("expires", name, len);
+            H2_LC_NAME("alt-svc", name, len);
+            break;
+        case 8:
+            H2_LC_NAME("location", name, len);
+            break;
+        case 10:
+            H2_LC_NAME("set-cookie", name, len);
+            break;
+        case 12:
+            H2_LC_NAME("content-type", name, len);
+            break;
+        case 13:
+            H2_LC_NAME("last-modified", name, len);
+            H2_LC_NAME("accept-ranges", name, len);
+            H2_LC_NAME("cache-control", name, len);
+            H2_LC_NAME("content-range", name, len);
+            break;
+        case 14:
+            H2_LC_NAME("content-length", name, len);
+            break;
+        case 15:
+            H2_LC_NAME("x-frame-options", name, len);
+            H2_LC_NAME("referrer-policy", name, len);
+            break;
+        case 16:
+            H2_LC_NAME("content-encoding", name, len);
+            H2_LC_NAME("content-language", name, len);
+            break;
+        case 22:
+            H2_LC_NAME("x-content-type-options", name, len);
+            break;
+        case 23:
+            H2_LC_NAME("content-security-policy", name, len);
+            break;
+        case 25:
+            H2_LC_NAME("strict-transport-security", name, len);
+            break;
+        case 27:
+            H2_LC_NAME("access-control-allow-origin", name, len);
+            break;
+        default:
+            break;
+    }
+    return NULL;
 }
 
 typedef struct ngh_ctx {
@@ -1636,20 +2510,25 @@ typedef struct ngh_ctx {
     apr_status_t status;
 } ngh_ctx;
 
-static int add_header(ngh_ctx *ctx, const char *key, const char *value)
+static int add_header(ngh_ctx *ctx, const char *key, const char *value, 
+                      int static_key)
 {
     nghttp2_nv *nv = &(ctx->ngh)->nv[(ctx->ngh)->nvlen++];
-    const char *p;
+    const char *p, *lc;
 
+    nv->name = (uint8_t*)key;
+    nv->namelen = strlen(key);
+    nv->value = (uint8_t*)value;
+    nv->valuelen = strlen(value);
     if (!ctx->unsafe) {
-        if ((p = inv_field_name_chr(key))) {
+        if ((p = inv_field_name_chr(key, nv->namelen))) {
             ap_log_perror(APLOG_MARK, APLOG_TRACE1, APR_EINVAL, ctx->p,
                           "h2_request: head field '%s: %s' has invalid char %s", 
                           key, value, p);
             ctx->status = APR_EINVAL;
             return 0;
         }
-        if ((p = inv_field_value_chr(value))) {
+        if ((p = inv_field_value_chr(value, nv->valuelen))) {
             ap_log_perror(APLOG_MARK, APLOG_TRACE1, APR_EINVAL, ctx->p,
                           "h2_request: head field '%s: %s' has invalid char %s", 
                           key, value, p);
@@ -1657,19 +2536,14 @@ static int add_header(ngh_ctx *ctx, const char *key, const char *value)
             return 0;
         }
     }
-    nv->name = (uint8_t*)key;
-    nv->namelen = strlen(key);
-    nv->value = (uint8_t*)value;
-    nv->valuelen = strlen(value);
-    
-    return 1;
-}
-
-static int add_table_header(void *ctx, const char *key, const char *value)
-{
-    if (!h2_util_ignore_header(key)) {
-        add_header(ctx, key, value);
+    if (static_key) {
+        nv->flags |= NGHTTP2_NV_FLAG_NO_COPY_NAME;
+    }
+    else if ((lc = lc_header_name(key, nv->namelen))) {
+        nv->name = (uint8_t*)lc;
+        nv->flags |= NGHTTP2_NV_FLAG_NO_COPY_NAME;
     }
+    
     return 1;
 }
 
@@ -1678,33 +2552,37 @@ static apr_status_t ngheader_create(h2_ngheader **ph, apr_pool_t *p,
                                     const char *keys[], const char *values[],
                                     apr_table_t *headers)
 {
+    const apr_array_header_t *arr = apr_table_elts(headers);
+    const apr_table_entry_t *elts = (const apr_table_entry_t *)arr->elts;
     ngh_ctx ctx;
-    size_t n, i;
+    int i;
     
     ctx.p = p;
     ctx.unsafe = unsafe;
     
-    n = key_count;
-    apr_table_do(count_header, &n, headers, NULL);
-    
     *ph = ctx.ngh = apr_pcalloc(p, sizeof(h2_ngheader));
     if (!ctx.ngh) {
         return APR_ENOMEM;
     }
     
-    ctx.ngh->nv =  apr_pcalloc(p, n * sizeof(nghttp2_nv));
+    /* room for all, we skip the few ignored ones in the same go */
+    ctx.ngh->nv =  apr_pcalloc(p, (key_count + arr->nelts) * sizeof(nghttp2_nv));
     if (!ctx.ngh->nv) {
         return APR_ENOMEM;
     }
     
     ctx.status = APR_SUCCESS;
-    for (i = 0; i < key_count; ++i) {
-        if (!add_header(&ctx, keys[i], values[i])) {
+    for (i = 0; i < (int)key_count; ++i) {
+        if (!add_header(&ctx, keys[i], values[i], 1)) {
             return ctx.status;
         }
     }
     
-    apr_table_do(add_table_header, &ctx, headers, NULL);
+    for (i = 0; i < arr->nelts; ++i) {
+        if (elts[i].key && !h2_util_ignore_header(elts[i].key)) {
+            add_header(&ctx, elts[i].key, elts[i].val, 0);
+        }
+    }
 
     return ctx.status;
 }
@@ -1722,6 +2600,25 @@ apr_status_t h2_res_create_ngtrailer(h2_ngheader **ph, apr_pool_t *p,
                            0, NULL, NULL, headers->headers);
 }
                                      
+static const char *status_value(apr_pool_t *p, int status)
+{
+    switch (status) {
+        case 200: return "200";
+        case 204: return "204";
+        case 206: return "206";
+        case 301: return "301";
+        case 302: return "302";
+        case 304: return "304";
+        case 400: return "400";
+        case 401: return "401";
+        case 403: return "403";
+        case 404: return "404";
+        case 500: return "500";
+        case 503: return "503";
+        default:  return apr_psprintf(p, "%d", status);
+    }
+}
+
 apr_status_t h2_res_create_ngheader(h2_ngheader **ph, apr_pool_t *p,
                                     h2_headers *headers) 
 {
@@ -1729,7 +2626,7 @@ apr_status_t h2_res_create_ngheader(h2_ngheader **ph, apr_pool_t *p,
         ":status"
     };
     const char *values[] = {
-        apr_psprintf(p, "%d", headers->status)
+        status_value(p, headers->status)
     };
     return ngheader_create(ph, p, is_unsafe(headers),  
                            H2_ALEN(keys), keys, values, headers->headers);
@@ -1765,78 +2662,85 @@ apr_status_t h2_req_create_ngheader(h2_ngheader **ph, apr_pool_t *p,
  ******************************************************************************/
  
 
-typedef struct {
-    const char *name;
-    size_t len;
-} literal;
-
-#define H2_DEF_LITERAL(n)   { (n), (sizeof(n)-1) }
-#define H2_LIT_ARGS(a)      (a),H2_ALEN(a)
-
-static literal IgnoredRequestHeaders[] = {
-    H2_DEF_LITERAL("upgrade"),
-    H2_DEF_LITERAL("connection"),
-    H2_DEF_LITERAL("keep-alive"),
-    H2_DEF_LITERAL("http2-settings"),
-    H2_DEF_LITERAL("proxy-connection"),
-    H2_DEF_LITERAL("transfer-encoding"),
-};
-static literal IgnoredRequestTrailers[] = { /* Ignore, see rfc7230, ch. 4.1.2 */
-    H2_DEF_LITERAL("te"),
-    H2_DEF_LITERAL("host"),
-    H2_DEF_LITERAL("range"),
-    H2_DEF_LITERAL("cookie"),
-    H2_DEF_LITERAL("expect"),
-    H2_DEF_LITERAL("pragma"),
-    H2_DEF_LITERAL("max-forwards"),
-    H2_DEF_LITERAL("cache-control"),
-    H2_DEF_LITERAL("authorization"),
-    H2_DEF_LITERAL("content-length"),       
-    H2_DEF_LITERAL("proxy-authorization"),
-};    
-static literal IgnoredResponseTrailers[] = {
-    H2_DEF_LITERAL("age"),
-    H2_DEF_LITERAL("date"),
-    H2_DEF_LITERAL("vary"),
-    H2_DEF_LITERAL("cookie"),
-    H2_DEF_LITERAL("expires"),
-    H2_DEF_LITERAL("warning"),
-    H2_DEF_LITERAL("location"),
-    H2_DEF_LITERAL("retry-after"),
-    H2_DEF_LITERAL("cache-control"),
-    H2_DEF_LITERAL("www-authenticate"),
-    H2_DEF_LITERAL("proxy-authenticate"),
-};
-
-static int ignore_header(const literal *lits, size_t llen,
-                         const char *name, size_t nlen)
-{
-    const literal *lit;
-    size_t i;
-    
-    for (i = 0; i < llen; ++i) {
-        lit = &lits[i];
-        if (lit->len == nlen && !apr_strnatcasecmp(lit->name, name)) {
-            return 1;
-        }
-    }
-    return 0;
-}
-
 int h2_req_ignore_header(const char *name, size_t len)
 {
-    return ignore_header(H2_LIT_ARGS(IgnoredRequestHeaders), name, len);
+    switch (len) {
+        case 7:
+            return H2_LIT_IS("upgrade", name);
+        case 10:
+            return (apr_tolower(name[0]) == 'c')? 
+                H2_LIT_IS("connection", name) : H2_LIT_IS("keep-alive", name);
+        case 14:
+            return H2_LIT_IS("http2-settings", name);
+        case 16:
+            return H2_LIT_IS("proxy-connection", name);
+        case 17:
+            return H2_LIT_IS("transfer-encoding", name);
+        default:
+            return 0;
+    }
 }
 
 int h2_req_ignore_trailer(const char *name, size_t len)
 {
-    return (h2_req_ignore_header(name, len) 
-            || ignore_header(H2_LIT_ARGS(IgnoredRequestTrailers), name, len));
+    /* Ignore, see rfc7230, ch. 4.1.2 */
+    if (h2_req_ignore_header(name, len)) {
+        return 1;
+    }
+    switch (len) {
+        case 2:
+            return H2_LIT_IS("te", name);
+        case 4:
+            return H2_LIT_IS("host", name);
+        case 5:
+            return H2_LIT_IS("range", name);
+        case 6:
+            switch (apr_tolower(name[0])) {
+                case 'c': return H2_LIT_IS("cookie", name);
+                case 'e': return H2_LIT_IS("expect", name);
+                case 'p': return H2_LIT_IS("pragma", name);
+                default:  return 0;
+            }
+        case 12:
+            return H2_LIT_IS("max-forwards", name);
+        case 13:
+            return (apr_tolower(name[0]) == 'c')? 
+                H2_LIT_IS("cache-control", name) : H2_LIT_IS("authorization", name);
+        case 14:
+            return H2_LIT_IS("content-length", name);
+        case 19:
+            return H2_LIT_IS("proxy-authorization", name);
+        default:
+            return 0;
+    }
 }
 
 int h2_res_ignore_trailer(const char *name, size_t len)
 {
-    return ignore_header(H2_LIT_ARGS(IgnoredResponseTrailers), name, len);
+    switch (len) {
+        case 3:
+            return H2_LIT_IS("age", name);
+        case 4:
+            return (apr_tolower(name[0]) == 'd')? 
+                H2_LIT_IS("date", name) : H2_LIT_IS("vary", name);
+        case 6:
+            return H2_LIT_IS("cookie", name);
+        case 7:
+            return (apr_tolower(name[0]) == 'e')? 
+                H2_LIT_IS("expires", name) : H2_LIT_IS("warning", name);
+        case 8:
+            return H2_LIT_IS("location", name);
+        case 11:
+            return H2_LIT_IS("retry-after", name);
+        case 13:
+            return H2_LIT_IS("cache-control", name);
+        case 16:
+            return H2_LIT_IS("www-authenticate", name);
+        case 18:
+            return H2_LIT_IS("proxy-authenticate", name);
+        default:
+            return 0;
+    }
 }
 
 apr_status_t h2_req_add_header(apr_table_t *headers, apr_pool_t *pool, 
@@ -1901,6 +2805,19 @@ h2_request *h2_req_create(int id, apr_pool_t *pool, const char *method,
  * frame logging
  ******************************************************************************/
 
+static const char *FrameTypeNames[] = {
+    "DATA", "HEADERS", "PRIORITY", "RST_STREAM", "SETTINGS", "PUSH_PROMISE", 
+    "PING", "GOAWAY", "WINDOW_UPDATE", "CONTINUATION"
+};
+
+const char *h2_util_frame_type_str(int type)
+{
+    if (type >= 0 && type < (int)H2_ALEN(FrameTypeNames)) {
+        return FrameTypeNames[type];
+    }
+    return "UNKNOWN";
+}
+
 int h2_util_frame_print(const nghttp2_frame *frame, char *buffer, size_t maxlen)
 {
     char scratch[128];
@@ -2013,3 +2930,53 @@ int h2_push_policy_determine(apr_table_t *headers, apr_pool_t *p, int push_enabl
     return policy;
 }
 
+apr_byte_t h2_util_priority_parse(const char *s, apr_size_t len)
+{
+    int urgency = H2_EXTPRI_URGENCY(H2_EXTPRI_DEFAULT);
+    int inc = H2_EXTPRI_INC(H2_EXTPRI_DEFAULT);
+    apr_size_t i = 0, key, klen;
+    int val, quoted;
+    
+    while (i < len) {
+        while (i < len && (s[i] == ' ' || s[i] == '\t')) {
+            ++i;
+        }
+        key = i;
+        while (i < len && (apr_islower(s[i]) || apr_isdigit(s[i]) 
+                           || s[i] == '_' || s[i] == '-' 
+                           || s[i] == '.' || s[i] == '*')) {
+            ++i;
+        }
+        klen = i - key;
+        if (klen == 1 && s[key] == 'u' && i < len && s[i] == '=') {
+            /* an integer, anything else (like decimals) is ignored */
+            for (++i, val = 0; i < len && apr_isdigit(s[i]) && val < 8; ++i) {
+                val = (val * 10) + (s[i] - '0');
+            }
+            if (val < 8 && i > key + 2 && (i == len || s[i] == ',' 
+                || s[i] == ';' || s[i] == ' ' || s[i] == '\t')) {
+                urgency = val;
+            }
+        }
+        else if (klen == 1 && s[key] == 'i') {
+            if (i == len || s[i] != '=') {
+                inc = 1;
+            }
+            else if (i + 2 < len && s[i+1] == '?' 
+                     && (s[i+2] == '0' || s[i+2] == '1')) {
+                inc = (s[i+2] == '1');
+            }
+        }
+        /* skip the rest of the member and its parameters */
+        for (quoted = 0; i < len && (quoted || s[i] != ','); ++i) {
+            if (quoted && s[i] == '\\') {
+                ++i;
+            }
+            else if (s[i] == '"') {
+                quoted = !quoted;
+            }
+        }
+        ++i;
+    }
+    return H2_EXTPRI(urgency, inc);
+}
@@ -36,6 +36,11 @@ void h2_util_camel_case_header(char *s, size_t len);
 
 int h2_util_frame_print(const nghttp2_frame *frame, char *buffer, size_t maxlen);
 
+/**
+ * The name of a frame type, "UNKNOWN" for extension types.
+ */
+const char *h2_util_frame_type_str(int type);
+
 /*******************************************************************************
  * ihash - hash for structs with int identifier
  ******************************************************************************/
@@ -55,7 +60,8 @@ void *h2_ihash_get(h2_ihash_t *ih, int id);
 
 /**
  * Iterate over the hash members (without defined order) and invoke
- * fn for each member until 0 is returned.
+ * fn for each member until 0 is returned. fn may remove the member it
+ * is invoked on, but must not add new ones.
  * @param ih the hash to iterate over
  * @param fn the function to invoke on each member
  * @param ctx user supplied data passed into each iteration call
@@ -185,6 +191,79 @@ size_t h2_iq_mshift(h2_iqueue *q, int *pint, size_t max);
  */
 int h2_iq_contains(h2_iqueue *q, int sid);
 
+/*******************************************************************************
+ * iheap - int ids ordered by a precomputed rank
+ ******************************************************************************/
+/**
+ * A binary heap of unique int ids, each with a 64 bit rank. The id with the
+ * lowest rank is shifted first, ids of equal rank in ascending order. Adding,
+ * changing the rank of, removing and shifting an id take O(log n).
+ */
+typedef struct h2_iheap h2_iheap;
+
+/**
+ * Calculate the rank of an id, used when all ranks are renewed.
+ */
+typedef apr_uint64_t h2_iheap_rank_fn(int id, void *ctx);
+
+/**
+ * Allocate a new heap from the pool and initialize.
+ * @param pool the memory pool
+ * @param capacity the initial capacity of the heap
+ */
+h2_iheap *h2_iheap_create(apr_pool_t *pool, int capacity);
+
+int h2_iheap_empty(h2_iheap *h);
+int h2_iheap_count(h2_iheap *h);
+
+/**
+ * Add an id with the given rank. If the id is already in the heap, 
+ * only its rank is changed.
+ * @return != 0 iff id was not already there
+ */
+int h2_iheap_add(h2_iheap *h, int id, apr_uint64_t rank);
+
+/**
+ * Remove the id from the heap.
+ * @return != 0 iff id was found in the heap
+ */
+int h2_iheap_remove(h2_iheap *h, int id);
+
+/**
+ * Remove all entries in the heap.
+ */
+void h2_iheap_clear(h2_iheap *h);
+
+/**
+ * Get the id of lowest rank from the heap or 0 if the heap is empty. 
+ * The id is being removed.
+ */
+int h2_iheap_shift(h2_iheap *h);
+
+/**
+ * Get the id of lowest rank from the heap or 0 if the heap is empty,
+ * leaving it in place.
+ * @param prank if not NULL, receives the rank of the id
+ */
+int h2_iheap_peek(h2_iheap *h, apr_uint64_t *prank);
+
+/**
+ * @return != 0 iff id is in the heap
+ */
+int h2_iheap_contains(h2_iheap *h, int id);
+
+/**
+ * Get the rank of an id in the heap.
+ * @return != 0 iff id is in the heap
+ */
+int h2_iheap_get_rank(h2_iheap *h, int id, apr_uint64_t *prank);
+
+/**
+ * Let the callback rank all ids anew and re-establish the heap order
+ * in O(n).
+ */
+void h2_iheap_rerank(h2_iheap *h, h2_iheap_rank_fn *fn, void *ctx);
+
 /*******************************************************************************
  * FIFO queue (void* elements)
  ******************************************************************************/
@@ -208,6 +287,20 @@ apr_status_t h2_fifo_create(h2_fifo **pfifo, apr_pool_t *pool, int capacity);
  */
 apr_status_t h2_fifo_set_create(h2_fifo **pfifo, apr_pool_t *pool, int capacity);
 
+#define H2_FIFO_SET         0x01   /* elements appear only once */
+#define H2_FIFO_LOCKFREE    0x02   /* use the lock-free ring, not for sets */
+
+/**
+ * Create a FIFO queue with the given H2_FIFO_* flags. A lock-free queue
+ * only waits when blocking on an empty or full queue. Producers and 
+ * consumers never take a lock otherwise. Removing an element waits for
+ * the peeks running concurrently, so that element is also not re-pushed
+ * by them. Sets always use the locked queue, H2_FIFO_LOCKFREE is ignored
+ * together with H2_FIFO_SET.
+ */
+apr_status_t h2_fifo_create_ex(h2_fifo **pfifo, apr_pool_t *pool, 
+                               int capacity, int flags);
+
 apr_status_t h2_fifo_term(h2_fifo *fifo);
 apr_status_t h2_fifo_interrupt(h2_fifo *fifo);
 
@@ -279,6 +372,13 @@ apr_status_t h2_ififo_create(h2_ififo **pfifo, apr_pool_t *pool, int capacity);
  */
 apr_status_t h2_ififo_set_create(h2_ififo **pfifo, apr_pool_t *pool, int capacity);
 
+/**
+ * Create a FIFO queue for ints with the given H2_FIFO_* flags, see
+ * h2_fifo_create_ex().
+ */
+apr_status_t h2_ififo_create_ex(h2_ififo **pfifo, apr_pool_t *pool, 
+                                int capacity, int flags);
+
 apr_status_t h2_ififo_term(h2_ififo *fifo);
 apr_status_t h2_ififo_interrupt(h2_ififo *fifo);
 
@@ -328,6 +428,13 @@ apr_status_t h2_ififo_remove(h2_ififo *fifo, int id);
 /* h2_log2(n) iff n is a power of 2 */
 unsigned char h2_log2(int n);
 
+/**
+ * The time of a monotonic clock in microseconds, for measuring durations
+ * that are not affected by adjustments of the system time. Falls back to
+ * apr_time_now() where no such clock is available.
+ */
+apr_time_t h2_util_mono_now(void);
+
 /**
  * Count the bytes that all key/value pairs in a table have
  * in length (exlucding terminating 0s), plus additional extra per pair.
@@ -361,6 +468,24 @@ int h2_res_ignore_trailer(const char *name, size_t len);
  */
 int h2_push_policy_determine(apr_table_t *headers, apr_pool_t *p, int push_enabled);
 
+/* An RFC 9218 priority in one byte: the urgency, 0 (highest) to 7, in the
+ * upper bits and the incremental flag in the lowest. */
+#define H2_EXTPRI(u, i)         ((apr_byte_t)(((u) << 1) | ((i)? 1 : 0)))
+#define H2_EXTPRI_URGENCY(p)    ((p) >> 1)
+#define H2_EXTPRI_INC(p)        ((p) & 1)
+#define H2_EXTPRI_DEFAULT       H2_EXTPRI(3, 0)
+
+/**
+ * Parse the value of a Priority header or PRIORITY_UPDATE frame, a
+ * structured field dictionary as in RFC 9218. Only the 'u' and 'i' members
+ * are looked at, members missing or with invalid values keep the default.
+ * 
+ * @param s the field value, need not be NUL terminated
+ * @param len the length of the value
+ * @return the priority, see H2_EXTPRI
+ */
+apr_byte_t h2_util_priority_parse(const char *s, apr_size_t len);
+
 /*******************************************************************************
  * base64 url encoding, different table from normal base64
  ******************************************************************************/
@@ -15,7 +15,13 @@
  */
 
 #include <assert.h>
+#include <stdlib.h>
+#ifdef H2_CPU_AFFINITY
+#include <errno.h>
+#include <sched.h>
+#endif
 #include <apr_atomic.h>
+#include <apr_strings.h>
 #include <apr_thread_mutex.h>
 #include <apr_thread_cond.h>
 
@@ -26,19 +32,48 @@
 
 #include "h2.h"
 #include "h2_private.h"
+#include "h2_metrics.h"
 #include "h2_mplx.h"
 #include "h2_task.h"
 #include "h2_workers.h"
 #include "h2_util.h"
 
+/* capacity of the per worker queue of h2_mplx when work stealing */
+#define H2_SLOT_QUEUE_SIZE      64
+
+/* Without stealing, connections share workers by deficit round robin. 
+ * Each time a mplx comes up in the shared queue, it is credited a quantum 
+ * of worker time, multiplied by its weight. Its tasks are charged the time
+ * they actually ran. A mplx that used up its credit is passed over until
+ * it earned some again, so that connections with many or long running 
+ * requests do not starve the others. The debt is limited, so that a long
+ * running task does not block its connection for long after it is done. */
+#define H2_DRR_QUANTUM          apr_time_from_msec(5)
+#define H2_DRR_MAX_DEBT         (8 * H2_DRR_QUANTUM)
+
+/* NUMA nodes we look for, numbered without gaps from 0 */
+#define H2_MAX_NODES            16
+
+/* With scaling, a controller looks at the pool every tick. When tasks wait
+ * for workers, because the queue holds more connections than there are 
+ * idle workers or because the average wait went above the limit, it adds
+ * a quarter of the workers at once, so that a burst does not have to 
+ * create one thread after the other on the request path. Workers are 
+ * retired one at a time, when more than the spares were idle for all 
+ * ticks of H2MaxWorkerIdleSeconds. */
+#define H2_SCALE_TICK           apr_time_from_msec(100)
+#define H2_SCALE_WAIT_MAX       apr_time_from_msec(1)
+
 typedef struct h2_slot h2_slot;
 struct h2_slot {
     int id;
+    int node;               /* NUMA node the thread runs on, 0 without affinity */
     h2_slot *next;
     h2_workers *workers;
     int aborted;
     int sticks;
     h2_task *task;
+    struct h2_fifo *mplxs;  /* local queue of affine h2_mplx, when stealing */
     apr_thread_t *thread;
     apr_thread_mutex_t *lock;
     apr_thread_cond_t *not_idle;
@@ -73,6 +108,125 @@ static void push_slot(h2_slot **phead, h2_slot *slot)
 
 static void* APR_THREAD_FUNC slot_run(apr_thread_t *thread, void *wctx);
 
+#ifdef H2_CPU_AFFINITY
+/* The topology is the same for all h2_workers of a process */
+static cpu_set_t node_cpus[H2_MAX_NODES];
+static int cpu_node[CPU_SETSIZE];
+
+static void parse_cpulist(char *list, int node, const cpu_set_t *allowed)
+{
+    char *s = list, *end;
+    long lo, hi, cpu;
+    
+    CPU_ZERO(&node_cpus[node]);
+    while (*s) {
+        lo = hi = strtol(s, &end, 10);
+        if (end == s) {
+            break;
+        }
+        if (*end == '-') {
+            hi = strtol(end + 1, &end, 10);
+        }
+        for (cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; ++cpu) {
+            cpu_node[cpu] = node;
+            if (CPU_ISSET(cpu, allowed)) {
+                CPU_SET(cpu, &node_cpus[node]);
+            }
+        }
+        if (*end != ',') {
+            break;
+        }
+        s = end + 1;
+    }
+}
+
+/* Read the CPUs of each node from sysfs, as far as this process may run
+ * on them. @return the number of nodes with CPUs available to us */
+static int read_topology(apr_pool_t *pool)
+{
+    cpu_set_t allowed;
+    apr_file_t *f;
+    char buf[1024];
+    apr_size_t len;
+    apr_status_t rv;
+    int node, usable = 0;
+    
+    if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+        return 0;
+    }
+    for (node = 0; node < H2_MAX_NODES; ++node) {
+        rv = apr_file_open(&f, apr_psprintf(pool, "/sys/devices/system/node/"
+                           "node%d/cpulist", node), APR_FOPEN_READ, 
+                           APR_OS_DEFAULT, pool);
+        if (rv != APR_SUCCESS) {
+            break;
+        }
+        len = sizeof(buf) - 1;
+        rv = apr_file_read(f, buf, &len);
+        apr_file_close(f);
+        if (rv != APR_SUCCESS) {
+            break;
+        }
+        buf[len] = '\0';
+        parse_cpulist(buf, node, &allowed);
+        if (CPU_COUNT(&node_cpus[node]) == 0) {
+            /* a node we are not allowed on would get no slots, keep the
+             * numbering dense by stopping here */
+            break;
+        }
+        ++usable;
+    }
+    return usable;
+}
+
+static void slot_bind(h2_slot *slot)
+{
+    if (sched_setaffinity(0, sizeof(cpu_set_t), &node_cpus[slot->node])) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, errno, slot->workers->s,
+                     "h2_workers: binding slot %d to node %d", 
+                     slot->id, slot->node);
+    }
+}
+
+int h2_workers_node(h2_workers *workers)
+{
+    int cpu;
+    
+    if (workers->nnodes <= 1 || (cpu = sched_getcpu()) < 0 || cpu >= CPU_SETSIZE) {
+        return 0;
+    }
+    return cpu_node[cpu];
+}
+#else /* defined(H2_CPU_AFFINITY) */
+int h2_workers_node(h2_workers *workers)
+{
+    (void)workers;
+    return 0;
+}
+#endif /* defined(H2_CPU_AFFINITY) */
+
+static void push_idle(h2_workers *workers, h2_slot *slot)
+{
+    push_slot(&workers->idle[slot->node], slot);
+    apr_atomic_inc32(&workers->idle_count);
+}
+
+/* Get an idle slot, from the given node if there is one */
+static h2_slot *pop_idle(h2_workers *workers, int node)
+{
+    h2_slot *slot;
+    int i;
+    
+    for (i = 0; i < workers->nnodes; ++i) {
+        slot = pop_slot(&workers->idle[(node + i) % workers->nnodes]);
+        if (slot) {
+            apr_atomic_dec32(&workers->idle_count);
+            return slot;
+        }
+    }
+    return NULL;
+}
+
 static apr_status_t activate_slot(h2_workers *workers, h2_slot *slot) 
 {
     apr_status_t status;
@@ -111,6 +265,7 @@ static apr_status_t activate_slot(h2_workers *workers, h2_slot *slot)
     }
     
     apr_atomic_inc32(&workers->worker_count);
+    H2_METRIC_INC(workers_started);
     return APR_SUCCESS;
 }
 
@@ -123,9 +278,9 @@ static apr_status_t add_worker(h2_workers *workers)
     return APR_EAGAIN;
 }
 
-static void wake_idle_worker(h2_workers *workers) 
+static void wake_idle_worker(h2_workers *workers, int node) 
 {
-    h2_slot *slot = pop_slot(&workers->idle);
+    h2_slot *slot = pop_idle(workers, node);
     if (slot) {
         apr_thread_mutex_lock(slot->lock);
         apr_thread_cond_signal(slot->not_idle);
@@ -151,6 +306,32 @@ static void cleanup_zombies(h2_workers *workers)
     }
 }
 
+static apr_int32_t mplx_credit_get(h2_mplx *m)
+{
+    return (apr_int32_t)apr_atomic_read32(&m->worker_credit);
+}
+
+static apr_int32_t mplx_credit_add(h2_mplx *m, apr_int32_t delta)
+{
+    apr_int32_t old, credit;
+    apr_int32_t max = (apr_int32_t)(H2_DRR_QUANTUM * m->worker_weight);
+    
+    for (;;) {
+        old = mplx_credit_get(m);
+        credit = old + delta;
+        if (credit > max) {
+            credit = max;
+        }
+        else if (credit < -(apr_int32_t)H2_DRR_MAX_DEBT) {
+            credit = -(apr_int32_t)H2_DRR_MAX_DEBT;
+        }
+        if (apr_atomic_cas32(&m->worker_credit, (apr_uint32_t)credit, 
+                             (apr_uint32_t)old) == (apr_uint32_t)old) {
+            return credit;
+        }
+    }
+}
+
 static apr_status_t slot_pull_task(h2_slot *slot, h2_mplx *m)
 {
     apr_status_t rv;
@@ -174,12 +355,101 @@ static h2_fifo_op_t mplx_peek(void *head, void *ctx)
     h2_slot *slot = ctx;
     
     if (slot_pull_task(slot, m) == APR_EAGAIN) {
-        wake_idle_worker(slot->workers);
+        wake_idle_worker(slot->workers, m->node);
         return H2_FIFO_OP_REPUSH;
     } 
     return H2_FIFO_OP_PULL;
 }
 
+static h2_fifo_op_t mplx_visit(void *head, void *ctx)
+{
+    h2_mplx *m = head;
+    apr_int32_t quantum = (apr_int32_t)(H2_DRR_QUANTUM * m->worker_weight);
+    
+    if (mplx_credit_add(m, quantum) <= 0) {
+        /* used more than its share lately, others go first */
+        return H2_FIFO_OP_REPUSH;
+    }
+    return mplx_peek(head, ctx);
+}
+
+static h2_fifo_op_t mplx_adopt(void *head, void *ctx)
+{
+    h2_mplx *m = head;
+    h2_slot *slot = ctx;
+    
+    if (slot_pull_task(slot, m) == APR_EAGAIN) {
+        /* more work to do, the mplx becomes affine to this slot. Should
+         * our own queue be full, leave it in the shared one. */
+        wake_idle_worker(slot->workers, m->node);
+        if (h2_fifo_try_push(slot->mplxs, m) != APR_SUCCESS) {
+            return H2_FIFO_OP_REPUSH;
+        }
+    } 
+    return H2_FIFO_OP_PULL;
+}
+
+static apr_status_t steal_task(h2_slot *slot)
+{
+    h2_workers *workers = slot->workers;
+    h2_slot *victim;
+    int i, local;
+    
+    /* Look at our siblings' queues, starting with our neighbour so that
+     * thieves do spread out. A stolen mplx stays where it is, with work
+     * left, the owning slot keeps it. Siblings on our node come first. */
+    for (local = 1; local >= 0 && !slot->task; --local) {
+        for (i = 1; i < workers->nslots && !slot->task; ++i) {
+            victim = &workers->slots[(slot->id + i) % workers->nslots];
+            if ((victim->node == slot->node) != local) {
+                continue;
+            }
+            if (victim->mplxs && h2_fifo_count(victim->mplxs) > 0) {
+                h2_fifo_try_peek(victim->mplxs, mplx_peek, slot);
+            }
+        }
+        if (workers->nnodes <= 1) {
+            break;
+        }
+    }
+    return slot->task? APR_SUCCESS : APR_EAGAIN;
+}
+
+/**
+ * Get the next task for the given worker from its own queue, the shared
+ * one or, failing that, from the queues of the other workers.
+ */
+static apr_status_t get_next_local(h2_slot *slot)
+{
+    h2_workers *workers = slot->workers;
+    apr_status_t status;
+    
+    status = h2_fifo_try_peek(slot->mplxs, mplx_peek, slot);
+    if (status == APR_EOF || slot->task) {
+        return status;
+    }
+    status = h2_fifo_try_peek(workers->mplxs, mplx_adopt, slot);
+    if (status == APR_EOF || slot->task) {
+        return status;
+    }
+    return steal_task(slot);
+}
+
+/**
+ * Get the next task for the given worker from the shared queue. Every
+ * visit adds credit to a mplx, so this ends at the latest when all debts 
+ * are paid.
+ */
+static apr_status_t get_next_shared(h2_slot *slot)
+{
+    apr_status_t status;
+    
+    do {
+        status = h2_fifo_try_peek(slot->workers->mplxs, mplx_visit, slot);
+    } while (status == APR_SUCCESS && !slot->task && !slot->aborted);
+    return status;
+}
+
 /**
  * Get the next task for the given worker. Will block until a task arrives
  * or the max_wait timer expires and more than min workers exist.
@@ -192,20 +462,26 @@ static apr_status_t get_next(h2_slot *slot)
     slot->task = NULL;
     while (!slot->aborted) {
         if (!slot->task) {
-            status = h2_fifo_try_peek(workers->mplxs, mplx_peek, slot);
+            if (slot->mplxs) {
+                status = get_next_local(slot);
+            }
+            else {
+                status = get_next_shared(slot);
+            }
             if (status == APR_EOF) {
                 return status;
             }
         }
         
         if (slot->task) {
+            H2_METRIC_SET(workers_queued, h2_fifo_count(workers->mplxs));
             return APR_SUCCESS;
         }
         
         cleanup_zombies(workers);
 
         apr_thread_mutex_lock(slot->lock);
-        push_slot(&workers->idle, slot);
+        push_idle(workers, slot);
         apr_thread_cond_wait(slot->not_idle, slot->lock);
         apr_thread_mutex_unlock(slot->lock);
     }
@@ -214,26 +490,60 @@ static apr_status_t get_next(h2_slot *slot)
 
 static void slot_done(h2_slot *slot)
 {
-    push_slot(&(slot->workers->zombies), slot);
+    h2_workers *workers = slot->workers;
+    void *m;
+    
+    if (slot->mplxs && !workers->aborted) {
+        /* retired, hand what is left on our queue to the others */
+        while (h2_fifo_try_pull(slot->mplxs, &m) == APR_SUCCESS) {
+            h2_fifo_push(workers->mplxs, m);
+        }
+    }
+    push_slot(&workers->zombies, slot);
+}
+
+static int slot_stays(h2_slot *slot)
+{
+    if (slot->aborted) {
+        return 0;
+    }
+    else if (slot->mplxs) {
+        /* Stay with the mplx of the last task as long as no other
+         * affine mplx is waiting on our queue. */
+        return h2_fifo_count(slot->mplxs) == 0;
+    }
+    return (--slot->sticks > 0) && mplx_credit_get(slot->task->mplx) > 0;
 }
 
 
 static void* APR_THREAD_FUNC slot_run(apr_thread_t *thread, void *wctx)
 {
     h2_slot *slot = wctx;
+    apr_time_t start;
     
+#ifdef H2_CPU_AFFINITY
+    if (slot->workers->affinity) {
+        slot_bind(slot);
+    }
+#endif
     while (!slot->aborted) {
 
         /* Get a h2_task from the mplxs queue. */
         get_next(slot);
         while (slot->task) {
         
+            start = apr_time_now();
             h2_task_do(slot->task, thread, slot->id);
+            if (!slot->mplxs) {
+                /* charge the run time, beyond a second it makes no difference */
+                mplx_credit_add(slot->task->mplx, -(apr_int32_t)H2MIN(
+                                apr_time_now() - start, apr_time_from_sec(1)));
+            }
             
             /* Report the task as done. If stickyness is left, offer the
              * mplx the opportunity to give us back a new task right away.
              */
-            if (!slot->aborted && (--slot->sticks > 0)) {
+            if (slot_stays(slot)) {
                 h2_mplx_task_done(slot->task->mplx, slot->task, &slot->task);
             }
             else {
@@ -247,16 +557,113 @@ static void* APR_THREAD_FUNC slot_run(apr_thread_t *thread, void *wctx)
     return NULL;
 }
 
+static apr_uint32_t count_queued(h2_workers *workers)
+{
+    apr_uint32_t queued = (apr_uint32_t)h2_fifo_count(workers->mplxs);
+    int i;
+    
+    if (workers->stealing) {
+        for (i = 0; i < workers->nslots; ++i) {
+            queued += (apr_uint32_t)h2_fifo_count(workers->slots[i].mplxs);
+        }
+    }
+    return queued;
+}
+
+static int retire_worker(h2_workers *workers)
+{
+    h2_slot *slot = pop_idle(workers, 0);
+    
+    if (slot) {
+        apr_thread_mutex_lock(slot->lock);
+        slot->aborted = 1;
+        apr_thread_cond_signal(slot->not_idle);
+        apr_thread_mutex_unlock(slot->lock);
+        H2_METRIC_INC(workers_retired);
+        return 1;
+    }
+    return 0;
+}
+
+static void* APR_THREAD_FUNC scaler_run(apr_thread_t *thread, void *wctx)
+{
+    h2_workers *workers = wctx;
+    apr_uint64_t wait_sum, wait_count, last_sum = 0, last_count = 0;
+    apr_interval_time_t wait;
+    apr_uint32_t count, idle, queued, spare, n;
+    int idle_ticks = 0, idle_limit;
+    
+    (void)thread;
+    idle_limit = (int)(apr_time_from_sec(workers->max_idle_secs) / H2_SCALE_TICK);
+    apr_thread_mutex_lock(workers->lock);
+    while (!workers->aborted) {
+        apr_thread_cond_timedwait(workers->scaler_wake, workers->lock, 
+                                  H2_SCALE_TICK);
+        if (workers->aborted) {
+            break;
+        }
+        cleanup_zombies(workers);
+        
+        count = apr_atomic_read32(&workers->worker_count);
+        idle = apr_atomic_read32(&workers->idle_count);
+        queued = count_queued(workers);
+        wait_sum = H2_ATOMIC_GET64(&workers->wait_sum);
+        wait_count = H2_ATOMIC_GET64(&workers->wait_count);
+        wait = (wait_count > last_count)? 
+            (apr_interval_time_t)((wait_sum - last_sum) / (wait_count - last_count)) : 0;
+        last_sum = wait_sum;
+        last_count = wait_count;
+        spare = 1 + count / 8;
+        
+        if ((queued > idle || wait > H2_SCALE_WAIT_MAX) 
+            && count < workers->max_workers) {
+            n = H2MIN(H2MAX(1, count / 4), workers->max_workers - count);
+            ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, workers->s,
+                         "h2_workers: %u queued, %u idle, avg wait %ld usec, "
+                         "adding %u to %u workers", queued, idle, (long)wait, 
+                         n, count);
+            while (n-- > 0 && add_worker(workers) == APR_SUCCESS);
+            idle_ticks = 0;
+        }
+        else if (idle > spare && count > workers->min_workers) {
+            if (++idle_ticks >= idle_limit) {
+                ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, workers->s,
+                             "h2_workers: %u of %u workers idle, retiring one",
+                             idle, count);
+                retire_worker(workers);
+                /* give it as long again before the next one goes */
+                idle_ticks = 0;
+            }
+        }
+        else {
+            idle_ticks = 0;
+        }
+        H2_METRIC_SET(workers_active, apr_atomic_read32(&workers->worker_count));
+    }
+    apr_thread_mutex_unlock(workers->lock);
+    return NULL;
+}
+
 static apr_status_t workers_pool_cleanup(void *data)
 {
     h2_workers *workers = data;
     h2_slot *slot;
+    apr_status_t rv;
+    int i;
     
     if (!workers->aborted) {
+        if (workers->scaler) {
+            apr_thread_mutex_lock(workers->lock);
+            workers->aborted = 1;
+            apr_thread_cond_signal(workers->scaler_wake);
+            apr_thread_mutex_unlock(workers->lock);
+            apr_thread_join(&rv, workers->scaler);
+            workers->scaler = NULL;
+        }
         workers->aborted = 1;
         /* abort all idle slots */
         for (;;) {
-            slot = pop_slot(&workers->idle);
+            slot = pop_idle(workers, 0);
             if (slot) {
                 apr_thread_mutex_lock(slot->lock);
                 slot->aborted = 1;
@@ -270,6 +677,12 @@ static apr_status_t workers_pool_cleanup(void *data)
 
         h2_fifo_term(workers->mplxs);
         h2_fifo_interrupt(workers->mplxs);
+        for (i = 0; i < workers->nslots; ++i) {
+            if (workers->slots[i].mplxs) {
+                h2_fifo_term(workers->slots[i].mplxs);
+                h2_fifo_interrupt(workers->slots[i].mplxs);
+            }
+        }
 
         cleanup_zombies(workers);
     }
@@ -278,7 +691,8 @@ static apr_status_t workers_pool_cleanup(void *data)
 
 h2_workers *h2_workers_create(server_rec *s, apr_pool_t *server_pool,
                               int min_workers, int max_workers,
-                              int idle_secs)
+                              int idle_secs, int stealing, int affinity,
+                              int scaling)
 {
     apr_status_t status;
     h2_workers *workers;
@@ -305,6 +719,28 @@ h2_workers *h2_workers_create(server_rec *s, apr_pool_t *server_pool,
     workers->min_workers = min_workers;
     workers->max_workers = max_workers;
     workers->max_idle_secs = (idle_secs > 0)? idle_secs : 10;
+    workers->stealing = stealing;
+    workers->scaling = (scaling && min_workers < max_workers);
+    workers->nnodes = 1;
+#ifdef H2_CPU_AFFINITY
+    if (affinity) {
+        n = read_topology(pool);
+        if (n > 1) {
+            workers->nnodes = n;
+            workers->affinity = 1;
+        }
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s,
+                     "h2_workers: %d usable NUMA nodes, affinity %s", 
+                     n, workers->affinity? "on" : "not needed");
+    }
+#else
+    if (affinity) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s,
+                     "h2_workers: H2WorkerAffinity is not supported "
+                     "on this platform");
+    }
+#endif
+    workers->idle = apr_pcalloc(pool, workers->nnodes * sizeof(h2_slot*));
 
     /* FIXME: the fifo set we use here has limited capacity. Once the
      * set is full, connections with new requests do a wait. Unfortunately,
@@ -317,7 +753,8 @@ h2_workers *h2_workers_create(server_rec *s, apr_pool_t *server_pool,
      * For now, we just make enough room to have many connections inside one
      * process.
      */
-    status = h2_fifo_set_create(&workers->mplxs, pool, 8 * 1024);
+    status = h2_fifo_create_ex(&workers->mplxs, pool, 8 * 1024, 
+                               H2_FIFO_SET);
     if (status != APR_SUCCESS) {
         return NULL;
     }
@@ -345,15 +782,23 @@ h2_workers *h2_workers_create(server_rec *s, apr_pool_t *server_pool,
             workers->nslots = 0;
             status = APR_ENOMEM;
         }
-        for (i = 0; i < n; ++i) {
+        for (i = 0; i < n && status == APR_SUCCESS; ++i) {
             workers->slots[i].id = i;
+            workers->slots[i].node = i % workers->nnodes;
+            if (stealing) {
+                status = h2_fifo_create_ex(&workers->slots[i].mplxs, pool,
+                                           H2_SLOT_QUEUE_SIZE, 
+                                           H2_FIFO_SET);
+            }
         }
     }
+    if (status == APR_SUCCESS && workers->scaling) {
+        status = apr_thread_cond_create(&workers->scaler_wake, workers->pool);
+    }
     if (status == APR_SUCCESS) {
-        /* we activate all for now, TODO: support min_workers again.
-         * do this in reverse for vanity reasons so slot 0 will most
-         * likely be at head of idle queue. */
-        n = workers->max_workers;
+        /* Without scaling, we activate all. Do this in reverse for vanity 
+         * reasons so slot 0 will most likely be at head of idle queue. */
+        n = workers->scaling? workers->min_workers : workers->max_workers;
         for (i = n-1; i >= 0; --i) {
             status = activate_slot(workers, &workers->slots[i]);
         }
@@ -365,19 +810,75 @@ h2_workers *h2_workers_create(server_rec *s, apr_pool_t *server_pool,
     }
     if (status == APR_SUCCESS) {
         apr_pool_pre_cleanup_register(pool, workers, workers_pool_cleanup);    
+        if (workers->scaling) {
+            status = apr_thread_create(&workers->scaler, workers->thread_attr,
+                                       scaler_run, workers, workers->pool);
+            if (status != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_WARNING, status, s,
+                             "h2_workers: no controller thread, the pool "
+                             "only grows on demand");
+                workers->scaler = NULL;
+            }
+        }
         return workers;
     }
     return NULL;
 }
 
+static apr_status_t register_local(h2_workers *workers, struct h2_mplx *m)
+{
+    h2_slot *slot = pop_idle(workers, m->node);
+    
+    /* Hand the mplx directly to the queue of an idle worker, one on the 
+     * mplx's node if possible. If all are busy, it goes to the shared 
+     * queue and the first worker done adopts it. */
+    if (slot) {
+        apr_status_t status = h2_fifo_try_push(slot->mplxs, m);
+        apr_thread_mutex_lock(slot->lock);
+        apr_thread_cond_signal(slot->not_idle);
+        apr_thread_mutex_unlock(slot->lock);
+        if (status == APR_SUCCESS || status == APR_EEXIST) {
+            return APR_SUCCESS;
+        }
+    }
+    else if (workers->dynamic) {
+        add_worker(workers);
+    }
+    return h2_fifo_push(workers->mplxs, m);
+}
+
 apr_status_t h2_workers_register(h2_workers *workers, struct h2_mplx *m)
 {
-    apr_status_t status = h2_fifo_push(workers->mplxs, m);
-    wake_idle_worker(workers);
+    apr_status_t status;
+    
+    if (workers->stealing) {
+        return register_local(workers, m);
+    }
+    status = h2_fifo_push(workers->mplxs, m);
+    H2_METRIC_SET(workers_queued, h2_fifo_count(workers->mplxs));
+    wake_idle_worker(workers, m->node);
     return status;
 }
 
 apr_status_t h2_workers_unregister(h2_workers *workers, struct h2_mplx *m)
 {
-    return h2_fifo_remove(workers->mplxs, m);
+    apr_status_t status = h2_fifo_remove(workers->mplxs, m);
+    int i;
+    
+    if (workers->stealing) {
+        for (i = 0; i < workers->nslots; ++i) {
+            if (h2_fifo_remove(workers->slots[i].mplxs, m) == APR_SUCCESS) {
+                status = APR_SUCCESS;
+            }
+        }
+    }
+    return status;
+}
+
+void h2_workers_task_waited(h2_workers *workers, apr_interval_time_t wait)
+{
+    if (workers->scaling && wait > 0) {
+        H2_ATOMIC_ADD64(&workers->wait_sum, (apr_uint64_t)wait);
+        H2_ATOMIC_ADD64(&workers->wait_count, 1);
+    }
 }
@@ -44,28 +44,55 @@ struct h2_workers {
     
     int aborted;
     int dynamic;
+    int stealing;
+    int affinity;               /* slots are bound to NUMA nodes */
+    int nnodes;                 /* number of nodes, 1 without affinity */
+    int scaling;                /* a controller thread resizes the pool */
 
     apr_threadattr_t *thread_attr;
     int nslots;
     struct h2_slot *slots;
     
     volatile apr_uint32_t worker_count;
+    volatile apr_uint32_t idle_count;
+    apr_uint64_t wait_sum;      /* usecs tasks waited in queue for a worker */
+    apr_uint64_t wait_count;    /* number of tasks in wait_sum */
     
     struct h2_slot *free;
-    struct h2_slot *idle;
+    struct h2_slot **idle;      /* idle slots, one list per node */
     struct h2_slot *zombies;
     
     struct h2_fifo *mplxs;
     
     struct apr_thread_mutex_t *lock;
+    struct apr_thread_cond_t *scaler_wake;
+    apr_thread_t *scaler;
 };
 
 
 /* Create a worker pool with the given minimum and maximum number of
- * threads.
+ * threads. With stealing enabled, each worker has its own queue of h2_mplx
+ * it prefers and takes work from the other queues when its own is empty.
+ * With affinity, each worker thread is bound to the CPUs of one NUMA node
+ * and idle workers on the node of a connection are preferred for it.
+ * With scaling, the pool starts with the minimum of threads and a controller
+ * thread adds or retires workers, looking at queue length and wait times.
  */
 h2_workers *h2_workers_create(server_rec *s, apr_pool_t *pool,
-                              int min_size, int max_size, int idle_secs);
+                              int min_size, int max_size, int idle_secs,
+                              int stealing, int affinity, int scaling);
+
+/**
+ * Note the time a task waited in queue before a worker took it up. Used
+ * by the controller of a scaling worker pool.
+ */
+void h2_workers_task_waited(h2_workers *workers, apr_interval_time_t wait);
+
+/**
+ * @return the NUMA node the calling thread runs on, 0 when the workers
+ *         have no affinity
+ */
+int h2_workers_node(h2_workers *workers);
 
 /**
  * Registers a h2_mplx for task scheduling. If this h2_mplx runs
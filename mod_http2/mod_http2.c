@@ -25,11 +25,14 @@
 #include <http_request.h>
 #include <http_log.h>
 
+#include <mod_log_config.h>
+
 #include "mod_http2.h"
 
 #include <nghttp2/nghttp2.h>
 #include "h2_stream.h"
 #include "h2_alt_svc.h"
+#include "h2_bucket_beam.h"
 #include "h2_conn.h"
 #include "h2_filter.h"
 #include "h2_task.h"
@@ -37,8 +40,12 @@
 #include "h2_config.h"
 #include "h2_ctx.h"
 #include "h2_h2.h"
+#include "h2_metrics.h"
 #include "h2_mplx.h"
 #include "h2_push.h"
+#include "h2_push_cache.h"
+#include "h2_fcache.h"
+#include "h2_rcache.h"
 #include "h2_request.h"
 #include "h2_switch.h"
 #include "h2_version.h"
@@ -60,6 +67,7 @@ AP_DECLARE_MODULE(http2) = {
 };
 
 static int h2_h2_fixups(request_rec *r);
+static const char *h2_log_timing(request_rec *r, char *a);
 
 typedef struct {
     unsigned int change_prio : 1;
@@ -157,13 +165,22 @@ static int h2_post_config(apr_pool_t *p, apr_pool_t *plog,
                      h2_conn_mpm_name());
     }
     
-    status = h2_h2_init(p, s);
+    status = h2_config_post_config(p, s);
+    if (status == APR_SUCCESS) {
+        status = h2_h2_init(p, s);
+    }
     if (status == APR_SUCCESS) {
         status = h2_switch_init(p, s);
     }
     if (status == APR_SUCCESS) {
         status = h2_task_init(p, s);
     }
+    if (status == APR_SUCCESS) {
+        status = h2_metrics_post_config(p, s);
+    }
+    if (status == APR_SUCCESS) {
+        status = h2_push_cache_post_config(p, s);
+    }
     
     return status;
 }
@@ -172,23 +189,100 @@ static char *http2_var_lookup(apr_pool_t *, server_rec *,
                          conn_rec *, request_rec *, char *name);
 static int http2_is_h2(conn_rec *);
 
+static apr_size_t http2_stream_max_mem(server_rec *s)
+{
+    return (apr_size_t)h2_config_sgeti(s, H2_CONF_STREAM_MAX_MEM);
+}
+
 static void http2_get_num_workers(server_rec *s, int *minw, int *maxw)
 {
     h2_get_num_workers(s, minw, maxw);
 }
 
+typedef struct {
+    h2_bucket_beam *beam;
+    http2_req_input_cb *cb;
+    void *ctx;
+} input_notify_ctx;
+
+static void input_produced(void *ctx, h2_bucket_beam *beam, apr_off_t bytes)
+{
+    input_notify_ctx *n = ctx;
+    (void)beam; (void)bytes;
+    n->cb(n->ctx);
+}
+
+static apr_status_t input_notify_cleanup(void *ctx)
+{
+    input_notify_ctx *n = ctx;
+    h2_beam_on_produced(n->beam, NULL, NULL);
+    return APR_SUCCESS;
+}
+
+static apr_status_t http2_req_input_notify(request_rec *r, 
+                                           http2_req_input_cb *cb, void *ctx)
+{
+    h2_task *task = h2_ctx_get_task(r->connection);
+    input_notify_ctx *n;
+    
+    if (!task || !task->input.beam) {
+        return APR_ENOTIMPL;
+    }
+    n = ap_get_module_config(r->request_config, &http2_module);
+    if (n) {
+        apr_pool_cleanup_run(r->pool, n, input_notify_cleanup);
+        ap_set_module_config(r->request_config, &http2_module, NULL);
+    }
+    if (cb) {
+        /* the beam lives in the stream, which outlives the request */
+        n = apr_pcalloc(r->pool, sizeof(*n));
+        n->beam = task->input.beam;
+        n->cb = cb;
+        n->ctx = ctx;
+        ap_set_module_config(r->request_config, &http2_module, n);
+        apr_pool_cleanup_register(r->pool, n, input_notify_cleanup, 
+                                  apr_pool_cleanup_null);
+        h2_beam_on_produced(n->beam, input_produced, n);
+    }
+    return APR_SUCCESS;
+}
+
 /* Runs once per created child process. Perform any process 
  * related initionalization here.
  */
 static void h2_child_init(apr_pool_t *pool, server_rec *s)
 {
+    apr_status_t status;
+    
+    /* metrics first, the workers count their threads from the start */
+    h2_metrics_child_init(pool, s);
     /* Set up our connection processing */
-    apr_status_t status = h2_conn_child_init(pool, s);
+    status = h2_conn_child_init(pool, s);
     if (status != APR_SUCCESS) {
         ap_log_error(APLOG_MARK, APLOG_ERR, status, s,
                      APLOGNO(02949) "initializing connection handling");
     }
+    h2_push_cache_child_init(pool, s);
+    h2_push_child_init(pool, s);
+    h2_rcache_child_init(pool, s);
+    h2_fcache_child_init(pool, s);
+    
+}
+
+static int h2_pre_config(apr_pool_t *pconf, apr_pool_t *plog, apr_pool_t *ptemp)
+{
+    APR_OPTIONAL_FN_TYPE(ap_register_log_handler) *log_register;
     
+    (void)plog;(void)ptemp;
+    h2_push_cache_pre_config(pconf);
+    h2_rcache_pre_config(pconf);
+    h2_fcache_pre_config(pconf);
+    log_register = APR_RETRIEVE_OPTIONAL_FN(ap_register_log_handler);
+    if (log_register) {
+        /* LogFormat "%{name}^h2", see h2_log_timing() */
+        log_register(pconf, (char*)"^h2", h2_log_timing, 0);
+    }
+    return OK;
 }
 
 /* Install this module into the apache2 infrastructure.
@@ -199,10 +293,16 @@ static void h2_hooks(apr_pool_t *pool)
     
     APR_REGISTER_OPTIONAL_FN(http2_is_h2);
     APR_REGISTER_OPTIONAL_FN(http2_var_lookup);
+    APR_REGISTER_OPTIONAL_FN(http2_stream_max_mem);
     APR_REGISTER_OPTIONAL_FN(http2_get_num_workers);
+    APR_REGISTER_OPTIONAL_FN(http2_req_input_notify);
 
     ap_log_perror(APLOG_MARK, APLOG_TRACE1, 0, pool, "installing hooks");
     
+    /* Run once before configuration is read, to register our log handler.
+     */
+    ap_hook_pre_config(h2_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
+    
     /* Run once after configuration is set, but before mpm children initialize.
      */
     ap_hook_post_config(h2_post_config, mod_ssl, NULL, APR_HOOK_MIDDLE);
@@ -214,6 +314,8 @@ static void h2_hooks(apr_pool_t *pool)
     h2_h2_register_hooks();
     h2_switch_register_hooks();
     h2_task_register_hooks();
+    h2_rcache_register_hooks();
+    h2_fcache_register_hooks();
 
     h2_alt_svc_register_hooks();
     
@@ -223,6 +325,7 @@ static void h2_hooks(apr_pool_t *pool)
     
     /* test http2 connection status handler */
     ap_hook_handler(h2_filter_h2_status_handler, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_handler(h2_metrics_handler, NULL, NULL, APR_HOOK_MIDDLE);
 }
 
 static const char *val_HTTP2(apr_pool_t *p, server_rec *s,
@@ -345,6 +448,48 @@ static char *http2_var_lookup(apr_pool_t *p, server_rec *s,
     return (char*)"";
 }
 
+/* Microseconds from the request HEADERS until the named stream event, 
+ * "-" when it has not happened (yet). Names are "task", "worker", "out",
+ * "data" and "close". The request is logged before the response is 
+ * written out, so "data" and "close" are mostly unknown here. */
+static const char *h2_log_timing(request_rec *r, char *a)
+{
+    h2_ctx *ctx = r->connection->master? h2_ctx_get(r->connection, 0) : NULL;
+    h2_stream *stream;
+    h2_stream_timing t;
+    apr_time_t at;
+    apr_interval_time_t since;
+    
+    if (!ctx || !ctx->task || !a) {
+        return "-";
+    }
+    stream = h2_mplx_stream_get(ctx->task->mplx, ctx->task->stream_id);
+    if (!stream) {
+        return "-";
+    }
+    h2_stream_get_timing(stream, &t);
+    if (!strcmp("task", a)) {
+        at = t.task_created;
+    }
+    else if (!strcmp("worker", a)) {
+        at = t.worker_started;
+    }
+    else if (!strcmp("out", a)) {
+        at = t.first_out;
+    }
+    else if (!strcmp("data", a)) {
+        at = t.first_data;
+    }
+    else if (!strcmp("close", a)) {
+        at = t.closed;
+    }
+    else {
+        return "-";
+    }
+    since = h2_stream_timing_since(&t, at);
+    return (since < 0)? "-" : apr_off_t_toa(r->pool, since);
+}
+
 static int h2_h2_fixups(request_rec *r)
 {
     if (r->connection->master) {
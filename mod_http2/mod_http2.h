@@ -28,6 +28,25 @@ APR_DECLARE_OPTIONAL_FN(char *,
 APR_DECLARE_OPTIONAL_FN(int, 
                         http2_is_h2, (conn_rec *));
 
+/** An optional function which returns the number of bytes a stream may
+ * buffer in memory on the server, as set by H2StreamMaxMemSize. */
+APR_DECLARE_OPTIONAL_FN(apr_size_t, 
+                        http2_stream_max_mem, (server_rec *));
+
+/** A callback invoked by mod_http2 when request body data has arrived. */
+typedef void http2_req_input_cb(void *ctx);
+
+/** An optional function which registers a callback for the arrival of
+ * request body data on the HTTP/2 stream of the given request. The callback
+ * is invoked from the thread serving the HTTP/2 connection and should only
+ * wake up whoever reads the request body. A NULL callback unregisters.
+ * Returns APR_ENOTIMPL if the request is not on an HTTP/2 stream with
+ * a body. */
+APR_DECLARE_OPTIONAL_FN(apr_status_t, 
+                        http2_req_input_notify, (request_rec *, 
+                                                 http2_req_input_cb *, 
+                                                 void *));
+
 
 /*******************************************************************************
  * START HTTP/2 request engines (DEPRECATED)
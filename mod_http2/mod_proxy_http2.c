@@ -19,6 +19,9 @@
 #include <ap_mmn.h>
 #include <httpd.h>
 #include <mod_proxy.h>
+#include <apr_hash.h>
+#include <apr_thread_cond.h>
+#include <apr_thread_mutex.h>
 #include "mod_http2.h"
 
 
@@ -30,6 +33,9 @@
 
 #define H2MIN(x,y) ((x) < (y) ? (x) : (y))
 
+/* Limit of autotuned stream windows when mod_http2 is not loaded */
+#define H2_PROXY_WINDOW_MAX     (16 * 1024 * 1024)
+
 static void register_hook(apr_pool_t *p);
 
 AP_DECLARE_MODULE(proxy_http2) = {
@@ -47,8 +53,12 @@ AP_DECLARE_MODULE(proxy_http2) = {
 
 /* Optional functions from mod_http2 */
 static int (*is_h2)(conn_rec *c);
+static apr_size_t (*stream_max_mem)(server_rec *s);
+static apr_status_t (*req_input_notify)(request_rec *r, 
+                                        http2_req_input_cb *cb, void *ctx);
 
-typedef struct h2_proxy_ctx {
+typedef struct h2_proxy_ctx h2_proxy_ctx;
+struct h2_proxy_ctx {
     const char *id;
     conn_rec *master;
     conn_rec *owner;
@@ -65,13 +75,87 @@ typedef struct h2_proxy_ctx {
     
     unsigned is_ssl : 1;
     unsigned flushall : 1;
+    unsigned multiplex : 1;    /* may share backend sessions with other requests */
+    unsigned handed_back : 1;  /* request was not taken by another session */
+    unsigned zero_copy : 1;    /* slice response data from the read buffer */
+    apr_size_t window_max;     /* limit for autotuned windows, 0 if off */
     
     request_rec *r;            /* the request processed in this ctx */
     apr_status_t r_status;     /* status of request work */
     int r_done;                /* request was processed, not necessarily successfully */
     int r_may_retry;           /* request may be retried */
     h2_proxy_session *session; /* current http2 session against backend */
-} h2_proxy_ctx;
+    
+    /* sharing of a session, protected by the hub mutex */
+    h2_proxy_ctx *hub_next;    /* next ctx running a session for the worker */
+    h2_proxy_ctx *next;        /* next in the pending/adopted list */
+    h2_proxy_ctx *pending;     /* requests waiting to be submitted */
+    h2_proxy_ctx *adopted;     /* requests submitted on our session */
+    int pending_count;
+    int adopted_count;
+    int max_streams;           /* concurrent streams the backend allows */
+    apr_thread_cond_t *done_cond; /* signalled when we were done by others */
+};
+
+/* What a child knows about the sessions of a proxy_worker. Running sessions
+ * that accept requests from other worker threads are listed here. A request
+ * that finds one hands itself over and waits for the thread running that
+ * session to process it. All protected by hub_mutex.
+ * Idle sessions are not kept warm here: they sit in mod_proxy's connection
+ * pool, where no thread owns them to ping or handshake outside a request. */
+typedef struct h2_proxy_hub {
+    h2_proxy_ctx *sessions;      /* ctx running a session, linked by hub_next */
+    apr_interval_time_t rtt;     /* smoothed PING round trip time or 0 */
+} h2_proxy_hub;
+
+static apr_thread_mutex_t *hub_mutex;
+static apr_hash_t *hubs;
+
+/* call with hub_mutex held */
+static h2_proxy_hub *hub_get(proxy_worker *worker, int create)
+{
+    h2_proxy_hub *hub = apr_hash_get(hubs, &worker, sizeof(worker));
+    
+    if (!hub && create) {
+        /* one per worker for the lifetime of the child */
+        apr_pool_t *pool = apr_hash_pool_get(hubs);
+        proxy_worker **pkey = apr_palloc(pool, sizeof(*pkey));
+        
+        *pkey = worker;
+        hub = apr_pcalloc(pool, sizeof(*hub));
+        apr_hash_set(hubs, pkey, sizeof(*pkey), hub);
+    }
+    return hub;
+}
+
+static apr_interval_time_t http2_proxy_worker_rtt(proxy_worker *worker)
+{
+    h2_proxy_hub *hub;
+    apr_interval_time_t rtt = -1;
+    
+    if (hub_mutex) {
+        apr_thread_mutex_lock(hub_mutex);
+        hub = hub_get(worker, 0);
+        if (hub && hub->rtt > 0) {
+            rtt = hub->rtt;
+        }
+        apr_thread_mutex_unlock(hub_mutex);
+    }
+    return rtt;
+}
+
+static void worker_rtt_update(proxy_worker *worker, apr_interval_time_t sample)
+{
+    h2_proxy_hub *hub;
+    
+    if (!hub_mutex || sample <= 0) {
+        return;
+    }
+    apr_thread_mutex_lock(hub_mutex);
+    hub = hub_get(worker, 1);
+    hub->rtt = hub->rtt? (7 * hub->rtt + sample) / 8 : sample;
+    apr_thread_mutex_unlock(hub_mutex);
+}
 
 static int h2_proxy_post_config(apr_pool_t *p, apr_pool_t *plog,
                                 apr_pool_t *ptemp, server_rec *s)
@@ -95,10 +179,27 @@ static int h2_proxy_post_config(apr_pool_t *p, apr_pool_t *plog,
                  MOD_HTTP2_VERSION, ngh2? ngh2->version_str : "unknown");
     
     is_h2 = APR_RETRIEVE_OPTIONAL_FN(http2_is_h2);
+    stream_max_mem = APR_RETRIEVE_OPTIONAL_FN(http2_stream_max_mem);
+    req_input_notify = APR_RETRIEVE_OPTIONAL_FN(http2_req_input_notify);
     
     return status;
 }
 
+static void h2_proxy_child_init(apr_pool_t *pool, server_rec *s)
+{
+    apr_status_t status;
+    
+    status = apr_thread_mutex_create(&hub_mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+    if (status != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, status, s,
+                     "mod_proxy_http2: unable to create hub mutex, backend "
+                     "sessions will not be shared");
+        hub_mutex = NULL;
+        return;
+    }
+    hubs = apr_hash_make(pool);
+}
+
 /**
  * canonicalize the url into the request, if it is meant for us.
  * slightly modified copy from mod_http
@@ -205,6 +306,8 @@ static apr_status_t add_request(h2_proxy_session *session, request_rec *r)
     return status;
 }
 
+static void hub_unregister(h2_proxy_ctx *ctx);
+
 static void request_done(h2_proxy_ctx *ctx, request_rec *r,
                          apr_status_t status, int touched)
 {   
@@ -216,6 +319,35 @@ static void request_done(h2_proxy_ctx *ctx, request_rec *r,
         if (touched) ctx->r_may_retry = 0;
         ctx->r_status = ((status == APR_SUCCESS)? APR_SUCCESS
                          : HTTP_SERVICE_UNAVAILABLE);
+        if (ctx->multiplex) {
+            /* nothing is taken from now on, waiting joiners go elsewhere */
+            apr_thread_mutex_lock(hub_mutex);
+            hub_unregister(ctx);
+            apr_thread_mutex_unlock(hub_mutex);
+        }
+    }
+    else if (ctx->adopted) {
+        h2_proxy_ctx **pa, *a;
+        
+        apr_thread_mutex_lock(hub_mutex);
+        for (pa = &ctx->adopted; *pa; pa = &(*pa)->next) {
+            a = *pa;
+            if (a->r == r) {
+                ap_log_cerror(APLOG_MARK, APLOG_TRACE1, status, r->connection, 
+                              "h2_proxy_session(%s): request of %s done, "
+                              "touched=%d", ctx->id, a->id, touched);
+                *pa = a->next;
+                --ctx->adopted_count;
+                a->next = NULL;
+                a->r_done = 1;
+                if (touched) a->r_may_retry = 0;
+                a->r_status = ((status == APR_SUCCESS)? APR_SUCCESS
+                               : HTTP_SERVICE_UNAVAILABLE);
+                apr_thread_cond_signal(a->done_cond);
+                break;
+            }
+        }
+        apr_thread_mutex_unlock(hub_mutex);
     }
 }    
 
@@ -225,6 +357,115 @@ static void session_req_done(h2_proxy_session *session, request_rec *r,
     request_done(session->user_data, r, status, touched);
 }
 
+static void hub_register(h2_proxy_ctx *ctx)
+{
+    h2_proxy_hub *hub;
+    
+    apr_thread_mutex_lock(hub_mutex);
+    hub = hub_get(ctx->worker, 1);
+    ctx->hub_next = hub->sessions;
+    hub->sessions = ctx;
+    apr_thread_mutex_unlock(hub_mutex);
+}
+
+/* call with hub_mutex held */
+static void hub_unregister(h2_proxy_ctx *ctx)
+{
+    h2_proxy_hub *hub = hub_get(ctx->worker, 0);
+    h2_proxy_ctx **pd, *p;
+    
+    for (pd = hub? &hub->sessions : NULL; pd && *pd; pd = &(*pd)->hub_next) {
+        if (*pd == ctx) {
+            *pd = ctx->hub_next;
+            break;
+        }
+    }
+    ctx->hub_next = NULL;
+    ctx->multiplex = 0;
+    
+    /* whoever is still waiting needs to find its own way */
+    while (ctx->pending) {
+        p = ctx->pending;
+        ctx->pending = p->next;
+        p->next = NULL;
+        p->handed_back = 1;
+        apr_thread_cond_signal(p->done_cond);
+    }
+    ctx->pending_count = 0;
+}
+
+static int hub_join(h2_proxy_ctx *ctx)
+{
+    h2_proxy_hub *hub;
+    h2_proxy_ctx *d, **pp;
+    
+    if (apr_thread_cond_create(&ctx->done_cond, ctx->pool) != APR_SUCCESS) {
+        return 0;
+    }
+    apr_thread_mutex_lock(hub_mutex);
+    hub = hub_get(ctx->worker, 0);
+    for (d = hub? hub->sessions : NULL; d; d = d->hub_next) {
+        if (d->multiplex && !d->r_done 
+            && 1 + d->adopted_count + d->pending_count < d->max_streams) {
+            break;
+        }
+    }
+    if (!d) {
+        apr_thread_mutex_unlock(hub_mutex);
+        return 0;
+    }
+    
+    for (pp = &d->pending; *pp; pp = &(*pp)->next);
+    *pp = ctx;
+    ++d->pending_count;
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, ctx->owner, 
+                  "eng(%s): handing request to session of %s", ctx->id, d->id);
+    /* registered sessions stay valid until unregistered under the mutex */
+    h2_proxy_session_wakeup(d->session);
+    while (!ctx->r_done && !ctx->handed_back) {
+        apr_thread_cond_wait(ctx->done_cond, hub_mutex);
+    }
+    apr_thread_mutex_unlock(hub_mutex);
+    return ctx->r_done;
+}
+
+static void hub_take(h2_proxy_ctx *ctx)
+{
+    h2_proxy_ctx *p, *next;
+    
+    apr_thread_mutex_lock(hub_mutex);
+    if (ctx->r_done || !h2_proxy_session_is_accepting(ctx->session)) {
+        hub_unregister(ctx);
+        apr_thread_mutex_unlock(hub_mutex);
+        return;
+    }
+    ctx->max_streams = (int)(ctx->session->remote_max_concurrent? 
+                             ctx->session->remote_max_concurrent : 100);
+    p = ctx->pending;
+    ctx->pending = NULL;
+    ctx->pending_count = 0;
+    apr_thread_mutex_unlock(hub_mutex);
+    
+    for (; p; p = next) {
+        apr_status_t status;
+        
+        next = p->next;
+        p->next = NULL;
+        status = add_request(ctx->session, p->r);
+        apr_thread_mutex_lock(hub_mutex);
+        if (status == APR_SUCCESS) {
+            p->next = ctx->adopted;
+            ctx->adopted = p;
+            ++ctx->adopted_count;
+        }
+        else {
+            p->handed_back = 1;
+            apr_thread_cond_signal(p->done_cond);
+        }
+        apr_thread_mutex_unlock(hub_mutex);
+    }
+}
+
 static apr_status_t ctx_run(h2_proxy_ctx *ctx) {
     apr_status_t status = OK;
     int h2_front;
@@ -246,11 +487,34 @@ static apr_status_t ctx_run(h2_proxy_ctx *ctx) {
     ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, ctx->owner, APLOGNO(03373)
                   "eng(%s): run session %s", ctx->id, ctx->session->id);
     ctx->session->user_data = ctx;
+    if (ctx->zero_copy) {
+        /* stays on for the connection, once its socket is read directly */
+        ctx->session->zero_copy = 1;
+    }
+    if (h2_front) {
+        /* wake up on request bodies arriving, instead of polling them */
+        ctx->session->input_notify = req_input_notify;
+    }
+    if (ctx->window_max > ctx->session->window_max) {
+        ctx->session->window_max = ctx->window_max;
+    }
     
     ctx->r_done = 0;
     add_request(ctx->session, ctx->r);
     
-    while (!ctx->master->aborted && !ctx->r_done) {
+    if (ctx->multiplex) {
+        /* joiners wake us to be taken, instead of waiting for the backend */
+        if (h2_proxy_session_make_wakeable(ctx->session) != APR_SUCCESS) {
+            ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, ctx->owner, 
+                          "eng(%s): session %s not wakeable, joiners are "
+                          "taken between backend reads", 
+                          ctx->id, ctx->session->id);
+        }
+        ctx->max_streams = 100;
+        hub_register(ctx);
+    }
+    
+    while (!ctx->master->aborted && (!ctx->r_done || ctx->adopted_count)) {
     
         status = h2_proxy_session_process(ctx->session);
         if (status != APR_SUCCESS) {
@@ -265,6 +529,10 @@ static apr_status_t ctx_run(h2_proxy_ctx *ctx) {
             h2_proxy_session_cleanup(ctx->session, session_req_done);
             goto out;
         }
+        if (ctx->multiplex) {
+            /* submit what others handed to us */
+            hub_take(ctx);
+        }
     }
     
 out:
@@ -280,6 +548,16 @@ out:
         }
     }
     
+    if (ctx->multiplex) {
+        apr_thread_mutex_lock(hub_mutex);
+        hub_unregister(ctx);
+        apr_thread_mutex_unlock(hub_mutex);
+    }
+    if (ctx->adopted_count) {
+        /* requests of others still open, they have to be told */
+        h2_proxy_session_cleanup(ctx->session, session_req_done);
+    }
+    worker_rtt_update(ctx->worker, ctx->session->rtt);
     ctx->session->user_data = NULL;
     ctx->session = NULL;
     return status;
@@ -338,6 +616,16 @@ static int proxy_http2_handler(request_rec *r,
     ctx->worker = worker;
     ctx->conf = conf;
     ctx->flushall = apr_table_get(r->subprocess_env, "proxy-flushall")? 1 : 0;
+    ctx->multiplex = (hub_mutex 
+                      && apr_table_get(r->subprocess_env, "proxy-h2-multiplex"))? 1 : 0;
+    ctx->zero_copy = apr_table_get(r->subprocess_env, "proxy-h2-zerocopy")? 1 : 0;
+    if (apr_table_get(r->subprocess_env, "proxy-h2-autotune")) {
+        /* stream windows grow as far as a stream may buffer */
+        ctx->window_max = stream_max_mem? stream_max_mem(r->server) : 0;
+        if (!ctx->window_max) {
+            ctx->window_max = H2_PROXY_WINDOW_MAX;
+        }
+    }
     ctx->req_buffer_size = (32*1024);
     ctx->r = r;
     ctx->r_status = status = HTTP_SERVICE_UNAVAILABLE;
@@ -351,6 +639,16 @@ static int proxy_http2_handler(request_rec *r,
     ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, ctx->r, 
                   "H2: serving URL %s", url);
     
+    if (ctx->multiplex && hub_join(ctx)) {
+        /* processed on the backend session of another request */
+        if (ctx->r_status == APR_SUCCESS || !ctx->r_may_retry) {
+            ctx->multiplex = 0;
+            goto cleanup;
+        }
+        ctx->r_done = 0;
+        ctx->r_status = HTTP_SERVICE_UNAVAILABLE;
+    }
+    
 run_connect:    
     if (ctx->master->aborted) goto cleanup;
 
@@ -459,6 +757,8 @@ cleanup:
 static void register_hook(apr_pool_t *p)
 {
     ap_hook_post_config(h2_proxy_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_child_init(h2_proxy_child_init, NULL, NULL, APR_HOOK_MIDDLE);
+    APR_REGISTER_OPTIONAL_FN(http2_proxy_worker_rtt);
 
     proxy_hook_scheme_handler(proxy_http2_handler, NULL, NULL, APR_HOOK_FIRST);
     proxy_hook_canon_handler(proxy_http2_canon, NULL, NULL, APR_HOOK_FIRST);
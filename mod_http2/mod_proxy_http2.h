@@ -17,5 +17,14 @@
 #ifndef __MOD_PROXY_HTTP2_H__
 #define __MOD_PROXY_HTTP2_H__
 
+struct proxy_worker;
+
+/** The http2_proxy_worker_rtt() optional function returns the smoothed
+ * round trip time of PINGs on the HTTP/2 sessions of a proxy worker,
+ * as measured in this child process. It returns -1 when no measurement
+ * has been made yet. Load balancer methods may use this to prefer the
+ * closest backend. */
+APR_DECLARE_OPTIONAL_FN(apr_interval_time_t, 
+                        http2_proxy_worker_rtt, (struct proxy_worker *worker));
 
 #endif
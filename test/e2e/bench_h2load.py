@@ -0,0 +1,216 @@
+#
+# mod-h2 benchmark suite
+# run h2load scenarios against the test server and record request rates,
+# latencies and server cpu time in $(GEN_DIR)/bench.json
+#
+# Not collected by a plain 'py.test', run it via 'make bench' or
+#   py.test -s bench_h2load.py
+# With H2_BENCH_BASELINE pointing to the bench.json of an earlier run, a
+# scenario fails when its request rate drops by more than
+# H2_BENCH_TOLERANCE percent (default 10).
+#
+
+import json
+import os
+import re
+import sys
+import time
+import pytest
+
+from datetime import datetime
+from TestEnv import TestEnv
+from TestHttpdConf import HttpdConf
+
+RESULTS = {}
+
+def setup_module(module):
+    print("setup_module: %s" % module.__name__)
+    TestEnv.init()
+    TestEnv.setup_data_1k_1m()
+    s100 = "0123456789" * 10
+    with open(os.path.join(TestEnv.HTTPD_DOCS_DIR, "test1", "bench-1m"), 'w') as f:
+        for i in range(10000):
+            f.write(s100)
+    HttpdConf(
+    ).add_proxy_setup(
+    ).start_vhost( TestEnv.HTTPS_PORT, "bench", docRoot="htdocs/test1", withSSL=True
+    ).add_line("""    Protocols h2 http/1.1
+    SSLProxyCheckPeerName off
+    ProxyPreserveHost on
+    ProxyPass "/h2proxy/" "h2://127.0.0.1:%s/"
+    <Location /006-push.html>
+        Header add Link "</006/006.css>;rel=preload"
+        Header add Link "</006/006.js>;rel=preload"
+    </Location>
+    RewriteEngine on
+    RewriteRule ^/006-push.html$ /006.html
+    <Location /002.jpg>
+        Header add Vary Accept-Encoding
+        Header add Vary "User-Agent, accept-encoding"
+    </Location>
+    """ % TestEnv.HTTPS_PORT
+    ).end_vhost(
+    ).start_vhost( TestEnv.HTTPS_PORT, "bench-serial", docRoot="htdocs/test1", withSSL=True
+    ).add_line("""    Protocols h2 http/1.1
+    H2SerializeHeaders on
+    <Location /002.jpg>
+        Header add Vary Accept-Encoding
+        Header add Vary "User-Agent, accept-encoding"
+    </Location>
+    """
+    ).end_vhost(
+    ).add_vhost_cgi(
+    ).install()
+    assert TestEnv.apache_restart() == 0
+
+def teardown_module(module):
+    print("teardown_module: %s" % module.__name__)
+    path = os.path.join(TestEnv.GEN_DIR, "bench.json")
+    with open(path, 'w') as f:
+        json.dump({
+            "date" : datetime.now().isoformat(),
+            "scenarios" : RESULTS
+        }, f, indent=2, sort_keys=True)
+    print("benchmark results written to %s" % path)
+    assert TestEnv.apache_stop() == 0
+
+def server_cpu_ticks():
+    # user+system ticks of the httpd parent and all its children, linux only
+    try:
+        with open(os.path.join(TestEnv.WEBROOT, "logs", "httpd.pid")) as f:
+            ppid = f.read().strip()
+        ticks = 0
+        for pid in os.listdir("/proc"):
+            if not pid.isdigit():
+                continue
+            try:
+                with open("/proc/%s/stat" % pid) as f:
+                    stat = f.read()
+            except IOError:
+                continue
+            fields = stat[stat.rfind(')')+2:].split()
+            if pid == ppid or fields[1] == ppid:
+                ticks += int(fields[11]) + int(fields[12])
+        return ticks
+    except (IOError, OSError, IndexError, ValueError):
+        return None
+
+def percentile(values, p):
+    if not values:
+        return None
+    values = sorted(values)
+    return values[min(len(values)-1, int(len(values) * p / 100))]
+
+def record(name, requests, succeeded, secs, latencies, ticks):
+    entry = {
+        "requests" : requests,
+        "succeeded" : succeeded,
+        "req_per_sec" : round(succeeded / secs, 2) if secs > 0 else None,
+        "latency_usec" : {
+            "p50" : percentile(latencies, 50),
+            "p99" : percentile(latencies, 99)
+        },
+        "cpu_usec_per_req" : None
+    }
+    if ticks is not None and succeeded > 0:
+        entry["cpu_usec_per_req"] = round(
+            ticks * 1000000.0 / os.sysconf("SC_CLK_TCK") / succeeded, 2)
+    RESULTS[name] = entry
+    print("%s: %s" % (name, json.dumps(entry, sort_keys=True)))
+
+    baseline = os.environ.get("H2_BENCH_BASELINE")
+    if baseline and entry["req_per_sec"]:
+        with open(baseline) as f:
+            base = json.load(f)["scenarios"].get(name)
+        if base and base["req_per_sec"]:
+            tolerance = float(os.environ.get("H2_BENCH_TOLERANCE", "10"))
+            limit = base["req_per_sec"] * (100 - tolerance) / 100
+            assert entry["req_per_sec"] >= limit, \
+                "%s: %.2f req/s, baseline %.2f" % (name, entry["req_per_sec"],
+                                                  base["req_per_sec"])
+    return entry
+
+def h2load(name, host, path, n, c, m, options=None):
+    logfile = os.path.join(TestEnv.GEN_DIR, "h2load-%s.log" % name)
+    if os.path.exists(logfile):
+        os.remove(logfile)
+    args = [ TestEnv.H2LOAD, "-n", "%d" % n, "-c", "%d" % c, "-m", "%d" % m,
+        "--log-file=%s" % logfile,
+        "-H", ":authority: %s.%s:%s" % (host, TestEnv.HTTP_TLD, TestEnv.HTTPS_PORT) ]
+    if options:
+        args.extend(options)
+    args.append("https://%s:%s%s" % (TestEnv.HTTPD_ADDR, TestEnv.HTTPS_PORT, path))
+    cpu_start = server_cpu_ticks()
+    r = TestEnv.run(args)
+    cpu_end = server_cpu_ticks()
+    assert 0 == r["rv"]
+    r = TestEnv.h2load_status(r)
+    assert n == r["h2load"]["requests"]["succeeded"]
+    m = re.search(r'finished in ([\d.]+)(m?s),', r["out"]["text"])
+    assert m
+    secs = float(m.group(1)) / (1000 if m.group(2) == "ms" else 1)
+    # log lines are: start time, status, duration in usec
+    latencies = []
+    with open(logfile) as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) >= 3:
+                latencies.append(int(fields[2]))
+    ticks = (cpu_end - cpu_start) if cpu_start is not None and cpu_end is not None else None
+    return record(name, n, r["h2load"]["requests"]["succeeded"], secs, latencies, ticks)
+
+
+@pytest.mark.skipif(not TestEnv.has_h2load(), reason="no h2load command available")
+class TestBench:
+
+    def setup_method(self, method):
+        print("setup_method: %s" % method.__name__)
+
+    def teardown_method(self, method):
+        print("teardown_method: %s" % method.__name__)
+
+    # many small GETs on few connections, one stream at a time
+    def test_bench_01_small(self):
+        h2load("small", "bench", "/index.html", 20000, 8, 1)
+
+    # large static files
+    def test_bench_02_large(self):
+        h2load("large", "bench", "/bench-1m", 500, 4, 1)
+
+    # POST uploads of 100k each
+    def test_bench_03_upload(self):
+        h2load("upload", "cgi", "/echo.py", 500, 4, 1,
+            [ "-d", os.path.join(TestEnv.GEN_DIR, "data-100k") ])
+
+    # many concurrent streams on a single connection
+    def test_bench_04_streams(self):
+        h2load("streams", "bench", "/index.html", 20000, 1, 100)
+
+    # requests proxied over a h2 backend connection
+    def test_bench_05_proxy(self):
+        h2load("proxy", "bench", "/h2proxy/index.html", 5000, 4, 10)
+
+    # h2load does not accept pushes, measure pages with 2 pushed
+    # resources with single nghttp runs
+    @pytest.mark.skipif(not TestEnv.has_nghttp(), reason="no nghttp command available")
+    def test_bench_06_push(self):
+        url = TestEnv.mkurl("https", "bench", "/006-push.html")
+        n = 200
+        latencies = []
+        cpu_start = server_cpu_ticks()
+        start = time.time()
+        for i in range(n):
+            t = time.time()
+            r = TestEnv.nghttp().get(url)
+            latencies.append(int((time.time() - t) * 1000000))
+            assert 0 == r["rv"]
+            assert 2 == len(r["streams"][r["response"]["id"]]["promises"])
+        secs = time.time() - start
+        cpu_end = server_cpu_ticks()
+        ticks = (cpu_end - cpu_start) if cpu_start is not None and cpu_end is not None else None
+        record("push", n, n, secs, latencies, ticks)
+
+    # merging Vary headers on native and serialized response headers
+    def test_bench_07_vary(self):
+        h2load("vary", "bench", "/002.jpg", 2000, 4, 10)
+        h2load("vary-serial", "bench-serial", "/002.jpg", 2000, 4, 10)
@@ -18,7 +18,13 @@ def setup_module(module):
     print("setup_module: %s" % module.__name__)
     TestEnv.init()
     TestEnv.setup_data_1k_1m()
-    HttpdConf().add_vhost_cgi().install()
+    HttpdConf().add_vhost_test1().add_vhost_cgi(
+    ).start_vhost( TestEnv.HTTPS_PORT, "cgi-limit", docRoot="htdocs/cgi", withSSL=True
+    ).add_line("      Protocols h2 http/1.1"
+    ).add_line("      AddHandler cgi-script .py"
+    ).add_line("      LimitRequestBody 1024"
+    ).end_vhost(
+    ).install()
     assert TestEnv.apache_restart() == 0
         
 def teardown_module(module):
@@ -146,3 +152,37 @@ class TestStore:
         self.nghttp_upload_and_verify( "data-100k", [  "--no-content-length" ] )
         self.nghttp_upload_and_verify( "data-1m", [  "--no-content-length" ] )
 
+    # a body without content-length reaches handlers that discard it,
+    # also twice when an error response follows
+    @pytest.mark.skipif(not TestEnv.has_nghttp(), reason="no nghttp command available")
+    def test_004_30(self):
+        fpath = os.path.join(TestEnv.GEN_DIR, "data-10k")
+        url = TestEnv.mkurl("https", "test1", "/index.html")
+        r = TestEnv.nghttp().upload(url, fpath, options=[ "--no-content-length" ])
+        assert r["rv"] == 0
+        assert 200 == r["response"]["status"]
+        with open(os.path.join(TestEnv.HTTPD_DOCS_DIR, "test1", "index.html"), 'rb') as f:
+            assert f.read() == r["response"]["body"]
+        url = TestEnv.mkurl("https", "test1", "/does-not-exist.html")
+        r = TestEnv.nghttp().upload(url, fpath, options=[ "--no-content-length" ])
+        assert r["rv"] == 0
+        assert 404 == r["response"]["status"]
+
+    # a body without content-length after a 100-continue
+    @pytest.mark.skipif(not TestEnv.has_nghttp(), reason="no nghttp command available")
+    def test_004_31(self):
+        for fname in [ "data-1k", "data-100k" ]:
+            self.nghttp_post_and_verify( fname, [ "--no-content-length", "--expect-continue" ] )
+
+    # LimitRequestBody applies to a body without content-length
+    @pytest.mark.skipif(not TestEnv.has_nghttp(), reason="no nghttp command available")
+    def test_004_32(self):
+        url = TestEnv.mkurl("https", "cgi-limit", "/echo.py")
+        fpath = os.path.join(TestEnv.GEN_DIR, "data-1k")
+        r = TestEnv.nghttp().upload(url, fpath, options=[ "--no-content-length" ])
+        assert r["rv"] == 0
+        assert 200 == r["response"]["status"]
+        fpath = os.path.join(TestEnv.GEN_DIR, "data-10k")
+        r = TestEnv.nghttp().upload(url, fpath, options=[ "--no-content-length" ])
+        assert r["rv"] == 0
+        assert 413 == r["response"]["status"]
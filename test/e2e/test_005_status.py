@@ -42,11 +42,34 @@ class TestStore:
         del st["peerSettings"]["SETTINGS_INITIAL_WINDOW_SIZE"]
         del st["streams"]["1"]["created"]
         del st["streams"]["1"]["flowOut"]
+        assert "timing" in st["streams"]["1"]
+        del st["streams"]["1"]["timing"]
         del st["stats"]["in"]["frames"]
         del st["stats"]["in"]["octets"]
         del st["stats"]["out"]["frames"]
         del st["stats"]["out"]["octets"]
+        # depends on the connection and what ran before
+        assert "io" in st["stats"]
+        del st["stats"]["io"]
+        assert "workers" in st["stats"]
+        assert st["stats"]["workers"]["limiter"] == "steps"
+        assert st["stats"]["workers"]["weight"] == 1
+        assert st["stats"]["workers"]["queueWait"]["tasks"] >= 1
+        del st["stats"]["workers"]
+        assert "streamPools" in st["stats"]
+        del st["stats"]["streamPools"]
+        assert "slavePool" in st["stats"]
+        del st["stats"]["slavePool"]
+        assert "beamChunks" in st["stats"]
+        del st["stats"]["beamChunks"]
         del st["connFlowOut"]
+        # the frame recorder has seen our request and the SETTINGS
+        frames = st["frames"]
+        assert len(frames) > 0 and len(frames) <= 32
+        assert { "dir": "recv", "type": "HEADERS", "stream": 1 } in [ 
+            { k: f[k] for k in ("dir", "type", "stream") } for f in frames ]
+        assert "SETTINGS" in [ f["type"] for f in frames if f["dir"] == "sent" ]
+        del st["frames"]
         
         assert st == {
             "version" : "draft-01",
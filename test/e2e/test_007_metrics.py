@@ -0,0 +1,70 @@
+#
+# mod-h2 test metrics in Prometheus text format
+#
+
+import copy
+import re
+import sys
+import time
+import pytest
+
+from datetime import datetime
+from TestEnv import TestEnv
+from TestHttpdConf import HttpdConf
+
+def setup_module(module):
+    print("setup_module: %s" % module.__name__)
+    TestEnv.init()
+    HttpdConf(
+    ).add_line("<Location \"/.well-known/h2/metrics\">"
+    ).add_line("    SetHandler http2-metrics"
+    ).add_line("</Location>"
+    ).add_vhost_cgi().install()
+    assert TestEnv.apache_restart() == 0
+        
+def teardown_module(module):
+    print("teardown_module: %s" % module.__name__)
+    assert TestEnv.apache_stop() == 0
+
+class TestStore:
+
+    def setup_method(self, method):
+        print("setup_method: %s" % method.__name__)
+
+    def teardown_method(self, method):
+        print("teardown_method: %s" % method.__name__)
+
+    def get_metrics(self, options=None):
+        url = TestEnv.mkurl("https", "cgi", "/.well-known/h2/metrics")
+        r = TestEnv.curl_get(url, 5, options)
+        assert 200 == r["response"]["status"]
+        assert r["response"]["header"]["content-type"].startswith("text/plain")
+        metrics = {}
+        for line in r["response"]["body"].decode().splitlines():
+            if line.startswith("#"):
+                continue
+            m = re.match(r'^(\S+) (\d+)$', line)
+            assert m
+            metrics[m.group(1)] = int(m.group(2))
+        return metrics
+    
+    def test_007_01(self):
+        m1 = self.get_metrics()
+        assert "h2_streams_opened_total" in m1
+        assert "h2_frames_received_total{type=\"HEADERS\"}" in m1
+        assert "h2_frames_sent_total{type=\"DATA\"}" in m1
+        assert "h2_beam_chunk_bytes" in m1
+        assert "h2_workers_queued" in m1
+        assert "h2_workers_started_total" in m1
+        # our own request is an h2 stream, the next one counts it
+        url = TestEnv.mkurl("https", "cgi", "/hello.py")
+        r = TestEnv.curl_get(url, 5)
+        assert 200 == r["response"]["status"]
+        m2 = self.get_metrics()
+        assert m2["h2_streams_opened_total"] >= m1["h2_streams_opened_total"] + 2
+        assert m2["h2_bytes_sent_total"] > m1["h2_bytes_sent_total"]
+
+    # the metrics are also served over HTTP/1.1
+    def test_007_02(self):
+        m = self.get_metrics([ "--http1.1" ])
+        assert "h2_streams_reset_total" in m
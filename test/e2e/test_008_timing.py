@@ -0,0 +1,66 @@
+#
+# mod-h2 test per-stream timing in the access log and status
+#
+
+import os
+import re
+import sys
+import time
+import pytest
+
+from datetime import datetime
+from TestEnv import TestEnv
+from TestHttpdConf import HttpdConf
+
+def setup_module(module):
+    print("setup_module: %s" % module.__name__)
+    TestEnv.init()
+    TestStore.LOG = os.path.join(TestEnv.WEBROOT, "logs", "timing_log")
+    if os.path.exists(TestStore.LOG):
+        os.remove(TestStore.LOG)
+    HttpdConf(
+    ).start_vhost( TestEnv.HTTPS_PORT, "test1", docRoot="htdocs/test1", withSSL=True
+    ).add_line("      Protocols h2 http/1.1"
+    ).add_line("      CustomLog \"logs/timing_log\" \"%U %{task}^h2 %{worker}^h2 %{out}^h2 %{bogus}^h2\""
+    ).end_vhost(
+    ).install()
+    assert TestEnv.apache_restart() == 0
+
+def teardown_module(module):
+    print("teardown_module: %s" % module.__name__)
+    assert TestEnv.apache_stop() == 0
+
+class TestStore:
+
+    def setup_method(self, method):
+        print("setup_method: %s" % method.__name__)
+
+    def teardown_method(self, method):
+        print("teardown_method: %s" % method.__name__)
+
+    def log_lines(self, path):
+        with open(self.LOG) as f:
+            return [l.split() for l in f.read().splitlines() if l.startswith(path + " ")]
+
+    # h2 requests log the usecs their stream waited for task, worker and output
+    def test_008_01(self):
+        url = TestEnv.mkurl("https", "test1", "/index.html")
+        r = TestEnv.curl_get(url, 5)
+        assert 200 == r["response"]["status"]
+        time.sleep(0.5)
+        lines = self.log_lines("/index.html")
+        assert 1 == len(lines)
+        task, worker, out, bogus = [int(v) for v in lines[0][1:4]] + [lines[0][4]]
+        assert 0 <= task <= worker
+        assert worker <= out
+        assert "-" == bogus
+
+    # HTTP/1.1 requests have no stream timings
+    def test_008_02(self):
+        url = TestEnv.mkurl("https", "test1", "/002.jpg")
+        r = TestEnv.curl_get(url, 5, [ "--http1.1" ])
+        assert 200 == r["response"]["status"]
+        time.sleep(0.5)
+        lines = self.log_lines("/002.jpg")
+        assert 1 == len(lines)
+        assert [ "-", "-", "-", "-" ] == lines[0][1:]
@@ -0,0 +1,143 @@
+#
+# mod-h2 test suite
+# check small responses answered from the per child response cache
+#
+
+import copy
+import os
+import re
+import sys
+import time
+import pytest
+
+from datetime import datetime
+from TestEnv import TestEnv
+from TestHttpdConf import HttpdConf
+
+def setup_module(module):
+    print("setup_module: %s" % module.__name__)
+    TestEnv.init()
+    HttpdConf(
+    ).add_line("H2ResponseCacheSize 65536 16384"
+    ).start_vhost( TestEnv.HTTPS_PORT, "rcache", docRoot="htdocs/test1", withSSL=True
+    ).add_line("""    Protocols h2 http/1.1
+    H2ResponseCache on
+    <Location /006/006.css>
+        Header set Cache-Control "max-age=60"
+    </Location>
+    <Location /006/006.js>
+        Header set Cache-Control "max-age=60, private"
+    </Location>
+    <Location /003.html>
+        Header set Cache-Control "max-age=60"
+        H2ResponseCache off
+    </Location>
+    <Location /004.html>
+        Header set Cache-Control "max-age=60"
+        Require ip 127.0.0.1 ::1
+    </Location>
+    <Location /007.html>
+        Header set Cache-Control "max-age=60"
+        Require all granted
+    </Location>
+    """).end_vhost(
+    ).start_vhost( TestEnv.HTTPS_PORT, "rcache-off", docRoot="htdocs/test1", withSSL=True
+    ).add_line("""    Protocols h2 http/1.1
+    <Location /007.html>
+        Header set Cache-Control "max-age=60"
+    </Location>
+    """).end_vhost(
+    ).install()
+    assert TestEnv.apache_restart() == 0
+        
+def teardown_module(module):
+    print("teardown_module: %s" % module.__name__)
+    assert TestEnv.apache_stop() == 0
+
+class TestStore:
+
+    def setup_method(self, method):
+        print("setup_method: %s" % method.__name__)
+
+    def teardown_method(self, method):
+        print("teardown_method: %s" % method.__name__)
+
+    # a fresh response is answered from the cache the second time
+    def test_009_01(self):
+        url = TestEnv.mkurl("https", "rcache", "/006/006.css")
+        r = TestEnv.curl_get(url)
+        assert 200 == r["response"]["status"]
+        assert "age" not in r["response"]["header"]
+        body = r["response"]["body"]
+        r = TestEnv.curl_get(url)
+        assert 200 == r["response"]["status"]
+        assert "age" in r["response"]["header"]
+        assert "date" in r["response"]["header"]
+        assert body == r["response"]["body"]
+        assert len(body) == int(r["response"]["header"]["content-length"])
+
+    # conditional requests get a 304 from the cache
+    def test_009_02(self):
+        url = TestEnv.mkurl("https", "rcache", "/006/006.css")
+        r = TestEnv.curl_get(url)
+        assert 200 == r["response"]["status"]
+        etag = r["response"]["header"]["etag"]
+        r = TestEnv.curl_get(url)
+        assert "age" in r["response"]["header"]
+        r = TestEnv.curl_get(url, options=[ "-H", "if-none-match: %s" % etag])
+        assert 304 == r["response"]["status"]
+        assert "age" in r["response"]["header"]
+        r = TestEnv.curl_get(url, options=[ "-H", "if-none-match: dummy"])
+        assert 200 == r["response"]["status"]
+        assert "age" in r["response"]["header"]
+
+    # private responses and locations with the cache off are not cached
+    def test_009_03(self):
+        for path in [ "/006/006.js", "/003.html" ]:
+            url = TestEnv.mkurl("https", "rcache", path)
+            r = TestEnv.curl_get(url)
+            assert 200 == r["response"]["status"]
+            r = TestEnv.curl_get(url)
+            assert 200 == r["response"]["status"]
+            assert "age" not in r["response"]["header"]
+
+    # responses of access restricted locations are never cached, even
+    # when the client passes the restriction
+    def test_009_04(self):
+        url = TestEnv.mkurl("https", "rcache", "/004.html")
+        for i in range(3):
+            r = TestEnv.curl_get(url)
+            assert 200 == r["response"]["status"]
+            assert "age" not in r["response"]["header"]
+
+    # a location open to all is cached, also with a Require
+    def test_009_05(self):
+        url = TestEnv.mkurl("https", "rcache", "/007.html")
+        r = TestEnv.curl_get(url)
+        assert 200 == r["response"]["status"]
+        r = TestEnv.curl_get(url)
+        assert 200 == r["response"]["status"]
+        assert "age" in r["response"]["header"]
+
+    # a request with no-cache is passed on to a worker
+    def test_009_06(self):
+        url = TestEnv.mkurl("https", "rcache", "/006/006.css")
+        r = TestEnv.curl_get(url)
+        assert 200 == r["response"]["status"]
+        for cc in [ "cache-control: no-cache", "cache-control: max-age=0",
+                    "pragma: no-cache" ]:
+            r = TestEnv.curl_get(url, options=[ "-H", cc ])
+            assert 200 == r["response"]["status"]
+            assert "age" not in r["response"]["header"]
+
+    # a server without the cache serves nothing from it, even for a path
+    # that another server has cached
+    def test_009_07(self):
+        r = TestEnv.curl_get(TestEnv.mkurl("https", "rcache", "/007.html"))
+        r = TestEnv.curl_get(TestEnv.mkurl("https", "rcache", "/007.html"))
+        assert "age" in r["response"]["header"]
+        url = TestEnv.mkurl("https", "rcache-off", "/007.html")
+        for i in range(2):
+            r = TestEnv.curl_get(url)
+            assert 200 == r["response"]["status"]
+            assert "age" not in r["response"]["header"]
@@ -0,0 +1,73 @@
+#
+# mod-h2 test suite
+# check requests processed inline on the main connection
+#
+
+import copy
+import os
+import re
+import sys
+import time
+import pytest
+
+from datetime import datetime
+from TestEnv import TestEnv
+from TestHttpdConf import HttpdConf
+
+def setup_module(module):
+    print("setup_module: %s" % module.__name__)
+    TestEnv.init()
+    HttpdConf(
+    ).start_vhost( TestEnv.HTTPS_PORT, "inline", docRoot="htdocs/test1", withSSL=True
+    ).add_line("""    Protocols h2 http/1.1
+    <Location /006>
+        H2Inline on
+    </Location>
+    <Location /006/006.js>
+        H2Inline off
+    </Location>
+    <Location "/.well-known/h2/state">
+        SetHandler http2-status
+        H2Inline on
+    </Location>
+    """).end_vhost(
+    ).install()
+    assert TestEnv.apache_restart() == 0
+        
+def teardown_module(module):
+    print("teardown_module: %s" % module.__name__)
+    assert TestEnv.apache_stop() == 0
+
+class TestStore:
+
+    def setup_method(self, method):
+        print("setup_method: %s" % method.__name__)
+
+    def teardown_method(self, method):
+        print("teardown_method: %s" % method.__name__)
+
+    # inline and worker processed responses are the same
+    def test_010_01(self):
+        for path in [ "/006/006.css", "/006/006.js", "/006.html" ]:
+            url = TestEnv.mkurl("https", "inline", path)
+            r = TestEnv.curl_get(url)
+            assert 200 == r["response"]["status"]
+            with open(os.path.join(TestEnv.HTTPD_DOCS_DIR, "test1", path[1:]), 'rb') as f:
+                assert f.read() == r["response"]["body"]
+
+    # the status handler answers inline
+    def test_010_02(self):
+        url = TestEnv.mkurl("https", "inline", "/.well-known/h2/state")
+        r = TestEnv.curl_get(url, 5)
+        assert 200 == r["response"]["status"]
+        assert "streams" in r["response"]["json"]
+
+    # a page and its assets on one connection, inline and on workers
+    @pytest.mark.skipif(not TestEnv.has_nghttp(), reason="no nghttp command available")
+    def test_010_03(self):
+        url = TestEnv.mkurl("https", "inline", "/006.html")
+        r = TestEnv.nghttp().assets(url)
+        assert 0 == r["rv"]
+        assert 3 == len(r["assets"])
+        for asset in r["assets"]:
+            assert 200 == asset["status"]
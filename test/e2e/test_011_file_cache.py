@@ -0,0 +1,122 @@
+#
+# mod-h2 test suite
+# check static files served from the per child file descriptor cache
+#
+
+import copy
+import os
+import re
+import sys
+import time
+import pytest
+
+from datetime import datetime
+from TestEnv import TestEnv
+from TestHttpdConf import HttpdConf
+
+def setup_module(module):
+    print("setup_module: %s" % module.__name__)
+    TestEnv.init()
+    HttpdConf(
+    ).add_line("H2FileCacheSize 4"
+    ).start_vhost( TestEnv.HTTPS_PORT, "fcache", docRoot="htdocs/test1", withSSL=True
+    ).add_line("""    Protocols h2 http/1.1
+    <Location "/.well-known/h2/metrics">
+        SetHandler http2-metrics
+    </Location>
+    """).end_vhost(
+    ).install()
+    assert TestEnv.apache_restart() == 0
+
+def teardown_module(module):
+    print("teardown_module: %s" % module.__name__)
+    assert TestEnv.apache_stop() == 0
+
+class TestStore:
+
+    def setup_method(self, method):
+        print("setup_method: %s" % method.__name__)
+
+    def teardown_method(self, method):
+        print("teardown_method: %s" % method.__name__)
+
+    def get_metrics(self):
+        url = TestEnv.mkurl("https", "fcache", "/.well-known/h2/metrics")
+        r = TestEnv.curl_get(url, 5)
+        assert 200 == r["response"]["status"]
+        metrics = {}
+        for line in r["response"]["body"].decode().splitlines():
+            m = re.match(r'^(h2_fcache\S+) (\d+)$', line)
+            if m:
+                metrics[m.group(1)] = int(m.group(2))
+        return metrics
+
+    def doc_path(self, path):
+        return os.path.join(TestEnv.HTTPD_DOCS_DIR, "test1", path[1:])
+
+    # files are served from cached descriptors, all requests either
+    # open a file or hit the cache
+    def test_011_01(self):
+        m1 = self.get_metrics()
+        for i in range(3):
+            for path in [ "/006/006.css", "/006/006.js", "/006.html" ]:
+                url = TestEnv.mkurl("https", "fcache", path)
+                r = TestEnv.curl_get(url)
+                assert 200 == r["response"]["status"]
+                with open(self.doc_path(path), 'rb') as f:
+                    assert f.read() == r["response"]["body"]
+        m2 = self.get_metrics()
+        served = (m2["h2_fcache_hits_total"] + m2["h2_fcache_opens_total"]
+                  - m1["h2_fcache_hits_total"] - m1["h2_fcache_opens_total"])
+        assert served >= 9
+        assert m2["h2_fcache_fds"] > 0
+
+    # ranges and conditionals work as with the core handler
+    def test_011_02(self):
+        url = TestEnv.mkurl("https", "fcache", "/006/006.js")
+        with open(self.doc_path("/006/006.js"), 'rb') as f:
+            body = f.read()
+        r = TestEnv.curl_get(url, options=[ "-r", "10-19" ])
+        assert 206 == r["response"]["status"]
+        assert body[10:20] == r["response"]["body"]
+        r = TestEnv.curl_get(url)
+        assert 200 == r["response"]["status"]
+        etag = r["response"]["header"]["etag"]
+        r = TestEnv.curl_get(url, options=[ "-H", "if-none-match: %s" % etag ])
+        assert 304 == r["response"]["status"]
+        r = TestEnv.curl_get(url, options=[ "-I" ])
+        assert 200 == r["response"]["status"]
+        assert len(body) == int(r["response"]["header"]["content-length"])
+
+    # a file replaced on disk is not served from the old descriptor
+    def test_011_03(self):
+        path = "/011-replace.txt"
+        url = TestEnv.mkurl("https", "fcache", path)
+        fpath = self.doc_path(path)
+        for content in [ b"first version\n", b"the second version\n" ]:
+            with open(fpath + ".tmp", 'wb') as f:
+                f.write(content)
+            os.rename(fpath + ".tmp", fpath)
+            for i in range(2):
+                r = TestEnv.curl_get(url)
+                assert 200 == r["response"]["status"]
+                assert content == r["response"]["body"]
+        os.remove(fpath)
+
+    # a file the server cannot open is refused by the cache handler,
+    # as the core handler would
+    @pytest.mark.skipif(os.geteuid() == 0, reason="root opens any file")
+    def test_011_04(self):
+        path = "/011-denied.txt"
+        url = TestEnv.mkurl("https", "fcache", path)
+        fpath = self.doc_path(path)
+        with open(fpath, 'wb') as f:
+            f.write(b"not for you\n")
+        os.chmod(fpath, 0)
+        try:
+            r = TestEnv.curl_get(url)
+            assert 403 == r["response"]["status"]
+            r = TestEnv.curl_get(url, options=[ "--data-binary", "x" * 1024 ])
+            assert 403 == r["response"]["status"]
+        finally:
+            os.remove(fpath)
@@ -0,0 +1,75 @@
+#
+# mod-h2 test suite
+# check uploads with autotuned stream receive windows
+#
+
+import copy
+import os
+import re
+import sys
+import time
+import pytest
+
+from datetime import datetime
+from TestEnv import TestEnv
+from TestHttpdConf import HttpdConf
+
+def setup_module(module):
+    print("setup_module: %s" % module.__name__)
+    TestEnv.init()
+    TestEnv.setup_data_1k_1m()
+    HttpdConf(
+    ).add_line("H2WindowAutotune on"
+    ).add_line("H2WindowBudget 1048576"
+    ).add_vhost_cgi().install()
+    assert TestEnv.apache_restart() == 0
+        
+def teardown_module(module):
+    print("teardown_module: %s" % module.__name__)
+    assert TestEnv.apache_stop() == 0
+
+class TestStore:
+
+    def setup_method(self, method):
+        print("setup_method: %s" % method.__name__)
+
+    def teardown_method(self, method):
+        print("teardown_method: %s" % method.__name__)
+
+    # upload and GET again using nghttp, compare to original content
+    def nghttp_upload_and_verify(self, fname, options=None):
+        url = TestEnv.mkurl("https", "cgi", "/upload.py")
+        fpath = os.path.join(TestEnv.GEN_DIR, fname)
+
+        r = TestEnv.nghttp().upload_file(url, fpath, options=options)
+        assert r["rv"] == 0
+        assert r["response"]["status"] >= 200 and r["response"]["status"] < 300
+        assert r["response"]["header"]["location"]
+
+        r2 = TestEnv.nghttp().get(r["response"]["header"]["location"])
+        assert r2["rv"] == 0
+        assert r2["response"]["status"] == 200 
+        with open(TestEnv.e2e_src( fpath ), mode='rb') as file:
+            src = file.read()
+        assert src == r2["response"]["body"]
+
+    @pytest.mark.skipif(not TestEnv.has_nghttp(), reason="no nghttp command available")
+    def test_105_01(self):
+        self.nghttp_upload_and_verify( "data-100k", [ ] )
+        self.nghttp_upload_and_verify( "data-1m", [ ] )
+
+    @pytest.mark.skipif(not TestEnv.has_nghttp(), reason="no nghttp command available")
+    def test_105_02(self):
+        self.nghttp_upload_and_verify( "data-1m", [ "--no-content-length" ] )
+
+    # windows of parallel uploads share the budget
+    @pytest.mark.skipif(not TestEnv.has_h2load(), reason="no h2load command available")
+    def test_105_03(self):
+        fpath = os.path.join(TestEnv.GEN_DIR, "data-1m")
+        r = TestEnv.run( [ TestEnv.H2LOAD, "-n", "20", "-c", "1", "-m", "10",
+            "-d", fpath,
+            "-H", ":authority: cgi.%s:%s" % (TestEnv.HTTP_TLD, TestEnv.HTTPS_PORT),
+            "https://%s:%s/echo.py" % (TestEnv.HTTPD_ADDR, TestEnv.HTTPS_PORT)] )
+        assert 0 == r["rv"]
+        r = TestEnv.h2load_status(r)
+        assert 20 == r["h2load"]["requests"]["succeeded"]
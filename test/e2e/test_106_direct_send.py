@@ -0,0 +1,59 @@
+#
+# mod-h2 test suite
+# check h2c output written directly to the socket
+#
+
+import copy
+import os
+import re
+import sys
+import time
+import pytest
+
+from datetime import datetime
+from TestEnv import TestEnv
+from TestHttpdConf import HttpdConf
+
+def setup_module(module):
+    print("setup_module: %s" % module.__name__)
+    TestEnv.init()
+    HttpdConf(
+    ).start_vhost( TestEnv.HTTP_PORT, "direct", docRoot="htdocs/test1", withSSL=False
+    ).add_line("""    Protocols h2c http/1.1
+    H2DirectSend on
+    """).end_vhost(
+    ).install()
+    assert TestEnv.apache_restart() == 0
+        
+def teardown_module(module):
+    print("teardown_module: %s" % module.__name__)
+    assert TestEnv.apache_stop() == 0
+
+class TestStore:
+
+    def setup_method(self, method):
+        print("setup_method: %s" % method.__name__)
+
+    def teardown_method(self, method):
+        print("teardown_method: %s" % method.__name__)
+
+    # single resources, small and large
+    @pytest.mark.skipif(not TestEnv.has_nghttp(), reason="no nghttp command available")
+    def test_106_01(self):
+        for path in [ "/index.html", "/002.jpg" ]:
+            url = TestEnv.mkurl("http", "direct", path)
+            r = TestEnv.nghttp().get(url)
+            assert 0 == r["rv"]
+            assert 200 == r["response"]["status"]
+            with open(os.path.join(TestEnv.HTTPD_DOCS_DIR, "test1", path[1:]), 'rb') as f:
+                assert len(f.read()) == len(r["response"]["body"])
+
+    # many streams interleaved on one connection
+    @pytest.mark.skipif(not TestEnv.has_nghttp(), reason="no nghttp command available")
+    def test_106_02(self):
+        url = TestEnv.mkurl("http", "direct", "/004.html")
+        r = TestEnv.nghttp().assets(url)
+        assert 0 == r["rv"]
+        assert 181 == len(r["assets"])
+        for asset in r["assets"]:
+            assert 200 == asset["status"]
@@ -0,0 +1,67 @@
+#
+# mod-h2 test suite
+# check uploads with control frames held back by H2FlushDelay
+#
+
+import copy
+import os
+import re
+import sys
+import time
+import pytest
+
+from datetime import datetime
+from TestEnv import TestEnv
+from TestHttpdConf import HttpdConf
+
+def setup_module(module):
+    print("setup_module: %s" % module.__name__)
+    TestEnv.init()
+    TestEnv.setup_data_1k_1m()
+    HttpdConf(
+    ).add_line("H2FlushDelay 2000 4096"
+    ).add_vhost_cgi().install()
+    assert TestEnv.apache_restart() == 0
+        
+def teardown_module(module):
+    print("teardown_module: %s" % module.__name__)
+    assert TestEnv.apache_stop() == 0
+
+class TestStore:
+
+    def setup_method(self, method):
+        print("setup_method: %s" % method.__name__)
+
+    def teardown_method(self, method):
+        print("teardown_method: %s" % method.__name__)
+
+    # upload and GET again using curl, compare to original content
+    def curl_upload_and_verify(self, fname, options=None):
+        url = TestEnv.mkurl("https", "cgi", "/upload.py")
+        fpath = os.path.join(TestEnv.GEN_DIR, fname)
+        r = TestEnv.curl_upload(url, fpath, options=options)
+        assert r["rv"] == 0
+        assert r["response"]["status"] >= 200 and r["response"]["status"] < 300
+
+        r2 = TestEnv.curl_get( r["response"]["header"]["location"])
+        assert r2["rv"] == 0
+        assert r2["response"]["status"] == 200 
+        with open(TestEnv.e2e_src( fpath ), mode='rb') as file:
+            src = file.read()
+        assert src == r2["response"]["body"]
+
+    def test_107_01(self):
+        self.curl_upload_and_verify( "data-100k", [ "--http2" ] )
+        self.curl_upload_and_verify( "data-1m", [ "--http2" ] )
+
+    # parallel uploads on one connection, all windows keep being updated
+    @pytest.mark.skipif(not TestEnv.has_h2load(), reason="no h2load command available")
+    def test_107_02(self):
+        fpath = os.path.join(TestEnv.GEN_DIR, "data-1m")
+        r = TestEnv.run( [ TestEnv.H2LOAD, "-n", "20", "-c", "1", "-m", "10",
+            "-d", fpath,
+            "-H", ":authority: cgi.%s:%s" % (TestEnv.HTTP_TLD, TestEnv.HTTPS_PORT),
+            "https://%s:%s/echo.py" % (TestEnv.HTTPD_ADDR, TestEnv.HTTPS_PORT)] )
+        assert 0 == r["rv"]
+        r = TestEnv.h2load_status(r)
+        assert 20 == r["h2load"]["requests"]["succeeded"]
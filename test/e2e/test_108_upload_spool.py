@@ -0,0 +1,91 @@
+#
+# mod-h2 test suite
+# check uploads that the session spools to disk with H2UploadSpool
+#
+
+import copy
+import os
+import re
+import sys
+import time
+import pytest
+
+from datetime import datetime
+from TestEnv import TestEnv
+from TestHttpdConf import HttpdConf
+
+def setup_module(module):
+    print("setup_module: %s" % module.__name__)
+    TestEnv.init()
+    TestEnv.setup_data_1k_1m()
+    HttpdConf(
+    ).add_line("H2UploadSpool 16384 200000"
+    ).add_vhost_cgi(
+    ).start_vhost( TestEnv.HTTPS_PORT, "spool-limit", docRoot="htdocs/cgi", withSSL=True
+    ).add_line("      Protocols h2 http/1.1"
+    ).add_line("      AddHandler cgi-script .py"
+    ).add_line("      LimitRequestBody 100000"
+    ).end_vhost(
+    ).install()
+    assert TestEnv.apache_restart() == 0
+        
+def teardown_module(module):
+    print("teardown_module: %s" % module.__name__)
+    assert TestEnv.apache_stop() == 0
+
+class TestStore:
+
+    def setup_method(self, method):
+        print("setup_method: %s" % method.__name__)
+
+    def teardown_method(self, method):
+        print("teardown_method: %s" % method.__name__)
+
+    # upload and GET again using curl, compare to original content
+    def curl_upload_and_verify(self, fname, options=None):
+        url = TestEnv.mkurl("https", "cgi", "/upload.py")
+        fpath = os.path.join(TestEnv.GEN_DIR, fname)
+        r = TestEnv.curl_upload(url, fpath, options=options)
+        assert r["rv"] == 0
+        assert r["response"]["status"] >= 200 and r["response"]["status"] < 300
+
+        r2 = TestEnv.curl_get( r["response"]["header"]["location"])
+        assert r2["rv"] == 0
+        assert r2["response"]["status"] == 200 
+        with open(TestEnv.e2e_src( fpath ), mode='rb') as file:
+            src = file.read()
+        assert src == r2["response"]["body"]
+
+    # small bodies stay in memory, larger ones go to a file, beyond the
+    # file limit the rest is passed on as it arrives
+    def test_108_01(self):
+        self.curl_upload_and_verify( "data-1k", [ "--http2" ] )
+        self.curl_upload_and_verify( "data-100k", [ "--http2" ] )
+        self.curl_upload_and_verify( "data-1m", [ "--http2" ] )
+
+    # a client waiting for 100-continue gets it, the body is not held
+    def test_108_02(self):
+        self.curl_upload_and_verify( "data-100k", [ "--http2", "-H", "Expect: 100-continue" ] )
+
+    # parallel uploads on one connection
+    @pytest.mark.skipif(not TestEnv.has_h2load(), reason="no h2load command available")
+    def test_108_03(self):
+        fpath = os.path.join(TestEnv.GEN_DIR, "data-1m")
+        r = TestEnv.run( [ TestEnv.H2LOAD, "-n", "20", "-c", "1", "-m", "10",
+            "-d", fpath,
+            "-H", ":authority: cgi.%s:%s" % (TestEnv.HTTP_TLD, TestEnv.HTTPS_PORT),
+            "https://%s:%s/echo.py" % (TestEnv.HTTPD_ADDR, TestEnv.HTTPS_PORT)] )
+        assert 0 == r["rv"]
+        r = TestEnv.h2load_status(r)
+        assert 20 == r["h2load"]["requests"]["succeeded"]
+
+    # no more than LimitRequestBody is spooled, the handler refuses the rest
+    def test_108_04(self):
+        url = TestEnv.mkurl("https", "spool-limit", "/echo.py")
+        fpath = os.path.join(TestEnv.GEN_DIR, "data-1m")
+        r = TestEnv.curl_get(url, 10, [ "--http2", "--data-binary", "@%s" % fpath ])
+        assert 413 == r["response"]["status"]
+        if TestEnv.has_nghttp():
+            r = TestEnv.nghttp().upload(url, fpath, options=[ "--no-content-length" ])
+            assert r["rv"] == 0
+            assert 413 == r["response"]["status"]
@@ -0,0 +1,61 @@
+#
+# mod-h2 test suite
+# check responses with H2HpackTableSize and H2HpackIndex
+#
+
+import copy
+import os
+import re
+import sys
+import time
+import pytest
+
+from datetime import datetime
+from TestEnv import TestEnv
+from TestHttpdConf import HttpdConf
+
+def setup_module(module):
+    print("setup_module: %s" % module.__name__)
+    TestEnv.init()
+    HttpdConf(
+    ).start_vhost( TestEnv.HTTPS_PORT, "hpack", docRoot="htdocs/test1", withSSL=True
+    ).add_line("""    Protocols h2 http/1.1
+    H2HpackTableSize 8192
+    H2HpackIndex never date etag X-Request-Time
+    Header set X-Request-Time "%t"
+    """).end_vhost(
+    ).install()
+    assert TestEnv.apache_restart() == 0
+        
+def teardown_module(module):
+    print("teardown_module: %s" % module.__name__)
+    assert TestEnv.apache_stop() == 0
+
+class TestStore:
+
+    def setup_method(self, method):
+        print("setup_method: %s" % method.__name__)
+
+    def teardown_method(self, method):
+        print("teardown_method: %s" % method.__name__)
+
+    # never indexed headers arrive as they are
+    def test_109_01(self):
+        url = TestEnv.mkurl("https", "hpack", "/index.html")
+        r = TestEnv.curl_get(url, 5)
+        assert 200 == r["response"]["status"]
+        assert "date" in r["response"]["header"]
+        assert r["response"]["header"]["x-request-time"].startswith("t=")
+
+    # the other response headers are still taken from the table
+    @pytest.mark.skipif(not TestEnv.has_h2load(), reason="no h2load command available")
+    def test_109_02(self):
+        r = TestEnv.run( [ TestEnv.H2LOAD, "-n", "100", "-c", "1", "-m", "1",
+            "-H", ":authority: hpack.%s:%s" % (TestEnv.HTTP_TLD, TestEnv.HTTPS_PORT),
+            "https://%s:%s/index.html" % (TestEnv.HTTPD_ADDR, TestEnv.HTTPS_PORT)] )
+        assert 0 == r["rv"]
+        r = TestEnv.h2load_status(r)
+        assert 100 == r["h2load"]["requests"]["succeeded"]
+        m = re.search(r'space savings ([\d.]+)%', r["out"]["text"])
+        assert m
+        assert float(m.group(1)) > 0
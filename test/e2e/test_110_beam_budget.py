@@ -0,0 +1,86 @@
+#
+# mod-h2 test suite
+# check responses when all streams share the memory of H2BeamMemBudget
+#
+
+import os
+import re
+import time
+import pytest
+
+from TestEnv import TestEnv
+from TestHttpdConf import HttpdConf
+
+def setup_module(module):
+    print("setup_module: %s" % module.__name__)
+    TestEnv.init()
+    s100 = "0123456789" * 10
+    with open(os.path.join(TestEnv.HTTPD_DOCS_DIR, "test1", "110-1m"), 'w') as f:
+        for i in range(10000):
+            f.write(s100)
+    HttpdConf(
+    ).add_line("H2BeamMemBudget 1048576"
+    ).add_line("H2StreamMaxMemSize 65536"
+    ).add_line("Timeout 10"
+    ).add_line("<Location \"/.well-known/h2/metrics\">"
+    ).add_line("    SetHandler http2-metrics"
+    ).add_line("</Location>"
+    ).add_vhost_test1().add_vhost_cgi().install()
+    assert TestEnv.apache_restart() == 0
+        
+def teardown_module(module):
+    print("teardown_module: %s" % module.__name__)
+    assert TestEnv.apache_stop() == 0
+
+class TestStore:
+
+    def setup_method(self, method):
+        print("setup_method: %s" % method.__name__)
+
+    def teardown_method(self, method):
+        print("teardown_method: %s" % method.__name__)
+
+    # a single stream may buffer beyond H2StreamMaxMemSize, the body
+    # arrives complete
+    def test_110_01(self):
+        url = TestEnv.mkurl("https", "test1", "/110-1m")
+        r = TestEnv.curl_get(url, 10)
+        assert 200 == r["response"]["status"]
+        with open(os.path.join(TestEnv.HTTPD_DOCS_DIR, "test1", "110-1m"), 'rb') as f:
+            assert f.read() == r["response"]["body"]
+
+    # more parallel streams than fit into the budget, all are served
+    @pytest.mark.skipif(not TestEnv.has_h2load(), reason="no h2load command available")
+    def test_110_02(self):
+        r = TestEnv.run( [ TestEnv.H2LOAD, "-n", "100", "-c", "2", "-m", "50",
+            "-H", ":authority: test1.%s:%s" % (TestEnv.HTTP_TLD, TestEnv.HTTPS_PORT),
+            "https://%s:%s/110-1m" % (TestEnv.HTTPD_ADDR, TestEnv.HTTPS_PORT)] )
+        assert 0 == r["rv"]
+        r = TestEnv.h2load_status(r)
+        assert 100 == r["h2load"]["requests"]["succeeded"]
+
+    # the buffered bytes and budget waits are in the metrics
+    def test_110_03(self):
+        url = TestEnv.mkurl("https", "test1", "/.well-known/h2/metrics")
+        r = TestEnv.curl_get(url, 5)
+        assert 200 == r["response"]["status"]
+        body = r["response"]["body"].decode()
+        assert re.search(r'^h2_beam_mem_bytes \d+$', body, re.M)
+        assert re.search(r'^h2_beam_budget_waits_total \d+$', body, re.M)
+
+    # sends of more than a beam holds complete without waiting for the
+    # beam timeout, in both directions
+    def test_110_04(self):
+        fpath = os.path.join(TestEnv.HTTPD_DOCS_DIR, "test1", "110-1m")
+        with open(fpath, 'rb') as f:
+            body = f.read()
+        start = time.time()
+        url = TestEnv.mkurl("https", "test1", "/110-1m")
+        r = TestEnv.curl_get(url, 10)
+        assert 200 == r["response"]["status"]
+        assert body == r["response"]["body"]
+        url = TestEnv.mkurl("https", "cgi", "/echo.py")
+        r = TestEnv.curl_get(url, 10, [ "--data-binary", "@%s" % fpath ])
+        assert 200 == r["response"]["status"]
+        assert body == r["response"]["body"]
+        assert time.time() - start < 5
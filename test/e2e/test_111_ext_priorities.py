@@ -0,0 +1,50 @@
+#
+# mod-h2 test suite
+# check requests with RFC 9218 priorities, H2ExtensiblePriorities on
+#
+
+import os
+import pytest
+
+from TestEnv import TestEnv
+from TestHttpdConf import HttpdConf
+
+def setup_module(module):
+    print("setup_module: %s" % module.__name__)
+    TestEnv.init()
+    HttpdConf(
+    ).add_line("H2ExtensiblePriorities on"
+    ).add_vhost_test1().install()
+    assert TestEnv.apache_restart() == 0
+        
+def teardown_module(module):
+    print("teardown_module: %s" % module.__name__)
+    assert TestEnv.apache_stop() == 0
+
+class TestStore:
+
+    def setup_method(self, method):
+        print("setup_method: %s" % method.__name__)
+
+    def teardown_method(self, method):
+        print("teardown_method: %s" % method.__name__)
+
+    # requests with and without a Priority header, valid or not
+    def test_111_01(self):
+        url = TestEnv.mkurl("https", "test1", "/index.html")
+        for prio in [ None, "u=0", "u=7, i", "i=?0;x=1, u=2", "u=9", "garbage" ]:
+            opts = [ "-H", "priority: %s" % prio ] if prio else None
+            r = TestEnv.curl_get(url, 5, opts)
+            assert 200 == r["response"]["status"]
+
+    # many streams of different urgency on one connection all complete
+    @pytest.mark.skipif(not TestEnv.has_h2load(), reason="no h2load command available")
+    def test_111_02(self):
+        for prio in [ "u=0", "u=5, i" ]:
+            r = TestEnv.run( [ TestEnv.H2LOAD, "-n", "200", "-c", "1", "-m", "50",
+                "-H", ":authority: test1.%s:%s" % (TestEnv.HTTP_TLD, TestEnv.HTTPS_PORT),
+                "-H", "priority: %s" % prio,
+                "https://%s:%s/index.html" % (TestEnv.HTTPD_ADDR, TestEnv.HTTPS_PORT)] )
+            assert 0 == r["rv"]
+            r = TestEnv.h2load_status(r)
+            assert 200 == r["h2load"]["requests"]["succeeded"]
@@ -0,0 +1,72 @@
+#
+# mod-h2 test suite
+# check TLS write sizes following the TCP state with H2TLSAdaptiveSize
+#
+
+import os
+import re
+import sys
+import time
+import pytest
+
+from datetime import datetime
+from TestEnv import TestEnv
+from TestHttpdConf import HttpdConf
+
+def setup_module(module):
+    print("setup_module: %s" % module.__name__)
+    TestEnv.init()
+    TestStore.LOG = os.path.join(TestEnv.WEBROOT, "logs", "adaptive_log")
+    if os.path.exists(TestStore.LOG):
+        os.remove(TestStore.LOG)
+    HttpdConf(
+    ).start_vhost( TestEnv.HTTPS_PORT, "adaptive", docRoot="htdocs/test1", withSSL=True
+    ).add_line("""    Protocols h2 http/1.1
+    H2TLSAdaptiveSize on
+    ErrorLog logs/adaptive_log
+    LogLevel http2:trace2
+    """).end_vhost(
+    ).install()
+    assert TestEnv.apache_restart() == 0
+
+def teardown_module(module):
+    print("teardown_module: %s" % module.__name__)
+    assert TestEnv.apache_stop() == 0
+
+class TestStore:
+
+    def setup_method(self, method):
+        print("setup_method: %s" % method.__name__)
+
+    def teardown_method(self, method):
+        print("teardown_method: %s" % method.__name__)
+
+    def size_changes(self):
+        changes = []
+        with open(self.LOG) as f:
+            for line in f.read().splitlines():
+                m = re.search(r'h2_conn_io\((\d+)\): write_size (\d+) -> (\d+)', line)
+                if m:
+                    changes.append((m.group(1), int(m.group(2)), int(m.group(3))))
+        return changes
+
+    # on a fresh connection, writes start small and grow with the
+    # congestion window. After idling longer than the retransmission
+    # timeout, they shrink again.
+    def test_113_01(self):
+        url = TestEnv.mkurl("https", "adaptive", "/002.jpg")
+        # two transfers on the same connection, a second apart
+        r = TestEnv.curl_get(url, 5, [ "--rate", "1/s", url ])
+        assert 200 == r["response"]["status"]
+        assert "previous" in r["response"]
+        assert 200 == r["response"]["previous"]["status"]
+        time.sleep(0.5)
+        changes = self.size_changes()
+        assert len(changes) > 0
+        conn = changes[0][0]
+        sizes = [ c[1:] for c in changes if c[0] == conn ]
+        assert sizes[0][0] == 1300
+        grown = [ i for i, s in enumerate(sizes) if s[1] > s[0] ]
+        assert grown
+        shrunk = [ i for i, s in enumerate(sizes) if i > grown[0] and s[1] == 1300 ]
+        assert shrunk
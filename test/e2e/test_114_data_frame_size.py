@@ -0,0 +1,108 @@
+#
+# mod-h2 test suite
+# check the size of DATA frames against the client's SETTINGS_MAX_FRAME_SIZE
+#
+
+import os
+import re
+import socket
+import struct
+import sys
+import time
+import pytest
+
+from datetime import datetime
+from TestEnv import TestEnv
+from TestHttpdConf import HttpdConf
+
+def setup_module(module):
+    print("setup_module: %s" % module.__name__)
+    TestEnv.init()
+    HttpdConf(
+    ).start_vhost( TestEnv.HTTP_PORT, "frames", docRoot="htdocs/test1", withSSL=False
+    ).add_line("""    Protocols h2c http/1.1
+    H2StreamMaxMemSize 65536
+    """).end_vhost(
+    ).install()
+    assert TestEnv.apache_restart() == 0
+
+def teardown_module(module):
+    print("teardown_module: %s" % module.__name__)
+    assert TestEnv.apache_stop() == 0
+
+class TestStore:
+
+    def setup_method(self, method):
+        print("setup_method: %s" % method.__name__)
+
+    def teardown_method(self, method):
+        print("teardown_method: %s" % method.__name__)
+
+    def frame(self, ftype, flags, sid, payload):
+        return struct.pack("!I", len(payload))[1:] + struct.pack("!BBI", ftype, flags, sid) + payload
+
+    def literal(self, name, value):
+        # literal header field without indexing, no huffman coding
+        return chr(0) + chr(len(name)) + name + chr(len(value)) + value
+
+    def recv_all(self, sock, n):
+        data = ""
+        while len(data) < n:
+            chunk = sock.recv(n - len(data))
+            if not chunk:
+                raise IOError("connection closed")
+            data += chunk
+        return data
+
+    # GET a resource with prior knowledge, announcing max_frame_size and
+    # the largest windows. Returns the lengths of all DATA frames received.
+    def data_frame_sizes(self, path, max_frame_size):
+        authority = "frames.%s:%s" % (TestEnv.HTTP_TLD, TestEnv.HTTP_PORT)
+        sock = socket.create_connection((TestEnv.HTTPD_ADDR, int(TestEnv.HTTP_PORT)), 5)
+        sizes = []
+        try:
+            sock.sendall("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n")
+            settings = struct.pack("!HI", 0x2, 0)
+            settings += struct.pack("!HI", 0x4, 0x7fffffff)
+            settings += struct.pack("!HI", 0x5, max_frame_size)
+            sock.sendall(self.frame(0x4, 0, 0, settings))
+            sock.sendall(self.frame(0x8, 0, 0, struct.pack("!I", 0x7fffffff - 65535)))
+            headers = (self.literal(":method", "GET") + self.literal(":scheme", "http")
+                       + self.literal(":path", path) + self.literal(":authority", authority))
+            sock.sendall(self.frame(0x1, 0x5, 1, headers))
+            while True:
+                hd = self.recv_all(sock, 9)
+                length = struct.unpack("!I", "\0" + hd[0:3])[0]
+                ftype, flags, sid = struct.unpack("!BBI", hd[3:9])
+                payload = self.recv_all(sock, length)
+                if ftype == 0x4 and not (flags & 0x1):
+                    sock.sendall(self.frame(0x4, 0x1, 0, ""))
+                elif ftype == 0x0 and sid == 1:
+                    sizes.append(length)
+                    if flags & 0x1:
+                        break
+                elif (ftype == 0x1 and sid == 1 and flags & 0x1) or ftype in [ 0x3, 0x7 ]:
+                    break
+        finally:
+            sock.close()
+        return sizes
+
+    # nghttp announces the default max frame size, frames stay below 16KB
+    def test_114_01(self):
+        url = TestEnv.mkurl("http", "frames", "/002.jpg")
+        r = TestEnv.nghttp().get(url)
+        assert 0 == r["rv"]
+        assert 200 == r["response"]["status"]
+        sizes = [ int(l) for l in re.findall(
+            r'recv DATA frame <length=(\d+), .*stream_id=', r["out"]["text"]) ]
+        assert sizes
+        assert max(sizes) <= 16384
+        assert 90364 == sum(sizes)
+
+    # a larger SETTINGS_MAX_FRAME_SIZE gives a stream alone on its
+    # connection larger frames, but no more than H2StreamMaxMemSize
+    def test_114_02(self):
+        sizes = self.data_frame_sizes("/002.jpg", 1024 * 1024)
+        assert 90364 == sum(sizes)
+        assert max(sizes) > 16384
+        assert max(sizes) <= 65536
@@ -0,0 +1,88 @@
+#
+# mod-h2 test suite
+# check merging of Vary headers, natively and with serialized headers
+#
+
+import copy
+import os
+import re
+import sys
+import time
+import pytest
+
+from datetime import datetime
+from TestEnv import TestEnv
+from TestHttpdConf import HttpdConf
+
+def setup_module(module):
+    print("setup_module: %s" % module.__name__)
+    TestEnv.init()
+    HttpdConf(
+    ).start_vhost( TestEnv.HTTPS_PORT, "test1", docRoot="htdocs/test1", withSSL=True
+    ).add_line("      Protocols h2 http/1.1"
+    ).add_line("      <Location /index.html>"
+    ).add_line("        Header add Vary Accept-Encoding"
+    ).add_line("      </Location>"
+    ).add_line("      <Location /002.jpg>"
+    ).add_line("        Header add Vary Accept-Encoding"
+    ).add_line("        Header add Vary \"User-Agent, accept-encoding\""
+    ).add_line("      </Location>"
+    ).end_vhost(
+    ).start_vhost( TestEnv.HTTPS_PORT, "test2", docRoot="htdocs/test1", withSSL=True
+    ).add_line("      Protocols h2 http/1.1"
+    ).add_line("      H2SerializeHeaders on"
+    ).add_line("      <Location /002.jpg>"
+    ).add_line("        Header add Vary Accept-Encoding"
+    ).add_line("        Header add Vary \"User-Agent, accept-encoding\""
+    ).add_line("      </Location>"
+    ).end_vhost(
+    ).install()
+    assert TestEnv.apache_restart() == 0
+
+def teardown_module(module):
+    print("teardown_module: %s" % module.__name__)
+    assert TestEnv.apache_stop() == 0
+
+class TestStore:
+
+    def setup_method(self, method):
+        print("setup_method: %s" % method.__name__)
+
+    def teardown_method(self, method):
+        print("teardown_method: %s" % method.__name__)
+
+    # a single Vary header passes unchanged
+    def test_203_01(self):
+        url = TestEnv.mkurl("https", "test1", "/index.html")
+        r = TestEnv.curl_get(url)
+        assert 200 == r["response"]["status"]
+        assert "Accept-Encoding" == r["response"]["header"]["vary"]
+
+    # several Vary headers are merged into one, without duplicates
+    def test_203_02(self):
+        url = TestEnv.mkurl("https", "test1", "/002.jpg")
+        r = TestEnv.curl_get(url)
+        assert 200 == r["response"]["status"]
+        assert "Accept-Encoding,User-Agent" == r["response"]["header"]["vary"]
+
+    # same with serialized HTTP/1.1 headers
+    def test_203_03(self):
+        url = TestEnv.mkurl("https", "test2", "/002.jpg")
+        r = TestEnv.curl_get(url)
+        assert 200 == r["response"]["status"]
+        assert "Accept-Encoding,User-Agent" == r["response"]["header"]["vary"]
+
+    # the merged header is the same on every response of a connection,
+    # natively and serialized
+    def test_203_10(self):
+        for host in [ "test1", "test2" ]:
+            url = TestEnv.mkurl("https", host, "/002.jpg")
+            r = TestEnv.curl_get(url, 5, [ url, url ])
+            resp = r["response"]
+            n = 0
+            while resp:
+                assert 200 == resp["status"]
+                assert "Accept-Encoding,User-Agent" == resp["header"]["vary"]
+                resp = resp.get("previous")
+                n += 1
+            assert 3 == n
@@ -162,6 +162,20 @@ class TestStore:
         promises = r["streams"][r["response"]["id"]]["promises"]
         assert 0 == len(promises)
 
+    # Same Link headers again on new connections, parsed from the link cache
+    def test_400_09(self):
+        for i in range(3):
+            url = TestEnv.mkurl("https", "push", "/006-push.html")
+            r = TestEnv.nghttp().get(url)
+            assert 200 == r["response"]["status"]
+            promises = r["streams"][r["response"]["id"]]["promises"]
+            assert 1 == len(promises)
+            assert '/006/006.css' == promises[0]["request"]["header"][":path"]
+            url = TestEnv.mkurl("https", "push", "/006-push8.html")
+            r = TestEnv.nghttp().get(url)
+            assert 200 == r["response"]["status"]
+            assert 0 == len(r["streams"][r["response"]["id"]]["promises"])
+
 
     #########################
     # H2PushResource configurations
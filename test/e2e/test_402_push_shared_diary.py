@@ -0,0 +1,118 @@
+#
+# mod-h2 test suite
+# check that pushes are remembered across connections by a shared diary
+#
+
+import json
+import os
+import re
+import sys
+import time
+import pytest
+
+from datetime import datetime
+from TestEnv import TestEnv
+from TestHttpdConf import HttpdConf
+
+def setup_module(module):
+    print("setup_module: %s" % module.__name__)
+    TestEnv.init()
+    HttpdConf(
+    ).add_line("H2PushDiaryCache shmcb:logs/h2_push_diary(65536)"
+    ).start_vhost( TestEnv.HTTPS_PORT, "push", docRoot="htdocs/test1", withSSL=True
+    ).add_line("""    Protocols h2 http/1.1
+    H2PushDiaryKey cookie h2id
+    RewriteEngine on
+    RewriteRule ^/006-push(.*)?\.html$ /006.html
+    <Location /006-push.html>
+        Header add Link "</006/006.css>;rel=preload"
+    </Location>
+    <Location /006-push2.html>
+        Header add Link "</006/006.css>;rel=preload"
+        Header add Link "</006/006.js>;rel=preload"
+    </Location>
+    <Location /006-push10.html>
+        Header add Link "</001.html>;rel=preload, </003.html>;rel=preload"
+        Header add Link "</004.html>;rel=preload, </006.html>;rel=preload"
+        Header add Link "</007.html>;rel=preload, </index.html>;rel=preload"
+        Header add Link "</002.jpg>;rel=preload, </006/006.css>;rel=preload"
+        Header add Link "</006/006.js>;rel=preload, </006/header.html>;rel=preload"
+    </Location>
+    <Location "/.well-known/h2/state">
+        SetHandler http2-status
+    </Location>
+    """).end_vhost(
+    ).start_vhost( TestEnv.HTTPS_PORT, "push-lru", docRoot="htdocs/test1", withSSL=True
+    ).add_line("""    Protocols h2 http/1.1
+    H2PushDiaryKey cookie h2id
+    H2PushDiarySize 4
+    RewriteEngine on
+    RewriteRule ^/006-lru(.*)?\.html$ /006.html
+    <Location /006-lru-a.html>
+        Header add Link "</001.html>;rel=preload, </003.html>;rel=preload"
+        Header add Link "</004.html>;rel=preload, </007.html>;rel=preload"
+    </Location>
+    <Location /006-lru-b.html>
+        Header add Link "</001.html>;rel=preload, </index.html>;rel=preload"
+    </Location>
+    <Location /006-lru-c.html>
+        Header add Link "</001.html>;rel=preload, </003.html>;rel=preload"
+    </Location>
+    """).end_vhost(
+    ).install()
+    assert TestEnv.apache_restart() == 0
+        
+def teardown_module(module):
+    print("teardown_module: %s" % module.__name__)
+    assert TestEnv.apache_stop() == 0
+
+# The push tests depend on "nghttp"
+@pytest.mark.skipif(not TestEnv.has_nghttp(), reason="no nghttp command available")
+class TestStore:
+
+    def setup_method(self, method):
+        print("setup_method: %s" % method.__name__)
+
+    def teardown_method(self, method):
+        print("teardown_method: %s" % method.__name__)
+
+    def get_promises(self, path, cookie=None, host="push"):
+        url = TestEnv.mkurl("https", host, path)
+        options = [ "-H", "cookie: a=b; h2id=%s" % cookie ] if cookie else None
+        r = TestEnv.nghttp().get(url, options=options)
+        assert 200 == r["response"]["status"]
+        return [ p["request"]["header"][":path"] 
+                 for p in r["streams"][r["response"]["id"]]["promises"] ]
+
+    # a new connection with the same cookie is not pushed css again
+    def test_402_01(self):
+        assert [ "/006/006.css" ] == self.get_promises("/006-push.html", "client-01")
+        assert [] == self.get_promises("/006-push.html", "client-01")
+        assert [ "/006/006.js" ] == self.get_promises("/006-push2.html", "client-01")
+
+    # other clients and clients without the cookie get their pushes
+    def test_402_02(self):
+        assert [ "/006/006.css" ] == self.get_promises("/006-push.html", "client-02")
+        assert [ "/006/006.css" ] == self.get_promises("/006-push.html", "client-03")
+        assert [ "/006/006.css" ] == self.get_promises("/006-push.html")
+        assert [ "/006/006.css" ] == self.get_promises("/006-push.html")
+
+    # the cache digest of a diary with more than a few entries
+    def test_402_03(self):
+        assert 10 == len(self.get_promises("/006-push10.html", "client-04"))
+        url = TestEnv.mkurl("https", "push", "/.well-known/h2/state")
+        r = TestEnv.nghttp().get(url, options=[ "-H", "cookie: h2id=client-04" ])
+        assert 200 == r["response"]["status"]
+        st = json.loads(r["response"]["body"])
+        digest = st["stats"]["push"]["cacheDigest"]
+        # an empty diary encodes as "AQg"
+        assert len(digest) > 3
+
+    # a full diary forgets the least recently used entry. Asking for a
+    # known resource again makes it the most recent.
+    def test_402_04(self):
+        assert [ "/001.html", "/003.html", "/004.html", "/007.html" ] \
+            == self.get_promises("/006-lru-a.html", "client-05", "push-lru")
+        # 001 is refreshed, index.html takes the place of 003
+        assert [ "/index.html" ] == self.get_promises("/006-lru-b.html", "client-05", "push-lru")
+        assert [ "/003.html" ] == self.get_promises("/006-lru-c.html", "client-05", "push-lru")
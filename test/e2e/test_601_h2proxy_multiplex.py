@@ -0,0 +1,87 @@
+#
+# mod-h2 test suite
+# check HTTP/2 proxied backend, with requests sharing backend sessions
+#
+
+import copy
+import os
+import re
+import sys
+import time
+import pytest
+
+from datetime import datetime
+from TestEnv import TestEnv
+from TestHttpdConf import HttpdConf
+
+def setup_module(module):
+    print("setup_module: %s" % module.__name__)
+    TestEnv.init()
+    TestEnv.setup_data_1k_1m()
+    TestStore.LOG = os.path.join(TestEnv.WEBROOT, "logs", "multiplex_log")
+    if os.path.exists(TestStore.LOG):
+        os.remove(TestStore.LOG)
+    HttpdConf(
+    ).add_line("SetEnv proxy-h2-multiplex 1"
+    ).add_line("ErrorLog logs/multiplex_log"
+    ).add_line("LogLevel proxy_http2:trace1"
+    ).add_vhost_cgi( h2proxy_self=True ).install()
+    assert TestEnv.apache_restart() == 0
+        
+def teardown_module(module):
+    print("teardown_module: %s" % module.__name__)
+    assert TestEnv.apache_stop() == 0
+
+class TestStore:
+
+    def setup_method(self, method):
+        print("setup_method: %s" % method.__name__)
+
+    def teardown_method(self, method):
+        print("teardown_method: %s" % method.__name__)
+
+    def test_601_01(self):
+        url = TestEnv.mkurl("https", "cgi", "/h2proxy/hello.py")
+        r = TestEnv.curl_get(url, 5)
+        assert 200 == r["response"]["status"]
+        assert "HTTP/2.0" == r["response"]["json"]["protocol"]
+        assert "on" == r["response"]["json"]["h2"]
+
+    def count_log(self, pattern):
+        with open(self.LOG) as f:
+            return len(re.findall(pattern, f.read()))
+
+    # many parallel requests, some of them will be sent on the backend
+    # session of another one
+    @pytest.mark.skipif(not TestEnv.has_h2load(), reason="no h2load command available")
+    def test_601_02(self):
+        handed = self.count_log(r'handing request to session of')
+        setups = self.count_log(r'setup session for')
+        r = TestEnv.run( [ TestEnv.H2LOAD, "-n", "200", "-c", "2", "-m", "20",
+            "-H", ":authority: cgi.%s:%s" % (TestEnv.HTTP_TLD, TestEnv.HTTPS_PORT),
+            "https://%s:%s/h2proxy/hello.py" % (TestEnv.HTTPD_ADDR, TestEnv.HTTPS_PORT)] )
+        assert 0 == r["rv"]
+        r = TestEnv.h2load_status(r)
+        assert 200 == r["h2load"]["requests"]["total"]
+        assert 200 == r["h2load"]["requests"]["succeeded"]
+        assert 200 == r["h2load"]["status"]["2xx"]
+        # requests joined running sessions, and there were fewer backend
+        # sessions than concurrent requests
+        time.sleep(0.5)
+        handed = self.count_log(r'handing request to session of') - handed
+        setups = self.count_log(r'setup session for') - setups
+        assert handed > 0
+        assert setups < 40
+
+    # a backend session taken from the pool after a second of idling
+    # checks liveness with a PING and measures its round trip
+    def test_601_03(self):
+        url = TestEnv.mkurl("https", "cgi", "/h2proxy/hello.py")
+        rtts = self.count_log(r'PING rtt \d+us, smoothed \d+us')
+        r = TestEnv.curl_get(url, 5)
+        assert 200 == r["response"]["status"]
+        time.sleep(1.5)
+        r = TestEnv.curl_get(url, 5)
+        assert 200 == r["response"]["status"]
+        time.sleep(0.5)
+        assert self.count_log(r'PING rtt \d+us, smoothed \d+us') > rtts
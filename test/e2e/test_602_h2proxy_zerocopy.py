@@ -0,0 +1,76 @@
+#
+# mod-h2 test suite
+# check HTTP/2 proxied h2c backend, with response DATA sliced from the read buffer
+#
+
+import copy
+import os
+import re
+import sys
+import time
+import pytest
+
+from datetime import datetime
+from TestEnv import TestEnv
+from TestHttpdConf import HttpdConf
+
+def setup_module(module):
+    print("setup_module: %s" % module.__name__)
+    TestEnv.init()
+    TestEnv.setup_data_1k_1m()
+    HttpdConf(
+    ).add_line("SetEnv proxy-h2-zerocopy 1"
+    ).start_vhost( TestEnv.HTTPS_PORT, "cgi", aliasList=[ "cgi-alias" ], docRoot="htdocs/cgi", withSSL=True
+    ).add_line("      Protocols h2 http/1.1"
+    ).add_line("      AddHandler cgi-script .py"
+    ).add_line("      ProxyPreserveHost on"
+    ).add_line("      ProxyPass \"/h2cproxy/\" \"h2c://127.0.0.1:%s/\"" % (TestEnv.HTTP_PORT)
+    ).end_vhost(
+    ).start_vhost( TestEnv.HTTP_PORT, "cgi", aliasList=[ "cgi-alias" ], docRoot="htdocs/cgi", withSSL=False
+    ).add_line("      Protocols h2c http/1.1"
+    ).add_line("      AddHandler cgi-script .py"
+    ).end_vhost(
+    ).install()
+    assert TestEnv.apache_restart() == 0
+        
+def teardown_module(module):
+    print("teardown_module: %s" % module.__name__)
+    assert TestEnv.apache_stop() == 0
+
+class TestStore:
+
+    def setup_method(self, method):
+        print("setup_method: %s" % method.__name__)
+
+    def teardown_method(self, method):
+        print("teardown_method: %s" % method.__name__)
+
+    # upload, then GET via the h2c proxy and compare to original content
+    def upload_and_verify(self, fname, options=None):
+        url = TestEnv.mkurl("https", "cgi", "/upload.py")
+        fpath = os.path.join(TestEnv.GEN_DIR, fname)
+        r = TestEnv.curl_upload(url, fpath)
+        assert r["rv"] == 0
+        assert r["response"]["status"] >= 200 and r["response"]["status"] < 300
+
+        url = TestEnv.mkurl("https", "cgi", "/h2cproxy/files/%s" % fname)
+        r2 = TestEnv.curl_get(url, 5, options)
+        assert r2["rv"] == 0
+        assert r2["response"]["status"] == 200 
+        with open(TestEnv.e2e_src( fpath ), mode='rb') as file:
+            src = file.read()
+        assert src == r2["response"]["body"]
+
+    def test_602_01(self):
+        url = TestEnv.mkurl("https", "cgi", "/h2cproxy/hello.py")
+        r = TestEnv.curl_get(url, 5)
+        assert 200 == r["response"]["status"]
+        assert "HTTP/2.0" == r["response"]["json"]["protocol"]
+
+    def test_602_02(self):
+        self.upload_and_verify( "data-100k", [ "--http2" ] )
+        self.upload_and_verify( "data-100k", [ "--http1.1" ] )
+
+    def test_602_03(self):
+        self.upload_and_verify( "data-1m", [ "--http2" ] )
+        self.upload_and_verify( "data-1m", [ "--http1.1" ] )
@@ -0,0 +1,67 @@
+#
+# mod-h2 test suite
+# check HTTP/2 proxied backend, with autotuned flow control windows
+#
+
+import copy
+import os
+import re
+import sys
+import time
+import pytest
+
+from datetime import datetime
+from TestEnv import TestEnv
+from TestHttpdConf import HttpdConf
+
+def setup_module(module):
+    print("setup_module: %s" % module.__name__)
+    TestEnv.init()
+    TestEnv.setup_data_1k_1m()
+    HttpdConf(
+    ).add_line("SetEnv proxy-h2-autotune 1"
+    ).add_line("H2StreamMaxMemSize 1048576"
+    ).add_vhost_cgi( h2proxy_self=True ).install()
+    assert TestEnv.apache_restart() == 0
+        
+def teardown_module(module):
+    print("teardown_module: %s" % module.__name__)
+    assert TestEnv.apache_stop() == 0
+
+class TestStore:
+
+    def setup_method(self, method):
+        print("setup_method: %s" % method.__name__)
+
+    def teardown_method(self, method):
+        print("teardown_method: %s" % method.__name__)
+
+    # upload, then GET via the h2 proxy and compare to original content
+    def upload_and_verify(self, fname, options=None):
+        url = TestEnv.mkurl("https", "cgi", "/upload.py")
+        fpath = os.path.join(TestEnv.GEN_DIR, fname)
+        r = TestEnv.curl_upload(url, fpath)
+        assert r["rv"] == 0
+        assert r["response"]["status"] >= 200 and r["response"]["status"] < 300
+
+        url = TestEnv.mkurl("https", "cgi", "/h2proxy/files/%s" % fname)
+        r2 = TestEnv.curl_get(url, 5, options)
+        assert r2["rv"] == 0
+        assert r2["response"]["status"] == 200 
+        with open(TestEnv.e2e_src( fpath ), mode='rb') as file:
+            src = file.read()
+        assert src == r2["response"]["body"]
+
+    def test_603_01(self):
+        url = TestEnv.mkurl("https", "cgi", "/h2proxy/hello.py")
+        r = TestEnv.curl_get(url, 5)
+        assert 200 == r["response"]["status"]
+        assert "HTTP/2.0" == r["response"]["json"]["protocol"]
+
+    def test_603_02(self):
+        self.upload_and_verify( "data-100k", [ "--http2" ] )
+        self.upload_and_verify( "data-100k", [ "--http1.1" ] )
+
+    def test_603_03(self):
+        self.upload_and_verify( "data-1m", [ "--http2" ] )
+        self.upload_and_verify( "data-1m", [ "--http1.1" ] )
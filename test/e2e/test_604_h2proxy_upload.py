@@ -0,0 +1,91 @@
+#
+# mod-h2 test suite
+# check request bodies streamed to a proxied h2c backend, without copies
+# and woken up by the arrival of the front's input
+#
+
+import copy
+import os
+import re
+import sys
+import time
+import pytest
+
+from datetime import datetime
+from TestEnv import TestEnv
+from TestHttpdConf import HttpdConf
+
+def setup_module(module):
+    print("setup_module: %s" % module.__name__)
+    TestEnv.init()
+    TestEnv.setup_data_1k_1m()
+    HttpdConf(
+    ).add_line("SetEnv proxy-h2-zerocopy 1"
+    ).start_vhost( TestEnv.HTTPS_PORT, "cgi", aliasList=[ "cgi-alias" ], docRoot="htdocs/cgi", withSSL=True
+    ).add_line("      Protocols h2 http/1.1"
+    ).add_line("      AddHandler cgi-script .py"
+    ).add_line("      ProxyPreserveHost on"
+    ).add_line("      ProxyPass \"/h2cproxy/\" \"h2c://127.0.0.1:%s/\"" % (TestEnv.HTTP_PORT)
+    ).add_line("      SSLProxyEngine on"
+    ).add_line("      SSLProxyCheckPeerName off"
+    ).add_line("      ProxyPass \"/h2proxy/\" \"h2://127.0.0.1:%s/\"" % (TestEnv.HTTPS_PORT)
+    ).end_vhost(
+    ).start_vhost( TestEnv.HTTP_PORT, "cgi", aliasList=[ "cgi-alias" ], docRoot="htdocs/cgi", withSSL=False
+    ).add_line("      Protocols h2c http/1.1"
+    ).add_line("      AddHandler cgi-script .py"
+    ).end_vhost(
+    ).install()
+    assert TestEnv.apache_restart() == 0
+        
+def teardown_module(module):
+    print("teardown_module: %s" % module.__name__)
+    assert TestEnv.apache_stop() == 0
+
+class TestStore:
+
+    def setup_method(self, method):
+        print("setup_method: %s" % method.__name__)
+
+    def teardown_method(self, method):
+        print("teardown_method: %s" % method.__name__)
+
+    # upload via the h2c proxy, then GET directly and compare to original
+    def upload_and_verify(self, fname, options=None, path="/h2cproxy/upload.py"):
+        url = TestEnv.mkurl("https", "cgi", path)
+        fpath = os.path.join(TestEnv.GEN_DIR, fname)
+        r = TestEnv.curl_upload(url, fpath, options=options)
+        assert r["rv"] == 0
+        assert r["response"]["status"] >= 200 and r["response"]["status"] < 300
+
+        url = TestEnv.mkurl("https", "cgi", "/files/%s" % fname)
+        r2 = TestEnv.curl_get(url, 5)
+        assert r2["rv"] == 0
+        assert r2["response"]["status"] == 200 
+        with open(TestEnv.e2e_src( fpath ), mode='rb') as file:
+            src = file.read()
+        assert src == r2["response"]["body"]
+
+    # HTTP/2 front, the proxy is woken by the arriving body
+    def test_604_01(self):
+        self.upload_and_verify( "data-1k", [ "--http2" ] )
+        self.upload_and_verify( "data-100k", [ "--http2" ] )
+        self.upload_and_verify( "data-1m", [ "--http2" ] )
+
+    # HTTP/1.1 front, the proxy polls for the body
+    def test_604_02(self):
+        self.upload_and_verify( "data-100k", [ "--http1.1" ] )
+        self.upload_and_verify( "data-1m", [ "--http1.1" ] )
+
+    # a body larger than the stream windows, delivered in many DATA frames
+    def test_604_03(self):
+        url = TestEnv.mkurl("https", "cgi", "/h2cproxy/upload.py")
+        fpath = os.path.join(TestEnv.GEN_DIR, "data-1m")
+        for i in range(3):
+            r = TestEnv.curl_upload(url, fpath, options=[ "--http2" ])
+            assert r["rv"] == 0
+            assert r["response"]["status"] >= 200 and r["response"]["status"] < 300
+
+    # over a TLS backend, request DATA is copied into the backend's memory
+    def test_604_04(self):
+        for fname in [ "data-1k", "data-100k", "data-1m" ]:
+            self.upload_and_verify( fname, [ "--http2" ], "/h2proxy/upload.py" )
@@ -0,0 +1,692 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Micro benchmarks for the data structures in h2_util, the push diary
+ * and the header character checks in h2_chars.
+ * This is a program of its own, link it against the same objects as the
+ * unit tests plus h2_push.c. Run without arguments for all benchmarks or
+ * give a name prefix to run only some, e.g. "bench_h2_util iq_".
+ *
+ * Each benchmark is run for 1, 10, 100 and 1000 elements (streams). The
+ * repetitions are scaled until one run takes BENCH_MIN_USEC, then
+ * BENCH_RUNS runs are measured and the fastest and the median time per
+ * operation reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <apr.h>
+#include <apr_atomic.h>
+#include <apr_buckets.h>
+#include <apr_general.h>
+#include <apr_strings.h>
+#include <apr_thread_proc.h>
+
+#include "h2.h"
+#include "h2_chars.h"
+#include "h2_util.h"
+#include "h2_push.h"
+
+#define BENCH_RUNS          5
+#define BENCH_MIN_USEC      (20 * 1000)
+#define BENCH_MAX_THREADS   8
+
+typedef struct bench_ctx {
+    apr_pool_t *pool;          /* destroyed after each run */
+    int n;                     /* number of elements to work with */
+    int *weights;              /* per stream id ordering, 1..n */
+    h2_ihash_t *ih;
+    void **items;
+    const char *data;
+    apr_size_t data_len;
+    h2_push_diary *diary;
+    apr_bucket_alloc_t *ba;
+    int flags;
+    int threads;
+} bench_ctx;
+
+/* Run the benchmark reps times, return the number of operations done */
+typedef apr_size_t bench_run_fn(bench_ctx *ctx, int reps);
+/* Prepare the context for n elements */
+typedef void bench_setup_fn(bench_ctx *ctx);
+
+typedef struct {
+    const char *name;
+    bench_setup_fn *setup;
+    bench_run_fn *run;
+    int flags;
+    int threads;
+} bench_def;
+
+static apr_uint32_t rnd_state = 2463534242u;
+
+static apr_uint32_t rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+static int cmp_weight(int i1, int i2, void *ctx)
+{
+    bench_ctx *bctx = ctx;
+    return bctx->weights[i1] - bctx->weights[i2];
+}
+
+typedef struct {
+    int id;
+} bench_item;
+
+/*******************************************************************************
+ * h2_iqueue
+ ******************************************************************************/
+
+static void setup_iq(bench_ctx *ctx)
+{
+    int i;
+    ctx->weights = apr_pcalloc(ctx->pool, (ctx->n + 1) * sizeof(int));
+    for (i = 1; i <= ctx->n; ++i) {
+        ctx->weights[i] = (int)(rnd() % ctx->n);
+    }
+}
+
+static apr_size_t run_iq_add(bench_ctx *ctx, int reps)
+{
+    int r, i;
+    for (r = 0; r < reps; ++r) {
+        h2_iqueue *q = h2_iq_create(ctx->pool, 16);
+        for (i = 1; i <= ctx->n; ++i) {
+            h2_iq_add(q, i, cmp_weight, ctx);
+        }
+    }
+    return (apr_size_t)reps * ctx->n;
+}
+
+static apr_size_t run_iq_sort(bench_ctx *ctx, int reps)
+{
+    h2_iqueue *q = h2_iq_create(ctx->pool, ctx->n);
+    int r, i;
+
+    for (i = 1; i <= ctx->n; ++i) {
+        h2_iq_append(q, i);
+    }
+    for (r = 0; r < reps; ++r) {
+        /* priorities change between sorts */
+        ctx->weights[1 + (r % ctx->n)] = (int)(rnd() % ctx->n);
+        h2_iq_sort(q, cmp_weight, ctx);
+    }
+    return (apr_size_t)reps;
+}
+
+static apr_size_t run_iq_shift(bench_ctx *ctx, int reps)
+{
+    h2_iqueue *q = h2_iq_create(ctx->pool, ctx->n);
+    int r, i;
+
+    for (r = 0; r < reps; ++r) {
+        for (i = 1; i <= ctx->n; ++i) {
+            h2_iq_append(q, i);
+        }
+        h2_iq_sort(q, cmp_weight, ctx);
+        while (h2_iq_shift(q) > 0);
+    }
+    return (apr_size_t)reps * ctx->n;
+}
+
+/*******************************************************************************
+ * h2_iheap
+ ******************************************************************************/
+
+static apr_uint64_t rank_weight(int id, void *ctx)
+{
+    bench_ctx *bctx = ctx;
+    return (apr_uint64_t)bctx->weights[id];
+}
+
+static apr_size_t run_iheap_add(bench_ctx *ctx, int reps)
+{
+    int r, i;
+    for (r = 0; r < reps; ++r) {
+        h2_iheap *h = h2_iheap_create(ctx->pool, 16);
+        for (i = 1; i <= ctx->n; ++i) {
+            h2_iheap_add(h, i, rank_weight(i, ctx));
+        }
+    }
+    return (apr_size_t)reps * ctx->n;
+}
+
+static apr_size_t run_iheap_rerank(bench_ctx *ctx, int reps)
+{
+    h2_iheap *h = h2_iheap_create(ctx->pool, ctx->n);
+    int r, i;
+
+    for (i = 1; i <= ctx->n; ++i) {
+        h2_iheap_add(h, i, rank_weight(i, ctx));
+    }
+    for (r = 0; r < reps; ++r) {
+        ctx->weights[1 + (r % ctx->n)] = (int)(rnd() % ctx->n);
+        h2_iheap_rerank(h, rank_weight, ctx);
+    }
+    return (apr_size_t)reps;
+}
+
+static apr_size_t run_iheap_shift(bench_ctx *ctx, int reps)
+{
+    h2_iheap *h = h2_iheap_create(ctx->pool, ctx->n);
+    int r, i;
+
+    for (r = 0; r < reps; ++r) {
+        for (i = 1; i <= ctx->n; ++i) {
+            h2_iheap_add(h, i, rank_weight(i, ctx));
+        }
+        while (h2_iheap_shift(h) > 0);
+    }
+    return (apr_size_t)reps * ctx->n;
+}
+
+/*******************************************************************************
+ * h2_ihash
+ ******************************************************************************/
+
+static void setup_ihash(bench_ctx *ctx)
+{
+    bench_item *items;
+    int i;
+
+    ctx->ih = h2_ihash_create(ctx->pool, offsetof(bench_item, id));
+    ctx->items = apr_pcalloc(ctx->pool, ctx->n * sizeof(void*));
+    items = apr_pcalloc(ctx->pool, ctx->n * sizeof(bench_item));
+    for (i = 0; i < ctx->n; ++i) {
+        /* client stream ids are odd */
+        items[i].id = 2*i + 1;
+        ctx->items[i] = &items[i];
+        h2_ihash_add(ctx->ih, &items[i]);
+    }
+}
+
+static apr_size_t run_ihash_get(bench_ctx *ctx, int reps)
+{
+    apr_size_t found = 0;
+    int r, i;
+
+    for (r = 0; r < reps; ++r) {
+        for (i = 0; i < ctx->n; ++i) {
+            found += (h2_ihash_get(ctx->ih, 2*i + 1) != NULL);
+        }
+    }
+    return found;
+}
+
+static apr_size_t run_ihash_add_remove(bench_ctx *ctx, int reps)
+{
+    int r, i;
+
+    for (r = 0; r < reps; ++r) {
+        for (i = 0; i < ctx->n; ++i) {
+            h2_ihash_remove(ctx->ih, 2*i + 1);
+        }
+        for (i = 0; i < ctx->n; ++i) {
+            h2_ihash_add(ctx->ih, ctx->items[i]);
+        }
+    }
+    return (apr_size_t)reps * ctx->n * 2;
+}
+
+/*******************************************************************************
+ * h2_fifo, n elements in flight between producer and consumer threads
+ ******************************************************************************/
+
+typedef struct {
+    h2_fifo *fifo;
+    int n;
+    volatile apr_uint32_t *producing;
+} fifo_worker;
+
+static void *APR_THREAD_FUNC fifo_produce(apr_thread_t *thread, void *data)
+{
+    fifo_worker *w = data;
+    int i;
+
+    for (i = 1; i <= w->n; ++i) {
+        if (h2_fifo_push(w->fifo, (void*)(apr_intptr_t)i) != APR_SUCCESS) {
+            break;
+        }
+    }
+    apr_atomic_dec32(w->producing);
+    return NULL;
+}
+
+static void *APR_THREAD_FUNC fifo_consume(apr_thread_t *thread, void *data)
+{
+    fifo_worker *w = data;
+    apr_status_t rv;
+    void *elem;
+
+    for (;;) {
+        rv = h2_fifo_try_pull(w->fifo, &elem);
+        if (rv == APR_SUCCESS) {
+            ++w->n;
+        }
+        else if (rv != APR_EAGAIN) {
+            break;
+        }
+        else if (!apr_atomic_read32(w->producing) && !h2_fifo_count(w->fifo)) {
+            break;
+        }
+        else {
+            apr_thread_yield();
+        }
+    }
+    return NULL;
+}
+
+static void setup_fifo(bench_ctx *ctx)
+{
+    (void)ctx;
+}
+
+static apr_size_t run_fifo(bench_ctx *ctx, int reps)
+{
+    fifo_worker w[2 * BENCH_MAX_THREADS];
+    apr_thread_t *threads[2 * BENCH_MAX_THREADS];
+    volatile apr_uint32_t producing;
+    apr_size_t pulled = 0;
+    apr_status_t rv;
+    h2_fifo *fifo;
+    int i, nthreads = 2 * ctx->threads;
+
+    if (h2_fifo_create_ex(&fifo, ctx->pool, ctx->n, ctx->flags) != APR_SUCCESS) {
+        return 0;
+    }
+    producing = ctx->threads;
+    for (i = 0; i < nthreads; ++i) {
+        w[i].fifo = fifo;
+        w[i].producing = &producing;
+        w[i].n = (i < ctx->threads)? reps : 0;
+        rv = apr_thread_create(&threads[i], NULL, (i < ctx->threads)?
+                               fifo_produce : fifo_consume, &w[i], ctx->pool);
+        if (rv != APR_SUCCESS) {
+            fprintf(stderr, "thread create failed\n");
+            exit(1);
+        }
+    }
+    for (i = 0; i < nthreads; ++i) {
+        apr_thread_join(&rv, threads[i]);
+        if (i >= ctx->threads) {
+            pulled += w[i].n;
+        }
+    }
+    h2_fifo_term(fifo);
+    return pulled;
+}
+
+/*******************************************************************************
+ * base64url, n * 16 bytes of data
+ ******************************************************************************/
+
+static void setup_base64(bench_ctx *ctx)
+{
+    char *data;
+    apr_size_t i;
+
+    ctx->data_len = ctx->n * 16;
+    data = apr_palloc(ctx->pool, ctx->data_len);
+    for (i = 0; i < ctx->data_len; ++i) {
+        data[i] = (char)rnd();
+    }
+    ctx->data = data;
+}
+
+static apr_size_t run_base64_encode(bench_ctx *ctx, int reps)
+{
+    int r;
+    for (r = 0; r < reps; ++r) {
+        h2_util_base64url_encode(ctx->data, ctx->data_len, ctx->pool);
+    }
+    return (apr_size_t)reps;
+}
+
+static apr_size_t run_base64_decode(bench_ctx *ctx, int reps)
+{
+    const char *enc, *dec;
+    int r;
+
+    enc = h2_util_base64url_encode(ctx->data, ctx->data_len, ctx->pool);
+    for (r = 0; r < reps; ++r) {
+        h2_util_base64url_decode(&dec, enc, ctx->pool);
+    }
+    return (apr_size_t)reps;
+}
+
+/*******************************************************************************
+ * push diary cache digests of n entries
+ ******************************************************************************/
+
+static int cmp_uint64(const void *p1, const void *p2)
+{
+    const apr_uint64_t *u1 = p1, *u2 = p2;
+    return (*u1 > *u2)? 1 : ((*u1 == *u2)? 0 : -1);
+}
+
+/* Golomb coded set of n random values as the client would send it */
+static void setup_diary(bench_ctx *ctx)
+{
+    unsigned char log2n = 0, log2p = 7, *data;
+    apr_uint64_t *vals, last = 0, delta, flex;
+    apr_size_t bit, max_bits;
+    int i, k;
+
+    while ((1 << log2n) < ctx->n) ++log2n;
+    vals = apr_palloc(ctx->pool, ctx->n * sizeof(apr_uint64_t));
+    for (i = 0; i < ctx->n; ++i) {
+        vals[i] = rnd() & ((((apr_uint64_t)1) << (log2n + log2p)) - 1);
+    }
+    qsort(vals, ctx->n, sizeof(apr_uint64_t), cmp_uint64);
+
+    max_bits = 16 + (apr_size_t)ctx->n * (log2p + 2) + (1 << (log2n + 1));
+    data = apr_pcalloc(ctx->pool, max_bits / 8 + 1);
+    data[0] = log2n;
+    data[1] = log2p;
+    bit = 16;
+    for (i = 0; i < ctx->n; ++i) {
+        if (i && vals[i] == vals[i-1]) {
+            continue;
+        }
+        delta = vals[i] - last;
+        last = vals[i];
+        for (flex = delta >> log2p; flex; --flex, ++bit) {
+            data[bit/8] |= (0x80u >> (bit % 8));
+        }
+        ++bit;
+        for (k = log2p - 1; k >= 0; --k, ++bit) {
+            if ((delta >> k) & 1) {
+                data[bit/8] |= (0x80u >> (bit % 8));
+            }
+        }
+    }
+    /* pad the last byte with 1 bits, an unterminated flex part */
+    for (; bit % 8; ++bit) {
+        data[bit/8] |= (0x80u >> (bit % 8));
+    }
+    ctx->data = (const char*)data;
+    ctx->data_len = bit / 8;
+    ctx->diary = h2_push_diary_create(ctx->pool, 1024);
+}
+
+static apr_size_t run_diary_set(bench_ctx *ctx, int reps)
+{
+    int r;
+    for (r = 0; r < reps; ++r) {
+        h2_push_diary_digest_set(ctx->diary, "*", ctx->data, ctx->data_len);
+    }
+    return (apr_size_t)reps;
+}
+
+static apr_size_t run_diary_get(bench_ctx *ctx, int reps)
+{
+    const char *data;
+    apr_size_t len;
+    int r;
+
+    h2_push_diary_digest_set(ctx->diary, "*", ctx->data, ctx->data_len);
+    for (r = 0; r < reps; ++r) {
+        h2_push_diary_digest_get(ctx->diary, ctx->pool, 128, "*", &data, &len);
+    }
+    return (apr_size_t)reps;
+}
+
+/*******************************************************************************
+ * h2_util_bb_readx on a brigade of n 1k buckets
+ ******************************************************************************/
+
+static apr_status_t count_cb(void *ctx, const char *data, apr_off_t len)
+{
+    *((apr_off_t*)ctx) += len;
+    return APR_SUCCESS;
+}
+
+static void setup_readx(bench_ctx *ctx)
+{
+    char *data = apr_pcalloc(ctx->pool, 1024);
+    ctx->ba = apr_bucket_alloc_create(ctx->pool);
+    ctx->data = data;
+    ctx->data_len = 1024;
+}
+
+static apr_bucket_brigade *readx_fill(bench_ctx *ctx, apr_bucket_brigade *bb)
+{
+    int i;
+    if (!bb) {
+        bb = apr_brigade_create(ctx->pool, ctx->ba);
+    }
+    for (i = 0; i < ctx->n; ++i) {
+        APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_immortal_create(
+                                ctx->data, ctx->data_len, ctx->ba));
+    }
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ctx->ba));
+    return bb;
+}
+
+static apr_size_t run_readx_avail(bench_ctx *ctx, int reps)
+{
+    apr_bucket_brigade *bb = readx_fill(ctx, NULL);
+    apr_off_t len;
+    int r, eos;
+
+    for (r = 0; r < reps; ++r) {
+        len = APR_INT32_MAX;
+        h2_util_bb_readx(bb, NULL, NULL, &len, &eos);
+    }
+    apr_brigade_destroy(bb);
+    return (apr_size_t)reps;
+}
+
+static apr_size_t run_readx_consume(bench_ctx *ctx, int reps)
+{
+    apr_bucket_brigade *bb = NULL;
+    apr_off_t len, total = 0;
+    int r, eos;
+
+    for (r = 0; r < reps; ++r) {
+        bb = readx_fill(ctx, bb);
+        len = APR_INT32_MAX;
+        h2_util_bb_readx(bb, count_cb, &total, &len, &eos);
+        apr_brigade_cleanup(bb);
+    }
+    apr_brigade_destroy(bb);
+    return (apr_size_t)reps;
+}
+
+/*******************************************************************************
+ * header characters, n header fields of 32 byte names and 64 byte values
+ ******************************************************************************/
+
+static void setup_chars(bench_ctx *ctx)
+{
+    static const char tchars[] = "abcdefghijklmnopqrstuvwxyz0123456789-";
+    char *data;
+    apr_size_t i;
+
+    ctx->data_len = ctx->n * 96;
+    data = apr_palloc(ctx->pool, ctx->data_len + 1);
+    for (i = 0; i < ctx->data_len; ++i) {
+        if ((i % 96) < 32) {
+            data[i] = tchars[rnd() % (sizeof(tchars) - 1)];
+        }
+        else {
+            data[i] = (char)(0x20 + (rnd() % 0x5f));
+        }
+    }
+    data[ctx->data_len] = '\0';
+    ctx->data = data;
+}
+
+static apr_size_t run_chars_token(bench_ctx *ctx, int reps)
+{
+    apr_size_t n = 0;
+    int r, i;
+
+    for (r = 0; r < reps; ++r) {
+        for (i = 0; i < ctx->n; ++i) {
+            n += h2_chars_span(ctx->data + i * 96, 32, H2_CHAR_TOKEN);
+        }
+    }
+    return n? (apr_size_t)reps : 0;
+}
+
+static apr_size_t run_chars_field(bench_ctx *ctx, int reps)
+{
+    apr_size_t n = 0;
+    int r;
+
+    for (r = 0; r < reps; ++r) {
+        n += h2_chars_span(ctx->data, ctx->data_len, H2_CHAR_FIELD);
+    }
+    return n? (apr_size_t)reps : 0;
+}
+
+static apr_size_t run_chars_lower(bench_ctx *ctx, int reps)
+{
+    char *buf = apr_palloc(ctx->pool, ctx->data_len);
+    int r;
+
+    for (r = 0; r < reps; ++r) {
+        h2_chars_lower(buf, ctx->data, ctx->data_len);
+    }
+    return (apr_size_t)reps;
+}
+
+static apr_size_t run_chars_camel(bench_ctx *ctx, int reps)
+{
+    char *buf = apr_pmemdup(ctx->pool, ctx->data, ctx->data_len);
+    int r;
+
+    for (r = 0; r < reps; ++r) {
+        h2_chars_camel_case(buf, ctx->data_len);
+    }
+    return (apr_size_t)reps;
+}
+
+/*******************************************************************************
+ * runner
+ ******************************************************************************/
+
+static const bench_def BENCHES[] = {
+    { "iq_add",             setup_iq,       run_iq_add },
+    { "iq_sort",            setup_iq,       run_iq_sort },
+    { "iq_shift",           setup_iq,       run_iq_shift },
+    { "iheap_add",          setup_iq,       run_iheap_add },
+    { "iheap_rerank",       setup_iq,       run_iheap_rerank },
+    { "iheap_shift",        setup_iq,       run_iheap_shift },
+    { "ihash_get",          setup_ihash,    run_ihash_get },
+    { "ihash_add_remove",   setup_ihash,    run_ihash_add_remove },
+    { "fifo_1x1",           setup_fifo,     run_fifo, 0, 1 },
+    { "fifo_4x4",           setup_fifo,     run_fifo, 0, 4 },
+    { "fifo_lockfree_1x1",  setup_fifo,     run_fifo, H2_FIFO_LOCKFREE, 1 },
+    { "fifo_lockfree_4x4",  setup_fifo,     run_fifo, H2_FIFO_LOCKFREE, 4 },
+    { "base64url_encode",   setup_base64,   run_base64_encode },
+    { "base64url_decode",   setup_base64,   run_base64_decode },
+    { "diary_digest_set",   setup_diary,    run_diary_set },
+    { "diary_digest_get",   setup_diary,    run_diary_get },
+    { "bb_readx_avail",     setup_readx,    run_readx_avail },
+    { "bb_readx_consume",   setup_readx,    run_readx_consume },
+    { "chars_token_span",   setup_chars,    run_chars_token },
+    { "chars_field_span",   setup_chars,    run_chars_field },
+    { "chars_lower",        setup_chars,    run_chars_lower },
+    { "chars_camel_case",   setup_chars,    run_chars_camel },
+};
+
+static const int SIZES[] = { 1, 10, 100, 1000 };
+
+static int cmp_double(const void *p1, const void *p2)
+{
+    const double *d1 = p1, *d2 = p2;
+    return (*d1 > *d2)? 1 : ((*d1 == *d2)? 0 : -1);
+}
+
+static double time_run(const bench_def *def, apr_pool_t *parent, int n,
+                       int reps, apr_interval_time_t *pusec)
+{
+    bench_ctx ctx;
+    apr_time_t start;
+    apr_size_t ops;
+
+    memset(&ctx, 0, sizeof(ctx));
+    apr_pool_create(&ctx.pool, parent);
+    ctx.n = n;
+    ctx.flags = def->flags;
+    ctx.threads = def->threads;
+    def->setup(&ctx);
+
+    start = h2_util_mono_now();
+    ops = def->run(&ctx, reps);
+    *pusec = h2_util_mono_now() - start;
+
+    apr_pool_destroy(ctx.pool);
+    return ops? ((double)*pusec * 1000.0 / (double)ops) : 0.0;
+}
+
+static void bench(const bench_def *def, apr_pool_t *pool, int n)
+{
+    double nsop[BENCH_RUNS];
+    apr_interval_time_t usec;
+    int reps = 1, i;
+
+    /* scale until a run is long enough for the clock resolution */
+    for (;;) {
+        time_run(def, pool, n, reps, &usec);
+        if (usec >= BENCH_MIN_USEC || reps >= (1 << 24)) {
+            break;
+        }
+        reps = (usec > 0 && usec < BENCH_MIN_USEC/2)?
+               (int)(reps * (BENCH_MIN_USEC / usec)) : reps * 2;
+    }
+    for (i = 0; i < BENCH_RUNS; ++i) {
+        nsop[i] = time_run(def, pool, n, reps, &usec);
+    }
+    qsort(nsop, BENCH_RUNS, sizeof(double), cmp_double);
+    printf("%-20s %6d %10d %12.1f %12.1f\n", def->name, n, reps,
+           nsop[0], nsop[BENCH_RUNS/2]);
+    fflush(stdout);
+}
+
+int main(int argc, const char * const argv[])
+{
+    apr_pool_t *pool;
+    const char *prefix = (argc > 1)? argv[1] : NULL;
+    int i, k;
+
+    apr_app_initialize(&argc, &argv, NULL);
+    if (apr_pool_create(&pool, NULL) != APR_SUCCESS) {
+        return 1;
+    }
+
+    printf("%-20s %6s %10s %12s %12s\n", "# benchmark", "n", "reps",
+           "min ns/op", "median ns/op");
+    for (i = 0; i < H2_ALEN(BENCHES); ++i) {
+        if (prefix && strncmp(prefix, BENCHES[i].name, strlen(prefix))) {
+            continue;
+        }
+        for (k = 0; k < H2_ALEN(SIZES); ++k) {
+            bench(&BENCHES[i], pool, SIZES[k]);
+        }
+    }
+
+    apr_pool_destroy(pool);
+    apr_terminate();
+    return 0;
+}
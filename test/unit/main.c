@@ -21,6 +21,8 @@ static Suite *main_test_suite(void)
     Suite *suite = suite_create("main");
 
     suite_add_tcase(suite, h2_util_test_case());
+    suite_add_tcase(suite, h2_fifo_test_case());
+    suite_add_tcase(suite, h2_chars_test_case());
 
     return suite;
 }
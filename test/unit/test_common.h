@@ -41,3 +41,5 @@
  */
 
 TCase *h2_util_test_case(void);
+TCase *h2_fifo_test_case(void);
+TCase *h2_chars_test_case(void);
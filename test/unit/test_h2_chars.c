@@ -0,0 +1,139 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <apr.h>
+
+#include "test_common.h"
+#include "h2_chars.h"
+
+/*
+ * Helpers
+ */
+
+static unsigned int rnd_state = 2463534242u;
+
+static unsigned int rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+/* header like bytes with the odd control and non-ascii char */
+static void fill(unsigned char *buf, apr_size_t len)
+{
+    static const char common[] = "aZq-09;= \"/";
+    apr_size_t i;
+    
+    for (i = 0; i < len; ++i) {
+        buf[i] = (rnd() % 8)? common[rnd() % (sizeof(common) - 1)] : (rnd() & 0xff);
+    }
+}
+
+static int field_char(unsigned char c)
+{
+    return c == '\t' || (c >= 0x20 && c != 0x7f);
+}
+
+/*
+ * Tests
+ */
+START_TEST(chars_classes)
+{
+    ck_assert(H2_CHAR_IS('a', H2_CHAR_TOKEN));
+    ck_assert(H2_CHAR_IS('~', H2_CHAR_TOKEN));
+    ck_assert(!H2_CHAR_IS(':', H2_CHAR_TOKEN));
+    ck_assert(!H2_CHAR_IS(' ', H2_CHAR_TOKEN));
+    ck_assert(H2_CHAR_IS(' ', H2_CHAR_FIELD));
+    ck_assert(H2_CHAR_IS('\t', H2_CHAR_FIELD));
+    ck_assert(H2_CHAR_IS(0xe4, H2_CHAR_FIELD));
+    ck_assert(!H2_CHAR_IS('\r', H2_CHAR_FIELD));
+    ck_assert(!H2_CHAR_IS(0x7f, H2_CHAR_FIELD));
+    ck_assert(!H2_CHAR_IS('\'', H2_CHAR_ATTR));
+    ck_assert(H2_CHAR_IS('\'', H2_CHAR_PTOKEN));
+    ck_assert(H2_CHAR_IS('/', H2_CHAR_PTOKEN));
+    ck_assert(!H2_CHAR_IS(';', H2_CHAR_PTOKEN));
+    ck_assert(!H2_CHAR_IS(0, H2_CHAR_TOKEN|H2_CHAR_FIELD|H2_CHAR_ATTR|H2_CHAR_PTOKEN));
+}
+END_TEST
+
+/* the vector paths must agree with the bytewise definition at all 
+ * lengths and positions of the first bad char */
+START_TEST(chars_span)
+{
+    unsigned char buf[100];
+    apr_size_t len, i, expect;
+    int r;
+    
+    for (r = 0; r < 20000; ++r) {
+        len = rnd() % sizeof(buf);
+        fill(buf, len);
+        for (expect = 0; expect < len && field_char(buf[expect]); ++expect);
+        ck_assert_int_eq(expect, h2_chars_span((char*)buf, len, H2_CHAR_FIELD));
+        for (expect = 0; expect < len 
+             && H2_CHAR_IS(buf[expect], H2_CHAR_TOKEN); ++expect);
+        ck_assert_int_eq(expect, h2_chars_span((char*)buf, len, H2_CHAR_TOKEN));
+    }
+    /* long clean values with one control char at every position */
+    for (i = 0; i < sizeof(buf); ++i) {
+        memset(buf, 'x', sizeof(buf));
+        buf[i] = '\n';
+        ck_assert_int_eq(i, h2_chars_span((char*)buf, sizeof(buf), H2_CHAR_FIELD));
+    }
+}
+END_TEST
+
+START_TEST(chars_case)
+{
+    unsigned char buf[100], lc[100], cc[100];
+    apr_size_t len, i;
+    int r;
+    
+    for (r = 0; r < 20000; ++r) {
+        len = rnd() % sizeof(buf);
+        fill(buf, len);
+        h2_chars_lower((char*)lc, (char*)buf, len);
+        memcpy(cc, buf, len);
+        h2_chars_camel_case((char*)cc, len);
+        for (i = 0; i < len; ++i) {
+            unsigned char c = buf[i];
+            ck_assert_int_eq((c >= 'A' && c <= 'Z')? (c | 0x20) : c, lc[i]);
+            if ((i == 0 || buf[i-1] == '-') && c >= 'a' && c <= 'z') {
+                c -= 'a' - 'A';
+            }
+            ck_assert_int_eq(c, cc[i]);
+        }
+    }
+    memcpy(cc, "content-type", 13);
+    h2_chars_camel_case((char*)cc, 12);
+    ck_assert_str_eq("Content-Type", (char*)cc);
+    memcpy(cc, "X-FORWARDED-FOR", 16);
+    h2_chars_lower((char*)cc, (char*)cc, 15);
+    ck_assert_str_eq("x-forwarded-for", (char*)cc);
+}
+END_TEST
+
+TCase *h2_chars_test_case(void)
+{
+    TCase *testcase = tcase_create("h2_chars");
+
+    tcase_add_test(testcase, chars_classes);
+    tcase_add_test(testcase, chars_span);
+    tcase_add_test(testcase, chars_case);
+
+    return testcase;
+}
@@ -0,0 +1,382 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <apr.h>
+#include <apr_atomic.h>
+#include <apr_strings.h>
+#include <apr_thread_proc.h>
+#include <apr_time.h>
+
+#include "test_common.h"
+#include "h2_util.h"
+
+/*
+ * Helpers
+ */
+
+#define FIFO_ITEMS      (64 * 1024)
+#define FIFO_MAX_THREADS 8
+
+/* flag combinations the loop tests run with, by _i */
+static const int fifo_flags[] = {
+    0, H2_FIFO_SET, H2_FIFO_LOCKFREE, H2_FIFO_SET|H2_FIFO_LOCKFREE,
+};
+
+#define ELEM(i)     ((void*)(apr_intptr_t)(i))
+
+typedef struct {
+    h2_fifo *fifo;
+    int id;
+    int n;
+    apr_uint64_t sum;
+    volatile apr_uint32_t *producing;
+} fifo_worker;
+
+static void *APR_THREAD_FUNC produce(apr_thread_t *thread, void *data)
+{
+    fifo_worker *w = data;
+    int i;
+
+    for (i = 1; i <= w->n; ++i) {
+        if (h2_fifo_push(w->fifo, ELEM(w->id * FIFO_ITEMS + i)) != APR_SUCCESS) {
+            break;
+        }
+    }
+    apr_atomic_dec32(w->producing);
+    return NULL;
+}
+
+static void *APR_THREAD_FUNC consume(apr_thread_t *thread, void *data)
+{
+    fifo_worker *w = data;
+    apr_status_t rv;
+    void *elem;
+
+    for (;;) {
+        rv = h2_fifo_try_pull(w->fifo, &elem);
+        if (rv == APR_SUCCESS) {
+            w->sum += (apr_intptr_t)elem;
+            ++w->n;
+        }
+        else if (rv != APR_EAGAIN) {
+            break;
+        }
+        else if (!apr_atomic_read32(w->producing)
+                 && !h2_fifo_count(w->fifo)) {
+            break;
+        }
+        else {
+            apr_thread_yield();
+        }
+    }
+    return NULL;
+}
+
+/* Run nprod producers against ncons consumers, return the duration. Every
+ * element pushed must be pulled exactly once. */
+static apr_interval_time_t run_mpmc(apr_pool_t *pool, int flags,
+                                    int nprod, int ncons)
+{
+    fifo_worker w[2 * FIFO_MAX_THREADS];
+    apr_thread_t *threads[2 * FIFO_MAX_THREADS];
+    volatile apr_uint32_t producing = nprod;
+    apr_uint64_t expected = 0, sum = 0;
+    apr_time_t start;
+    h2_fifo *fifo;
+    apr_status_t rv;
+    int i, k, n = 0;
+
+    ck_assert_int_eq(h2_fifo_create_ex(&fifo, pool, 256, flags), APR_SUCCESS);
+
+    start = apr_time_now();
+    for (i = 0; i < nprod + ncons; ++i) {
+        memset(&w[i], 0, sizeof(w[i]));
+        w[i].fifo = fifo;
+        w[i].id = i;
+        w[i].producing = &producing;
+        if (i < nprod) {
+            w[i].n = FIFO_ITEMS / nprod;
+        }
+        rv = apr_thread_create(&threads[i], NULL,
+                               (i < nprod)? produce : consume, &w[i], pool);
+        ck_assert_int_eq(rv, APR_SUCCESS);
+    }
+    for (i = 0; i < nprod + ncons; ++i) {
+        apr_thread_join(&rv, threads[i]);
+    }
+
+    for (i = 0; i < nprod; ++i) {
+        for (k = 1; k <= w[i].n; ++k) {
+            expected += (apr_uint64_t)(i * FIFO_ITEMS + k);
+        }
+    }
+    for (i = nprod; i < nprod + ncons; ++i) {
+        sum += w[i].sum;
+        n += w[i].n;
+    }
+    ck_assert_int_eq(n, (FIFO_ITEMS / nprod) * nprod);
+    ck_assert(sum == expected);
+    ck_assert_int_eq(h2_fifo_count(fifo), 0);
+
+    return apr_time_now() - start;
+}
+
+typedef struct {
+    h2_fifo *fifo;
+    volatile apr_uint32_t stop;
+    volatile void *gone;        /* the last element removed */
+    volatile apr_uint32_t seen_gone;
+} peek_worker;
+
+static h2_fifo_op_t peek_repush(void *head, void *ctx)
+{
+    peek_worker *w = ctx;
+
+    if (head == apr_atomic_casptr(&w->gone, NULL, NULL)) {
+        apr_atomic_inc32(&w->seen_gone);
+    }
+    return H2_FIFO_OP_REPUSH;
+}
+
+static h2_fifo_op_t peek_pull(void *head, void *ctx)
+{
+    *((void**)ctx) = head;
+    return H2_FIFO_OP_PULL;
+}
+
+static h2_fifo_op_t ipeek_pull(int head, void *ctx)
+{
+    *((int*)ctx) = head;
+    return H2_FIFO_OP_PULL;
+}
+
+static void *APR_THREAD_FUNC repeek(apr_thread_t *thread, void *data)
+{
+    peek_worker *w = data;
+
+    while (!apr_atomic_read32(&w->stop)) {
+        h2_fifo_try_peek(w->fifo, peek_repush, w);
+    }
+    return NULL;
+}
+
+/*
+ * Test Fixture -- runs once per test
+ */
+
+static apr_pool_t *g_pool;
+
+static void h2_fifo_setup(void)
+{
+    if (apr_pool_create(&g_pool, NULL) != APR_SUCCESS) {
+        exit(1);
+    }
+}
+
+static void h2_fifo_teardown(void)
+{
+    apr_pool_destroy(g_pool);
+}
+
+/*
+ * Tests
+ */
+START_TEST(fifo_ops)
+{
+    int flags = fifo_flags[_i];
+    h2_fifo *fifo;
+    void *elem;
+    int i;
+
+    ck_assert_int_eq(h2_fifo_create_ex(&fifo, g_pool, 4, flags), APR_SUCCESS);
+    ck_assert_int_eq(h2_fifo_try_pull(fifo, &elem), APR_EAGAIN);
+
+    for (i = 1; i <= 4; ++i) {
+        ck_assert_int_eq(h2_fifo_push(fifo, ELEM(i)), APR_SUCCESS);
+    }
+    ck_assert_int_eq(h2_fifo_count(fifo), 4);
+    ck_assert_int_eq(h2_fifo_try_push(fifo, ELEM(5)), APR_EAGAIN);
+    if (flags & H2_FIFO_SET) {
+        ck_assert_int_eq(h2_fifo_try_push(fifo, ELEM(2)), APR_EEXIST);
+    }
+
+    /* removing frees room in the middle */
+    ck_assert_int_eq(h2_fifo_remove(fifo, ELEM(1)), APR_SUCCESS);
+    ck_assert_int_eq(h2_fifo_remove(fifo, ELEM(3)), APR_SUCCESS);
+    ck_assert_int_eq(h2_fifo_remove(fifo, ELEM(3)), APR_EAGAIN);
+    ck_assert_int_eq(h2_fifo_count(fifo), 2);
+    ck_assert_int_eq(h2_fifo_try_push(fifo, ELEM(1)), APR_SUCCESS);
+
+    ck_assert_int_eq(h2_fifo_pull(fifo, &elem), APR_SUCCESS);
+    ck_assert_ptr_eq(elem, ELEM(2));
+    ck_assert_int_eq(h2_fifo_try_peek(fifo, peek_pull, &elem), APR_SUCCESS);
+    ck_assert_ptr_eq(elem, ELEM(4));
+    ck_assert_int_eq(h2_fifo_pull(fifo, &elem), APR_SUCCESS);
+    ck_assert_ptr_eq(elem, ELEM(1));
+    ck_assert_int_eq(h2_fifo_try_pull(fifo, &elem), APR_EAGAIN);
+
+    /* wrap around the ring, many times */
+    for (i = 0; i < 1000; ++i) {
+        ck_assert_int_eq(h2_fifo_push(fifo, ELEM(10 + i)), APR_SUCCESS);
+        ck_assert_int_eq(h2_fifo_push(fifo, ELEM(5000 + i)), APR_SUCCESS);
+        ck_assert_int_eq(h2_fifo_remove(fifo, ELEM(10 + i)), APR_SUCCESS);
+        ck_assert_int_eq(h2_fifo_pull(fifo, &elem), APR_SUCCESS);
+        ck_assert_ptr_eq(elem, ELEM(5000 + i));
+    }
+    ck_assert_int_eq(h2_fifo_count(fifo), 0);
+
+    h2_fifo_term(fifo);
+    ck_assert_int_eq(h2_fifo_pull(fifo, &elem), APR_EOF);
+}
+END_TEST
+
+START_TEST(ififo_ops)
+{
+    int flags = fifo_flags[_i];
+    h2_ififo *fifo;
+    int i, id;
+
+    ck_assert_int_eq(h2_ififo_create_ex(&fifo, g_pool, 8, flags), APR_SUCCESS);
+    for (i = 1; i <= 5; ++i) {
+        ck_assert_int_eq(h2_ififo_push(fifo, i), APR_SUCCESS);
+    }
+    ck_assert_int_eq(h2_ififo_remove(fifo, 2), APR_SUCCESS);
+    ck_assert_int_eq(h2_ififo_pull(fifo, &id), APR_SUCCESS);
+    ck_assert_int_eq(id, 1);
+    ck_assert_int_eq(h2_ififo_try_peek(fifo, ipeek_pull, &id), APR_SUCCESS);
+    ck_assert_int_eq(id, 3);
+    ck_assert_int_eq(h2_ififo_count(fifo), 2);
+}
+END_TEST
+
+START_TEST(fifo_remove_while_peeking)
+{
+    /* peeks re-pushing their heads must not bring back removed elements */
+    int flags = fifo_flags[_i];
+    peek_worker w;
+    apr_thread_t *threads[4];
+    apr_status_t rv;
+    h2_fifo *fifo;
+    void *elem;
+    int i;
+
+    ck_assert_int_eq(h2_fifo_create_ex(&fifo, g_pool, 64, flags), APR_SUCCESS);
+    w.fifo = fifo;
+    w.stop = 0;
+    w.gone = NULL;
+    w.seen_gone = 0;
+    for (i = 0; i < 4; ++i) {
+        rv = apr_thread_create(&threads[i], NULL, repeek, &w, g_pool);
+        ck_assert_int_eq(rv, APR_SUCCESS);
+    }
+    for (i = 0; i < 20000; ++i) {
+        h2_fifo_try_push(fifo, ELEM(1000 + (i % 50)));
+        h2_fifo_try_push(fifo, ELEM(5000 + (i % 7)));
+        h2_fifo_remove(fifo, ELEM(1000 + (i % 50)));
+    }
+    apr_atomic_set32(&w.stop, 1);
+    for (i = 0; i < 4; ++i) {
+        apr_thread_join(&rv, threads[i]);
+    }
+    while (h2_fifo_try_pull(fifo, &elem) == APR_SUCCESS) {
+        ck_assert_int_ge((int)(apr_intptr_t)elem, 5000);
+    }
+}
+END_TEST
+
+START_TEST(fifo_peek_sees_no_removed)
+{
+    /* once a remove returned, no peek may hand the element to its callback */
+    int flags = fifo_flags[_i];
+    peek_worker w;
+    apr_thread_t *threads[4];
+    apr_status_t rv;
+    h2_fifo *fifo;
+    int i;
+
+    ck_assert_int_eq(h2_fifo_create_ex(&fifo, g_pool, 64, flags), APR_SUCCESS);
+    w.fifo = fifo;
+    w.stop = 0;
+    w.gone = NULL;
+    w.seen_gone = 0;
+    for (i = 0; i < 4; ++i) {
+        rv = apr_thread_create(&threads[i], NULL, repeek, &w, g_pool);
+        ck_assert_int_eq(rv, APR_SUCCESS);
+    }
+    for (i = 0; i < 20000; ++i) {
+        void *elem = ELEM(1000 + i);
+        h2_fifo_try_push(fifo, ELEM(5000 + (i % 7)));
+        if (h2_fifo_try_push(fifo, elem) == APR_SUCCESS) {
+            h2_fifo_remove(fifo, elem);
+            apr_atomic_xchgptr(&w.gone, elem);
+        }
+    }
+    apr_atomic_set32(&w.stop, 1);
+    for (i = 0; i < 4; ++i) {
+        apr_thread_join(&rv, threads[i]);
+    }
+    ck_assert_int_eq(w.seen_gone, 0);
+}
+END_TEST
+
+START_TEST(fifo_mpmc)
+{
+    int np, nc;
+
+    for (np = 1; np <= FIFO_MAX_THREADS; np *= 2) {
+        for (nc = 1; nc <= FIFO_MAX_THREADS; nc *= 2) {
+            run_mpmc(g_pool, fifo_flags[_i], np, nc);
+        }
+    }
+}
+END_TEST
+
+START_TEST(fifo_mpmc_bench)
+{
+    apr_interval_time_t t_locked, t_lockfree;
+    int np, nc;
+
+    /* timings go to stderr, stdout carries the TAP */
+    for (np = 1; np <= FIFO_MAX_THREADS; np *= 2) {
+        for (nc = 1; nc <= FIFO_MAX_THREADS; nc *= 2) {
+            t_locked = run_mpmc(g_pool, 0, np, nc);
+            t_lockfree = run_mpmc(g_pool, H2_FIFO_LOCKFREE, np, nc);
+            fprintf(stderr, "# h2_fifo %d producers, %d consumers: "
+                    "locked %" APR_TIME_T_FMT "us, lock-free %"
+                    APR_TIME_T_FMT "us\n", np, nc, t_locked, t_lockfree);
+        }
+    }
+}
+END_TEST
+
+TCase *h2_fifo_test_case(void)
+{
+    TCase *testcase = tcase_create("h2_fifo");
+    int nflags = sizeof(fifo_flags)/sizeof(fifo_flags[0]);
+
+    tcase_add_checked_fixture(testcase, h2_fifo_setup, h2_fifo_teardown);
+    tcase_set_timeout(testcase, 60);
+
+    tcase_add_loop_test(testcase, fifo_ops, 0, nflags);
+    tcase_add_loop_test(testcase, ififo_ops, 0, nflags);
+    tcase_add_loop_test(testcase, fifo_remove_while_peeking, 0, nflags);
+    tcase_add_loop_test(testcase, fifo_peek_sees_no_removed, 0, nflags);
+    tcase_add_loop_test(testcase, fifo_mpmc, 0, nflags);
+    tcase_add_test(testcase, fifo_mpmc_bench);
+
+    return testcase;
+}
@@ -12,6 +12,7 @@
  * limitations under the License.
  */
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <apr.h>
 #include <apr_strings.h>
@@ -101,6 +102,250 @@ START_TEST(base64_h2_util_largetrip)
 }
 END_TEST
 
+typedef struct {
+    int id;
+    int seen;
+} ih_item;
+
+static int ih_count_iter(void *ctx, void *val)
+{
+    ++((ih_item*)val)->seen;
+    ++*((int*)ctx);
+    return 1;
+}
+
+static int ih_remove_iter(void *ctx, void *val)
+{
+    ih_item *item = val;
+    ++item->seen;
+    if (item->id % 3 == 0) {
+        h2_ihash_remove_val(ctx, val);
+    }
+    return 1;
+}
+
+START_TEST(ihash_ops)
+{
+    ih_item items[2000];
+    h2_ihash_t *ih;
+    void *buffer[8];
+    int i, n;
+
+    ih = h2_ihash_create(g_pool, offsetof(ih_item, id));
+    ck_assert(h2_ihash_empty(ih));
+    ck_assert_ptr_eq(h2_ihash_get(ih, 1), NULL);
+
+    /* client and server stream ids, growing the table several times */
+    for (i = 0; i < 2000; ++i) {
+        items[i].id = (i < 1000)? (2 * i + 1) : (2 * (i - 1000) + 2);
+        items[i].seen = 0;
+        h2_ihash_add(ih, &items[i]);
+    }
+    ck_assert_int_eq(h2_ihash_count(ih), 2000);
+    for (i = 0; i < 2000; ++i) {
+        ck_assert_ptr_eq(h2_ihash_get(ih, items[i].id), &items[i]);
+    }
+    h2_ihash_add(ih, &items[0]);
+    ck_assert_int_eq(h2_ihash_count(ih), 2000);
+
+    /* remove every other, the rest must still be found */
+    for (i = 0; i < 2000; i += 2) {
+        h2_ihash_remove(ih, items[i].id);
+    }
+    h2_ihash_remove(ih, 99999);
+    ck_assert_int_eq(h2_ihash_count(ih), 1000);
+    for (i = 0; i < 2000; ++i) {
+        ck_assert_ptr_eq(h2_ihash_get(ih, items[i].id), 
+                         (i % 2)? &items[i] : NULL);
+    }
+
+    /* removing during iteration visits each member once */
+    h2_ihash_iter(ih, ih_remove_iter, ih);
+    for (i = 1, n = 0; i < 2000; i += 2) {
+        ck_assert_int_eq(items[i].seen, 1);
+        ck_assert_ptr_eq(h2_ihash_get(ih, items[i].id), 
+                         (items[i].id % 3)? &items[i] : NULL);
+        n += (items[i].id % 3)? 1 : 0;
+    }
+    ck_assert_int_eq(h2_ihash_count(ih), n);
+    i = 0;
+    h2_ihash_iter(ih, ih_count_iter, &i);
+    ck_assert_int_eq(i, n);
+
+    while ((i = (int)h2_ihash_shift(ih, buffer, 8)) > 0) {
+        n -= i;
+        ck_assert_int_eq(h2_ihash_count(ih), n);
+    }
+    ck_assert_int_eq(n, 0);
+    ck_assert(h2_ihash_empty(ih));
+
+    h2_ihash_add(ih, &items[5]);
+    h2_ihash_clear(ih);
+    ck_assert(h2_ihash_empty(ih));
+    ck_assert_ptr_eq(h2_ihash_get(ih, items[5].id), NULL);
+}
+END_TEST
+
+START_TEST(ihash_window)
+{
+    /* a sliding window of open streams, as on a long lived connection */
+    ih_item items[64];
+    h2_ihash_t *ih;
+    int i, id;
+
+    ih = h2_ihash_create(g_pool, offsetof(ih_item, id));
+    for (id = 1; id < 200000; id += 2) {
+        i = (id / 2) % 64;
+        if (id > 128) {
+            ck_assert_ptr_eq(h2_ihash_get(ih, items[i].id), &items[i]);
+            h2_ihash_remove(ih, items[i].id);
+        }
+        items[i].id = id;
+        h2_ihash_add(ih, &items[i]);
+        ck_assert_ptr_eq(h2_ihash_get(ih, id), &items[i]);
+    }
+    ck_assert_int_eq(h2_ihash_count(ih), 64);
+}
+END_TEST
+
+static apr_uint64_t ih_rank_rev(int id, void *ctx)
+{
+    return (apr_uint64_t)(100000 - id);
+}
+
+START_TEST(iheap_ops)
+{
+    h2_iheap *h;
+    apr_uint64_t rank;
+    int i, id, last;
+
+    h = h2_iheap_create(g_pool, 4);
+    ck_assert(h2_iheap_empty(h));
+    ck_assert_int_eq(h2_iheap_shift(h), 0);
+    ck_assert_int_eq(h2_iheap_peek(h, NULL), 0);
+
+    /* ranks in pseudo random order, growing the heap */
+    for (i = 1; i <= 1000; ++i) {
+        ck_assert_int_eq(h2_iheap_add(h, i, (i * 7919) % 1000), 1);
+    }
+    ck_assert_int_eq(h2_iheap_add(h, 5, (5 * 7919) % 1000), 0);
+    ck_assert_int_eq(h2_iheap_count(h), 1000);
+    ck_assert(h2_iheap_get_rank(h, 10, &rank));
+    ck_assert(rank == (10 * 7919) % 1000);
+
+    /* remove some, re-rank some */
+    for (i = 3; i <= 1000; i += 3) {
+        ck_assert_int_eq(h2_iheap_remove(h, i), 1);
+    }
+    ck_assert_int_eq(h2_iheap_remove(h, 3), 0);
+    ck_assert(!h2_iheap_contains(h, 3));
+    h2_iheap_add(h, 1000, 0);
+    h2_iheap_add(h, 1, 2000);
+
+    ck_assert_int_eq(h2_iheap_peek(h, &rank), 1000);
+    ck_assert(rank == 0);
+    ck_assert_int_eq(h2_iheap_count(h), 667);
+    ck_assert_int_eq(h2_iheap_shift(h), 1000);
+    for (last = -1, i = 0; (id = h2_iheap_shift(h)) > 0; ++i) {
+        h2_iheap_get_rank(h, id, &rank);
+        ck_assert(!h2_iheap_contains(h, id));
+        ck_assert_int_ne(id % 3, 0);
+        if (id == 1) {
+            ck_assert(h2_iheap_empty(h));
+        }
+        else {
+            /* equal ranks are shifted by ascending id */
+            int r = (id * 7919) % 1000;
+            ck_assert_int_ge(r * 10000 + id, last);
+            last = r * 10000 + id;
+        }
+    }
+    ck_assert_int_eq(i, 666);
+
+    /* reranking restores the order */
+    for (i = 1; i <= 100; ++i) {
+        h2_iheap_add(h, i, i);
+    }
+    h2_iheap_rerank(h, ih_rank_rev, NULL);
+    for (i = 100; i > 0; --i) {
+        ck_assert_int_eq(h2_iheap_shift(h), i);
+    }
+
+    h2_iheap_add(h, 5, 5);
+    h2_iheap_clear(h);
+    ck_assert(h2_iheap_empty(h));
+    ck_assert(!h2_iheap_contains(h, 5));
+}
+END_TEST
+
+#define IGN_REQ(n)      h2_req_ignore_header((n), strlen(n))
+#define IGN_REQ_TR(n)   h2_req_ignore_trailer((n), strlen(n))
+#define IGN_RES_TR(n)   h2_res_ignore_trailer((n), strlen(n))
+
+START_TEST(ignore_headers)
+{
+    ck_assert(IGN_REQ("connection"));
+    ck_assert(IGN_REQ("Keep-Alive"));
+    ck_assert(IGN_REQ("upgrade"));
+    ck_assert(IGN_REQ("http2-settings"));
+    ck_assert(IGN_REQ("proxy-connection"));
+    ck_assert(IGN_REQ("Transfer-Encoding"));
+    ck_assert(!IGN_REQ("connectiox"));
+    ck_assert(!IGN_REQ("keep-alivex"));
+    ck_assert(!IGN_REQ("accept"));
+    ck_assert(!IGN_REQ(""));
+    
+    ck_assert(h2_util_ignore_header("Connection"));
+    ck_assert(h2_util_ignore_header("transfer-encoding"));
+    ck_assert(!h2_util_ignore_header("http2-settings"));
+    ck_assert(!h2_util_ignore_header("content-type"));
+    
+    ck_assert(IGN_REQ_TR("te"));
+    ck_assert(IGN_REQ_TR("Cookie"));
+    ck_assert(IGN_REQ_TR("expect"));
+    ck_assert(IGN_REQ_TR("pragma"));
+    ck_assert(IGN_REQ_TR("cache-control"));
+    ck_assert(IGN_REQ_TR("Authorization"));
+    ck_assert(IGN_REQ_TR("connection"));
+    ck_assert(!IGN_REQ_TR("accept"));
+    ck_assert(!IGN_REQ_TR("trailer-x"));
+    
+    ck_assert(IGN_RES_TR("age"));
+    ck_assert(IGN_RES_TR("date"));
+    ck_assert(IGN_RES_TR("Vary"));
+    ck_assert(IGN_RES_TR("expires"));
+    ck_assert(IGN_RES_TR("warning"));
+    ck_assert(IGN_RES_TR("WWW-Authenticate"));
+    ck_assert(!IGN_RES_TR("server"));
+    ck_assert(!IGN_RES_TR("grpc-status"));
+}
+END_TEST
+
+#define PRI(s)          h2_util_priority_parse((s), strlen(s))
+
+START_TEST(priority_parse)
+{
+    ck_assert_int_eq(PRI(""), H2_EXTPRI_DEFAULT);
+    ck_assert_int_eq(PRI("u=0"), H2_EXTPRI(0, 0));
+    ck_assert_int_eq(PRI("u=7, i"), H2_EXTPRI(7, 1));
+    ck_assert_int_eq(PRI("i"), H2_EXTPRI(3, 1));
+    ck_assert_int_eq(PRI("i=?1;x=1,u=1"), H2_EXTPRI(1, 1));
+    ck_assert_int_eq(PRI("u=5,i=?0"), H2_EXTPRI(5, 0));
+    ck_assert_int_eq(PRI("u=1, u=2"), H2_EXTPRI(2, 0));
+    /* invalid values are ignored */
+    ck_assert_int_eq(PRI("u=8"), H2_EXTPRI_DEFAULT);
+    ck_assert_int_eq(PRI("u=-1"), H2_EXTPRI_DEFAULT);
+    ck_assert_int_eq(PRI("u=1.5"), H2_EXTPRI_DEFAULT);
+    ck_assert_int_eq(PRI("u="), H2_EXTPRI_DEFAULT);
+    ck_assert_int_eq(PRI("u=12"), H2_EXTPRI_DEFAULT);
+    /* unknown members, also with commas in strings */
+    ck_assert_int_eq(PRI("x=\"a,u=0\", u=4"), H2_EXTPRI(4, 0));
+    ck_assert_int_eq(PRI("uu=1, ii"), H2_EXTPRI_DEFAULT);
+    /* not NUL terminated */
+    ck_assert_int_eq(h2_util_priority_parse("u=1, i", 3), H2_EXTPRI(1, 0));
+}
+END_TEST
+
 TCase *h2_util_test_case(void)
 {
     TCase *testcase = tcase_create("h2_util");
@@ -109,6 +354,11 @@ TCase *h2_util_test_case(void)
 
     tcase_add_test(testcase, base64_h2_util_roundtrip);
     tcase_add_test(testcase, base64_h2_util_largetrip);
+    tcase_add_test(testcase, ihash_ops);
+    tcase_add_test(testcase, ihash_window);
+    tcase_add_test(testcase, iheap_ops);
+    tcase_add_test(testcase, ignore_headers);
+    tcase_add_test(testcase, priority_parse);
 
     return testcase;
 }